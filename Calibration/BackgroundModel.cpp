@@ -0,0 +1,198 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\BackgroundModel.cpp
+///
+/// @brief  Implements the background model class.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "BackgroundModel.h"
+
+// Maximum depth that can be represented by a 16-bit sample (in mm).
+static const float MAX_SAMPLE_DEPTH = 65535.0f;
+
+// Constructor
+BackgroundModel::BackgroundModel(struct slParams* sl_params, int max_scans)
+{
+    mNumPixels    = sl_params->cam_w*sl_params->cam_h;
+    mMaxScans     = (max_scans < 1) ? 1 : max_scans;
+    mScanCount    = 0;
+    mDepthSamples = new ushort[mMaxScans*mNumPixels];
+    mTexture      = NULL;
+}
+
+// Destructor
+BackgroundModel::~BackgroundModel()
+{
+    delete[] mDepthSamples;
+    if(mTexture != NULL)
+        cvReleaseImage(&mTexture);
+}
+
+// Discard all accumulated background scans.
+void BackgroundModel::Reset()
+{
+    mScanCount = 0;
+    if(mTexture != NULL)
+        cvReleaseImage(&mTexture);
+}
+
+// Add the depth map (and texture) of one background scan.
+// Note: depth_map is a camera-sized float matrix (in mm) and mask a float matrix with
+//       one element per camera pixel (non-zero = valid depth), as produced by triangulation.
+int BackgroundModel::AddScan(CvMat* depth_map, CvMat* mask, IplImage* texture)
+{
+    if(mScanCount >= mMaxScans){
+        printf("ERROR: Background model already holds %d scans!\n", mMaxScans);
+        return -1;
+    }
+    if(depth_map->rows*depth_map->cols != mNumPixels){
+        printf("ERROR: Background depth map does not match the camera resolution!\n");
+        return -1;
+    }
+
+    // Quantize valid depths to millimetres.
+    ushort* samples = mDepthSamples + mScanCount*mNumPixels;
+    int cols = depth_map->cols;
+    int step = depth_map->step/sizeof(float);
+    #pragma omp parallel for
+    for(int r=0; r<depth_map->rows; r++){
+        const float* depth_data = depth_map->data.fl + r*step;
+        for(int c=0; c<cols; c++){
+            int   i     = r*cols+c;
+            float depth = depth_data[c];
+            if((mask != NULL && mask->data.fl[i] == 0) || !(depth > 0.5f) || depth > MAX_SAMPLE_DEPTH)
+                samples[i] = 0;
+            else
+                samples[i] = (ushort)(depth + 0.5f);
+        }
+    }
+
+    // Keep the most recent texture.
+    if(texture != NULL){
+        if(mTexture != NULL)
+            cvReleaseImage(&mTexture);
+        mTexture = cvCloneImage(texture);
+    }
+
+    return ++mScanCount;
+}
+
+// Estimate the per-pixel median background depth and update the background model in sl_calib.
+// Note: The median is robust to objects or decoding errors present in a minority of the scans.
+//       background_mask is set to 255 where a background depth was estimated, and 0 elsewhere.
+int BackgroundModel::Estimate(struct slCalib* sl_calib, int min_observations)
+{
+    if(mScanCount < 1){
+        printf("ERROR: No background scans have been captured!\n");
+        return -1;
+    }
+    if(min_observations < 1)
+        min_observations = 1;
+
+    CvMat*    background_depth_map = sl_calib->background_depth_map;
+    IplImage* background_mask      = sl_calib->background_mask;
+    int cols       = background_depth_map->cols;
+    int depth_step = background_depth_map->step/sizeof(float);
+    int n_modelled = 0;
+    #pragma omp parallel for reduction(+:n_modelled)
+    for(int r=0; r<background_depth_map->rows; r++){
+        float* depth_data = background_depth_map->data.fl + r*depth_step;
+        uchar* mask_data  = (uchar*)(background_mask->imageData + r*background_mask->widthStep);
+        ushort values[256];
+        for(int c=0; c<cols; c++){
+
+            // Gather valid samples (in sorted order, by insertion).
+            int i = r*cols+c, n = 0;
+            for(int s=0; s<mScanCount && n<256; s++){
+                ushort v = mDepthSamples[s*mNumPixels+i];
+                if(v == 0)
+                    continue;
+                int j = n++;
+                while(j > 0 && values[j-1] > v){
+                    values[j] = values[j-1];
+                    j--;
+                }
+                values[j] = v;
+            }
+
+            // Assign median depth (or disable background rejection for this pixel).
+            if(n >= min_observations){
+                depth_data[c] = (n % 2) ? (float)values[n/2] : 0.5f*((float)values[n/2-1] + (float)values[n/2]);
+                mask_data[c]  = 255;
+                n_modelled++;
+            }
+            else{
+                depth_data[c] = FLT_MAX;
+                mask_data[c]  = 0;
+            }
+        }
+    }
+
+    // Update background image.
+    if(mTexture != NULL)
+        cvCopy(mTexture, sl_calib->background_image);
+
+    printf("Estimated background depth for %d of %d pixels from %d scans.\n", n_modelled, mNumPixels, mScanCount);
+    return 0;
+}
+
+// Save the background model (16-bit depth image in mm, plus texture) to a directory.
+int BackgroundModel::Save(const char* dir, struct slCalib* sl_calib)
+{
+    CvMat* depth = sl_calib->background_depth_map;
+    IplImage* depth_mm = cvCreateImage(cvSize(depth->cols, depth->rows), IPL_DEPTH_16U, 1);
+    for(int r=0; r<depth->rows; r++){
+        const float* depth_data = depth->data.fl + r*(depth->step/sizeof(float));
+        ushort* depth_mm_data = (ushort*)(depth_mm->imageData + r*depth_mm->widthStep);
+        for(int c=0; c<depth->cols; c++)
+            depth_mm_data[c] = (depth_data[c] > MAX_SAMPLE_DEPTH) ? 0 : (ushort)(depth_data[c] + 0.5f);
+    }
+
+    char str[1024];
+    sprintf(str, "%s\\background_depth.png", dir);
+    int ok = cvSaveImage(str, depth_mm);
+    sprintf(str, "%s\\background_image.png", dir);
+    ok = ok && cvSaveImage(str, sl_calib->background_image);
+    cvReleaseImage(&depth_mm);
+    if(!ok){
+        printf("ERROR: Cannot save background model!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Load a background model previously written by Save().
+int BackgroundModel::Load(const char* dir, struct slCalib* sl_calib)
+{
+    char str[1024];
+    sprintf(str, "%s\\background_depth.png", dir);
+    IplImage* depth_mm = cvLoadImage(str, -1);
+    CvMat* depth = sl_calib->background_depth_map;
+    if(depth_mm == NULL || depth_mm->depth != IPL_DEPTH_16U ||
+       depth_mm->width != depth->cols || depth_mm->height != depth->rows){
+        if(depth_mm != NULL)
+            cvReleaseImage(&depth_mm);
+        return -1;
+    }
+
+    for(int r=0; r<depth->rows; r++){
+        float* depth_data = depth->data.fl + r*(depth->step/sizeof(float));
+        uchar* mask_data  = (uchar*)(sl_calib->background_mask->imageData + r*sl_calib->background_mask->widthStep);
+        const ushort* depth_mm_data = (const ushort*)(depth_mm->imageData + r*depth_mm->widthStep);
+        for(int c=0; c<depth->cols; c++){
+            depth_data[c] = (depth_mm_data[c] == 0) ? FLT_MAX : (float)depth_mm_data[c];
+            mask_data[c]  = (depth_mm_data[c] == 0) ? 0 : 255;
+        }
+    }
+    cvReleaseImage(&depth_mm);
+
+    sprintf(str, "%s\\background_image.png", dir);
+    IplImage* image = cvLoadImage(str, 1);
+    if(image != NULL){
+        if(image->width == sl_calib->background_image->width && image->height == sl_calib->background_image->height)
+            cvCopy(image, sl_calib->background_image);
+        cvReleaseImage(&image);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\BackgroundModel.h
+///
+/// @brief  Declares the background model class.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  BackgroundModel
+///
+/// @brief  Robust background depth model estimated from several scans of the empty scene.
+///
+/// Each scan's depth map is quantized to 16-bit millimetres and kept until Estimate() computes
+/// the per-pixel median depth, which is written to slCalib::background_depth_map. Triangulation
+/// then rejects every point that is not at least slParams::background_depth_thresh in front of
+/// the background.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class BackgroundModel
+{
+public:
+    BackgroundModel(struct slParams* sl_params, int max_scans);
+
+    ~BackgroundModel();
+
+    // Discard all accumulated background scans.
+    void Reset();
+
+    // Add the depth map (and texture) of one background scan.
+    // Note: Returns the number of accumulated scans, or -1 if the model is full.
+    int AddScan(CvMat* depth_map, CvMat* mask, IplImage* texture CV_DEFAULT(NULL));
+
+    // Estimate the per-pixel median background depth and update the background model in sl_calib.
+    // Note: Pixels observed in fewer than min_observations scans are left at FLT_MAX (never rejected).
+    int Estimate(struct slCalib* sl_calib, int min_observations);
+
+    // Save the background model (16-bit depth image in mm, plus texture) to a directory.
+    static int Save(const char* dir, struct slCalib* sl_calib);
+
+    // Load a background model previously written by Save().
+    static int Load(const char* dir, struct slCalib* sl_calib);
+
+    // Accessor methods
+    int GetScanCount() { return mScanCount; };
+
+private:
+    /// <summary> Number of camera pixels. </summary>
+    int mNumPixels;
+
+    /// <summary> Maximum number of background scans. </summary>
+    int mMaxScans;
+
+    /// <summary> Number of accumulated background scans. </summary>
+    int mScanCount;
+
+    /// <summary> Depth samples (mMaxScans x mNumPixels, in mm, 0 = not observed). </summary>
+    ushort* mDepthSamples;
+
+    /// <summary> Texture of the most recent background scan. </summary>
+    IplImage* mTexture;
+};
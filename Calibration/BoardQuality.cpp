@@ -0,0 +1,319 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\BoardQuality.cpp
+///
+/// @brief  Implements the calibration board scoring and outlier rejection.
+///
+/// Overview:
+///   Corner residuals are measured against a homography from the board grid (in units of squares),
+///   and expressed in squares (the mean distance between neighbouring corners), so the criteria do
+///   not depend on how far away the board is held. Lens distortion bends the board away from a
+///   homography by a small fraction of a square, well below a misdetected corner. Sharpness is the
+///   variance of the Laplacian over the bounding box of the printed corners; a blurred board has
+///   weak edges and hence a small variance. Coverage is tracked on a coarse grid of cells over the
+///   camera image (see CoverageGrid). Corner order may be reversed between detections, so pose
+///   differences are measured in both orders.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "BoardQuality.h"
+#include "Homography.h"
+
+#include <float.h>
+
+// Seed of the RANSAC random number generator.
+static const int64 RANSAC_SEED = 0x5eed;
+
+// Evaluate the mean distance between neighbouring corners along the rows of a chessboard.
+static double boardSpacing(CvSize board_size, const CvPoint2D32f* corners)
+{
+    double spacing = 0;
+    for(int r=0; r<board_size.height; r++){
+        for(int c=0; c+1<board_size.width; c++){
+            const CvPoint2D32f* p = &corners[r*board_size.width+c];
+            spacing += sqrt((double)((p[1].x-p->x)*(p[1].x-p->x) + (p[1].y-p->y)*(p[1].y-p->y)));
+        }
+    }
+    spacing /= (board_size.width > 1) ? board_size.height*(board_size.width-1) : 1;
+    return (spacing > 0) ? spacing : 1.0;
+}
+
+// Evaluate the distance of a corner from its grid position mapped through a homography.
+static double cornerResidual(const double H[9], CvPoint2D32f grid, CvPoint2D32f corner)
+{
+    CvPoint2D32f p = applyHomography(H, grid);
+    return sqrt((double)((p.x-corner.x)*(p.x-corner.x) + (p.y-corner.y)*(p.y-corner.y)));
+}
+
+// Constructor
+BoardScorer::BoardScorer(struct slParams* sl_params)
+{
+    mSlParams      = sl_params;
+    mCamBoardSize  = cvSize(sl_params->cam_board_w,  sl_params->cam_board_h);
+    mProjBoardSize = cvSize(sl_params->proj_board_w, sl_params->proj_board_h);
+    int cam_board_n  = mCamBoardSize.width*mCamBoardSize.height;
+    int proj_board_n = mProjBoardSize.width*mProjBoardSize.height;
+    int max_board_n  = MAX(cam_board_n, proj_board_n);
+    mCamGrid       = new CvPoint2D32f[cam_board_n];
+    mProjGrid      = new CvPoint2D32f[proj_board_n];
+    mInlierGrid    = new CvPoint2D32f[max_board_n];
+    mInlierCorners = new CvPoint2D32f[max_board_n];
+    mResiduals     = new double[max_board_n];
+    for(int i=0; i<cam_board_n; i++)
+        mCamGrid[i] = cvPoint2D32f(i%mCamBoardSize.width, i/mCamBoardSize.width);
+    for(int i=0; i<proj_board_n; i++)
+        mProjGrid[i] = cvPoint2D32f(i%mProjBoardSize.width, i/mProjBoardSize.width);
+    mLaplace = NULL;
+    mRng     = cvRNG(RANSAC_SEED);
+    mCoverage.SetImageSize(cvSize(sl_params->cam_w, sl_params->cam_h));
+    Reset();
+}
+
+// Destructor
+BoardScorer::~BoardScorer()
+{
+    delete[] mCamGrid;
+    delete[] mProjGrid;
+    delete[] mInlierGrid;
+    delete[] mInlierCorners;
+    delete[] mResiduals;
+    cvReleaseImage(&mLaplace);
+}
+
+// Score a candidate board (camera frame, printed and projected chessboard corners in camera pixels).
+bool BoardScorer::Score(IplImage* frame, CvPoint2D32f* cam_corners, CvPoint2D32f* proj_corners, struct slBoardScore* score)
+{
+    int cam_board_n = mCamBoardSize.width*mCamBoardSize.height;
+
+    // Evaluate the sharpness over the bounding box of the printed corners.
+    if(mLaplace == NULL || mLaplace->width != frame->width || mLaplace->height != frame->height){
+        cvReleaseImage(&mLaplace);
+        mLaplace = cvCreateImage(cvGetSize(frame), IPL_DEPTH_16S, 1);
+    }
+    double x_min = DBL_MAX, y_min = DBL_MAX, x_max = -DBL_MAX, y_max = -DBL_MAX;
+    for(int i=0; i<cam_board_n; i++){
+        x_min = MIN(x_min, cam_corners[i].x); x_max = MAX(x_max, cam_corners[i].x);
+        y_min = MIN(y_min, cam_corners[i].y); y_max = MAX(y_max, cam_corners[i].y);
+    }
+    int x0 = MAX(0, cvFloor(x_min)), x1 = MIN(frame->width,  cvCeil(x_max)+1);
+    int y0 = MAX(0, cvFloor(y_min)), y1 = MIN(frame->height, cvCeil(y_max)+1);
+    score->sharpness = 0;
+    if(x1-x0 > 2 && y1-y0 > 2){
+        CvRect roi = cvRect(x0, y0, x1-x0, y1-y0);
+        CvScalar mean, sdv;
+        cvSetImageROI(frame, roi);
+        cvSetImageROI(mLaplace, roi);
+        cvLaplace(frame, mLaplace, 3);
+        cvAvgSdv(mLaplace, &mean, &sdv);
+        cvResetImageROI(frame);
+        cvResetImageROI(mLaplace);
+        score->sharpness = sdv.val[0]*sdv.val[0];
+    }
+
+    // Evaluate the consistency of both chessboards with a homography of their board.
+    score->cam_residual  = FitBoard(mCamBoardSize,  mCamGrid,  cam_corners);
+    score->proj_residual = FitBoard(mProjBoardSize, mProjGrid, proj_corners);
+
+    // Evaluate the coverage contribution (cells not covered by an accepted board).
+    CvPoint2D32f outline[4];
+    BoardOutline(cam_corners, outline);
+    score->coverage = (double)mCoverage.CountNew(outline)/(CoverageGrid::COLS*CoverageGrid::ROWS);
+
+    // Evaluate the pose difference to the most similar accepted board (in either corner order).
+    double diagonal = sqrt((double)(mSlParams->cam_w*mSlParams->cam_w + mSlParams->cam_h*mSlParams->cam_h));
+    score->difference = 1.0;
+    for(size_t b=0; b<mAcceptedCorners.size(); b+=cam_board_n){
+        double forward = 0, reverse = 0;
+        for(int i=0; i<cam_board_n; i++){
+            const CvPoint2D32f& p = mAcceptedCorners[b+i];
+            const CvPoint2D32f& q = mAcceptedCorners[b+cam_board_n-1-i];
+            forward += (p.x-cam_corners[i].x)*(p.x-cam_corners[i].x) + (p.y-cam_corners[i].y)*(p.y-cam_corners[i].y);
+            reverse += (q.x-cam_corners[i].x)*(q.x-cam_corners[i].x) + (q.y-cam_corners[i].y)*(q.y-cam_corners[i].y);
+        }
+        score->difference = MIN(score->difference, sqrt(MIN(forward, reverse)/cam_board_n)/diagonal);
+    }
+
+    // Apply the quality criteria.
+    score->reason = NULL;
+    if(mSlParams->board_min_sharpness > 0 && score->sharpness < mSlParams->board_min_sharpness){
+        score->reason = "blurred";
+        mBlurred++;
+    }
+    else if(score->cam_residual < 0 || score->cam_residual > mSlParams->board_max_residual ||
+            score->proj_residual < 0 || score->proj_residual > mSlParams->board_max_residual){
+        score->reason = "corners inconsistent with the board";
+        mInconsistent++;
+    }
+    else if(score->difference < mSlParams->board_min_difference){
+        score->reason = "same pose as an accepted board";
+        mDuplicate++;
+    }
+    score->accepted = (score->reason == NULL);
+    if(!score->accepted)
+        mRejected++;
+    return score->accepted;
+}
+
+// Add an accepted board to the coverage and pose history.
+void BoardScorer::Accept(CvPoint2D32f* cam_corners)
+{
+    CvPoint2D32f outline[4];
+    BoardOutline(cam_corners, outline);
+    mCoverage.Add(outline);
+    mAcceptedCorners.insert(mAcceptedCorners.end(), cam_corners, cam_corners+mCamBoardSize.width*mCamBoardSize.height);
+    mAccepted++;
+}
+
+// Forget the accepted boards (and reset the statistics).
+void BoardScorer::Reset()
+{
+    mCoverage.Reset();
+    mAcceptedCorners.clear();
+    mAccepted     = 0;
+    mRejected     = 0;
+    mBlurred      = 0;
+    mInconsistent = 0;
+    mDuplicate    = 0;
+}
+
+// Display the scoring statistics to the console.
+void BoardScorer::DisplayStatistics()
+{
+    printf("Board scoring: %d boards accepted, %d rejected (%d blurred, %d inconsistent, %d duplicate), %.0f%% of the camera image covered.\n",
+        mAccepted, mRejected, mBlurred, mInconsistent, mDuplicate, 100.0*mCoverage.GetCoverage());
+}
+
+// Fit a homography from the board grid to the corners, and find the RMS residual of the corners (in squares).
+double BoardScorer::FitBoard(CvSize board_size, const CvPoint2D32f* grid, const CvPoint2D32f* corners)
+{
+    int board_n = board_size.width*board_size.height;
+    double H[9];
+    if(!estimateHomography(grid, corners, board_n, H))
+        return -1.0;
+    double sum = 0;
+    for(int i=0; i<board_n; i++){
+        double r = cornerResidual(H, grid[i], corners[i]);
+        sum += r*r;
+    }
+    return sqrt(sum/board_n)/boardSpacing(board_size, corners);
+}
+
+// Fit a homography with RANSAC, and count the corners inconsistent with the best homography.
+int BoardScorer::CountOutliers(CvSize board_size, const CvPoint2D32f* grid, const CvPoint2D32f* corners)
+{
+    int board_n = board_size.width*board_size.height;
+    if(board_n < 4)
+        return 0;
+    double threshold = mSlParams->ransac_threshold*boardSpacing(board_size, corners);
+
+    // Find the homography of four random corners with the most inliers.
+    double H[9], best_H[9];
+    int best_inliers = 0;
+    for(int it=0; it<mSlParams->ransac_iterations; it++){
+        int sample[4];
+        CvPoint2D32f src[4], dst[4];
+        for(int k=0; k<4; k++){
+            bool repeated;
+            do{
+                sample[k] = cvRandInt(&mRng)%board_n;
+                repeated = false;
+                for(int j=0; j<k; j++)
+                    repeated |= (sample[j] == sample[k]);
+            } while(repeated);
+            src[k] = grid[sample[k]];
+            dst[k] = corners[sample[k]];
+        }
+        if(!estimateHomography(src, dst, 4, H))
+            continue;
+        int inliers = 0;
+        for(int i=0; i<board_n; i++)
+            inliers += (cornerResidual(H, grid[i], corners[i]) <= threshold) ? 1 : 0;
+        if(inliers > best_inliers){
+            best_inliers = inliers;
+            memcpy(best_H, H, sizeof(H));
+        }
+    }
+    if(best_inliers < 4)
+        return board_n;
+
+    // Refit the homography to the inliers, and count the corners inconsistent with it.
+    int n = 0;
+    for(int i=0; i<board_n; i++){
+        if(cornerResidual(best_H, grid[i], corners[i]) <= threshold){
+            mInlierGrid[n]    = grid[i];
+            mInlierCorners[n] = corners[i];
+            n++;
+        }
+    }
+    if(!estimateHomography(mInlierGrid, mInlierCorners, n, H))
+        return board_n;
+    int outliers = 0;
+    for(int i=0; i<board_n; i++){
+        mResiduals[i] = cornerResidual(H, grid[i], corners[i]);
+        outliers += (mResiduals[i] > threshold) ? 1 : 0;
+    }
+    return outliers;
+}
+
+// Remove boards with corners inconsistent with a RANSAC homography of their board (in place).
+int BoardScorer::RejectOutliers(struct slCalibObservations* obs, int* kept_boards)
+{
+    int cam_board_n  = mCamBoardSize.width*mCamBoardSize.height;
+    int proj_board_n = mProjBoardSize.width*mProjBoardSize.height;
+    mRng = cvRNG(RANSAC_SEED);
+    int n_kept = 0;
+    for(int i=0; i<obs->n_boards; i++){
+
+        // Check the printed and the projected chessboard corners.
+        int cam_outliers  = CountOutliers(mCamBoardSize,  mCamGrid,
+            (CvPoint2D32f*)&CV_MAT_ELEM(*obs->cam_image_points,  float, cam_board_n*i,  0));
+        int proj_outliers = CountOutliers(mProjBoardSize, mProjGrid,
+            (CvPoint2D32f*)&CV_MAT_ELEM(*obs->proj_image_points, float, proj_board_n*i, 0));
+        if(cam_outliers > mSlParams->ransac_max_outliers || proj_outliers > mSlParams->ransac_max_outliers){
+            printf("Board %d rejected: %d printed and %d projected corners inconsistent with the board.\n",
+                i, cam_outliers, proj_outliers);
+            continue;
+        }
+
+        // Move the board forward (over the removed boards), swapping its images with a removed board's.
+        if(n_kept != i){
+            for(int j=0; j<cam_board_n; j++){
+                CV_MAT_ELEM(*obs->cam_image_points, float, cam_board_n*n_kept+j, 0) = CV_MAT_ELEM(*obs->cam_image_points, float, cam_board_n*i+j, 0);
+                CV_MAT_ELEM(*obs->cam_image_points, float, cam_board_n*n_kept+j, 1) = CV_MAT_ELEM(*obs->cam_image_points, float, cam_board_n*i+j, 1);
+            }
+            for(int j=0; j<proj_board_n; j++){
+                CV_MAT_ELEM(*obs->proj_image_points, float, proj_board_n*n_kept+j, 0) = CV_MAT_ELEM(*obs->proj_image_points, float, proj_board_n*i+j, 0);
+                CV_MAT_ELEM(*obs->proj_image_points, float, proj_board_n*n_kept+j, 1) = CV_MAT_ELEM(*obs->proj_image_points, float, proj_board_n*i+j, 1);
+                CV_MAT_ELEM(*obs->proj_pixel_points, float, proj_board_n*n_kept+j, 0) = CV_MAT_ELEM(*obs->proj_pixel_points, float, proj_board_n*i+j, 0);
+                CV_MAT_ELEM(*obs->proj_pixel_points, float, proj_board_n*n_kept+j, 1) = CV_MAT_ELEM(*obs->proj_pixel_points, float, proj_board_n*i+j, 1);
+            }
+            IplImage* temp;
+            if(obs->cam_images != NULL){
+                temp = obs->cam_images[n_kept];
+                obs->cam_images[n_kept] = obs->cam_images[i];
+                obs->cam_images[i] = temp;
+            }
+            if(obs->proj_images != NULL){
+                temp = obs->proj_images[n_kept];
+                obs->proj_images[n_kept] = obs->proj_images[i];
+                obs->proj_images[i] = temp;
+            }
+        }
+        if(kept_boards != NULL)
+            kept_boards[n_kept] = i;
+        n_kept++;
+    }
+    int removed = obs->n_boards - n_kept;
+    obs->n_boards = n_kept;
+    return removed;
+}
+
+// Find the outline of the printed chessboard (its four outer corners, in order around the board).
+void BoardScorer::BoardOutline(CvPoint2D32f* cam_corners, CvPoint2D32f outline[4])
+{
+    int w = mCamBoardSize.width, n = mCamBoardSize.width*mCamBoardSize.height;
+    outline[0] = cam_corners[0];
+    outline[1] = cam_corners[w-1];
+    outline[2] = cam_corners[n-1];
+    outline[3] = cam_corners[n-w];
+}
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\BoardQuality.h
+///
+/// @brief  Declares the calibration board scoring and outlier rejection.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "CalibrateProCam.h"
+#include "CaptureGuide.h"
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slBoardScore
+///
+/// @brief  Quality of a candidate calibration board.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slBoardScore{
+	double sharpness;               // variance of the Laplacian over the printed chessboard (gray levels^2)
+	double cam_residual;            // RMS distance of the printed corners from a homography of the board (squares)
+	double proj_residual;           // RMS distance of the projected corners from a homography of the board (squares)
+	double coverage;                // fraction of the camera image first covered by this board
+	double difference;              // RMS corner distance to the most similar accepted board (fraction of the image diagonal)
+	bool   accepted;                // board meets the quality criteria
+	const char* reason;             // reason the board was rejected (NULL if accepted)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  BoardScorer
+///
+/// @brief  Scores calibration boards as they are captured, and rejects outlier boards before a solve.
+///
+/// A candidate board is scored as soon as both chessboards are found: the sharpness of the printed
+/// chessboard, how well each set of corners agrees with a homography of its board (a blurred,
+/// reflected or misdetected corner pulls away from it), how much of the camera image it covers for
+/// the first time, and how different its pose is from the boards already accepted. Blurred,
+/// inconsistent and duplicate boards are rejected automatically.
+///
+/// Before a solve, the corners of every board are checked again with RANSAC: a homography is fitted
+/// to random minimal sets of corners, and boards with corners inconsistent with the best homography
+/// are removed from the observations.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class BoardScorer
+{
+public:
+    BoardScorer(struct slParams* sl_params);
+
+    ~BoardScorer();
+
+    // Score a candidate board (camera frame, printed and projected chessboard corners in camera pixels).
+    // Note: Returns true if the board meets the quality criteria.
+    bool Score(IplImage* frame, CvPoint2D32f* cam_corners, CvPoint2D32f* proj_corners, struct slBoardScore* score);
+
+    // Add an accepted board to the coverage and pose history.
+    void Accept(CvPoint2D32f* cam_corners);
+
+    // Forget the accepted boards (and reset the statistics).
+    void Reset();
+
+    // Display the scoring statistics to the console.
+    void DisplayStatistics();
+
+    // Remove boards with corners inconsistent with a RANSAC homography of their board (in place).
+    // Note: Returns the number of boards removed; kept_boards (if not NULL) receives the original index of each kept board.
+    //       Removed boards' images are moved to the end of the image arrays, so they are still released by the owner.
+    int RejectOutliers(struct slCalibObservations* obs, int* kept_boards CV_DEFAULT(NULL));
+
+    // Accessor methods
+    int GetAcceptedCount() { return mAccepted; };
+    int GetRejectedCount() { return mRejected; };
+
+private:
+    // Fit a homography from the board grid to the corners, and find the RMS residual of the corners (in squares).
+    // Note: Returns a negative residual if the corners are degenerate.
+    static double FitBoard(CvSize board_size, const CvPoint2D32f* grid, const CvPoint2D32f* corners);
+
+    // Fit a homography with RANSAC, and count the corners inconsistent with the best homography.
+    // Note: Boards with fewer than four corners cannot be checked, and have no outliers.
+    int CountOutliers(CvSize board_size, const CvPoint2D32f* grid, const CvPoint2D32f* corners);
+
+    // Find the outline of the printed chessboard (its four outer corners, in order around the board).
+    void BoardOutline(CvPoint2D32f* cam_corners, CvPoint2D32f outline[4]);
+
+    /// <summary> Configuration, board sizes and grids (in units of squares), and RANSAC buffers. </summary>
+    struct slParams* mSlParams;
+    CvSize mCamBoardSize;
+    CvSize mProjBoardSize;
+    CvPoint2D32f* mCamGrid;
+    CvPoint2D32f* mProjGrid;
+    CvPoint2D32f* mInlierGrid;
+    CvPoint2D32f* mInlierCorners;
+    double* mResiduals;
+
+    /// <summary> Laplacian of the camera frame (used to measure sharpness). </summary>
+    IplImage* mLaplace;
+
+    /// <summary> Accepted boards: camera coverage and corners. </summary>
+    CoverageGrid mCoverage;
+    std::vector<CvPoint2D32f> mAcceptedCorners;
+
+    /// <summary> RANSAC random number generator (fixed seed, so repeated solves agree). </summary>
+    CvRNG mRng;
+
+    /// <summary> Statistics: boards accepted, and rejected for each reason. </summary>
+    int mAccepted;
+    int mRejected;
+    int mBlurred;
+    int mInconsistent;
+    int mDuplicate;
+};
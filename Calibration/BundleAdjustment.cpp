@@ -0,0 +1,881 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\BundleAdjustment.cpp
+///
+/// @brief  Implements the joint projector-camera bundle adjustment.
+///
+/// Overview:
+///   Both devices use the OpenCV lens model (fx, fy, cx, cy, k1, k2, p1, p2, k3), so the results
+///   can replace the cvCalibrateCamera2 solutions directly. Distortion terms disabled in the
+///   configuration stay fixed, as does the camera if only the projector is being calibrated. The
+///   camera-to-projector transform is initialized with the average of the per-board transforms of
+///   the separate calibrations. Jacobians are found by central differences, one corner at a time,
+///   and accumulated into the normal equations: a dense block for the shared parameters, and per
+///   board a 6x6 pose block and its coupling with the shared parameters. A step eliminates the
+///   pose blocks (Schur complement), solves the reduced system by Cholesky decomposition, and
+///   recovers each pose update by back-substitution. Steps are accepted only if the total squared
+///   reprojection error (camera and projector, in pixels) decreases.
+///   Every per-board stage (cost, Jacobians and normal equations, elimination, back-substitution)
+///   runs on the solver threads. Boards are handed out dynamically, so a thread which finishes its
+///   board early takes the next unclaimed one: the boards cost the same, but the solve shares the
+///   processors with the threads saving the calibration images, so a static split would wait for
+///   whichever solver thread they preempt. Each thread accumulates the shared block privately, and
+///   the partial sums are added once the boards are exhausted.
+///   The covariance of the shared parameters is the inverse of the undamped reduced system at the
+///   solution (the poses are marginalized by the same elimination), scaled by the residual variance
+///   (total cost over the degrees of freedom). The depth error of a camera pixel is found by placing
+///   a point at the given distance along its ray, finding the projector pixel which lights it, and
+///   differentiating the ray-ray triangulated depth of that correspondence with respect to the shared
+///   parameters; the covariance is propagated to first order.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "BundleAdjustment.h"
+
+#include <float.h>
+#include <omp.h>
+
+// Levenberg-Marquardt damping: initial value, update factor, and largest value tried before giving up.
+static const double INITIAL_LAMBDA = 1e-3;
+static const double LAMBDA_FACTOR  = 10.0;
+static const double MAX_LAMBDA     = 1e10;
+
+// Smallest relative decrease of the cost that continues the iterations.
+static const double MIN_RELATIVE_DECREASE = 1e-10;
+
+// Relative step of the central differences.
+static const double DIFFERENCE_STEP = 1e-6;
+
+// Fixed-point iterations used to undistort camera pixels.
+static const int UNDISTORT_ITERATIONS = 10;
+
+// Evaluate the rotation matrix of a rotation vector (Rodrigues' formula).
+static void rotationMatrix(const double r[3], double R[9])
+{
+    double theta = sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+    if(theta < 1e-12){
+        R[0] = 1;     R[1] = -r[2]; R[2] = r[1];
+        R[3] = r[2];  R[4] = 1;     R[5] = -r[0];
+        R[6] = -r[1]; R[7] = r[0];  R[8] = 1;
+        return;
+    }
+    double kx = r[0]/theta, ky = r[1]/theta, kz = r[2]/theta;
+    double c = cos(theta), s = sin(theta), c1 = 1-c;
+    R[0] = c + c1*kx*kx;    R[1] = c1*kx*ky - s*kz; R[2] = c1*kx*kz + s*ky;
+    R[3] = c1*ky*kx + s*kz; R[4] = c + c1*ky*ky;    R[5] = c1*ky*kz - s*kx;
+    R[6] = c1*kz*kx - s*ky; R[7] = c1*kz*ky + s*kx; R[8] = c + c1*kz*kz;
+}
+
+// Evaluate the unit quaternion (w,x,y,z) of a rotation matrix.
+static void rotationQuaternion(const double R[9], double q[4])
+{
+    double trace = R[0] + R[4] + R[8];
+    if(trace > 0){
+        double s = 2.0*sqrt(trace+1.0);
+        q[0] = 0.25*s;
+        q[1] = (R[7]-R[5])/s;
+        q[2] = (R[2]-R[6])/s;
+        q[3] = (R[3]-R[1])/s;
+    }
+    else if(R[0] > R[4] && R[0] > R[8]){
+        double s = 2.0*sqrt(1.0+R[0]-R[4]-R[8]);
+        q[0] = (R[7]-R[5])/s;
+        q[1] = 0.25*s;
+        q[2] = (R[1]+R[3])/s;
+        q[3] = (R[2]+R[6])/s;
+    }
+    else if(R[4] > R[8]){
+        double s = 2.0*sqrt(1.0+R[4]-R[0]-R[8]);
+        q[0] = (R[2]-R[6])/s;
+        q[1] = (R[1]+R[3])/s;
+        q[2] = 0.25*s;
+        q[3] = (R[5]+R[7])/s;
+    }
+    else{
+        double s = 2.0*sqrt(1.0+R[8]-R[0]-R[4]);
+        q[0] = (R[3]-R[1])/s;
+        q[1] = (R[2]+R[6])/s;
+        q[2] = (R[5]+R[7])/s;
+        q[3] = 0.25*s;
+    }
+}
+
+// Evaluate the rotation vector of a (not necessarily unit) quaternion.
+static void quaternionRotation(const double q[4], double r[3])
+{
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+    if(w < 0){
+        w = -w; x = -x; y = -y; z = -z;
+    }
+    double v = sqrt(x*x + y*y + z*z);
+    if(v < 1e-15){
+        r[0] = r[1] = r[2] = 0;
+        return;
+    }
+    double theta = 2.0*atan2(v, w);
+    r[0] = theta*x/v;
+    r[1] = theta*y/v;
+    r[2] = theta*z/v;
+}
+
+// Project a point (in device coordinates) to device pixels with the OpenCV lens model.
+static void projectPoint(const double* d, const double X[3], double uv[2])
+{
+    double x = X[0]/X[2], y = X[1]/X[2];
+    double r2 = x*x + y*y;
+    double radial = 1.0 + ((d[8]*r2 + d[5])*r2 + d[4])*r2;
+    double xd = x*radial + 2.0*d[6]*x*y + d[7]*(r2 + 2.0*x*x);
+    double yd = y*radial + d[6]*(r2 + 2.0*y*y) + 2.0*d[7]*x*y;
+    uv[0] = d[0]*xd + d[2];
+    uv[1] = d[1]*yd + d[3];
+}
+
+// Undistort a device pixel to normalized coordinates with the OpenCV lens model (as cvUndistortPoints).
+static void undistortPoint(const double* d, double u, double v, double& x, double& y)
+{
+    double x0 = (u-d[2])/d[0], y0 = (v-d[3])/d[1];
+    x = x0;
+    y = y0;
+    for(int i=0; i<UNDISTORT_ITERATIONS; i++){
+        double r2 = x*x + y*y;
+        double icdist = 1.0/(1.0 + ((d[8]*r2 + d[5])*r2 + d[4])*r2);
+        double dx = 2.0*d[6]*x*y + d[7]*(r2 + 2.0*x*x);
+        double dy = d[6]*(r2 + 2.0*y*y) + 2.0*d[7]*x*y;
+        x = (x0-dx)*icdist;
+        y = (y0-dy)*icdist;
+    }
+}
+
+// Factor a symmetric positive definite matrix in place (lower triangle, A = L*L').
+static bool choleskyDecompose(double* A, int n)
+{
+    for(int j=0; j<n; j++){
+        double sum = A[j*n+j];
+        for(int k=0; k<j; k++)
+            sum -= A[j*n+k]*A[j*n+k];
+        if(!(sum > 0))
+            return false;
+        double ljj = sqrt(sum);
+        A[j*n+j] = ljj;
+        for(int i=j+1; i<n; i++){
+            double s = A[i*n+j];
+            for(int k=0; k<j; k++)
+                s -= A[i*n+k]*A[j*n+k];
+            A[i*n+j] = s/ljj;
+        }
+    }
+    return true;
+}
+
+// Solve L*L'*x = b in place, given the factor of choleskyDecompose.
+static void choleskySolve(const double* L, int n, double* b)
+{
+    for(int i=0; i<n; i++){
+        double s = b[i];
+        for(int k=0; k<i; k++)
+            s -= L[i*n+k]*b[k];
+        b[i] = s/L[i*n+i];
+    }
+    for(int i=n-1; i>=0; i--){
+        double s = b[i];
+        for(int k=i+1; k<n; k++)
+            s -= L[k*n+i]*b[k];
+        b[i] = s/L[i*n+i];
+    }
+}
+
+// Constructor
+ProCamBundleAdjuster::ProCamBundleAdjuster(struct slParams* sl_params, bool calibrate_camera)
+{
+    mSlParams       = sl_params;
+    mNumBoards      = 0;
+    mCamBoardN      = sl_params->cam_board_w*sl_params->cam_board_h;
+    mProjBoardN     = sl_params->proj_board_w*sl_params->proj_board_h;
+    mCamObject      = NULL;
+    mCamImage       = NULL;
+    mProjCamImage   = NULL;
+    mProjImage      = NULL;
+    mPoses          = NULL;
+    mStepPoses      = NULL;
+    mCandidatePoses = NULL;
+    mU              = NULL;
+    mW              = NULL;
+    mV              = NULL;
+    mGradGlobals    = NULL;
+    mGradPoses      = NULL;
+    mNumThreads     = (sl_params->solver_threads > 0) ? sl_params->solver_threads : omp_get_num_procs();
+    memset(&mResult, 0, sizeof(mResult));
+    mResult.threads = mNumThreads;
+
+    // Select the adjusted shared parameters (disabled distortion terms, and an uncalibrated camera, stay fixed).
+    for(int k=0; k<NUM_GLOBALS; k++)
+        mActive[k] = true;
+    for(int k=CAM; k<CAM+9; k++)
+        mActive[k] = calibrate_camera;
+    mActive[CAM+6]  = mActive[CAM+7] = calibrate_camera && sl_params->cam_dist_model[0];
+    mActive[CAM+8]  = calibrate_camera && sl_params->cam_dist_model[1];
+    mActive[PROJ+6] = mActive[PROJ+7] = sl_params->proj_dist_model[0];
+    mActive[PROJ+8] = sl_params->proj_dist_model[1];
+    mNumActive = 0;
+    for(int k=0; k<NUM_GLOBALS; k++)
+        mActiveIndex[k] = mActive[k] ? mNumActive++ : -1;
+}
+
+// Destructor
+ProCamBundleAdjuster::~ProCamBundleAdjuster()
+{
+    Release();
+}
+
+// Release the observations and buffers.
+void ProCamBundleAdjuster::Release()
+{
+    delete[] mCamObject;
+    delete[] mCamImage;
+    delete[] mProjCamImage;
+    delete[] mProjImage;
+    delete[] mPoses;
+    delete[] mStepPoses;
+    delete[] mCandidatePoses;
+    delete[] mU;
+    delete[] mW;
+    delete[] mV;
+    delete[] mGradGlobals;
+    delete[] mGradPoses;
+    mCamObject = mCamImage = mProjCamImage = mProjImage = NULL;
+    mPoses = mStepPoses = mCandidatePoses = NULL;
+    mU = mW = mV = mGradGlobals = mGradPoses = NULL;
+    mNumBoards = 0;
+}
+
+// Initialize from separate camera and projector calibrations (per-board poses are n_boards x 3).
+int ProCamBundleAdjuster::Initialize(struct slCalibObservations* obs,
+                                     CvMat* cam_intrinsic, CvMat* cam_distortion, CvMat* cam_rotation_vectors, CvMat* cam_translation_vectors,
+                                     CvMat* proj_intrinsic, CvMat* proj_distortion, CvMat* proj_rotation_vectors, CvMat* proj_translation_vectors)
+{
+    Release();
+    if(obs->n_boards < 1)
+        return -1;
+    mNumBoards = obs->n_boards;
+    int G = mNumActive;
+
+    // Copy the observations (and the printed chessboard corners, in mm, using the usual corner order).
+    mCamObject    = new float[2*mCamBoardN];
+    mCamImage     = new float[2*mCamBoardN*mNumBoards];
+    mProjCamImage = new float[2*mProjBoardN*mNumBoards];
+    mProjImage    = new float[2*mProjBoardN*mNumBoards];
+    for(int j=0; j<mCamBoardN; j++){
+        mCamObject[2*j]   = mSlParams->cam_board_w_mm*float(j/mSlParams->cam_board_w);
+        mCamObject[2*j+1] = mSlParams->cam_board_h_mm*float(j%mSlParams->cam_board_w);
+    }
+    for(int i=0; i<mCamBoardN*mNumBoards; i++){
+        mCamImage[2*i]   = CV_MAT_ELEM(*obs->cam_image_points, float, i, 0);
+        mCamImage[2*i+1] = CV_MAT_ELEM(*obs->cam_image_points, float, i, 1);
+    }
+    for(int i=0; i<mProjBoardN*mNumBoards; i++){
+        mProjCamImage[2*i]   = CV_MAT_ELEM(*obs->proj_image_points, float, i, 0);
+        mProjCamImage[2*i+1] = CV_MAT_ELEM(*obs->proj_image_points, float, i, 1);
+        mProjImage[2*i]      = CV_MAT_ELEM(*obs->proj_pixel_points, float, i, 0);
+        mProjImage[2*i+1]    = CV_MAT_ELEM(*obs->proj_pixel_points, float, i, 1);
+    }
+
+    // Allocate the parameters and the normal equations.
+    mPoses          = new double[POSE*mNumBoards];
+    mStepPoses      = new double[POSE*mNumBoards];
+    mCandidatePoses = new double[POSE*mNumBoards];
+    mU              = new double[G*G];
+    mW              = new double[G*POSE*mNumBoards];
+    mV              = new double[POSE*POSE*mNumBoards];
+    mGradGlobals    = new double[G];
+    mGradPoses      = new double[POSE*mNumBoards];
+
+    // Copy the intrinsics, distortion and camera poses.
+    double* cam  = &mGlobals[CAM];
+    double* proj = &mGlobals[PROJ];
+    cam[0]  = cvmGet(cam_intrinsic,  0, 0); cam[1]  = cvmGet(cam_intrinsic,  1, 1);
+    cam[2]  = cvmGet(cam_intrinsic,  0, 2); cam[3]  = cvmGet(cam_intrinsic,  1, 2);
+    proj[0] = cvmGet(proj_intrinsic, 0, 0); proj[1] = cvmGet(proj_intrinsic, 1, 1);
+    proj[2] = cvmGet(proj_intrinsic, 0, 2); proj[3] = cvmGet(proj_intrinsic, 1, 2);
+    for(int k=0; k<5; k++){
+        cam[4+k]  = cvmGet(cam_distortion,  k, 0);
+        proj[4+k] = cvmGet(proj_distortion, k, 0);
+    }
+    for(int i=0; i<mNumBoards; i++){
+        for(int k=0; k<3; k++){
+            mPoses[POSE*i+k]   = cvmGet(cam_rotation_vectors,    i, k);
+            mPoses[POSE*i+3+k] = cvmGet(cam_translation_vectors, i, k);
+        }
+    }
+
+    // Average the camera-to-projector transforms of the boards (Rp*Rc', tp-Rp*Rc'*tc).
+    double q_sum[4] = {0, 0, 0, 0}, t_sum[3] = {0, 0, 0};
+    for(int i=0; i<mNumBoards; i++){
+        double rc[3], rp[3], Rc[9], Rp[9], R[9], q[4];
+        for(int k=0; k<3; k++){
+            rc[k] = mPoses[POSE*i+k];
+            rp[k] = cvmGet(proj_rotation_vectors, i, k);
+        }
+        rotationMatrix(rc, Rc);
+        rotationMatrix(rp, Rp);
+        for(int r=0; r<3; r++)
+            for(int c=0; c<3; c++)
+                R[r*3+c] = Rp[r*3]*Rc[c*3] + Rp[r*3+1]*Rc[c*3+1] + Rp[r*3+2]*Rc[c*3+2];
+        rotationQuaternion(R, q);
+        double sign = (q[0]*q_sum[0] + q[1]*q_sum[1] + q[2]*q_sum[2] + q[3]*q_sum[3] < 0) ? -1.0 : 1.0;
+        for(int k=0; k<4; k++)
+            q_sum[k] += sign*q[k];
+        for(int r=0; r<3; r++)
+            t_sum[r] += cvmGet(proj_translation_vectors, i, r) -
+                (R[r*3]*mPoses[POSE*i+3] + R[r*3+1]*mPoses[POSE*i+4] + R[r*3+2]*mPoses[POSE*i+5]);
+    }
+    quaternionRotation(q_sum, &mGlobals[REL]);
+    for(int k=0; k<3; k++)
+        mGlobals[REL+3+k] = t_sum[k]/mNumBoards;
+    return 0;
+}
+
+// Evaluate the residual of a printed corner in the camera (pixels).
+void ProCamBundleAdjuster::CameraResidual(const double* globals, const double* pose, const float* object, const float* image, double* r)
+{
+    double R[9], X[3], uv[2];
+    rotationMatrix(pose, R);
+    for(int k=0; k<3; k++)
+        X[k] = R[k*3]*object[0] + R[k*3+1]*object[1] + pose[3+k];
+    projectPoint(&globals[CAM], X, uv);
+    r[0] = uv[0] - image[0];
+    r[1] = uv[1] - image[1];
+}
+
+// Evaluate the residual of a projected corner in the projector (pixels).
+void ProCamBundleAdjuster::ProjectorResidual(const double* globals, const double* pose, const float* cam_image, const float* proj_image, double* r)
+{
+    // Intersect the camera ray with the board plane (normal is the board z-axis, through the board origin).
+    double R[9], ray[3], X[3], Xp[3], uv[2];
+    rotationMatrix(pose, R);
+    undistortPoint(&globals[CAM], cam_image[0], cam_image[1], ray[0], ray[1]);
+    ray[2] = 1.0;
+    double n_ray = R[2]*ray[0] + R[5]*ray[1] + R[8]*ray[2];
+    double n_t   = R[2]*pose[3] + R[5]*pose[4] + R[8]*pose[5];
+    if(fabs(n_ray) < DBL_EPSILON){
+        r[0] = r[1] = 0;
+        return;
+    }
+    for(int k=0; k<3; k++)
+        X[k] = ray[k]*n_t/n_ray;
+
+    // Transform to the projector, and compare with the projector pixel.
+    double Rrel[9];
+    rotationMatrix(&globals[REL], Rrel);
+    for(int k=0; k<3; k++)
+        Xp[k] = Rrel[k*3]*X[0] + Rrel[k*3+1]*X[1] + Rrel[k*3+2]*X[2] + globals[REL+3+k];
+    projectPoint(&globals[PROJ], Xp, uv);
+    r[0] = uv[0] - proj_image[0];
+    r[1] = uv[1] - proj_image[1];
+}
+
+// Evaluate the squared reprojection errors of the camera and the projector (summed over all corners).
+void ProCamBundleAdjuster::EvaluateCost(const double* globals, const double* poses, double& cam_cost, double& proj_cost)
+{
+    double cam_sum = 0, proj_sum = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:cam_sum,proj_sum) num_threads(mNumThreads)
+    for(int i=0; i<mNumBoards; i++){
+        const double* pose = &poses[POSE*i];
+        double r[2];
+        for(int j=0; j<mCamBoardN; j++){
+            CameraResidual(globals, pose, &mCamObject[2*j], &mCamImage[2*(mCamBoardN*i+j)], r);
+            cam_sum += r[0]*r[0] + r[1]*r[1];
+        }
+        for(int j=0; j<mProjBoardN; j++){
+            int k = mProjBoardN*i+j;
+            ProjectorResidual(globals, pose, &mProjCamImage[2*k], &mProjImage[2*k], r);
+            proj_sum += r[0]*r[0] + r[1]*r[1];
+        }
+    }
+    cam_cost  = cam_sum;
+    proj_cost = proj_sum;
+}
+
+// Accumulate the normal equations of one board (its pose block, and its contribution to the shared block).
+void ProCamBundleAdjuster::AccumulateBoard(int board, double* U, double* g)
+{
+    int G = mNumActive;
+    double* W  = &mW[G*POSE*board];
+    double* V  = &mV[POSE*POSE*board];
+    double* gp = &mGradPoses[POSE*board];
+    memset(W,  0, G*POSE*sizeof(double));
+    memset(V,  0, POSE*POSE*sizeof(double));
+    memset(gp, 0, POSE*sizeof(double));
+
+    double globals[NUM_GLOBALS], pose[POSE];
+    memcpy(globals, mGlobals, sizeof(globals));
+    memcpy(pose, &mPoses[POSE*board], sizeof(pose));
+    double Jg[2][NUM_GLOBALS], Jp[2][POSE], r[2], r_plus[2], r_minus[2];
+    int n = mCamBoardN + mProjBoardN;
+    for(int j=0; j<n; j++){
+
+        // Select the observation (the camera corners only depend on the camera parameters).
+        bool is_cam = (j < mCamBoardN);
+        int k_end = is_cam ? PROJ : NUM_GLOBALS;
+        const float *a, *b;
+        if(is_cam){
+            a = &mCamObject[2*j];
+            b = &mCamImage[2*(mCamBoardN*board+j)];
+        }
+        else{
+            int k = mProjBoardN*board + j - mCamBoardN;
+            a = &mProjCamImage[2*k];
+            b = &mProjImage[2*k];
+        }
+        if(is_cam)
+            CameraResidual(globals, pose, a, b, r);
+        else
+            ProjectorResidual(globals, pose, a, b, r);
+
+        // Differentiate with respect to the active shared parameters and the pose (central differences).
+        for(int k=0; k<G; k++)
+            Jg[0][k] = Jg[1][k] = 0;
+        for(int k=0; k<k_end; k++){
+            if(!mActive[k])
+                continue;
+            double value = globals[k], h = DIFFERENCE_STEP*MAX(1.0, fabs(value));
+            globals[k] = value + h;
+            if(is_cam) CameraResidual(globals, pose, a, b, r_plus); else ProjectorResidual(globals, pose, a, b, r_plus);
+            globals[k] = value - h;
+            if(is_cam) CameraResidual(globals, pose, a, b, r_minus); else ProjectorResidual(globals, pose, a, b, r_minus);
+            globals[k] = value;
+            Jg[0][mActiveIndex[k]] = (r_plus[0]-r_minus[0])/(2.0*h);
+            Jg[1][mActiveIndex[k]] = (r_plus[1]-r_minus[1])/(2.0*h);
+        }
+        for(int k=0; k<POSE; k++){
+            double value = pose[k], h = DIFFERENCE_STEP*MAX(1.0, fabs(value));
+            pose[k] = value + h;
+            if(is_cam) CameraResidual(globals, pose, a, b, r_plus); else ProjectorResidual(globals, pose, a, b, r_plus);
+            pose[k] = value - h;
+            if(is_cam) CameraResidual(globals, pose, a, b, r_minus); else ProjectorResidual(globals, pose, a, b, r_minus);
+            pose[k] = value;
+            Jp[0][k] = (r_plus[0]-r_minus[0])/(2.0*h);
+            Jp[1][k] = (r_plus[1]-r_minus[1])/(2.0*h);
+        }
+
+        // Accumulate J'J and J'r (upper triangle of U, completed by the caller).
+        for(int e=0; e<2; e++){
+            for(int p=0; p<G; p++){
+                if(Jg[e][p] == 0)
+                    continue;
+                for(int q=p; q<G; q++)
+                    U[p*G+q] += Jg[e][p]*Jg[e][q];
+                for(int q=0; q<POSE; q++)
+                    W[p*POSE+q] += Jg[e][p]*Jp[e][q];
+                g[p] += Jg[e][p]*r[e];
+            }
+            for(int p=0; p<POSE; p++){
+                for(int q=0; q<POSE; q++)
+                    V[p*POSE+q] += Jp[e][p]*Jp[e][q];
+                gp[p] += Jp[e][p]*r[e];
+            }
+        }
+    }
+}
+
+// Accumulate the normal equations of all boards at the current parameters.
+void ProCamBundleAdjuster::AccumulateNormalEquations()
+{
+    // Accumulate board by board (each thread sums its boards' shared blocks).
+    int G = mNumActive;
+    memset(mU, 0, G*G*sizeof(double));
+    memset(mGradGlobals, 0, G*sizeof(double));
+    #pragma omp parallel num_threads(mNumThreads)
+    {
+        double U[NUM_GLOBALS*NUM_GLOBALS], g[NUM_GLOBALS];
+        memset(U, 0, G*G*sizeof(double));
+        memset(g, 0, G*sizeof(double));
+        #pragma omp for schedule(dynamic)
+        for(int i=0; i<mNumBoards; i++)
+            AccumulateBoard(i, U, g);
+        #pragma omp critical
+        {
+            for(int k=0; k<G*G; k++)
+                mU[k] += U[k];
+            for(int k=0; k<G; k++)
+                mGradGlobals[k] += g[k];
+        }
+    }
+    for(int p=0; p<G; p++)
+        for(int q=0; q<p; q++)
+            mU[p*G+q] = mU[q*G+p];
+}
+
+// Eliminate the board poses from the damped normal equations (S and b are the reduced system in the active shared parameters).
+bool ProCamBundleAdjuster::ReduceSystem(double lambda, double* S, double* b)
+{
+    // Start from the damped shared block (S = U) and right-hand side (b = -g).
+    int G = mNumActive;
+    for(int p=0; p<G; p++){
+        for(int q=0; q<G; q++)
+            S[p*G+q] = mU[p*G+q];
+        S[p*G+p] *= 1.0 + lambda;
+        b[p] = -mGradGlobals[p];
+    }
+
+    // Eliminate the board poses: S -= W*inv(V)*W', b += W*inv(V)*gp (summed per thread).
+    int failed = 0;
+    #pragma omp parallel num_threads(mNumThreads)
+    {
+        double S_sum[NUM_GLOBALS*NUM_GLOBALS], b_sum[NUM_GLOBALS];
+        double L[POSE*POSE], Y[POSE*NUM_GLOBALS], y[POSE];
+        memset(S_sum, 0, G*G*sizeof(double));
+        memset(b_sum, 0, G*sizeof(double));
+        #pragma omp for schedule(dynamic)
+        for(int i=0; i<mNumBoards; i++){
+            const double* W  = &mW[G*POSE*i];
+            const double* gp = &mGradPoses[POSE*i];
+            memcpy(L, &mV[POSE*POSE*i], sizeof(L));
+            for(int p=0; p<POSE; p++)
+                L[p*POSE+p] *= 1.0 + lambda;
+            if(!choleskyDecompose(L, POSE)){
+                #pragma omp atomic
+                failed++;
+                continue;
+            }
+            for(int q=0; q<G; q++){
+                for(int p=0; p<POSE; p++)
+                    y[p] = W[q*POSE+p];
+                choleskySolve(L, POSE, y);
+                for(int p=0; p<POSE; p++)
+                    Y[p*G+q] = y[p];
+            }
+            memcpy(y, gp, sizeof(y));
+            choleskySolve(L, POSE, y);
+            for(int p=0; p<G; p++){
+                for(int q=0; q<G; q++){
+                    double s = 0;
+                    for(int k=0; k<POSE; k++)
+                        s += W[p*POSE+k]*Y[k*G+q];
+                    S_sum[p*G+q] += s;
+                }
+                for(int k=0; k<POSE; k++)
+                    b_sum[p] += W[p*POSE+k]*y[k];
+            }
+        }
+        #pragma omp critical
+        {
+            for(int k=0; k<G*G; k++)
+                S[k] -= S_sum[k];
+            for(int k=0; k<G; k++)
+                b[k] += b_sum[k];
+        }
+    }
+    return (failed == 0);
+}
+
+// Solve the damped normal equations for the update (via the Schur complement).
+bool ProCamBundleAdjuster::SolveStep(double lambda, double* d_globals, double* d_poses)
+{
+    // Solve the reduced system for the shared parameters.
+    int G = mNumActive;
+    double S[NUM_GLOBALS*NUM_GLOBALS], b[NUM_GLOBALS];
+    if(!ReduceSystem(lambda, S, b) || !choleskyDecompose(S, G))
+        return false;
+    choleskySolve(S, G, b);
+    memcpy(d_globals, b, G*sizeof(double));
+
+    // Recover the pose updates: dp = inv(V)*(-gp - W'*dg).
+    #pragma omp parallel for schedule(dynamic) num_threads(mNumThreads)
+    for(int i=0; i<mNumBoards; i++){
+        const double* W  = &mW[G*POSE*i];
+        const double* gp = &mGradPoses[POSE*i];
+        double L[POSE*POSE];
+        memcpy(L, &mV[POSE*POSE*i], sizeof(L));
+        for(int p=0; p<POSE; p++)
+            L[p*POSE+p] *= 1.0 + lambda;
+        choleskyDecompose(L, POSE);
+        double* dp = &d_poses[POSE*i];
+        for(int p=0; p<POSE; p++){
+            dp[p] = -gp[p];
+            for(int q=0; q<G; q++)
+                dp[p] -= W[q*POSE+p]*d_globals[q];
+        }
+        choleskySolve(L, POSE, dp);
+    }
+    return true;
+}
+
+// Run Levenberg-Marquardt iterations until the cost stops decreasing.
+int ProCamBundleAdjuster::Solve(int max_iterations)
+{
+    int64 t0 = cvGetTickCount();
+    double cam_cost, proj_cost;
+    EvaluateCost(mGlobals, mPoses, cam_cost, proj_cost);
+    double cost = cam_cost + proj_cost;
+    mResult.iterations         = 0;
+    mResult.converged          = false;
+    mResult.initial_cam_error  = sqrt(cam_cost/MAX(1, mCamBoardN*mNumBoards));
+    mResult.initial_proj_error = sqrt(proj_cost/MAX(1, mProjBoardN*mNumBoards));
+    mResult.cam_error          = mResult.initial_cam_error;
+    mResult.proj_error         = mResult.initial_proj_error;
+    if(mNumBoards < 1 || !(cost < DBL_MAX)){
+        mResult.time = (cvGetTickCount()-t0)/(1000.0*cvGetTickFrequency());
+        return -1;
+    }
+
+    double lambda = INITIAL_LAMBDA;
+    while(mResult.iterations < max_iterations){
+
+        // Accumulate the normal equations at the current parameters.
+        AccumulateNormalEquations();
+        mResult.iterations++;
+
+        // Increase the damping until a step decreases the cost.
+        bool accepted = false;
+        double new_cost = cost, new_cam_cost = cam_cost, new_proj_cost = proj_cost;
+        while(!accepted && lambda <= MAX_LAMBDA){
+            if(SolveStep(lambda, mStepGlobals, mStepPoses)){
+                memcpy(mCandidateGlobals, mGlobals, sizeof(mGlobals));
+                for(int k=0; k<NUM_GLOBALS; k++)
+                    if(mActive[k])
+                        mCandidateGlobals[k] += mStepGlobals[mActiveIndex[k]];
+                for(int i=0; i<POSE*mNumBoards; i++)
+                    mCandidatePoses[i] = mPoses[i] + mStepPoses[i];
+                EvaluateCost(mCandidateGlobals, mCandidatePoses, new_cam_cost, new_proj_cost);
+                new_cost = new_cam_cost + new_proj_cost;
+                accepted = (new_cost < cost);
+            }
+            if(!accepted)
+                lambda *= LAMBDA_FACTOR;
+        }
+        if(!accepted){
+            mResult.converged = true;
+            break;
+        }
+
+        // Take the step.
+        double decrease = cost - new_cost;
+        memcpy(mGlobals, mCandidateGlobals, sizeof(mGlobals));
+        memcpy(mPoses, mCandidatePoses, POSE*mNumBoards*sizeof(double));
+        cost      = new_cost;
+        cam_cost  = new_cam_cost;
+        proj_cost = new_proj_cost;
+        lambda    = MAX(lambda/LAMBDA_FACTOR, DBL_EPSILON);
+        if(decrease <= MIN_RELATIVE_DECREASE*cost){
+            mResult.converged = true;
+            break;
+        }
+    }
+
+    mResult.cam_error  = sqrt(cam_cost/(mCamBoardN*mNumBoards));
+    mResult.proj_error = sqrt(proj_cost/(mProjBoardN*mNumBoards));
+    mResult.time           = (cvGetTickCount()-t0)/(1000.0*cvGetTickFrequency());
+    mResult.iteration_time = (mResult.iterations > 0) ? mResult.time/mResult.iterations : 0;
+    return 0;
+}
+
+// Evaluate the covariance of the shared parameters (NUM_SHARED x NUM_SHARED, CV_64FC1) and their standard deviations.
+int ProCamBundleAdjuster::EvaluateUncertainty(CvMat* covariance, struct slCalibUncertainty* uncertainty)
+{
+    // Estimate the residual variance (the poses and the active shared parameters are fitted).
+    int G = mNumActive;
+    int n_residuals = 2*(mCamBoardN + mProjBoardN)*mNumBoards;
+    int dof = n_residuals - G - POSE*mNumBoards;
+    if(mNumBoards < 1 || dof < 1)
+        return -1;
+    double cam_cost, proj_cost;
+    EvaluateCost(mGlobals, mPoses, cam_cost, proj_cost);
+    double variance = (cam_cost + proj_cost)/dof;
+
+    // Invert the reduced normal equations (undamped, at the current parameters).
+    double S[NUM_GLOBALS*NUM_GLOBALS], b[NUM_GLOBALS], C[NUM_GLOBALS*NUM_GLOBALS];
+    AccumulateNormalEquations();
+    if(!ReduceSystem(0, S, b) || !choleskyDecompose(S, G))
+        return -1;
+    for(int q=0; q<G; q++){
+        for(int p=0; p<G; p++)
+            b[p] = (p == q) ? 1.0 : 0.0;
+        choleskySolve(S, G, b);
+        for(int p=0; p<G; p++)
+            C[p*G+q] = variance*b[p];
+    }
+
+    // Expand to all shared parameters (fixed parameters have zero variance).
+    cvSetZero(covariance);
+    for(int p=0; p<NUM_GLOBALS; p++)
+        for(int q=0; q<NUM_GLOBALS; q++)
+            if(mActive[p] && mActive[q])
+                cvmSet(covariance, p, q, C[mActiveIndex[p]*G+mActiveIndex[q]]);
+
+    // Extract the standard deviations.
+    double sigma[NUM_GLOBALS];
+    for(int k=0; k<NUM_GLOBALS; k++)
+        sigma[k] = sqrt(MAX(cvmGet(covariance, k, k), 0.0));
+    for(int k=0; k<2; k++){
+        uncertainty->cam_focal[k]      = sigma[CAM+k];
+        uncertainty->cam_principal[k]  = sigma[CAM+2+k];
+        uncertainty->proj_focal[k]     = sigma[PROJ+k];
+        uncertainty->proj_principal[k] = sigma[PROJ+2+k];
+    }
+    for(int k=0; k<5; k++){
+        uncertainty->cam_distortion[k]  = sigma[CAM+4+k];
+        uncertainty->proj_distortion[k] = sigma[PROJ+4+k];
+    }
+    for(int k=0; k<3; k++){
+        uncertainty->rotation[k]    = sigma[REL+k]*180.0/CV_PI;
+        uncertainty->translation[k] = sigma[REL+3+k];
+    }
+    uncertainty->residual = sqrt(variance);
+    return 0;
+}
+
+// Evaluate the depth (distance from the camera) triangulated from a camera pixel and a projector pixel.
+// Note: Uses the midpoint of the shortest segment between the rays, as triangulateRayRay does.
+double ProCamBundleAdjuster::TriangulateDepth(const double* globals, double cam_u, double cam_v, double proj_u, double proj_v)
+{
+    // Evaluate the camera ray, and the projector ray and centre (in camera coordinates).
+    double v1[3], ray[3], v2[3], q2[3], Rrel[9];
+    undistortPoint(&globals[CAM], cam_u, cam_v, v1[0], v1[1]);
+    v1[2] = 1.0;
+    undistortPoint(&globals[PROJ], proj_u, proj_v, ray[0], ray[1]);
+    ray[2] = 1.0;
+    rotationMatrix(&globals[REL], Rrel);
+    for(int k=0; k<3; k++){
+        v2[k] = Rrel[k]*ray[0] + Rrel[3+k]*ray[1] + Rrel[6+k]*ray[2];
+        q2[k] = -(Rrel[k]*globals[REL+3] + Rrel[3+k]*globals[REL+4] + Rrel[6+k]*globals[REL+5]);
+    }
+
+    // Find the closest points on both rays (the camera centre is the origin), and the depth of their midpoint.
+    double v11 = v1[0]*v1[0] + v1[1]*v1[1] + v1[2]*v1[2];
+    double v22 = v2[0]*v2[0] + v2[1]*v2[1] + v2[2]*v2[2];
+    double v12 = v1[0]*v2[0] + v1[1]*v2[1] + v1[2]*v2[2];
+    double q12_v1 = -(q2[0]*v1[0] + q2[1]*v1[1] + q2[2]*v1[2]);
+    double q12_v2 = -(q2[0]*v2[0] + q2[1]*v2[1] + q2[2]*v2[2]);
+    double denom = v11*v22 - v12*v12;
+    if(!(denom > DBL_EPSILON*v11*v22))
+        return 0;
+    double s = (v12*q12_v2 - v22*q12_v1)/denom;
+    double t = (v11*q12_v2 - v12*q12_v1)/denom;
+    double m[3];
+    for(int k=0; k<3; k++)
+        m[k] = 0.5*(s*v1[k] + q2[k] + t*v2[k]);
+    return (m[0]*v1[0] + m[1]*v1[1] + m[2]*v1[2])/sqrt(v11);
+}
+
+// Evaluate the expected depth error (standard deviation, mm) of camera pixels at a distance from the camera.
+void ProCamBundleAdjuster::EvaluateDepthError(const CvMat* covariance, double distance, CvMat* depth_error)
+{
+    int rows = depth_error->rows, cols = depth_error->cols;
+    double Rrel[9];
+    rotationMatrix(&mGlobals[REL], Rrel);
+    #pragma omp parallel for schedule(dynamic) num_threads(mNumThreads)
+    for(int r=0; r<rows; r++){
+        double globals[NUM_GLOBALS], J[NUM_GLOBALS];
+        memcpy(globals, mGlobals, sizeof(globals));
+        for(int c=0; c<cols; c++){
+
+            // Place the point at the distance along the camera ray, and find the projector pixel lighting it.
+            double cam_u = (c+0.5)*mSlParams->cam_w/cols, cam_v = (r+0.5)*mSlParams->cam_h/rows;
+            double ray[3], X[3], Xp[3], uv[2];
+            undistortPoint(&globals[CAM], cam_u, cam_v, ray[0], ray[1]);
+            ray[2] = 1.0;
+            double scale = distance/sqrt(ray[0]*ray[0] + ray[1]*ray[1] + ray[2]*ray[2]);
+            for(int k=0; k<3; k++)
+                X[k] = scale*ray[k];
+            for(int k=0; k<3; k++)
+                Xp[k] = Rrel[k*3]*X[0] + Rrel[k*3+1]*X[1] + Rrel[k*3+2]*X[2] + globals[REL+3+k];
+            CV_MAT_ELEM(*depth_error, float, r, c) = FLT_MAX;
+            if(!(Xp[2] > 0))
+                continue;
+            projectPoint(&globals[PROJ], Xp, uv);
+            if(!(uv[0] >= 0 && uv[0] < mSlParams->proj_w && uv[1] >= 0 && uv[1] < mSlParams->proj_h))
+                continue;
+
+            // Differentiate the triangulated depth with respect to the shared parameters (central differences).
+            for(int k=0; k<NUM_GLOBALS; k++){
+                J[k] = 0;
+                if(!mActive[k])
+                    continue;
+                double value = globals[k], h = DIFFERENCE_STEP*MAX(1.0, fabs(value));
+                globals[k] = value + h;
+                double z_plus = TriangulateDepth(globals, cam_u, cam_v, uv[0], uv[1]);
+                globals[k] = value - h;
+                double z_minus = TriangulateDepth(globals, cam_u, cam_v, uv[0], uv[1]);
+                globals[k] = value;
+                J[k] = (z_plus-z_minus)/(2.0*h);
+            }
+
+            // Propagate the covariance: var(z) = J*C*J'.
+            double var = 0;
+            for(int p=0; p<NUM_GLOBALS; p++){
+                if(J[p] == 0)
+                    continue;
+                for(int q=0; q<NUM_GLOBALS; q++)
+                    var += J[p]*cvmGet(covariance, p, q)*J[q];
+            }
+            CV_MAT_ELEM(*depth_error, float, r, c) = (float)sqrt(MAX(var, 0.0));
+        }
+    }
+}
+
+// Find the distances of the nearest and farthest board origins from the camera (mm).
+void ProCamBundleAdjuster::GetBoardDistances(double& nearest, double& farthest)
+{
+    nearest  = DBL_MAX;
+    farthest = 0;
+    for(int i=0; i<mNumBoards; i++){
+        const double* t = &mPoses[POSE*i+3];
+        double d = sqrt(t[0]*t[0] + t[1]*t[1] + t[2]*t[2]);
+        nearest  = MIN(nearest, d);
+        farthest = MAX(farthest, d);
+    }
+}
+
+// Copy the adjusted intrinsics and distortion of a device.
+static void copyDevice(const double* d, CvMat* intrinsic, CvMat* distortion)
+{
+    cvSetZero(intrinsic);
+    cvmSet(intrinsic, 0, 0, d[0]);
+    cvmSet(intrinsic, 1, 1, d[1]);
+    cvmSet(intrinsic, 0, 2, d[2]);
+    cvmSet(intrinsic, 1, 2, d[3]);
+    cvmSet(intrinsic, 2, 2, 1.0);
+    for(int k=0; k<5; k++)
+        cvmSet(distortion, k, 0, d[4+k]);
+}
+
+// Copy the adjusted camera intrinsics and distortion.
+void ProCamBundleAdjuster::GetCamera(CvMat* intrinsic, CvMat* distortion)
+{
+    copyDevice(&mGlobals[CAM], intrinsic, distortion);
+}
+
+// Copy the adjusted projector intrinsics and distortion.
+void ProCamBundleAdjuster::GetProjector(CvMat* intrinsic, CvMat* distortion)
+{
+    copyDevice(&mGlobals[PROJ], intrinsic, distortion);
+}
+
+// Copy the adjusted board poses, relative to the camera and to the projector (n_boards x 3).
+void ProCamBundleAdjuster::GetBoardPoses(CvMat* cam_rotation_vectors, CvMat* cam_translation_vectors,
+                                         CvMat* proj_rotation_vectors, CvMat* proj_translation_vectors)
+{
+    double Rrel[9];
+    rotationMatrix(&mGlobals[REL], Rrel);
+    for(int i=0; i<mNumBoards; i++){
+        const double* pose = &mPoses[POSE*i];
+        for(int k=0; k<3; k++){
+            cvmSet(cam_rotation_vectors,    i, k, pose[k]);
+            cvmSet(cam_translation_vectors, i, k, pose[3+k]);
+        }
+
+        // Compose the board pose with the camera-to-projector transform.
+        double Rc[9], R[9], q[4], r[3];
+        rotationMatrix(pose, Rc);
+        for(int a=0; a<3; a++)
+            for(int c=0; c<3; c++)
+                R[a*3+c] = Rrel[a*3]*Rc[c] + Rrel[a*3+1]*Rc[3+c] + Rrel[a*3+2]*Rc[6+c];
+        rotationQuaternion(R, q);
+        quaternionRotation(q, r);
+        for(int k=0; k<3; k++){
+            cvmSet(proj_rotation_vectors, i, k, r[k]);
+            cvmSet(proj_translation_vectors, i, k,
+                Rrel[k*3]*pose[3] + Rrel[k*3+1]*pose[4] + Rrel[k*3+2]*pose[5] + mGlobals[REL+3+k]);
+        }
+    }
+}
@@ -0,0 +1,189 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\BundleAdjustment.h
+///
+/// @brief  Declares the joint projector-camera bundle adjustment.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "CalibrateProCam.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slBundleResult
+///
+/// @brief  Summary of a bundle adjustment.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slBundleResult{
+	int    iterations;              // number of Levenberg-Marquardt iterations
+	bool   converged;               // the cost stopped decreasing (rather than reaching the maximum iterations)
+	double initial_cam_error;       // camera reprojection error before adjustment (RMS pixels)
+	double initial_proj_error;      // projector reprojection error before adjustment (RMS pixels)
+	double cam_error;               // camera reprojection error after adjustment (RMS pixels)
+	double proj_error;              // projector reprojection error after adjustment (RMS pixels)
+	double time;                    // solve time (ms)
+	double iteration_time;          // mean time per iteration (ms)
+	int    threads;                 // number of solver threads
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slCalibUncertainty
+///
+/// @brief  Standard deviations of the calibration parameters (zero for parameters held fixed).
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slCalibUncertainty{
+	double cam_focal[2];            // camera focal lengths (fx, fy; pixels)
+	double cam_principal[2];        // camera principal point (cx, cy; pixels)
+	double cam_distortion[5];       // camera distortion (k1, k2, p1, p2, k3)
+	double proj_focal[2];           // projector focal lengths (fx, fy; pixels)
+	double proj_principal[2];       // projector principal point (cx, cy; pixels)
+	double proj_distortion[5];      // projector distortion (k1, k2, p1, p2, k3)
+	double rotation[3];             // camera-to-projector rotation vector (degrees)
+	double translation[3];          // camera-to-projector translation (mm)
+	double residual;                // standard deviation of a corner residual, estimated from the fit (pixels)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ProCamBundleAdjuster
+///
+/// @brief  Refines the camera and projector calibration jointly over all chessboard observations.
+///
+/// The unknowns are the intrinsics and distortion of both devices, the camera-to-projector
+/// transform, and the pose of every board relative to the camera. Printed corners are projected
+/// into the camera. Each projected corner is intersected with its board plane along the camera ray
+/// it was observed on, and projected into the projector, where it must land on the projector pixel
+/// it was projected from. The board poses are shared by both devices, so the solution is a single
+/// consistent projector-camera geometry (rather than two independent calibrations).
+///
+/// Each board pose only affects the residuals of its own board, so the normal equations are
+/// block-sparse. Levenberg-Marquardt steps are solved with the Schur complement: the board poses
+/// are eliminated board by board, leaving a small dense system in the shared parameters. The cost
+/// of an iteration grows linearly with the number of boards, and the boards are evaluated in
+/// parallel (on sl_params->solver_threads threads).
+///
+/// Once solved, the covariance of the shared parameters is the inverse of the reduced (Schur
+/// complement) normal equations, scaled by the residual variance of the fit. It gives the standard
+/// deviation of every intrinsic, distortion and extrinsic parameter, and is propagated through the
+/// ray-ray triangulation to the expected depth error of a camera pixel at a given distance.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ProCamBundleAdjuster
+{
+public:
+    ProCamBundleAdjuster(struct slParams* sl_params, bool calibrate_camera);
+
+    ~ProCamBundleAdjuster();
+
+    // Initialize from separate camera and projector calibrations (per-board poses are n_boards x 3).
+    // Note: Returns -1 if there are no observations.
+    int Initialize(struct slCalibObservations* obs,
+                   CvMat* cam_intrinsic, CvMat* cam_distortion, CvMat* cam_rotation_vectors, CvMat* cam_translation_vectors,
+                   CvMat* proj_intrinsic, CvMat* proj_distortion, CvMat* proj_rotation_vectors, CvMat* proj_translation_vectors);
+
+    // Run Levenberg-Marquardt iterations until the cost stops decreasing.
+    // Note: Returns -1 if the initial reprojection error is not finite (the parameters are then unchanged).
+    int Solve(int max_iterations);
+
+    // Evaluate the covariance of the shared parameters (NUM_SHARED x NUM_SHARED, CV_64FC1) and their standard deviations.
+    // Note: Returns -1 if the parameters are not constrained by the observations (the outputs are then unchanged).
+    int EvaluateUncertainty(CvMat* covariance, struct slCalibUncertainty* uncertainty);
+
+    // Evaluate the expected depth error (standard deviation, mm) of camera pixels at a distance from the camera.
+    // Note: Each element of depth_error (CV_32FC1) is evaluated at the centre of its cell of the camera image;
+    //       cells whose point is not lit by the projector are set to FLT_MAX.
+    void EvaluateDepthError(const CvMat* covariance, double distance, CvMat* depth_error);
+
+    // Find the distances of the nearest and farthest board origins from the camera (mm).
+    void GetBoardDistances(double& nearest, double& farthest);
+
+    // Copy the adjusted intrinsics and distortion.
+    void GetCamera(CvMat* intrinsic, CvMat* distortion);
+    void GetProjector(CvMat* intrinsic, CvMat* distortion);
+
+    // Copy the adjusted board poses, relative to the camera and to the projector (n_boards x 3).
+    void GetBoardPoses(CvMat* cam_rotation_vectors, CvMat* cam_translation_vectors,
+                       CvMat* proj_rotation_vectors, CvMat* proj_translation_vectors);
+
+    // Accessor methods
+    struct slBundleResult* GetResult() { return &mResult; };
+    int GetBoardCount() { return mNumBoards; };
+
+    enum { NUM_SHARED = 24 };
+
+private:
+    enum { CAM = 0, PROJ = 9, REL = 18, NUM_GLOBALS = NUM_SHARED, POSE = 6 };
+
+    // Evaluate the residual of a printed corner in the camera (pixels).
+    static void CameraResidual(const double* globals, const double* pose, const float* object, const float* image, double* r);
+
+    // Evaluate the residual of a projected corner in the projector (pixels).
+    static void ProjectorResidual(const double* globals, const double* pose, const float* cam_image, const float* proj_image, double* r);
+
+    // Evaluate the squared reprojection errors of the camera and the projector (summed over all corners).
+    void EvaluateCost(const double* globals, const double* poses, double& cam_cost, double& proj_cost);
+
+    // Accumulate the normal equations of one board (its pose block, and its contribution to the shared block).
+    // Note: Only writes the board's own blocks (and U and g), so boards can be accumulated concurrently.
+    void AccumulateBoard(int board, double* U, double* g);
+
+    // Accumulate the normal equations of all boards at the current parameters.
+    void AccumulateNormalEquations();
+
+    // Eliminate the board poses from the damped normal equations (S and b are the reduced system in the active shared parameters).
+    // Note: Returns false if a damped pose block is not positive definite.
+    bool ReduceSystem(double lambda, double* S, double* b);
+
+    // Evaluate the depth (distance from the camera) triangulated from a camera pixel and a projector pixel.
+    static double TriangulateDepth(const double* globals, double cam_u, double cam_v, double proj_u, double proj_v);
+
+    // Solve the damped normal equations for the update (via the Schur complement).
+    // Note: Returns false if the damped system is not positive definite.
+    bool SolveStep(double lambda, double* d_globals, double* d_poses);
+
+    // Release the observations and buffers.
+    void Release();
+
+    /// <summary> Configuration, number of solver threads, and which shared parameters are adjusted. </summary>
+    struct slParams* mSlParams;
+    int   mNumThreads;
+    bool  mActive[NUM_GLOBALS];
+    int   mActiveIndex[NUM_GLOBALS];
+    int   mNumActive;
+
+    /// <summary> Observations: camera corners and object points, camera and projector pixels of projected corners. </summary>
+    int    mNumBoards;
+    int    mCamBoardN;
+    int    mProjBoardN;
+    float* mCamObject;
+    float* mCamImage;
+    float* mProjCamImage;
+    float* mProjImage;
+
+    /// <summary> Parameters: shared (camera, projector, camera-to-projector) and per-board poses (rotation vector, translation). </summary>
+    double  mGlobals[NUM_GLOBALS];
+    double* mPoses;
+
+    /// <summary> Candidate step: update of the active shared parameters and the poses, and the updated parameters. </summary>
+    double  mStepGlobals[NUM_GLOBALS];
+    double* mStepPoses;
+    double  mCandidateGlobals[NUM_GLOBALS];
+    double* mCandidatePoses;
+
+    /// <summary> Normal equations: shared block U, per-board blocks W (shared x pose) and V (pose x pose), gradients. </summary>
+    double* mU;
+    double* mW;
+    double* mV;
+    double* mGradGlobals;
+    double* mGradPoses;
+
+    /// <summary> Result summary. </summary>
+    struct slBundleResult mResult;
+};
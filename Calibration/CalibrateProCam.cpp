@@ -7,21 +7,33 @@
 #include "Common.h"
 #include "Calibration.h"
 #include "CalibrateProCam.h"
+#include "TriangulateProCam.h"
 #include "UtilProCam.h"
+#include "ImageWriter.h"
+#include "ChessboardDetector.h"
+#include "ChessboardTracker.h"
+#include "Homography.h"
+#include "BundleAdjustment.h"
+#include "BoardQuality.h"
+#include "CaptureGuide.h"
+#include "PatternEngine.h"
+#include "PhotometricCalibration.h"
 #include <fstream>
 
 using namespace std;
 using namespace cv;
 
 // Constructor
-CalibrateProCam::CalibrateProCam(Camera *camera_)
+CalibrateProCam::CalibrateProCam(Camera *camera_, struct slParams* sl_params)
 {
     camera = camera_;
+    detector = new ChessboardDetector(sl_params->chessboard_levels, sl_params->chessboard_threads);
 }
 
 // Destructor
 CalibrateProCam::~CalibrateProCam()
 {
+    delete detector;
 }
 
 // Display the camera calibration results to the console.
@@ -80,109 +92,21 @@ void CalibrateProCam::displayProjCalib(struct slCalib* sl_calib){
 
 // Generate a chessboard pattern for projector calibration.
 int CalibrateProCam::generateChessboard(struct slParams* sl_params, IplImage*& board, int& border_cols, int& border_rows){
-
-	// Calculate chessboard border.
-	border_cols = (int)floor((board->width -(sl_params->proj_board_w+1)*sl_params->proj_board_w_pixels)/2.0);
-	border_rows = (int)floor((board->height-(sl_params->proj_board_h+1)*sl_params->proj_board_h_pixels)/2.0);
-
-	// Check for chessboard errors.
-	if( (border_cols < 0) || (border_rows < 0) ){
-		printf("ERROR: Cannot create chessboard with user-requested dimensions!\n");
-		return -1;
-	}
-
-	// Initialize chessboard with white image.
-	cvSet(board, cvScalar(255));
-
-	// Create odd black squares.
-	uchar* data = (uchar*)board->imageData;
-	int step = board->widthStep/sizeof(uchar);
-	for(int r=0; r<(sl_params->proj_board_h+1); r+=2)
-		for(int c=0; c<(sl_params->proj_board_w+1); c+=2)
-			for(int i=(r*sl_params->proj_board_h_pixels+border_rows); 
-				i<((r+1)*sl_params->proj_board_h_pixels+border_rows); i++)
-				for(int j=(c*sl_params->proj_board_w_pixels+border_cols); 
-					j<((c+1)*sl_params->proj_board_w_pixels+border_cols); j++)
-					data[i*step+j] = 0;
-
-	// Create even black squares.
-	for(int r=1; r<sl_params->proj_board_h; r+=2)
-		for(int c=1; c<sl_params->proj_board_w; c+=2)
-			for(int i=(r*sl_params->proj_board_h_pixels+border_rows); 
-				i<((r+1)*sl_params->proj_board_h_pixels+border_rows); i++)
-				for(int j=(c*sl_params->proj_board_w_pixels+border_cols); 
-					j<((c+1)*sl_params->proj_board_w_pixels+border_cols); j++)
-					data[i*step+j] = 0;
-
-	// Return without errors.
-	return 0;
+	return PatternEngine::RenderChessboard(sl_params, board, 1.0f, border_cols, border_rows);
 }
 
 // Generate a chessboard pattern for projector calibration.
 int CalibrateProCam::generateChessboardScale(struct slParams* sl_params, IplImage*& board, int& border_cols, int& border_rows, float scale){
-
-	// Calculate chessboard border.
-	border_cols = (int)floor((board->width -(sl_params->proj_board_w+1)*sl_params->proj_board_w_pixels*scale)/2.0);
-	border_rows = (int)floor((board->height-(sl_params->proj_board_h+1)*sl_params->proj_board_h_pixels*scale)/2.0);
-
-	// Check for chessboard errors.
-	if( (border_cols < 0) || (border_rows < 0) ){
-		printf("ERROR: Cannot create chessboard with user-requested dimensions!\n");
-		return -1;
-	}
-
-	// Initialize chessboard with white image.
-	cvSet(board, cvScalar(255));
-
-	// Create odd black squares.
-	uchar* data = (uchar*)board->imageData;
-	int step = board->widthStep/sizeof(uchar);
-	for(int r=0; r<(sl_params->proj_board_h+1); r+=2)
-		for(int c=0; c<(sl_params->proj_board_w+1); c+=2)
-			for(int i=(r*sl_params->proj_board_h_pixels*scale+border_rows); 
-				i<((r+1)*sl_params->proj_board_h_pixels*scale+border_rows); i++)
-				for(int j=(c*sl_params->proj_board_w_pixels*scale+border_cols); 
-					j<((c+1)*sl_params->proj_board_w_pixels*scale+border_cols); j++)
-					data[i*step+j] = 0;
-
-	// Create even black squares.
-	for(int r=1; r<sl_params->proj_board_h; r+=2)
-		for(int c=1; c<sl_params->proj_board_w; c+=2)
-			for(int i=(r*sl_params->proj_board_h_pixels*scale+border_rows); 
-				i<((r+1)*sl_params->proj_board_h_pixels*scale+border_rows); i++)
-				for(int j=(c*sl_params->proj_board_w_pixels*scale+border_cols); 
-					j<((c+1)*sl_params->proj_board_w_pixels*scale+border_cols); j++)
-					data[i*step+j] = 0;
-
-	// Return without errors.
-	return 0;
+	return PatternEngine::RenderChessboard(sl_params, board, scale, border_cols, border_rows);
 }
 
 // Detect chessboard corners (with subpixel refinement).
 // Note: Returns 1 if chessboard is found, 0 otherwise.
+//       Searches a downscaled frame first (see ChessboardDetector).
 int CalibrateProCam::detectChessboard(IplImage* frame, CvSize board_size,
                      CvPoint2D32f* corners,
                      int* corner_count){
-
-	// Find chessboard corners. 
-	int found = cvFindChessboardCorners(
-		frame, board_size, corners, corner_count, CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_FILTER_QUADS);
-
-	// Refine chessboard corners.
-	IplImage* gray_frame = cvCreateImage(cvGetSize(frame), frame->depth, 1);
-	if(frame->nChannels > 1)
-		cvCvtColor(frame, gray_frame, CV_BGR2GRAY);
-	else
-		cvCopyImage(frame, gray_frame);
-	cvFindCornerSubPix(gray_frame, corners, *corner_count, 
-		cvSize(11,11), cvSize(-1,-1), 
-		cvTermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1));
-
-	// Release allocated resources.
-	cvReleaseImage(&gray_frame);
-
-	// Return without errors (i.e., chessboard was found).						 
-	return found;
+	return detector->Detect(frame, board_size, corners, corner_count);
 }
 
 static void printMatrix(CvMat *mat, std::string name)
@@ -208,6 +132,148 @@ static void printPoints(CvPoint2D32f *points, int length, std::string name)
     }
 }
 
+// Copy the pose of one board (row i of the n_boards x 3 pose matrices) to 3x1 rotation and translation vectors.
+static void copyBoardPose(CvMat* rotation_vectors, CvMat* translation_vectors, int i,
+                          CvMat* rot_vec, CvMat* rot_mat, CvMat* trans){
+	for(int k=0; k<3; k++){
+		cvmSet(rot_vec, k, 0, cvmGet(rotation_vectors,    i, k));
+		cvmSet(trans,   k, 0, cvmGet(translation_vectors, i, k));
+	}
+	cvRodrigues2(rot_vec, rot_mat, NULL);
+}
+
+// Grid of camera pixels the expected depth error is evaluated on.
+static const int UNCERTAINTY_GRID_COLS = 32;
+static const int UNCERTAINTY_GRID_ROWS = 24;
+
+// Write the standard deviations of a device's intrinsics and distortion (as a map of named entries).
+static void writeDeviceUncertainty(CvFileStorage* fs, const char* name,
+                                   const double* focal, const double* principal, const double* distortion){
+	static const char* DISTORTION_NAMES[5] = {"k1", "k2", "p1", "p2", "k3"};
+	cvStartWriteStruct(fs, name, CV_NODE_MAP);
+	cvWriteReal(fs, "fx_pixels", focal[0]);
+	cvWriteReal(fs, "fy_pixels", focal[1]);
+	cvWriteReal(fs, "cx_pixels", principal[0]);
+	cvWriteReal(fs, "cy_pixels", principal[1]);
+	for(int k=0; k<5; k++)
+		cvWriteReal(fs, DISTORTION_NAMES[k], distortion[k]);
+	cvEndWriteStruct(fs);
+}
+
+// Estimate the uncertainty of the calibration, and the expected depth error over the working volume.
+// Note: The covariance is evaluated at the final calibration (board poses are n_boards x 3). The working
+//       volume is dist_range, or the range of board distances if dist_range does not bound it.
+//       Writes the results to "calib\calibration_uncertainty.xml".
+static void estimateUncertainty(struct slParams* sl_params, struct slCalib* sl_calib,
+                                struct slCalibObservations* obs, bool calibrate_both,
+                                CvMat* cam_rotation_vectors, CvMat* cam_translation_vectors,
+                                CvMat* proj_rotation_vectors, CvMat* proj_translation_vectors,
+                                struct slCalibResult* result){
+
+	// Evaluate the covariance of the calibration parameters.
+	printf("Estimating calibration uncertainty...\n");
+	ProCamBundleAdjuster adjuster(sl_params, calibrate_both);
+	CvMat* covariance = cvCreateMat(ProCamBundleAdjuster::NUM_SHARED, ProCamBundleAdjuster::NUM_SHARED, CV_64FC1);
+	struct slCalibUncertainty u;
+	if(adjuster.Initialize(obs,
+		sl_calib->cam_intrinsic,  sl_calib->cam_distortion,  cam_rotation_vectors,  cam_translation_vectors,
+		sl_calib->proj_intrinsic, sl_calib->proj_distortion, proj_rotation_vectors, proj_translation_vectors) != 0 ||
+	   adjuster.EvaluateUncertainty(covariance, &u) != 0){
+		printf("Calibration uncertainty could not be estimated (the parameters are not constrained by the boards).\n");
+		cvReleaseMat(&covariance);
+		return;
+	}
+	printf("Calibration uncertainty (standard deviations, residual %.3f pixels):\n", u.residual);
+	if(calibrate_both)
+		printf("+ Camera:    f = (%.3f, %.3f), c = (%.3f, %.3f) pixels, k = (%.2e, %.2e, %.2e, %.2e, %.2e)\n",
+			u.cam_focal[0], u.cam_focal[1], u.cam_principal[0], u.cam_principal[1],
+			u.cam_distortion[0], u.cam_distortion[1], u.cam_distortion[2], u.cam_distortion[3], u.cam_distortion[4]);
+	printf("+ Projector: f = (%.3f, %.3f), c = (%.3f, %.3f) pixels, k = (%.2e, %.2e, %.2e, %.2e, %.2e)\n",
+		u.proj_focal[0], u.proj_focal[1], u.proj_principal[0], u.proj_principal[1],
+		u.proj_distortion[0], u.proj_distortion[1], u.proj_distortion[2], u.proj_distortion[3], u.proj_distortion[4]);
+	printf("+ Extrinsic: rotation = (%.4f, %.4f, %.4f) degrees, translation = (%.3f, %.3f, %.3f) mm\n",
+		u.rotation[0], u.rotation[1], u.rotation[2], u.translation[0], u.translation[1], u.translation[2]);
+
+	// Choose the working volume (near, middle and far distances from the camera).
+	double distances[3];
+	if(sl_params->dist_range[0] > 0 && sl_params->dist_range[1] > sl_params->dist_range[0]){
+		distances[0] = sl_params->dist_range[0];
+		distances[2] = sl_params->dist_range[1];
+	}
+	else
+		adjuster.GetBoardDistances(distances[0], distances[2]);
+	distances[1] = 0.5*(distances[0]+distances[2]);
+
+	// Propagate the covariance to the expected depth error of the camera pixels (on a coarse grid).
+	static const char* PLANE_NAMES[3] = {"near", "middle", "far"};
+	CvMat* depth_error[3];
+	double max_error = 0, error_sum = 0;
+	int n_valid = 0;
+	for(int i=0; i<3; i++){
+		depth_error[i] = cvCreateMat(UNCERTAINTY_GRID_ROWS, UNCERTAINTY_GRID_COLS, CV_32FC1);
+		adjuster.EvaluateDepthError(covariance, distances[i], depth_error[i]);
+		double plane_max = 0, plane_sum = 0;
+		int plane_valid = 0;
+		for(int r=0; r<depth_error[i]->rows; r++)
+			for(int c=0; c<depth_error[i]->cols; c++){
+				float e = CV_MAT_ELEM(*depth_error[i], float, r, c);
+				if(e == FLT_MAX)
+					continue;
+				plane_max = MAX(plane_max, e);
+				plane_sum += e;
+				plane_valid++;
+			}
+		if(plane_valid > 0)
+			printf("+ Depth error at %.0f mm: mean %.3f mm, maximum %.3f mm (%d%% of the camera image lit)\n",
+				distances[i], plane_sum/plane_valid, plane_max, 100*plane_valid/(depth_error[i]->rows*depth_error[i]->cols));
+		else
+			printf("+ Depth error at %.0f mm: the projector does not light the camera image\n", distances[i]);
+		max_error = MAX(max_error, plane_max);
+		error_sum += plane_sum;
+		n_valid   += plane_valid;
+	}
+	if(result != NULL){
+		result->max_depth_error  = max_error;
+		result->mean_depth_error = (n_valid > 0) ? error_sum/n_valid : 0;
+	}
+
+	// Save the standard deviations and depth error maps.
+	char str[1024];
+	sprintf(str, "%s\\calib\\calibration_uncertainty.xml", sl_params->outdir);
+	CvFileStorage* fs = cvOpenFileStorage(str, 0, CV_STORAGE_WRITE);
+	if(fs != NULL){
+		cvWriteReal(fs, "residual_pixels", u.residual);
+		if(calibrate_both)
+			writeDeviceUncertainty(fs, "camera", u.cam_focal, u.cam_principal, u.cam_distortion);
+		writeDeviceUncertainty(fs, "projector", u.proj_focal, u.proj_principal, u.proj_distortion);
+		cvStartWriteStruct(fs, "extrinsic", CV_NODE_MAP);
+		cvWriteReal(fs, "rx_degrees", u.rotation[0]);
+		cvWriteReal(fs, "ry_degrees", u.rotation[1]);
+		cvWriteReal(fs, "rz_degrees", u.rotation[2]);
+		cvWriteReal(fs, "tx_mm", u.translation[0]);
+		cvWriteReal(fs, "ty_mm", u.translation[1]);
+		cvWriteReal(fs, "tz_mm", u.translation[2]);
+		cvEndWriteStruct(fs);
+		cvStartWriteStruct(fs, "depth_error", CV_NODE_MAP);
+		cvWriteReal(fs, "maximum_mm", max_error);
+		cvWriteReal(fs, "mean_mm",    (n_valid > 0) ? error_sum/n_valid : 0);
+		for(int i=0; i<3; i++){
+			cvStartWriteStruct(fs, PLANE_NAMES[i], CV_NODE_MAP);
+			cvWriteReal(fs, "distance_mm", distances[i]);
+			cvWrite(fs, "map_mm", depth_error[i]);
+			cvEndWriteStruct(fs);
+		}
+		cvEndWriteStruct(fs);
+		cvWrite(fs, "covariance", covariance);
+		cvReleaseFileStorage(&fs);
+	}
+	else
+		printf("ERROR: Cannot save calibration uncertainty \"%s\"!\n", str);
+	for(int i=0; i<3; i++)
+		cvReleaseMat(&depth_error[i]);
+	cvReleaseMat(&covariance);
+}
+
 // Run projector-camera calibration (including intrinsic and extrinsic parameters).
 int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params, 
 					        struct slCalib* sl_calib,
@@ -227,8 +293,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 		sprintf(str, "%s\\calib", sl_params->outdir);
 		_mkdir(str);
 		_mkdir(calibDir);
-		sprintf(str, "rd /s /q \"%s\"", calibDir);
-		system(str);
+		removeDirectory(calibDir);
 		if(_mkdir(calibDir) != 0){
 			printf("ERROR: Cannot open output directory!\n");
 			printf("Projector-camera calibration was not successful and must be repeated.\n");
@@ -249,8 +314,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	sprintf(str, "%s\\calib", sl_params->outdir);
 	_mkdir(str);
 	_mkdir(calibDir);
-	sprintf(str, "rd /s /q \"%s\"", calibDir);
-	system(str);
+	removeDirectory(calibDir);
 	if(_mkdir(calibDir) != 0){
 		printf("ERROR: Cannot open output directory!\n");
 		if(calibrate_both)
@@ -278,8 +342,6 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	int cam_board_n            = sl_params->cam_board_w*sl_params->cam_board_h;
 	CvSize cam_board_size      = cvSize(sl_params->cam_board_w, sl_params->cam_board_h);
 	CvMat* cam_image_points    = cvCreateMat(n_boards*cam_board_n, 2, CV_32FC1);
-    CvMat* cam_object_points   = cvCreateMat(n_boards*cam_board_n, 3, CV_32FC1);
-    CvMat* cam_point_counts    = cvCreateMat(n_boards, 1, CV_32SC1);
 	IplImage** cam_calibImages = new IplImage* [n_boards];
 
 	// Evaluate derived projector parameters and allocate storage.
@@ -287,7 +349,6 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	CvSize proj_board_size      = cvSize(sl_params->proj_board_w, sl_params->proj_board_h);
 	CvMat* proj_image_points    = cvCreateMat(n_boards*proj_board_n, 2, CV_32FC1);
     CvMat* proj_image_points2    = cvCreateMat(n_boards*proj_board_n, 2, CV_32FC1);
-    CvMat* proj_point_counts    = cvCreateMat(n_boards, 1, CV_32SC1);
 	IplImage** proj_calibImages = new IplImage* [n_boards];
 
 	// Generate projector calibration chessboard pattern.
@@ -312,7 +373,26 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 		return -1;
 	}
 	
-	// Generate projector calibration sinusoidal pattern.
+	// Render the projected frames once (switching patterns only swaps the displayed frame).
+	PatternEngine patterns(sl_params);
+	IplImage* proj_warp = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 1);
+
+	// Measure the projector and camera responses (or use a previous photometric calibration).
+	if(sl_params->photometric_calibration){
+		printf("Measuring projector and camera responses...\n");
+		PhotometricCalibration photometry(sl_params);
+		if(photometry.Run(camera, &patterns, sl_calib) == 0){
+			sprintf(str, "%s\\calib\\photometry.xml", sl_params->outdir);
+			photometry.Save(str, sl_calib);
+		}
+		else
+			printf("WARNING: Photometric calibration failed; the manual gains are used.\n");
+	}
+	else if(sl_calib->photometric_calib)
+		patterns.SetResponse(sl_calib->proj_response_lut);
+
+	// Start background writer for debug and calibration images (keeps encoding off the capture path).
+	AsyncImageWriter image_writer(sl_params->image_queue_size, sl_params->image_writer_threads, sl_params->image_queue_drop);
 
 	// Initialize capture and allocate storage.
 	printf("Press 'n' (in 'Camera Correspondences') to capture next image, or 'ESC' to quit.\n");
@@ -321,6 +401,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	IplImage* cam_frame_1 = cvCreateImage(cvGetSize(cam_frame), cam_frame->depth, cam_frame->nChannels);
 	IplImage* cam_frame_2 = cvCreateImage(cvGetSize(cam_frame), cam_frame->depth, cam_frame->nChannels);
 	IplImage* cam_frame_3 = cvCreateImage(cvGetSize(cam_frame), cam_frame->depth, cam_frame->nChannels);
+	IplImage* cam_board_frame = cvCreateImage(cvGetSize(cam_frame), IPL_DEPTH_8U, 1);
 	for(int i=0; i<n_boards; i++)
 		cam_calibImages[i]  = cvCreateImage(cvGetSize(cam_frame), cam_frame->depth, cam_frame->nChannels);
 	for(int i=0; i<n_boards; i++)
@@ -341,16 +422,9 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	cvWaitKey(1);
 
     // Create a window to display projector image.
-	IplImage* proj_frame = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 3);
-	IplImage* proj_fram_gray = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 1);
-	cvSet(proj_frame, cvScalar(255.0, 0.0, 0.0));
-    //cvSet(proj_frame, cvScalar(0.0, 0.0, 255.0));
-	cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-	cvShowImage("projWindow", proj_frame);
+	cvShowImage("projWindow", patterns.Solid(cvScalar(255.0, 0.0, 0.0)));
     printf("Press any key to capture\n");
 	cvWaitKey(1);
-	IplImage* proj_zero = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 1);
-    cvZero(proj_zero);
 
 	// Allocate storage for grayscale images.
 	IplImage* cam_frame_1_gray = cvCreateImage(cvGetSize(cam_frame), IPL_DEPTH_8U, 1);
@@ -358,10 +432,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
     IplImage* cam_frame_red = cvCreateImage(cvGetSize(cam_frame), IPL_DEPTH_8U, 1);
 
     // determine projector-camera homography to project the projector checkerboard 
-    cvZero(proj_frame);
-    cvMerge(proj_chessboard, proj_chessboard, proj_chessboard, NULL, proj_frame);
-    cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-	cvShowImage("projWindow", proj_frame);
+	cvShowImage("projWindow", patterns.Chessboard());
     cvWaitKey(sl_params->delay);
 
     bool capturedH = false;
@@ -387,15 +458,24 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 		}
 	}
 
+	// Allocate chessboard corners and display images once (reused for every captured frame).
+	CvPoint2D32f* cam_corners  = new CvPoint2D32f[MAX(cam_board_n, proj_board_n)];
+	CvPoint2D32f* proj_corners = new CvPoint2D32f[proj_board_n];
+	IplImage* cam_frame_BGR    = cvCreateImage(cvGetSize(cam_frame_1_gray), IPL_DEPTH_8U, 3);
+	IplImage* cam_frame_view   = cvCreateImage(cvSize(sl_params->window_w, sl_params->window_h), IPL_DEPTH_8U, 3);
+
+	// Projector chessboard corners as points (proj_points is a continuous Nx2 matrix).
+	CvPoint2D32f* proj_board_points = (CvPoint2D32f*)proj_points->data.fl;
+
     // to do
     // fix hack on projector points
+	double cam_to_proj[9];
 	CvMat* camToProjHomography = cvCreateMat(3, 3, CV_32FC1);
     while(!capturedH)
     {
         cam_frame = camera->QueryFrame();
-		cvScale(cam_frame, cam_frame, 2.*(sl_params->cam_gain/100.), 0);
+		PhotometricCalibration::CorrectFrame(sl_params, sl_calib, cam_frame);
 
-		CvPoint2D32f* cam_corners = new CvPoint2D32f[cam_board_n];
 		int cam_corner_count;
 		int cam_found =	detectChessboard(cam_frame, proj_board_size, cam_corners, &cam_corner_count);
 
@@ -404,42 +484,26 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
         cvWaitKey(1);
 
 		// if we see the projected checkerboard pattern
-		if(cam_corner_count == proj_board_n)
+		if(cam_corner_count == proj_board_n &&
+		   estimateHomography(cam_corners, proj_board_points, proj_board_n, cam_to_proj))
         {
-			CvMat* cam_src    = cvCreateMat(proj_board_n, 3, CV_32FC1);
-			CvMat* cam_dst    = cvCreateMat(proj_board_n, 3, CV_32FC1);
-			for(int j=0; j<proj_board_n; ++j){
-                CV_MAT_ELEM(*cam_src, float, j, 0) = cam_corners[j].x;
-				CV_MAT_ELEM(*cam_src, float, j, 1) = cam_corners[j].y;
-				CV_MAT_ELEM(*cam_src, float, j, 2) = 1.0;
-				CV_MAT_ELEM(*cam_dst, float, j, 0) = CV_MAT_ELEM(*proj_points, float, j, 0);
-				CV_MAT_ELEM(*cam_dst, float, j, 1) = CV_MAT_ELEM(*proj_points, float, j, 1);
-				CV_MAT_ELEM(*cam_dst, float, j, 2) = 1.0;
-                //printf("Corner: %i cam_corner: %f %f proj_points: %f %f\n", j, cam_corners[j].x, cam_corners[j].y, CV_MAT_ELEM(*proj_points, float, j, 0), CV_MAT_ELEM(*proj_points, float, j, 1));
-			}
-
-			cvFindHomography(cam_src, cam_dst, camToProjHomography);
-			cvReleaseMat(&cam_src);
-			cvReleaseMat(&cam_dst);
-
+			homographyToMat(cam_to_proj, camToProjHomography);
             capturedH = true;
         }
 
         IplImage* cam_warp = cvCreateImage(cvGetSize(cam_frame), IPL_DEPTH_8U, cam_frame->nChannels);
-        cvSaveImage("cam_frame.tiff", cam_frame);
+        image_writer.Save("cam_frame.tiff", cam_frame);
         cvWarpPerspective(cam_frame, cam_warp, camToProjHomography);
-        cvSaveImage("cam_warp.tiff", cam_warp);
+        image_writer.SaveOwned("cam_warp.tiff", cam_warp);
 
         cvReleaseImage(&cam_frame);
     }
 
-	//cvSet(proj_frame, cvScalar(255.0, 0.0, 0.0));
-    cvSet(proj_frame, cvScalar(0.0, 0.0, 255.0));
-	cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-	cvShowImage("projWindow", proj_frame);
+	cvShowImage("projWindow", patterns.Solid(cvScalar(0.0, 0.0, 255.0)));
     cvWaitKey(sl_params->delay);
 
-	CvMat* projToCamHomography = cvCreateMat(3, 3, CV_32FC1);
+	double proj_to_cam[9], proj_to_proj[9];
+	CvMat* projToProjHomography = cvCreateMat(3, 3, CV_32FC1);
 
 	// Capture live image stream, until "ESC" is pressed or calibration is complete.
 	int successTimer = 0;
@@ -447,65 +511,56 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
     int successes = 0;
 	bool captureFrame = false;
 	int cvKey = -1, cvKey_temp = -1;
+	int64 capture_start = cvGetTickCount();
+	int capture_frames  = 0;
+	detector->ResetStatistics();
+	ChessboardTracker tracker(detector);
+	BoardScorer scorer(sl_params);
+	CaptureGuide guide(sl_params, calibrate_both);
 	while(successes < n_boards)
     {
+		capture_frames++;
+
 		// Get next available "safe" frame.
         cam_frame = camera->QueryFrameR();
-		cvScale(cam_frame, cam_frame, 2.*(sl_params->cam_gain/100.), 0);
+		PhotometricCalibration::CorrectFrame(sl_params, sl_calib, cam_frame, 2);
 
-        IplImage* cam_frame_BGR = Gray2BGR(cam_frame);
+        Gray2BGR(cam_frame, cam_frame_BGR);
         //cvSplit(cam_frame, NULL, NULL, cam_frame_red, NULL);
         //cvMerge(cam_frame_red, cam_frame_red, cam_frame_red, NULL, cam_frame);
 
-		// Find camera chessboard corners.
-		CvPoint2D32f* cam_corners = new CvPoint2D32f[cam_board_n];
-		int cam_corner_count;
+		// Find camera chessboard corners (tracked from the previous frame, if enabled).
+		int cam_corner_count, cam_found;
 		//int cam_found =	detectChessboard(cam_frame_red, cam_board_size, cam_corners, &cam_corner_count);
-		int cam_found =	detectChessboard(cam_frame, cam_board_size, cam_corners, &cam_corner_count);
+		if(sl_params->chessboard_tracking)
+			cam_found = tracker.Track(cam_frame, cam_board_size, cam_corners, &cam_corner_count);
+		else
+			cam_found =	detectChessboard(cam_frame, cam_board_size, cam_corners, &cam_corner_count);
 
         //for(int i = 0; i < cam_board_n; i++)
         //{
         //    printf("cam_corners[%i] = %f, %f\n", i, cam_corners[i].x, cam_corners[i].y);
         //}
 		cvDrawChessboardCorners(cam_frame_BGR, cam_board_size, cam_corners, cam_corner_count, cam_found);
-		ShowImageResampled("Camera Correspondences", cam_frame_BGR, sl_params->window_w, sl_params->window_h);
-        cvReleaseImage(&cam_frame_BGR);
+		if(sl_params->guidance)
+			guide.Draw(cam_frame_BGR);
+		ShowImageResampled("Camera Correspondences", cam_frame_BGR, cam_frame_view);
 
 		// If camera chessboard is found, attempt to detect projector chessboard.
-		if(cam_corner_count == cam_board_n){
+		if(cam_corner_count == cam_board_n &&
+		   estimateHomography(proj_board_points, cam_corners, proj_board_n, proj_to_cam)){
 
             // calculate projector points
-	        CvMat* projToCamHomography = cvCreateMat(3, 3, CV_32FC1);
-
-			CvMat* cam_src    = cvCreateMat(proj_board_n, 3, CV_32FC1);
-			CvMat* cam_dst    = cvCreateMat(proj_board_n, 3, CV_32FC1);
-			for(int j=0; j<proj_board_n; ++j){
-                CV_MAT_ELEM(*cam_src, float, j, 0) = cam_corners[j].x;
-				CV_MAT_ELEM(*cam_src, float, j, 1) = cam_corners[j].y;
-				CV_MAT_ELEM(*cam_src, float, j, 2) = 1.0;
-				CV_MAT_ELEM(*cam_dst, float, j, 0) = CV_MAT_ELEM(*proj_points, float, j, 0);
-				CV_MAT_ELEM(*cam_dst, float, j, 1) = CV_MAT_ELEM(*proj_points, float, j, 1);
-				CV_MAT_ELEM(*cam_dst, float, j, 2) = 1.0;
-			}
-
-			cvFindHomography(cam_dst, cam_src, projToCamHomography);
-			cvReleaseMat(&cam_src);
-			cvReleaseMat(&cam_dst);
-
-            CvMat* projToProjHomography = cvCreateMat(3, 3, CV_32FC1);
-            cvMatMul(camToProjHomography, projToCamHomography, projToProjHomography);
+            composeHomography(cam_to_proj, proj_to_cam, proj_to_proj);
+            homographyToMat(proj_to_proj, projToProjHomography);
 
             // Red light checkerboard detection successful
             ostringstream os;
             os << "CameraImage" << 5*successes << ".png";
-            cvSaveImage(os.str().c_str(), cam_frame);
+            image_writer.Save(os.str().c_str(), cam_frame);
 
             // Get a white checkboard image
-            //cvSet(proj_frame, cvScalar(255.0, 255.0, 255.0));
-            cvSet(proj_frame, cvScalar(255.0, 255.0, 255.0));
-
-	        //cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-			cvShowImage("projWindow", proj_frame);
+			cvShowImage("projWindow", patterns.Solid(cvScalar(255.0, 255.0, 255.0), false));
 
 			// Get next available "safe" frame (after appropriate delay).
 			cvKey_temp = cvWaitKey(sl_params->delay);
@@ -519,39 +574,25 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 
             os.str("");
             os << "CameraImage" << 5*successes+1 << ".png";
-            cvSaveImage(os.str().c_str(), cam_frame_1_gray);
+            image_writer.Save(os.str().c_str(), cam_frame_1_gray);
 			ShowImageResampled("Projector Correspondences", cam_frame_1_gray, sl_params->window_w, sl_params->window_h);
 
+			// Keep the white-lit printed chessboard (to score its sharpness).
+			if(sl_params->board_scoring)
+				cvCopy(cam_frame_1_gray, cam_board_frame);
+
 
-			//cvCopy(proj_chessboard, proj_frame);
             // Display projector chessboard.
-            cvZero(proj_frame);
-            //cvMerge(proj_zero, proj_chessboard, proj_zero, NULL, proj_frame);
-            cvMerge(proj_chessboard, proj_chessboard, proj_chessboard, NULL, proj_frame);
+            image_writer.Save("projFrame.png", proj_chessboard);
+            image_writer.Save("cam_frame.png", cam_frame);
 
             // warp the input based on the camera checkerboard and the precomputed proCam homography
-            
-            cvSaveImage("projFrame.png", proj_frame);
-            cvSaveImage("cam_frame.png", cam_frame);
-
-            //IplImage* projWarp = cvCreateImage(cvGetSize(proj_frame), IPL_DEPTH_8U, 3);
-            //cvWarpPerspective(proj_frame, projWarp, projToCamHomography);
-            //cvSaveImage("projWarp.png", projWarp);
-
-            //IplImage* projWarp2 = cvCreateImage(cvGetSize(proj_frame), IPL_DEPTH_8U, 3);
-            //cvWarpPerspective(projWarp, projWarp2, camToProjHomography);
-            //cvSaveImage("projWarp2.png", projWarp2);
-
-            IplImage* projWarp2 = cvCreateImage(cvGetSize(proj_frame), IPL_DEPTH_8U, 3);
-            //cvSet(projWarp2, cvScalar(1.0, 0.0, 1.0));
-            cvWarpPerspective(proj_frame, projWarp2, projToProjHomography, CV_INTER_LINEAR+CV_WARP_FILL_OUTLIERS, cvScalar(255.0, 255.0, 255.0));
-            cvSaveImage("projWarp.png", projWarp2);
-            cvScale(projWarp2, projWarp2, 2.*(sl_params->proj_gain/100.), 0);
-
+            // (all channels of the chessboard are equal, so only one channel is warped)
+            cvWarpPerspective(proj_chessboard, proj_warp, projToProjHomography, CV_INTER_LINEAR+CV_WARP_FILL_OUTLIERS, cvScalarAll(255.0));
+            image_writer.Save("projWarp.png", proj_warp);
+            patterns.ApplyGain(proj_warp, proj_warp);
 
-            //cvWarpPerspective(proj_frame, proj_frame, camToProjHomography);
-
-			cvShowImage("projWindow", projWarp2);
+			cvShowImage("projWindow", proj_warp);
             //cvWaitKey(sl_params->delay);
             //cvSaveImage("projWarp.tiff", projWarp);
 
@@ -573,7 +614,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
             //cvShowImageResampled("Camera Correspondences", cam_frame_2_gray, sl_params->window_w, sl_params->window_h);
             os.str("");
             os << "CameraImage" << 5*successes+2 << ".png";
-            cvSaveImage(os.str().c_str(), cam_frame_2_gray);
+            image_writer.Save(os.str().c_str(), cam_frame_2_gray);
 
 			//cvScale(cam_frame, cam_frame, 2.*(sl_params->cam_gain/100.), 0);
 			//cvCopyImage(cam_frame, cam_frame_2);
@@ -588,7 +629,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 
             os.str("");
             os << "CameraImage" << 5*successes+3 << ".png";
-            cvSaveImage(os.str().c_str(), cam_frame_2_gray);
+            image_writer.Save(os.str().c_str(), cam_frame_2_gray);
 
 			// Invert chessboard image.
 			double min_val, max_val;
@@ -597,7 +638,6 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 				-255.0/(max_val-min_val), 255.0+((255.0*min_val)/(max_val-min_val)));
 
 			// Find projector chessboard corners.
-			CvPoint2D32f* proj_corners = new CvPoint2D32f[proj_board_n];
 			int proj_corner_count;
 			int proj_found = detectChessboard(cam_frame_2_gray, proj_board_size, proj_corners, &proj_corner_count);
 
@@ -607,15 +647,14 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 
 			// Display current projector tracking results.
             //cvMerge(cam_frame_2_gray, cam_frame_2_gray, cam_frame_2_gray, NULL, cam_frame_2);
-            IplImage* cam_frame_BGR = Gray2BGR(cam_frame_2_gray);
+            Gray2BGR(cam_frame_2_gray, cam_frame_BGR);
 
 			cvDrawChessboardCorners(cam_frame_BGR, proj_board_size, proj_corners, proj_corner_count, proj_found);
-			ShowImageResampled("Projector Correspondences", cam_frame_BGR, sl_params->window_w, sl_params->window_h);
-            cvReleaseImage(&cam_frame_BGR);
+			ShowImageResampled("Projector Correspondences", cam_frame_BGR, cam_frame_view);
 
             os.str("");
             os << "CameraImage" << 5*successes+4 << ".png";
-            cvSaveImage(os.str().c_str(), cam_frame_2_gray);
+            image_writer.Save(os.str().c_str(), cam_frame_2_gray);
 
             //if(proj_corner_count == proj_board_n)
             //{
@@ -632,17 +671,31 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 			//if(captureFrame & (proj_corner_count == proj_board_n)){
 			//if(successTimer > numSuccessTimerMax)
 
+            // Reject blurred, inconsistent and duplicate boards (without asking).
+            struct slBoardScore score;
+            bool rejected = false;
+            if(proj_corner_count == proj_board_n && sl_params->board_scoring &&
+               !scorer.Score(cam_board_frame, cam_corners, proj_corners, &score)){
+                printf("Board rejected (%s): sharpness %.0f, residuals %.3f/%.3f squares, pose difference %.3f.\n",
+                    score.reason, score.sharpness, score.cam_residual, score.proj_residual, score.difference);
+                rejected = true;
+            }
+
             if(proj_corner_count == proj_board_n)
             //if(0)
             {
-                printf("Press any key to save results or c to cancel this round\n");
-	            int key = cvWaitKey(0);
+                int key = 'c';
+                if(!rejected){
+                    if(sl_params->board_scoring)
+                        printf("Board score: sharpness %.0f, residuals %.3f/%.3f squares, new coverage %.0f%%, pose difference %.3f.\n",
+                            score.sharpness, score.cam_residual, score.proj_residual, 100.0*score.coverage, score.difference);
+                    printf("Press any key to save results or c to cancel this round\n");
+	                key = cvWaitKey(0);
+                }
 	            if(key=='c')
                 {
 		            // Display red image for next camera capture frame.
-		            cvSet(proj_frame, cvScalar(0.0, 0.0, 255.0));
-		            cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-		            cvShowImage("projWindow", proj_frame);
+		            cvShowImage("projWindow", patterns.Solid(cvScalar(0.0, 0.0, 255.0)));
 
 		            cvKey_temp = cvWaitKey(sl_params->delay);
 		            if(cvKey_temp != -1) 
@@ -654,11 +707,7 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 				for(int i=successes*cam_board_n, j=0; j<cam_board_n; ++i,++j){
 					CV_MAT_ELEM(*cam_image_points,  float, i, 0) = cam_corners[j].x;
 					CV_MAT_ELEM(*cam_image_points,  float, i, 1) = cam_corners[j].y;
-					CV_MAT_ELEM(*cam_object_points, float, i, 0) = sl_params->cam_board_w_mm*float(j/sl_params->cam_board_w);
-					CV_MAT_ELEM(*cam_object_points, float, i, 1) = sl_params->cam_board_h_mm*float(j%sl_params->cam_board_w);
-					CV_MAT_ELEM(*cam_object_points, float, i, 2) = 0.0f;
 				}
-				CV_MAT_ELEM(*cam_point_counts, int, successes, 0) = cam_board_n;
 				cvCopyImage(cam_frame_1, cam_calibImages[successes]);
 
 				// Add projector calibration data.
@@ -668,44 +717,19 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 				//}
 				//CV_MAT_ELEM(*proj_point_counts, int, successes, 0) = proj_board_n;
 
-                // define projector points
-                for(int j=0; j<proj_board_n; ++j){
-                    CvMat* p_x = cvCreateMat(3, 1, CV_32FC1);
-                    CvMat* p_x_h = cvCreateMat(3, 1, CV_32FC1);
-
-                    CV_MAT_ELEM(*p_x, float, 0, 0) = CV_MAT_ELEM(*proj_points, float, j, 0);
-                    CV_MAT_ELEM(*p_x, float, 1, 0) = CV_MAT_ELEM(*proj_points, float, j, 1);
-                    CV_MAT_ELEM(*p_x, float, 2, 0) = 1.0;
-
-                    //printf("p_x: %f %f\n", CV_MAT_ELEM(*p_x, float, 0, 0), CV_MAT_ELEM(*p_x, float, 1, 0));
-
-                    cvMatMul(projToProjHomography, p_x, p_x_h);
-
-
-			        //		CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*i+j, 0) = 
-			        //			sl_params->proj_board_w_pixels*float(j%sl_params->proj_board_w) + (float)proj_border_cols + (float)sl_params->proj_board_w_pixels - (float)0.5;
-			        //		CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*i+j, 1) = 
-			        //			sl_params->proj_board_h_pixels*float(j/sl_params->proj_board_w) + (float)proj_border_rows + (float)sl_params->proj_board_h_pixels - (float)0.5;
-
-                    float p_x_h_x = CV_MAT_ELEM(*p_x_h, float, 0, 0) / CV_MAT_ELEM(*p_x_h, float, 2, 0);
-                    float p_x_h_y = CV_MAT_ELEM(*p_x_h, float, 1, 0) / CV_MAT_ELEM(*p_x_h, float, 2, 0);
-
-                    //printf("p_x_h: %f %f\n", p_x_h_x, p_x_h_y);
-
-                    CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*successes+j, 0) = p_x_h_x;
-                    CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*successes+j, 1) = p_x_h_y;
-
-                    cvReleaseMat(&p_x);
-                    cvReleaseMat(&p_x_h);
-			    }
+                // define projector points (projector pixels the chessboard corners were projected from)
+                applyHomography(proj_to_proj, proj_board_points,
+                    (CvPoint2D32f*)&CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*successes, 0), proj_board_n);
 				// Add projector calibration data.
 				for(int i=successes*proj_board_n, j=0; j<proj_board_n; ++i,++j){
 					CV_MAT_ELEM(*proj_image_points, float, i, 0) = proj_corners[j].x;
 					CV_MAT_ELEM(*proj_image_points, float, i, 1) = proj_corners[j].y;
 				}
-                CV_MAT_ELEM(*proj_point_counts, int, successes, 0) = proj_board_n;
 
 				cvCopyImage(cam_frame_2, proj_calibImages[successes]);
+				scorer.Accept(cam_corners);
+				guide.Accept(cam_corners, proj_corners,
+					(CvPoint2D32f*)&CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*successes, 0));
 
 				// Update display.
 				successes++;
@@ -714,40 +738,33 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 
                 successTimer = 0;
 
+				// Stop once the calibration is certain enough (otherwise, suggest the next pose).
+				if(guide.IsComplete()){
+					printf("Calibration uncertainty is %.3f%% (below %.3f%%); capture is complete.\n",
+						100.0*guide.GetUncertainty(), sl_params->guidance_stop_uncertainty);
+					break;
+				}
+				if(sl_params->guidance)
+					printf("%s\n", guide.GetSuggestion());
+
 				cvWaitKey(sl_params->delay);
 			}
 
-			// Free allocated resources.
-			delete[] proj_corners;
-
 			// Display red image for next camera capture frame.
-			cvSet(proj_frame, cvScalar(0.0, 0.0, 255.0));
-			cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-			cvShowImage("projWindow", proj_frame);  
+			cvShowImage("projWindow", patterns.Solid(cvScalar(0.0, 0.0, 255.0)));
 			cvKey_temp = cvWaitKey(sl_params->delay);
 			if(cvKey_temp != -1) 
 				cvKey = cvKey_temp;
 		}
 		else{
 			// Display red image for next camera capture frame.
-			cvSet(proj_frame, cvScalar(0.0, 0.0, 255.0));
-			cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-			cvShowImage("projWindow", proj_frame);
-
-         //   // determine projector-camera homography to project the projector checkerboard 
-         //   cvZero(proj_frame);
-         //   cvMerge(proj_chessboard, proj_chessboard, proj_chessboard, NULL, proj_frame);
-         //   cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-	        //cvShowImage("projWindow", proj_frame);
+			cvShowImage("projWindow", patterns.Solid(cvScalar(0.0, 0.0, 255.0)));
 
             cvKey_temp = cvWaitKey(sl_params->delay);
 			if(cvKey_temp != -1) 
 				cvKey = cvKey_temp;
 		}
 
-		// Free allocated resources.
-		delete[] cam_corners;
-
 		// Process user input.
         //printf("Press any key to capture\n");
         cvKey_temp = cvWaitKey(sl_params->delay);
@@ -764,6 +781,110 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	// Close the display window.
 	cvDestroyWindow("Camera Correspondences");
 
+	// Display capture loop throughput.
+	double capture_time = (cvGetTickCount()-capture_start)/(1000.0*cvGetTickFrequency());
+	printf("Capture loop: %d frames in %.1f s (%.2f frames/s).\n",
+		capture_frames, capture_time/1000.0, capture_frames/(capture_time > 0 ? capture_time/1000.0 : 1.0));
+	detector->DisplayStatistics();
+	if(sl_params->chessboard_tracking)
+		tracker.DisplayStatistics();
+	if(sl_params->board_scoring)
+		scorer.DisplayStatistics();
+	guide.DisplayStatistics();
+
+	// Calibrate projector (and camera) from the captured chessboard corners.
+	struct slCalibObservations observations;
+	observations.n_boards          = successes;
+	observations.cam_image_points  = cam_image_points;
+	observations.proj_image_points = proj_image_points;
+	observations.proj_pixel_points = proj_image_points2;
+	observations.cam_images        = cam_calibImages;
+	observations.proj_images       = proj_calibImages;
+	sprintf(str, "%s\\calib\\observations.xml", sl_params->outdir);
+	saveObservations(str, sl_params, &observations);
+	if(sl_params->board_outlier_rejection)
+		scorer.RejectOutliers(&observations);
+	if(solveProjectorCalibration(sl_params, sl_calib, &observations, calibrate_both) != 0)
+		return -1;
+
+	// Wait for the remaining images to be saved.
+	image_writer.Flush();
+	printf("Saved %d images (%d dropped, %d failed, maximum queue depth %d).\n",
+		image_writer.GetWrittenCount(), image_writer.GetDroppedCount(),
+		image_writer.GetFailedCount(), image_writer.GetMaxQueueDepth());
+
+	// Free allocated resources.
+	cvReleaseMat(&proj_points);
+	cvReleaseMat(&cam_image_points);
+	cvReleaseMat(&proj_image_points);
+	cvReleaseMat(&proj_image_points2);
+	cvReleaseImage(&proj_chessboard);
+	cvReleaseImage(&cam_frame_1);
+	cvReleaseImage(&cam_board_frame);
+	cvReleaseImage(&cam_frame_2);
+	cvReleaseImage(&cam_frame_3);
+	cvReleaseImage(&proj_warp);
+	cvReleaseImage(&cam_frame_1_gray);
+	cvReleaseImage(&cam_frame_2_gray);
+    cvReleaseImage(&cam_frame_red);
+    cvReleaseMat(&camToProjHomography);
+    cvReleaseMat(&projToProjHomography);
+	cvReleaseImage(&cam_frame_BGR);
+	cvReleaseImage(&cam_frame_view);
+	delete[] cam_corners;
+	delete[] proj_corners;
+	for(int i=0; i<n_boards; i++){
+		cvReleaseImage(&cam_calibImages[i]);
+		cvReleaseImage(&proj_calibImages[i]);
+	}
+	delete[] cam_calibImages;
+	delete[] proj_calibImages;
+
+	// Return without errors.
+	if(calibrate_both){
+		printf("Projector-camera calibration was successful.\n");
+		displayCamCalib(sl_calib);
+	}
+	else
+		printf("Projector calibration was successful.\n");
+	displayProjCalib(sl_calib);
+	return 0;
+}
+
+// Solve for the projector (and camera) calibration from captured chessboard corners.
+// Note: Writes the calibration parameters and images to the "calib" output directories, which must exist.
+int CalibrateProCam::solveProjectorCalibration(struct slParams* sl_params,
+                                               struct slCalib* sl_calib,
+                                               struct slCalibObservations* obs,
+                                               bool calibrate_both,
+                                               struct slCalibResult* result){
+
+	// Evaluate derived chessboard parameters.
+	char str[1024], calibDir[1024];
+	int successes               = obs->n_boards;
+	int cam_board_n             = sl_params->cam_board_w*sl_params->cam_board_h;
+	int proj_board_n            = sl_params->proj_board_w*sl_params->proj_board_h;
+	CvMat* cam_image_points     = obs->cam_image_points;
+	CvMat* proj_image_points    = obs->proj_image_points;
+	IplImage** cam_calibImages  = obs->cam_images;
+	IplImage** proj_calibImages = obs->proj_images;
+	sprintf(calibDir, "%s\\calib\\proj", sl_params->outdir);
+	if(result != NULL){
+		result->cam_error       = 0;
+		result->proj_error      = 0;
+		result->cam_initial_error  = 0;
+		result->proj_initial_error = 0;
+		result->cam_solve_time    = 0;
+		result->proj_solve_time   = 0;
+		result->bundle_solve_time = 0;
+		result->bundle_iterations = 0;
+		result->max_depth_error   = 0;
+		result->mean_depth_error  = 0;
+	}
+
+	// Save calibration images in the background.
+	AsyncImageWriter image_writer(sl_params->image_queue_size, sl_params->image_writer_threads, false);
+
 	// Calibrate projector, if minimum number of frames are available.
 	if(successes >= 2){
 		
@@ -774,21 +895,26 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	    CvMat* cam_rotation_vectors     = cvCreateMat(successes, 3, CV_32FC1);
   	    CvMat* cam_translation_vectors  = cvCreateMat(successes, 3, CV_32FC1);
 		CvMat* proj_object_points2      = cvCreateMat(successes*proj_board_n, 3, CV_32FC1);
-		//CvMat* proj_image_points2       = cvCreateMat(successes*proj_board_n, 2, CV_32FC1);
+		CvMat* proj_image_points2       = cvCreateMat(successes*proj_board_n, 2, CV_32FC1);
 		CvMat* proj_point_counts2       = cvCreateMat(successes, 1, CV_32SC1);
 	    CvMat* proj_rotation_vectors    = cvCreateMat(successes, 3, CV_32FC1);
   	    CvMat* proj_translation_vectors = cvCreateMat(successes, 3, CV_32FC1);
+		for(int i=0; i<successes*proj_board_n; ++i){
+			CV_MAT_ELEM(*proj_image_points2, float, i, 0) = CV_MAT_ELEM(*obs->proj_pixel_points, float, i, 0);
+			CV_MAT_ELEM(*proj_image_points2, float, i, 1) = CV_MAT_ELEM(*obs->proj_pixel_points, float, i, 1);
+		}
 
 		// Transfer camera calibration data from captured values.
 		for(int i=0; i<successes*cam_board_n; ++i){
+			int j = i%cam_board_n;
 			CV_MAT_ELEM(*cam_image_points2,  float, i, 0) = CV_MAT_ELEM(*cam_image_points,  float, i, 0);
 			CV_MAT_ELEM(*cam_image_points2,  float, i, 1) = CV_MAT_ELEM(*cam_image_points,  float, i, 1);
-			CV_MAT_ELEM(*cam_object_points2, float, i, 0) =	CV_MAT_ELEM(*cam_object_points, float, i, 0);
-			CV_MAT_ELEM(*cam_object_points2, float, i, 1) =	CV_MAT_ELEM(*cam_object_points, float, i, 1);
-			CV_MAT_ELEM(*cam_object_points2, float, i, 2) = CV_MAT_ELEM(*cam_object_points, float, i, 2);
+			CV_MAT_ELEM(*cam_object_points2, float, i, 0) = sl_params->cam_board_w_mm*float(j/sl_params->cam_board_w);
+			CV_MAT_ELEM(*cam_object_points2, float, i, 1) = sl_params->cam_board_h_mm*float(j%sl_params->cam_board_w);
+			CV_MAT_ELEM(*cam_object_points2, float, i, 2) = 0.0f;
 		}
 		for(int i=0; i<successes; ++i)
-			CV_MAT_ELEM(*cam_point_counts2, int, i, 0) = CV_MAT_ELEM(*cam_point_counts, int, i, 0);
+			CV_MAT_ELEM(*cam_point_counts2, int, i, 0) = cam_board_n;
 
 		// Calibrate the camera and save calibration parameters (if camera calibration is enabled).
 		if(calibrate_both){
@@ -800,10 +926,16 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 				cvmSet(sl_calib->cam_distortion, 4, 0, 0);
 				calib_flags |= CV_CALIB_FIX_K3;
 			}
+			int64 t0 = cvGetTickCount();
 			double camCalibrationError = cvCalibrateCamera2(cam_object_points2, cam_image_points2, cam_point_counts2, 
 				cvSize(sl_params->cam_w, sl_params->cam_h), 
 				sl_calib->cam_intrinsic, sl_calib->cam_distortion,
 				cam_rotation_vectors, cam_translation_vectors, calib_flags);
+			if(result != NULL){
+				result->cam_error         = camCalibrationError;
+				result->cam_initial_error = camCalibrationError;
+				result->cam_solve_time = (cvGetTickCount()-t0)/(1000.0*cvGetTickFrequency());
+			}
             printf("***Camera Calibration succeeded with error: %f\n", camCalibrationError);
 
             CvMat* camCalibrationErrorMat = cvCreateMat(1, 1, CV_32FC1);
@@ -815,13 +947,12 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 			printf("Saving calibration images and parameters...\n");
 			sprintf(calibDir, "%s\\calib\\cam", sl_params->outdir);
 			CvMat* r = cvCreateMat(1, 3, CV_32FC1);
-			for(int i=0; i<successes; ++i){
+			for(int i=0; i<successes && cam_calibImages != NULL; ++i){
 				sprintf(str,"%s\\%0.2d.png", calibDir, i);
-				cvSaveImage(str, cam_calibImages[i]);
+				image_writer.Save(str, cam_calibImages[i], true);
 			}
-			cvGetRow(cam_rotation_vectors, sl_calib->cam_rot_vec, successes-1);
-            cvGetRow(cam_translation_vectors, sl_calib->cam_trans, successes-1);
-			cvRodrigues2(sl_calib->cam_rot_vec, sl_calib->cam_rot_mat, NULL);
+			copyBoardPose(cam_rotation_vectors, cam_translation_vectors, successes-1,
+				sl_calib->cam_rot_vec, sl_calib->cam_rot_mat, sl_calib->cam_trans);
 
             sprintf(str,"%s\\cam_object_points2.xml", calibDir);	
 			cvSave(str, cam_object_points2);
@@ -839,95 +970,24 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 			sl_calib->cam_intrinsic_calib = true;
 		}
 
-		// Transfer projector calibration data from captured values.
-		for(int i=0; i<successes; ++i){
- 
-			//// Define image points corresponding to projector chessboard (i.e., considering projector as an inverse camera).
-			//if(!sl_params->proj_invert){
-			//	for(int j=0; j<proj_board_n; ++j){
-			//		CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*i+j, 0) = 
-			//			sl_params->proj_board_w_pixels*float(j%sl_params->proj_board_w) + (float)proj_border_cols + (float)sl_params->proj_board_w_pixels - (float)0.5;
-			//		CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*i+j, 1) = 
-			//			sl_params->proj_board_h_pixels*float(j/sl_params->proj_board_w) + (float)proj_border_rows + (float)sl_params->proj_board_h_pixels - (float)0.5;
-			//	}
-			//}
-			//else{
-			//	for(int j=0; j<proj_board_n; ++j){
-			//		CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*i+j, 0) = 
-			//			sl_params->proj_board_w_pixels*float((proj_board_n-j-1)%sl_params->proj_board_w) + (float)proj_border_cols + (float)sl_params->proj_board_w_pixels - (float)0.5;
-			//		CV_MAT_ELEM(*proj_image_points2, float, proj_board_n*i+j, 1) = 
-			//			sl_params->proj_board_h_pixels*float((proj_board_n-j-1)/sl_params->proj_board_w) + (float)proj_border_rows + (float)sl_params->proj_board_h_pixels - (float)0.5;
-			//	}
-			//}
-
-            //printMatrix(proj_image_points2, "proj_image_points2");
-
-			// Evaluate undistorted image pixels for both the camera and the projector chessboard corners.
-			CvMat* cam_dist_image_points    = cvCreateMat(cam_board_n,  1, CV_32FC2);
-			CvMat* cam_undist_image_points  = cvCreateMat(cam_board_n,  1, CV_32FC2);
-			CvMat* proj_dist_image_points   = cvCreateMat(proj_board_n, 1, CV_32FC2);
-			CvMat* proj_undist_image_points = cvCreateMat(proj_board_n, 1, CV_32FC2);
-			for(int j=0; j<cam_board_n; ++j)
-				cvSet1D(cam_dist_image_points, j, 
-					cvScalar(CV_MAT_ELEM(*cam_image_points, float, cam_board_n*i+j, 0), 
-					         CV_MAT_ELEM(*cam_image_points, float, cam_board_n*i+j, 1)));
-			for(int j=0; j<proj_board_n; ++j)
-				cvSet1D(proj_dist_image_points, j, 
-					cvScalar(CV_MAT_ELEM(*proj_image_points, float, proj_board_n*i+j, 0), 
-					         CV_MAT_ELEM(*proj_image_points, float, proj_board_n*i+j, 1)));
-			cvUndistortPoints(cam_dist_image_points, cam_undist_image_points, 
-				sl_calib->cam_intrinsic, sl_calib->cam_distortion, NULL, NULL);
-			cvUndistortPoints(proj_dist_image_points, proj_undist_image_points, 
-				sl_calib->cam_intrinsic, sl_calib->cam_distortion, NULL, NULL);
-			cvReleaseMat(&cam_dist_image_points);
-			cvReleaseMat(&proj_dist_image_points);
-
-            //for(int i = 0; i < cam_board_n; i++)
-            //{
-            //    printf("cam_undist_image_points[%i] = %f, %f\n", i, cvGet2D(cam_undist_image_points, i, 0).val[0], cvGet2D(cam_undist_image_points, i, 0).val[1]);
-            //}
-
-			// Estimate homography that maps undistorted image pixels to positions on the chessboard.
-			CvMat* homography = cvCreateMat(3, 3, CV_32FC1);
-			CvMat* cam_src    = cvCreateMat(cam_board_n, 3, CV_32FC1);
-			CvMat* cam_dst    = cvCreateMat(cam_board_n, 3, CV_32FC1);
-			for(int j=0; j<cam_board_n; ++j){
-				CvScalar pd = cvGet1D(cam_undist_image_points, j);
-				CV_MAT_ELEM(*cam_src, float, j, 0) = (float)pd.val[0];
-				CV_MAT_ELEM(*cam_src, float, j, 1) = (float)pd.val[1];
-				CV_MAT_ELEM(*cam_src, float, j, 2) = 1.0;
-				CV_MAT_ELEM(*cam_dst, float, j, 0) = CV_MAT_ELEM(*cam_object_points, float, cam_board_n*i+j, 0);
-				CV_MAT_ELEM(*cam_dst, float, j, 1) = CV_MAT_ELEM(*cam_object_points, float, cam_board_n*i+j, 1);
-				CV_MAT_ELEM(*cam_dst, float, j, 2) = 1.0;
-			}
-			cvReleaseMat(&cam_undist_image_points);
-			cvFindHomography(cam_src, cam_dst, homography);
-			cvReleaseMat(&cam_src);
-			cvReleaseMat(&cam_dst);
-
-			// Map undistorted projector image corners to positions on the chessboard plane.
-			CvMat* proj_src = cvCreateMat(proj_board_n, 1, CV_32FC2);
-			CvMat* proj_dst = cvCreateMat(proj_board_n, 1, CV_32FC2);
-			for(int j=0; j<proj_board_n; j++)
-				cvSet1D(proj_src, j, cvGet1D(proj_undist_image_points, j));
-			cvReleaseMat(&proj_undist_image_points);
-			cvPerspectiveTransform(proj_src, proj_dst, homography);
-			cvReleaseMat(&homography);
-			cvReleaseMat(&proj_src);
-			
-			// Define object points corresponding to projector chessboard.
-			for(int j=0; j<proj_board_n; j++){
-				CvScalar pd = cvGet1D(proj_dst, j);
-				CV_MAT_ELEM(*proj_object_points2, float, proj_board_n*i+j, 0) = (float)pd.val[0];
-				CV_MAT_ELEM(*proj_object_points2, float, proj_board_n*i+j, 1) = (float)pd.val[1];
-				CV_MAT_ELEM(*proj_object_points2, float, proj_board_n*i+j, 2) = 0.0f;
+		// Find the camera pose of each board (if the camera was calibrated before).
+		if(!calibrate_both){
+			for(int i=0; i<successes; ++i){
+				CvMat object_points, image_points, rotation_vector, translation_vector;
+				cvGetRows(cam_object_points2, &object_points, cam_board_n*i, cam_board_n*(i+1));
+				cvGetRows(cam_image_points2,  &image_points,  cam_board_n*i, cam_board_n*(i+1));
+				cvGetRow(cam_rotation_vectors,    &rotation_vector,    i);
+				cvGetRow(cam_translation_vectors, &translation_vector, i);
+				cvFindExtrinsicCameraParams2(&object_points, &image_points,
+					sl_calib->cam_intrinsic, sl_calib->cam_distortion, &rotation_vector, &translation_vector);
 			}
-			cvReleaseMat(&proj_dst); 
-
-            //printMatrix(proj_object_points2, "proj_object_points2");
 		}
+
+		// Transfer projector calibration data from captured values.
+		evaluateProjectorObjectPoints(sl_params, sl_calib->cam_intrinsic, sl_calib->cam_distortion,
+			cam_image_points, proj_image_points, successes, proj_object_points2);
 		for(int i=0; i<successes; ++i)
-			CV_MAT_ELEM(*proj_point_counts2, int, i, 0) = CV_MAT_ELEM(*proj_point_counts, int, i, 0);
+			CV_MAT_ELEM(*proj_point_counts2, int, i, 0) = proj_board_n;
 
 		// Calibrate the projector and save calibration parameters (if camera calibration is enabled).
 		printf("Calibrating projector...\n");
@@ -938,11 +998,71 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 			cvmSet(sl_calib->proj_distortion, 4, 0, 0);
 			calib_flags |= CV_CALIB_FIX_K3;
 		}
+		int64 t0 = cvGetTickCount();
 		double projCalibrationError = cvCalibrateCamera2(
 			proj_object_points2, proj_image_points2, proj_point_counts2, 
 			cvSize(sl_params->proj_w, sl_params->proj_h), 
 			sl_calib->proj_intrinsic, sl_calib->proj_distortion,
 			proj_rotation_vectors, proj_translation_vectors, calib_flags);
+		if(result != NULL){
+			result->proj_error         = projCalibrationError;
+			result->proj_initial_error = projCalibrationError;
+			result->proj_solve_time = (cvGetTickCount()-t0)/(1000.0*cvGetTickFrequency());
+		}
+
+		// Refine the camera and projector calibration jointly (the board poses are shared by both devices).
+		if(sl_params->bundle_adjustment){
+			printf("Refining projector-camera calibration (bundle adjustment)...\n");
+			ProCamBundleAdjuster adjuster(sl_params, calibrate_both);
+			if(adjuster.Initialize(obs,
+				sl_calib->cam_intrinsic,  sl_calib->cam_distortion,  cam_rotation_vectors,  cam_translation_vectors,
+				sl_calib->proj_intrinsic, sl_calib->proj_distortion, proj_rotation_vectors, proj_translation_vectors) == 0 &&
+			   adjuster.Solve(sl_params->bundle_iterations) == 0){
+				struct slBundleResult* bundle = adjuster.GetResult();
+				adjuster.GetProjector(sl_calib->proj_intrinsic, sl_calib->proj_distortion);
+				adjuster.GetBoardPoses(cam_rotation_vectors, cam_translation_vectors, proj_rotation_vectors, proj_translation_vectors);
+				projCalibrationError = bundle->proj_error;
+				printf("Bundle adjustment: %d iterations (%.1f ms each, %d threads), camera error %f -> %f, projector error %f -> %f.\n",
+					bundle->iterations, bundle->iteration_time, bundle->threads,
+					bundle->initial_cam_error, bundle->cam_error, bundle->initial_proj_error, bundle->proj_error);
+				if(result != NULL){
+					result->proj_error        = bundle->proj_error;
+					result->bundle_solve_time = bundle->time;
+					result->bundle_iterations = bundle->iterations;
+				}
+
+				// Save the refined camera calibration (if camera calibration is enabled).
+				if(calibrate_both){
+					char camDir[1024];
+					sprintf(camDir, "%s\\calib\\cam", sl_params->outdir);
+					adjuster.GetCamera(sl_calib->cam_intrinsic, sl_calib->cam_distortion);
+					copyBoardPose(cam_rotation_vectors, cam_translation_vectors, successes-1,
+						sl_calib->cam_rot_vec, sl_calib->cam_rot_mat, sl_calib->cam_trans);
+					if(result != NULL)
+						result->cam_error = bundle->cam_error;
+					CvMat* camCalibrationErrorMat = cvCreateMat(1, 1, CV_32FC1);
+					camCalibrationErrorMat->data.fl[0] = (float)bundle->cam_error;
+					sprintf(str, "%s\\calib\\proj\\calibrationError.xml", sl_params->outdir);
+					cvSave(str, camCalibrationErrorMat);
+					cvReleaseMat(&camCalibrationErrorMat);
+					sprintf(str,"%s\\cam_intrinsic.xml", camDir);
+					cvSave(str, sl_calib->cam_intrinsic);
+					sprintf(str,"%s\\cam_distortion.xml", camDir);
+					cvSave(str, sl_calib->cam_distortion);
+					sprintf(str,"%s\\cam_rotation_vectors.xml", camDir);
+					cvSave(str, sl_calib->cam_rot_vec);
+					sprintf(str,"%s\\cam_translation_vectors.xml", camDir);
+					cvSave(str, sl_calib->cam_trans);
+				}
+			}
+			else
+				printf("Bundle adjustment failed; keeping the separate calibrations.\n");
+		}
+
+		// Estimate the uncertainty of the final calibration.
+		if(sl_params->estimate_uncertainty)
+			estimateUncertainty(sl_params, sl_calib, obs, calibrate_both,
+				cam_rotation_vectors, cam_translation_vectors, proj_rotation_vectors, proj_translation_vectors, result);
 
         // Create projector extrinsics with the camera as the origin
         //  instead of the final calibration target as the origin
@@ -959,16 +1079,18 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 		printf("Saving calibration images and parameters...\n");
 		sprintf(calibDir, "%s\\calib\\proj", sl_params->outdir);
 		CvMat* r = cvCreateMat(1, 3, CV_32FC1);
-		for(int i=0; i<successes; ++i){
+		for(int i=0; i<successes && proj_calibImages != NULL && cam_calibImages != NULL; ++i){
 			sprintf(str,"%s\\%0.2d.png", calibDir, i);
-			cvSaveImage(str, proj_calibImages[i]);
+			image_writer.Save(str, proj_calibImages[i], true);
 			sprintf(str,"%s\\%0.2db.png", calibDir, i);
-			cvSaveImage(str, cam_calibImages[i]);
+			image_writer.Save(str, cam_calibImages[i], true);
 			//cvSave(str, R);
 		}
-		cvGetRow(proj_rotation_vectors, sl_calib->proj_rot_vec, successes-1);
-		cvGetRow(proj_translation_vectors, sl_calib->proj_trans, successes-1);
-		cvRodrigues2(sl_calib->proj_rot_vec, sl_calib->proj_rot_mat, NULL);
+		copyBoardPose(proj_rotation_vectors, proj_translation_vectors, successes-1,
+			sl_calib->proj_rot_vec, sl_calib->proj_rot_mat, sl_calib->proj_trans);
+		if(!calibrate_both)
+			copyBoardPose(cam_rotation_vectors, cam_translation_vectors, successes-1,
+				sl_calib->cam_rot_vec, sl_calib->cam_rot_mat, sl_calib->cam_trans);
 
         sprintf(str,"%s\\proj_intrinsic.xml", calibDir);	
 		cvSave(str, sl_calib->proj_intrinsic);
@@ -1017,33 +1139,10 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 
 		// Save extrinsic calibration of projector-camera system.
 		// Note: First calibration image is used to define extrinsic calibration.
-		CvMat* cam_object_points_00      = cvCreateMat(cam_board_n, 3, CV_32FC1);
-		CvMat* cam_image_points_00       = cvCreateMat(cam_board_n, 2, CV_32FC1);
-		CvMat* cam_rotation_vector_00    = cvCreateMat(1, 3, CV_32FC1);
-  	    CvMat* cam_translation_vector_00 = cvCreateMat(1, 3, CV_32FC1);
-		if(!calibrate_both){
-			for(int i=0; i<cam_board_n; ++i){
-				CV_MAT_ELEM(*cam_image_points_00,  float, i, 0) = CV_MAT_ELEM(*cam_image_points2,  float, i, 0);
-				CV_MAT_ELEM(*cam_image_points_00,  float, i, 1) = CV_MAT_ELEM(*cam_image_points2,  float, i, 1);
-				CV_MAT_ELEM(*cam_object_points_00, float, i, 0) = CV_MAT_ELEM(*cam_object_points2, float, i, 0);
-				CV_MAT_ELEM(*cam_object_points_00, float, i, 1) = CV_MAT_ELEM(*cam_object_points2, float, i, 1);
-				CV_MAT_ELEM(*cam_object_points_00, float, i, 2) = CV_MAT_ELEM(*cam_object_points2, float, i, 2);
-			}
-			cvFindExtrinsicCameraParams2(
-				cam_object_points_00, cam_image_points_00, 
-				sl_calib->cam_intrinsic, sl_calib->cam_distortion,
-				cam_rotation_vector_00, cam_translation_vector_00);
-			for(int i=0; i<3; i++)
-				CV_MAT_ELEM(*sl_calib->cam_extrinsic, float, 0, i) = (float)cvmGet(cam_rotation_vector_00, 0, i);
-			for(int i=0; i<3; i++)
-				CV_MAT_ELEM(*sl_calib->cam_extrinsic, float, 1, i) = (float)cvmGet(cam_translation_vector_00, 0, i);
-		}
-		else{
-			for(int i=0; i<3; i++)
-				CV_MAT_ELEM(*sl_calib->cam_extrinsic, float, 0, i) = (float)cvmGet(cam_rotation_vectors, 0, i);
-			for(int i=0; i<3; i++)
-				CV_MAT_ELEM(*sl_calib->cam_extrinsic, float, 1, i) = (float)cvmGet(cam_translation_vectors, 0, i);
-		}
+		for(int i=0; i<3; i++)
+			CV_MAT_ELEM(*sl_calib->cam_extrinsic, float, 0, i) = (float)cvmGet(cam_rotation_vectors, 0, i);
+		for(int i=0; i<3; i++)
+			CV_MAT_ELEM(*sl_calib->cam_extrinsic, float, 1, i) = (float)cvmGet(cam_translation_vectors, 0, i);
 		sprintf(str, "%s\\cam_extrinsic.xml", calibDir);
 		cvSave(str, sl_calib->cam_extrinsic);
 		//sprintf(str, "%s\\fundamental_matrix.xml", calibDir);
@@ -1126,13 +1225,13 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
         proj_ext_mat.at<float>(3,1) = 0;
         proj_ext_mat.at<float>(3,2) = 0;
         proj_ext_mat.at<float>(3,3) = 1;
-        PrintMatrix("cam_ext_mat", proj_ext_mat);
+        PrintMatrix("proj_ext_mat", proj_ext_mat);
         //proj_ext_mat( Range(0,2), Range(0,2) ) = proj_rot_mat2( Range::all(), Range::all() );
         //proj_ext_mat( Range(0,0), Range(0,2) ) = proj_trans2( Range::all(), Range(0,0) );
         //proj_ext_mat.at<float>(3,3) = 1;
         
-        Mat proj_ext_mat_new(4, 4, CV_32F);
-        multiply(proj_ext_mat, cam_ext_mat_inv, proj_ext_mat_new);
+        // Camera-to-projector transform (board to projector, after camera to board).
+        Mat proj_ext_mat_new = proj_ext_mat*cam_ext_mat_inv;
         PrintMatrix("proj_ext_mat_new", proj_ext_mat_new);
         
 		sprintf(str, "%s\\proj_extrinsic_4x4.xml", calibDir);
@@ -1143,21 +1242,21 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
         Mat proj_rot_mat_new(3, 3, CV_32F);
         proj_rot_mat_new = proj_ext_mat_new( Range(0,3), Range(0,3) );
         
-        // create the rotation vectors
-        Mat proj_rot_vec_new(1, 3, CV_32F);
+        // create the rotation vectors (3x1)
+        Mat proj_rot_vec_new(3, 1, CV_32F);
         Rodrigues(proj_rot_mat_new, proj_rot_vec_new);
 
-        // create the new translation vectors
+        // create the new translation vectors (3x1)
         Mat proj_trans_new(3, 1, CV_32F);
         proj_trans_new = proj_ext_mat_new( Range(0,3), Range(3,4) );
 
         Mat proj_ext_mat_orig_format(2, 3, CV_32F);
         proj_ext_mat_orig_format.at<float>(0,0) = proj_rot_vec_new.at<float>(0,0);
-        proj_ext_mat_orig_format.at<float>(0,1) = proj_rot_vec_new.at<float>(0,1);
-        proj_ext_mat_orig_format.at<float>(0,2) = proj_rot_vec_new.at<float>(0,2);
+        proj_ext_mat_orig_format.at<float>(0,1) = proj_rot_vec_new.at<float>(1,0);
+        proj_ext_mat_orig_format.at<float>(0,2) = proj_rot_vec_new.at<float>(2,0);
         proj_ext_mat_orig_format.at<float>(1,0) = proj_trans_new.at<float>(0,0);
-        proj_ext_mat_orig_format.at<float>(1,1) = proj_trans_new.at<float>(0,1);
-        proj_ext_mat_orig_format.at<float>(1,2) = proj_trans_new.at<float>(0,2);
+        proj_ext_mat_orig_format.at<float>(1,1) = proj_trans_new.at<float>(1,0);
+        proj_ext_mat_orig_format.at<float>(1,2) = proj_trans_new.at<float>(2,0);
         //proj_ext_mat_orig_format( Range(0,0), Range(0,2) ) = proj_rot_vec_new;
         //proj_ext_mat_orig_format( Range(1,1), Range(0,2) ) = proj_trans_new;
 
@@ -1178,10 +1277,6 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
   	    cvReleaseMat(&proj_translation_vectors);
 		//cvReleaseMat(&R);
 		cvReleaseMat(&r);
-		cvReleaseMat(&cam_object_points_00);
-		cvReleaseMat(&cam_image_points_00);
-		cvReleaseMat(&cam_rotation_vector_00);
-  	    cvReleaseMat(&cam_translation_vector_00);
 	}
 	else{
 		printf("ERROR: At least two detected chessboards are required!\n");
@@ -1197,39 +1292,164 @@ int CalibrateProCam::runProjectorCalibration(struct slParams* sl_params,
 	sl_calib->procam_extrinsic_calib = true;
 
 	// Evaluate projector-camera geometry.
-	//evaluateProCamGeometry(sl_params, sl_calib);
+	evaluateProCamGeometry(sl_params, sl_calib);
+
+	// Return without errors.
+	return 0;
+}
+
+// Evaluate the positions of the projected chessboard corners on the printed chessboard plane.
+// Note: Corners of board i occupy rows [i*board_n, (i+1)*board_n) of the point matrices.
+void CalibrateProCam::evaluateProjectorObjectPoints(struct slParams* sl_params,
+                                                   CvMat* cam_intrinsic, CvMat* cam_distortion,
+                                                   CvMat* cam_image_points, CvMat* proj_image_points,
+                                                   int n_boards, CvMat* proj_object_points){
+
+	// Evaluate derived chessboard parameters.
+	int cam_board_n  = sl_params->cam_board_w*sl_params->cam_board_h;
+	int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+
+	// Allocate temporary storage, and define the chessboard positions of the camera chessboard corners.
+	CvMat* cam_undist_image_points  = cvCreateMat(cam_board_n,  1, CV_32FC2);
+	CvMat* proj_undist_image_points = cvCreateMat(proj_board_n, 1, CV_32FC2);
+	CvPoint2D32f* cam_board_points  = new CvPoint2D32f[cam_board_n];
+	CvPoint2D32f* proj_board_points = new CvPoint2D32f[proj_board_n];
+	for(int j=0; j<cam_board_n; ++j){
+		cam_board_points[j].x = sl_params->cam_board_w_mm*float(j/sl_params->cam_board_w);
+		cam_board_points[j].y = sl_params->cam_board_h_mm*float(j%sl_params->cam_board_w);
+	}
+	double homography[9];
+	for(int i=0; i<n_boards; ++i){
+
+		// Evaluate undistorted image pixels for both the camera and the projector chessboard corners.
+		CvMat cam_dist_image_points  = cvMat(cam_board_n,  1, CV_32FC2, &CV_MAT_ELEM(*cam_image_points,  float, cam_board_n*i,  0));
+		CvMat proj_dist_image_points = cvMat(proj_board_n, 1, CV_32FC2, &CV_MAT_ELEM(*proj_image_points, float, proj_board_n*i, 0));
+		cvUndistortPoints(&cam_dist_image_points, cam_undist_image_points, 
+			cam_intrinsic, cam_distortion, NULL, NULL);
+		cvUndistortPoints(&proj_dist_image_points, proj_undist_image_points, 
+			cam_intrinsic, cam_distortion, NULL, NULL);
+
+		// Estimate homography that maps undistorted image pixels to positions on the chessboard.
+		// Note: If the corners are degenerate, the projector corners are placed at the origin.
+		if(!estimateHomography((CvPoint2D32f*)cam_undist_image_points->data.fl, cam_board_points, cam_board_n, homography)){
+			for(int k=0; k<9; k++)
+				homography[k] = 0;
+			homography[8] = 1;
+		}
+
+		// Map undistorted projector image corners to positions on the chessboard plane.
+		applyHomography(homography, (CvPoint2D32f*)proj_undist_image_points->data.fl, proj_board_points, proj_board_n);
+		
+		// Define object points corresponding to projector chessboard.
+		for(int j=0; j<proj_board_n; j++){
+			CV_MAT_ELEM(*proj_object_points, float, proj_board_n*i+j, 0) = proj_board_points[j].x;
+			CV_MAT_ELEM(*proj_object_points, float, proj_board_n*i+j, 1) = proj_board_points[j].y;
+			CV_MAT_ELEM(*proj_object_points, float, proj_board_n*i+j, 2) = 0.0f;
+		}
+	}
 
 	// Free allocated resources.
-	cvReleaseMat(&proj_points);
-	cvReleaseMat(&cam_image_points);
-    cvReleaseMat(&cam_object_points);
-    cvReleaseMat(&cam_point_counts);
-	cvReleaseMat(&proj_image_points);
-    cvReleaseMat(&proj_point_counts);
-	cvReleaseImage(&proj_chessboard);
-	cvReleaseImage(&cam_frame_1);
-	cvReleaseImage(&cam_frame_2);
-	cvReleaseImage(&cam_frame_3);
-	cvReleaseImage(&proj_frame);
-    cvReleaseImage(&proj_fram_gray);
-	cvReleaseImage(&cam_frame_1_gray);
-	cvReleaseImage(&cam_frame_2_gray);
-    cvReleaseImage(&cam_frame_red);
-    cvReleaseMat(&projToCamHomography);
-	for(int i=0; i<n_boards; i++){
-		cvReleaseImage(&cam_calibImages[i]);
-		cvReleaseImage(&proj_calibImages[i]);
+	cvReleaseMat(&cam_undist_image_points);
+	cvReleaseMat(&proj_undist_image_points);
+	delete[] cam_board_points;
+	delete[] proj_board_points;
+}
+
+// Save chessboard observations (and the board and image sizes they were captured with).
+int CalibrateProCam::saveObservations(const char* filename, struct slParams* sl_params, struct slCalibObservations* obs){
+
+	// Open file storage for XML-formatted observations.
+	CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_WRITE);
+	if(fs == NULL){
+		printf("ERROR: Cannot save calibration observations \"%s\"!\n", filename);
+		return -1;
 	}
-	delete[] cam_calibImages;
-	delete[] proj_calibImages;
 
-	// Return without errors.
-	if(calibrate_both){
-		printf("Projector-camera calibration was successful.\n");
-		displayCamCalib(sl_calib);
+	// Write chessboard parameters.
+	int cam_board_n  = sl_params->cam_board_w*sl_params->cam_board_h;
+	int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+	cvStartWriteStruct(fs, "observations", CV_NODE_MAP);
+		cvWriteInt(fs,  "number_of_boards",                   obs->n_boards);
+		cvWriteInt(fs,  "camera_width_pixels",                sl_params->cam_w);
+		cvWriteInt(fs,  "camera_height_pixels",               sl_params->cam_h);
+		cvWriteInt(fs,  "projector_width_pixels",             sl_params->proj_w);
+		cvWriteInt(fs,  "projector_height_pixels",            sl_params->proj_h);
+		cvWriteInt(fs,  "camera_interior_horizontal_corners", sl_params->cam_board_w);
+		cvWriteInt(fs,  "camera_interior_vertical_corners",   sl_params->cam_board_h);
+		cvWriteReal(fs, "camera_square_width_mm",             sl_params->cam_board_w_mm);
+		cvWriteReal(fs, "camera_square_height_mm",            sl_params->cam_board_h_mm);
+		cvWriteInt(fs,  "projector_interior_horizontal_corners", sl_params->proj_board_w);
+		cvWriteInt(fs,  "projector_interior_vertical_corners",   sl_params->proj_board_h);
+	cvEndWriteStruct(fs);
+
+	// Write chessboard corners of the observed boards.
+	if(obs->n_boards > 0){
+		CvMat rows;
+		cvGetRows(obs->cam_image_points,  &rows, 0, obs->n_boards*cam_board_n);
+		cvWrite(fs, "cam_image_points",  &rows);
+		cvGetRows(obs->proj_image_points, &rows, 0, obs->n_boards*proj_board_n);
+		cvWrite(fs, "proj_image_points", &rows);
+		cvGetRows(obs->proj_pixel_points, &rows, 0, obs->n_boards*proj_board_n);
+		cvWrite(fs, "proj_pixel_points", &rows);
+	}
+	cvReleaseFileStorage(&fs);
+	return 0;
+}
+
+// Load chessboard observations saved by saveObservations (without calibration images).
+// Note: The observations must have been captured with the chessboards and image sizes in sl_params.
+int CalibrateProCam::loadObservations(const char* filename, struct slParams* sl_params, struct slCalibObservations* obs){
+
+	// Open file storage for XML-formatted observations.
+	memset(obs, 0, sizeof(*obs));
+	CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_READ);
+	if(fs == NULL){
+		printf("ERROR: Cannot open calibration observations \"%s\"!\n", filename);
+		return -1;
+	}
+
+	// Check chessboard parameters.
+	CvFileNode* m = cvGetFileNodeByName(fs, 0, "observations");
+	int n_boards = cvReadIntByName(fs, m, "number_of_boards", 0);
+	bool match =
+		m != NULL &&
+		cvReadIntByName(fs, m, "camera_width_pixels",                   0) == sl_params->cam_w        &&
+		cvReadIntByName(fs, m, "camera_height_pixels",                  0) == sl_params->cam_h        &&
+		cvReadIntByName(fs, m, "projector_width_pixels",                0) == sl_params->proj_w       &&
+		cvReadIntByName(fs, m, "projector_height_pixels",               0) == sl_params->proj_h       &&
+		cvReadIntByName(fs, m, "camera_interior_horizontal_corners",    0) == sl_params->cam_board_w  &&
+		cvReadIntByName(fs, m, "camera_interior_vertical_corners",      0) == sl_params->cam_board_h  &&
+		cvReadIntByName(fs, m, "projector_interior_horizontal_corners", 0) == sl_params->proj_board_w &&
+		cvReadIntByName(fs, m, "projector_interior_vertical_corners",   0) == sl_params->proj_board_h &&
+		fabs(cvReadRealByName(fs, m, "camera_square_width_mm",  0) - sl_params->cam_board_w_mm) < 1e-3 &&
+		fabs(cvReadRealByName(fs, m, "camera_square_height_mm", 0) - sl_params->cam_board_h_mm) < 1e-3;
+	if(!match){
+		printf("ERROR: Calibration observations \"%s\" do not match the chessboard parameters!\n", filename);
+		cvReleaseFileStorage(&fs);
+		return -1;
+	}
+
+	// Read chessboard corners.
+	int cam_board_n  = sl_params->cam_board_w*sl_params->cam_board_h;
+	int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+	obs->n_boards          = n_boards;
+	obs->cam_image_points  = (CvMat*)cvReadByName(fs, NULL, "cam_image_points");
+	obs->proj_image_points = (CvMat*)cvReadByName(fs, NULL, "proj_image_points");
+	obs->proj_pixel_points = (CvMat*)cvReadByName(fs, NULL, "proj_pixel_points");
+	cvReleaseFileStorage(&fs);
+	if(n_boards <= 0 ||
+	   obs->cam_image_points  == NULL || obs->cam_image_points->rows  != n_boards*cam_board_n  ||
+	   obs->proj_image_points == NULL || obs->proj_image_points->rows != n_boards*proj_board_n ||
+	   obs->proj_pixel_points == NULL || obs->proj_pixel_points->rows != n_boards*proj_board_n){
+		printf("ERROR: Calibration observations \"%s\" are incomplete!\n", filename);
+		if(obs->cam_image_points != NULL)
+			cvReleaseMat(&obs->cam_image_points);
+		if(obs->proj_image_points != NULL)
+			cvReleaseMat(&obs->proj_image_points);
+		if(obs->proj_pixel_points != NULL)
+			cvReleaseMat(&obs->proj_pixel_points);
+		obs->n_boards = 0;
+		return -1;
 	}
-	else
-		printf("Projector calibration was successful.\n");
-	displayProjCalib(sl_calib);
 	return 0;
-}
\ No newline at end of file
+}
@@ -9,6 +9,47 @@
 #include "Common.h"
 #include "Calibration.h"
 #include "Camera.h"
+#include "ChessboardDetector.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slCalibObservations
+///
+/// @brief  Chessboard corners observed on each calibration board.
+///
+/// Corners of board i occupy rows [i*board_n, (i+1)*board_n) of each matrix (extra rows are
+/// ignored). The projector corners are observed twice: in the camera image, and at the projector
+/// pixels they were projected from.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slCalibObservations{
+	int        n_boards;            // number of calibration boards
+	CvMat*     cam_image_points;    // camera chessboard corners (camera pixels, Nx2)
+	CvMat*     proj_image_points;   // projected chessboard corners (camera pixels, Nx2)
+	CvMat*     proj_pixel_points;   // projected chessboard corners (projector pixels, Nx2)
+	IplImage** cam_images;          // camera image of each board (NULL = not saved)
+	IplImage** proj_images;         // projected chessboard image of each board (NULL = not saved)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slCalibResult
+///
+/// @brief  Reprojection errors, solve times and expected depth errors of a projector-camera calibration.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slCalibResult{
+	double cam_error;               // camera reprojection error (pixels, 0 if not calibrated)
+	double proj_error;              // projector reprojection error (pixels)
+	double cam_initial_error;       // camera reprojection error before bundle adjustment (pixels, cam_error if not run)
+	double proj_initial_error;      // projector reprojection error before bundle adjustment (pixels, proj_error if not run)
+	double cam_solve_time;          // camera solve time (ms)
+	double proj_solve_time;         // projector solve time (ms)
+	double bundle_solve_time;       // bundle adjustment time (ms, 0 if not run)
+	int    bundle_iterations;       // bundle adjustment iterations (0 if not run)
+	double max_depth_error;         // largest expected depth error over the working volume (mm, 0 if not estimated)
+	double mean_depth_error;        // mean expected depth error over the working volume (mm, 0 if not estimated)
+};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 /// @class  CalibrateProCam
@@ -24,9 +65,10 @@ class CalibrateProCam
 {
 private:
     Camera* camera;
+    ChessboardDetector* detector;
 
 public:
-    CalibrateProCam(Camera *camera_);
+    CalibrateProCam(Camera *camera_, struct slParams* sl_params);
 
     ~CalibrateProCam();
 
@@ -45,9 +87,28 @@ public:
     // Note: Returns 1 if chessboard is found, 0 otherwise.
     int detectChessboard(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count CV_DEFAULT(NULL));
 
+    // Chessboard detector (for detecting several chessboards concurrently).
+    ChessboardDetector* getDetector() { return detector; };
+
     // Run projector-camera calibration (including intrinsic and extrinsic parameters).
     int runProjectorCalibration(struct slParams* sl_params, struct slCalib* sl_calib, bool calibrate_both);
 
+    // Solve for the projector (and camera) calibration from captured chessboard corners.
+    int solveProjectorCalibration(struct slParams* sl_params, struct slCalib* sl_calib,
+                                  struct slCalibObservations* obs, bool calibrate_both,
+                                  struct slCalibResult* result CV_DEFAULT(NULL));
+
+    // Evaluate the positions of the projected chessboard corners on the printed chessboard plane.
+    void evaluateProjectorObjectPoints(struct slParams* sl_params, CvMat* cam_intrinsic, CvMat* cam_distortion,
+                                       CvMat* cam_image_points, CvMat* proj_image_points,
+                                       int n_boards, CvMat* proj_object_points);
+
+    // Save chessboard observations, so that the calibration can be solved again offline.
+    int saveObservations(const char* filename, struct slParams* sl_params, struct slCalibObservations* obs);
+
+    // Load chessboard observations saved by saveObservations (without calibration images).
+    int loadObservations(const char* filename, struct slParams* sl_params, struct slCalibObservations* obs);
+
 private:
     // helper functions
 
@@ -11,9 +11,13 @@
 #include "Calibration.h"
 #include "CalibrationExceptions.h"
 #include "CalibrateProCam.h"
+#include "CalibrationJob.h"
 #include "CameraConfigParams.h"
 #include "Configuration.h"
 #include "KinectCameraManager.h"
+#include "OfflineCalibration.h"
+#include "PhotometricCalibration.h"
+#include "TriangulateProCam.h"
 #include "UtilProCam.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -21,6 +25,11 @@
 ///
 /// @brief  Main entry-point for this application. 
 ///
+/// Usage: Calibration [config.xml [job.xml]]. If a calibration job is given, calibration runs
+/// without user interaction (see CalibrationJob) and the exit code reports whether it was accepted.
+/// If the job file describes a recalibration instead, the calibration is solved again from saved
+/// chessboard observations (see OfflineCalibration).
+///
 /// @author Brett Jones
 /// @date   12/12/2010
 ///
@@ -55,6 +64,24 @@ int main(int argc, char* argv[])
         return -1;
     }
 
+    // Read calibration job or offline recalibration (if given).
+    CalibrationJob* job = NULL;
+    OfflineCalibration* recalibration = NULL;
+    if(argc > 2 && OfflineCalibration::IsRecalibration(argv[2])){
+        recalibration = new OfflineCalibration(&sl_params);
+        if(recalibration->Load(argv[2]) != 0){
+            delete recalibration;
+            return -1;
+        }
+    }
+    else if(argc > 2){
+        job = new CalibrationJob(&sl_params);
+        if(job->Load(argv[2]) != 0){
+            delete job;
+            return -1;
+        }
+    }
+
     // ***************************************************
     // Intialize the hardware
     // ***************************************************
@@ -65,34 +92,37 @@ int main(int argc, char* argv[])
     
     KinectCameraManager kinectCameraManager;
     std::vector<Camera*> cameras;
-    Camera* camera;
+    Camera* camera = NULL;
     
-    // Initialize cameras
-    try
+    // Initialize cameras (not needed to replay a recorded calibration session or to recalibrate)
+    if((job == NULL && recalibration == NULL) || (job != NULL && job->UsesCamera()))
     {
-        kinectCameraManager.Init(&cameraConfigParams);
-
-        std::vector<Camera*> cameras = kinectCameraManager.GetCameras();
-        if(cameras.size() < 1)
+        try
         {
-            printf("Camera not found\n");
-            return -1;
-        }   
+            kinectCameraManager.Init(&cameraConfigParams);
 
-        camera = cameras[0];
+            std::vector<Camera*> cameras = kinectCameraManager.GetCameras();
+            if(cameras.size() < 1)
+            {
+                printf("Camera not found\n");
+                return -1;
+            }   
 
-        // Start Camera Capture
-        camera->StartCapture();
+            camera = cameras[0];
 
-        // Get 1st Frame
-        IplImage* cam_frame = camera->QueryFrame();
-    }
-    catch(...)
-    {
-        return -1;
+            // Start Camera Capture
+            camera->StartCapture();
+
+            // Get 1st Frame
+            IplImage* cam_frame = camera->QueryFrame();
+        }
+        catch(...)
+        {
+            return -1;
+        }
     }
 
-    CalibrateProCam cvCalibrateProCam(camera);
+    CalibrateProCam cvCalibrateProCam(camera, &sl_params);
 
 	// Create fullscreen window (for controlling projector display).
 	cvNamedWindow("projWindow", CV_WINDOW_AUTOSIZE);
@@ -108,9 +138,7 @@ int main(int argc, char* argv[])
 	_mkdir(sl_params.outdir);
 	sprintf(str, "%s\\%s", sl_params.outdir, sl_params.object);
 	_mkdir(str);
-	sprintf(str, "rd /s /q \"%s\\%s\"", sl_params.outdir, sl_params.object);
-	system(str);
-	sprintf(str, "%s\\%s", sl_params.outdir, sl_params.object);
+	removeDirectory(str);
 	if(_mkdir(str) != 0){
 		printf("ERROR: Cannot open output directory!\n");
 		printf("Press any key to exit.\n");
@@ -140,8 +168,7 @@ int main(int argc, char* argv[])
 	sl_calib.cam_center             = cvCreateMat(3, 1, CV_32FC1);
 	sl_calib.proj_center            = cvCreateMat(3, 1, CV_32FC1);
 	sl_calib.cam_rays               = cvCreateMat(3, cam_nelems, CV_32FC1);
-	sl_calib.proj_rays              = cvCreateMat(3, cam_nelems, CV_32FC1);
-	//sl_calib.proj_rays              = cvCreateMat(3, proj_nelems, CV_32FC1);
+	sl_calib.proj_rays              = cvCreateMat(3, proj_nelems, CV_32FC1);
 	sl_calib.proj_column_planes     = cvCreateMat(sl_params.proj_w, 4, CV_32FC1);
 	sl_calib.proj_row_planes        = cvCreateMat(sl_params.proj_h, 4, CV_32FC1);
 	//sl_calib.fundMatrx				= new FundamentalMatrix();
@@ -187,7 +214,7 @@ int main(int argc, char* argv[])
 		sl_calib.cam_extrinsic  = (CvMat*)cvLoad(str1);
 		sl_calib.proj_extrinsic = (CvMat*)cvLoad(str2);
 		sl_calib.procam_extrinsic_calib = true;
-		//cvCalibrateProCam.evaluateProCamGeometry(&sl_params, &sl_calib);
+		evaluateProCamGeometry(&sl_params, &sl_calib);
 		printf("Loaded previous extrinsic projector-camera calibration.\n");
 	}
 	else
@@ -201,12 +228,31 @@ int main(int argc, char* argv[])
 	cvZero(sl_calib.background_image);
 	cvSet(sl_calib.background_mask, cvScalar(255));
 
+	// Initialize photometric calibration (manual gains, until measured or loaded).
+	sl_calib.cam_response_lut  = cvCreateMat(1, 256, CV_8UC3);
+	sl_calib.proj_response_lut = cvCreateMat(1, 256, CV_8UC1);
+	sl_calib.photometric_calib = false;
+	sprintf(str1, "%s\\calib\\photometry.xml", sl_params.outdir);
+	if(sl_params.photometric_reuse && PhotometricCalibration::Load(str1, &sl_calib) == 0)
+		printf("Loaded previous photometric calibration.\n");
+
 	// Initialize scan counter (used to index each scan iteration).
 	int scan_index = 0;
 
+	// Run calibration job (if given) instead of processing user input.
+	int status = 0;
+	if(job != NULL){
+		printf("\n> Running calibration job \"%s\"...\n", argv[2]);
+		status = job->Run(&cvCalibrateProCam, camera, &sl_calib);
+	}
+	else if(recalibration != NULL){
+		printf("\n> Running offline recalibration \"%s\"...\n", argv[2]);
+		status = recalibration->Run(&cvCalibrateProCam, &sl_calib);
+	}
+
 	// Process user input, until 'ESC' is pressed.
 	int cvKey = NULL;
-	while(1){
+	while(job == NULL && recalibration == NULL){
 
 		// Display a black projector image by default.
 		cvSet(proj_frame, cvScalar(0, 0, 255));
@@ -240,10 +286,13 @@ int main(int argc, char* argv[])
 		cvKey = _getch();
 	}
 
+    delete job;
+    delete recalibration;
+
     // Destory camera
-    camera->EndCapture();
     if(camera)
 	{
+        camera->EndCapture();
         delete camera;
 	}
 
@@ -272,9 +321,11 @@ int main(int argc, char* argv[])
 	cvReleaseMat(&sl_calib.background_depth_map);
 	cvReleaseImage(&sl_calib.background_image);
 	cvReleaseImage(&sl_calib.background_mask);
+	cvReleaseMat(&sl_calib.cam_response_lut);
+	cvReleaseMat(&sl_calib.proj_response_lut);
 
 	// Exit without errors.
 	cvDestroyWindow("projWindow");
 
-    return 0;
+    return status;
 }
\ No newline at end of file
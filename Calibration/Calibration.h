@@ -23,6 +23,9 @@ struct slParams{
 	char outdir[1024];	            // base output directory
 	char object[1024];              // object name
 	bool save;                      // enable/disable saving of image sequence
+	int  image_queue_size;          // maximum number of debug images waiting to be saved
+	int  image_writer_threads;      // number of threads encoding and saving debug images
+	bool image_queue_drop;          // drop (rather than wait to save) debug images when the queue is full
 
 	// Camera options.
 	int  cam_w;                     // camera columns
@@ -56,6 +59,44 @@ struct slParams{
 	int proj_board_w_pixels;        // physical length of chessboard square (width in pixels)
 	int proj_board_h_pixels;        // physical length of chessboard square (height in pixels)
 
+	// Chessboard detection options.
+	int chessboard_levels;          // number of downscaled pyramid levels searched first (0 = full resolution only)
+	int chessboard_threads;         // number of threads detecting chessboards concurrently
+	bool chessboard_tracking;       // enable/disable tracking of chessboard corners between frames (detects only on loss)
+
+	// Calibration solver options.
+	bool bundle_adjustment;         // enable/disable joint refinement of the camera and projector calibration
+	int  bundle_iterations;         // maximum number of bundle adjustment iterations
+	int  solver_threads;            // number of threads evaluating the calibration solver (0 = one per processor)
+	bool estimate_uncertainty;      // enable/disable estimation of the parameter uncertainty and expected depth error
+
+	// Board quality options.
+	bool  board_scoring;            // enable/disable scoring (and automatic rejection) of boards during capture
+	float board_min_sharpness;      // minimum variance of the Laplacian over the printed chessboard (0 = not checked)
+	float board_max_residual;       // maximum RMS distance of corners from a homography of their board (squares)
+	float board_min_difference;     // minimum RMS corner distance to an accepted board (fraction of the image diagonal)
+	bool  board_outlier_rejection;  // enable/disable RANSAC rejection of outlier boards before a solve
+	int   ransac_iterations;        // number of RANSAC samples per chessboard
+	float ransac_threshold;         // maximum distance of an inlier corner from the RANSAC homography (squares)
+	int   ransac_max_outliers;      // maximum number of outlier corners per chessboard (otherwise the board is removed)
+
+	// Capture guidance options.
+	bool  guidance;                 // enable/disable the coverage map and suggested next pose (in "Camera Correspondences")
+	float guidance_stop_uncertainty;// stop capture once the calibration uncertainty is below this (percent, 0 = capture all boards)
+	int   guidance_min_boards;      // minimum number of boards before capture may stop
+	float guidance_corner_noise;    // assumed standard deviation of the detected corners (in camera pixels)
+
+	// Multiplexed capture options.
+	bool  multiplexed_capture;      // enable/disable capture of both chessboards from one projector frame (requires a colour camera)
+	int   multiplex_min_response;   // minimum camera response to each multiplexed projector channel (summed over the camera channels)
+
+	// Photometric calibration options.
+	bool  photometric_calibration;  // enable/disable measurement of the projector and camera responses before capture
+	bool  photometric_reuse;        // enable/disable use of the responses measured by a previous run (calib\photometry.xml)
+	int   photometric_levels;       // number of projector levels measured (the response is interpolated between them)
+	int   photometric_target;       // camera level the brightest lit pixels are stretched to (maximum of 255)
+	float photometric_max_gain;     // maximum gain of the camera response lookup table
+
 	// General options.
 	int   mode;                     // structured light reconstruction mode (1 = "ray-plane", 2 = "ray-ray")
 	bool  scan_cols;                // enable/disable column scanning
@@ -66,6 +107,21 @@ struct slParams{
 	float dist_reject;              // rejection distance (for outlier removal) if row and column scanning are both enabled (in mm)
 	float background_depth_thresh;  // threshold distance for background removal (in mm)	
     bool  generate_normals;         // generate smoothed surface normals
+	float mesh_max_depth_jump;      // maximum depth difference between connected pixels (as a fraction of depth)
+	int   export_sample_points;     // number of points written to SfM/SBA text files (0 = all valid points)
+	int   export_sample_seed;       // random seed for selecting the exported points
+
+	// Phase-shift options (subpixel refinement of Gray-code correspondences).
+	int   phase_shift_steps;        // number of phase-shifted sinusoids (3 to 32)
+	int   phase_shift_period;       // sinusoid period (in projector pixels)
+	float phase_shift_min_modulation; // minimum sinusoid amplitude for refinement (maximum of 127.5)
+
+	// Multi-scan fusion options (registration and volumetric integration of successive scans).
+	float fusion_voxel_size;        // TSDF voxel size (in mm)
+	float fusion_truncation;        // TSDF truncation distance (in mm)
+	int   fusion_max_blocks;        // maximum number of allocated 8x8x8 voxel blocks (bounds memory use)
+	int   fusion_icp_iterations;    // maximum number of ICP iterations per scan
+	float fusion_icp_max_distance;  // maximum distance between ICP correspondences (in mm)
 
 	// Visualization options.
 	bool display;                   // enable/disable display of intermediate results (e.g., image sequence, calibration data, etc.)
@@ -125,6 +181,11 @@ struct slCalib{
     bool proj_intrinsic_calib;		// flag to indicate state of intrinsic projector calibration
 	bool procam_extrinsic_calib;    // flag to indicate state of extrinsic projector-camera calibration
 
+	// Photometric calibration (replaces the manual camera and projector gains, if available).
+	CvMat* cam_response_lut;        // camera lookup table (1x256, 8-bit, BGR): removes the black level and stretches the lit range
+	CvMat* proj_response_lut;       // inverse projector response (1x256, 8-bit): maps linear levels to projector levels
+	bool   photometric_calib;       // flag to indicate state of photometric calibration
+
 	// Background model (used to segment foreground objects of interest from static background).
 	CvMat*    background_depth_map; // background depth map
 	IplImage* background_image;     // background image 
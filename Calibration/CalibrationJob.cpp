@@ -0,0 +1,826 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\CalibrationJob.cpp
+///
+/// @brief  Implements the non-interactive (scripted) calibration job.
+///
+/// Overview:
+///   Each board is captured with the same sequence as runProjectorCalibration: the printed
+///   chessboard under red light, a white frame, and a frame with the projector chessboard
+///   prewarped onto the printed board. Instead of waiting for a key press, every board with both
+///   chessboards detected (and, if board scoring is enabled, meeting the quality criteria) is
+///   accepted. Recorded sessions hold the (gain-corrected) frames of the accepted boards, so a
+///   replay repeats detection, scoring and solve exactly.
+///   Multiplexed boards are recorded as their separated frames: the illumination image is both the
+///   red and the white frame. A multiplexed board may show a projector chessboard warped for an
+///   earlier board pose, so the homography it was projected with is recorded for every board, and
+///   replays use it rather than reevaluating it from the printed chessboard (which only reproduces
+///   sequential boards, and is kept for sessions recorded without it). A projected chessboard warped
+///   for an earlier board pose may hang over the edge of the printed board (onto a different plane),
+///   so it is only accepted if all of its corners lie on the printed board.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "CalibrationJob.h"
+#include "Homography.h"
+#include "ScanArchive.h"
+#include "UtilProCam.h"
+#include "PatternEngine.h"
+
+#include <float.h>
+
+// Phase names (as written to the job report).
+static const char* PHASE_NAMES[] = { "setup", "photometry", "homography", "capture", "detection",
+                                     "camera_solve", "projector_solve", "bundle_adjustment", "output", "total" };
+
+// Number of recorded session parameters.
+static const int SESSION_PARAMETERS = 11;
+
+// Time elapsed since a cvGetTickCount() value (in ms).
+static double elapsedTime(int64 start){
+    return (double)(cvGetTickCount()-start)/(1000.0*cvGetTickFrequency());
+}
+
+// Pack the chessboard and projector parameters a recorded session depends on.
+static void getSessionParameters(struct slParams* sl_params, double* p){
+    p[0]  = sl_params->cam_board_w;
+    p[1]  = sl_params->cam_board_h;
+    p[2]  = sl_params->cam_board_w_mm;
+    p[3]  = sl_params->cam_board_h_mm;
+    p[4]  = sl_params->proj_board_w;
+    p[5]  = sl_params->proj_board_h;
+    p[6]  = sl_params->proj_board_w_pixels;
+    p[7]  = sl_params->proj_board_h_pixels;
+    p[8]  = sl_params->proj_w;
+    p[9]  = sl_params->proj_h;
+    p[10] = sl_params->proj_invert ? 1 : 0;
+}
+
+// Constructor
+CalibrationJob::CalibrationJob(struct slParams* sl_params)
+{
+    mSlParams = sl_params;
+    mSlCalib  = NULL;
+    strcpy(mJob.source, "camera");
+    mJob.record[0]      = '\0';
+    mJob.calibrate_both = true;
+    mJob.n_boards       = 10;
+    mJob.board_delay    = 2000;
+    mJob.max_attempts   = 100;
+    mJob.min_boards     = 2;
+    mJob.max_cam_error  = 0;
+    mJob.max_proj_error = 0;
+    mJob.max_depth_error = 0;
+
+    mProjChessboard  = NULL;
+    mProjPoints      = NULL;
+    mCamToProj       = cvCreateMat(3, 3, CV_64FC1);
+    mHomographyFound = false;
+    mCamCorners      = NULL;
+    mProjCorners     = NULL;
+    mProjImage       = NULL;
+    memset(&mObs, 0, sizeof(mObs));
+    mScorer          = NULL;
+    mOutlierBoards   = 0;
+    mGuide           = NULL;
+    mMultiplexer     = NULL;
+    mWarpShown       = false;
+    for(int i=0; i<NUM_PHASES; i++)
+        mPhaseTime[i] = 0;
+}
+
+// Destructor
+CalibrationJob::~CalibrationJob()
+{
+    if(mProjChessboard != NULL)
+        cvReleaseImage(&mProjChessboard);
+    if(mProjPoints != NULL)
+        cvReleaseMat(&mProjPoints);
+    cvReleaseMat(&mCamToProj);
+    delete[] mCamCorners;
+    delete[] mProjCorners;
+    if(mProjImage != NULL)
+        cvReleaseImage(&mProjImage);
+    delete mScorer;
+    delete mGuide;
+    delete mMultiplexer;
+
+    if(mObs.cam_image_points != NULL){
+        cvReleaseMat(&mObs.cam_image_points);
+        cvReleaseMat(&mObs.proj_image_points);
+        cvReleaseMat(&mObs.proj_pixel_points);
+        for(int i=0; i<mObs.n_boards; i++){
+            cvReleaseImage(&mObs.cam_images[i]);
+            cvReleaseImage(&mObs.proj_images[i]);
+        }
+        delete[] mObs.cam_images;
+        delete[] mObs.proj_images;
+    }
+}
+
+// Read a job description (chessboard parameters in the job override the configuration).
+int CalibrationJob::Load(const char* filename)
+{
+    CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_READ);
+    if(fs == NULL){
+        printf("ERROR: Cannot open calibration job \"%s\"!\n", filename);
+        return -1;
+    }
+    struct slParams* sl_params = mSlParams;
+
+    // Read job parameters.
+    CvFileNode* m = cvGetFileNodeByName(fs, 0, "job");
+    strncpy(mJob.source, cvReadStringByName(fs, m, "source",         "camera"), sizeof(mJob.source)-1);
+    strncpy(mJob.record, cvReadStringByName(fs, m, "record_session", ""),       sizeof(mJob.record)-1);
+    mJob.source[sizeof(mJob.source)-1] = '\0';
+    mJob.record[sizeof(mJob.record)-1] = '\0';
+    mJob.calibrate_both = (cvReadIntByName(fs, m, "calibrate_camera",              1) != 0);
+    mJob.n_boards       =  cvReadIntByName(fs, m, "number_of_boards",             10);
+    mJob.board_delay    =  cvReadIntByName(fs, m, "board_delay_ms",             2000);
+    mJob.max_attempts   =  cvReadIntByName(fs, m, "maximum_attempts_per_board",  100);
+
+    // Read camera calibration chessboard parameters (defaults to the configuration).
+    m = cvGetFileNodeByName(fs, 0, "camera_chessboard");
+    sl_params->cam_board_w    =        cvReadIntByName(fs,  m, "interior_horizontal_corners", sl_params->cam_board_w);
+    sl_params->cam_board_h    =        cvReadIntByName(fs,  m, "interior_vertical_corners",   sl_params->cam_board_h);
+    sl_params->cam_board_w_mm = (float)cvReadRealByName(fs, m, "square_width_mm",             sl_params->cam_board_w_mm);
+    sl_params->cam_board_h_mm = (float)cvReadRealByName(fs, m, "square_height_mm",            sl_params->cam_board_h_mm);
+
+    // Read projector calibration chessboard parameters (defaults to the configuration).
+    m = cvGetFileNodeByName(fs, 0, "projector_chessboard");
+    sl_params->proj_board_w        = cvReadIntByName(fs, m, "interior_horizontal_corners", sl_params->proj_board_w);
+    sl_params->proj_board_h        = cvReadIntByName(fs, m, "interior_vertical_corners",   sl_params->proj_board_h);
+    sl_params->proj_board_w_pixels = cvReadIntByName(fs, m, "square_width_pixels",         sl_params->proj_board_w_pixels);
+    sl_params->proj_board_h_pixels = cvReadIntByName(fs, m, "square_height_pixels",        sl_params->proj_board_h_pixels);
+
+    // Read acceptance criteria.
+    m = cvGetFileNodeByName(fs, 0, "acceptance");
+    mJob.min_boards     = cvReadIntByName(fs,  m, "minimum_boards",                 2);
+    mJob.max_cam_error  = cvReadRealByName(fs, m, "maximum_camera_error_pixels",    0);
+    mJob.max_proj_error = cvReadRealByName(fs, m, "maximum_projector_error_pixels", 0);
+    mJob.max_depth_error = cvReadRealByName(fs, m, "maximum_depth_error_mm",        0);
+
+    cvReleaseFileStorage(&fs);
+
+    // Check job parameters.
+    if(mJob.n_boards < 2){
+        printf("ERROR: At least two images are required!\n");
+        return -1;
+    }
+    if(sl_params->cam_board_w*sl_params->cam_board_h < sl_params->proj_board_w*sl_params->proj_board_h){
+        printf("ERROR: The camera chessboard must have at least as many corners as the projector chessboard!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Capture (or replay) and solve the calibration.
+int CalibrationJob::Run(CalibrateProCam* calibrator, Camera* camera, struct slCalib* sl_calib)
+{
+    int64 start = cvGetTickCount();
+    mSlCalib = sl_calib;
+
+    // Reset projector (and camera) calibration status (will be set again, if successful).
+    if(!mJob.calibrate_both && !sl_calib->cam_intrinsic_calib){
+        printf("ERROR: Camera must be calibrated first or simultaneously!\n");
+        return -1;
+    }
+    sl_calib->proj_intrinsic_calib   = false;
+    sl_calib->procam_extrinsic_calib = false;
+    if(mJob.calibrate_both)
+        sl_calib->cam_intrinsic_calib = false;
+
+    // Prepare chessboard, storage and output directories.
+    int64 t0 = cvGetTickCount();
+    int status = Setup(calibrator);
+    mPhaseTime[PHASE_SETUP] = elapsedTime(t0);
+
+    // Capture (or replay) calibration boards.
+    if(status == 0){
+        calibrator->getDetector()->ResetStatistics();
+        if(UsesCamera())
+            status = CaptureFromCamera(calibrator, camera);
+        else
+            status = CaptureFromSession(calibrator);
+        calibrator->getDetector()->DisplayStatistics();
+        mGuide->DisplayStatistics();
+    }
+
+    // Solve for the calibration.
+    struct slCalibResult result;
+    memset(&result, 0, sizeof(result));
+    if(status == 0){
+        char str[1024];
+        sprintf(str, "%s\\calib\\observations.xml", mSlParams->outdir);
+        calibrator->saveObservations(str, mSlParams, &mObs);
+        if(mSlParams->board_outlier_rejection){
+            int n_boards = mObs.n_boards;
+            mOutlierBoards = mScorer->RejectOutliers(&mObs);
+            for(int i=mObs.n_boards; i<n_boards; i++){
+                cvReleaseImage(&mObs.cam_images[i]);
+                cvReleaseImage(&mObs.proj_images[i]);
+            }
+        }
+        printf("Solving calibration from %d boards...\n", mObs.n_boards);
+        t0 = cvGetTickCount();
+        status = calibrator->solveProjectorCalibration(mSlParams, sl_calib, &mObs, mJob.calibrate_both, &result);
+        mPhaseTime[PHASE_CAMERA_SOLVE]    = result.cam_solve_time;
+        mPhaseTime[PHASE_PROJECTOR_SOLVE] = result.proj_solve_time;
+        mPhaseTime[PHASE_BUNDLE_SOLVE]    = result.bundle_solve_time;
+        mPhaseTime[PHASE_OUTPUT]          = elapsedTime(t0) - result.cam_solve_time - result.proj_solve_time - result.bundle_solve_time;
+    }
+    mPhaseTime[PHASE_TOTAL] = elapsedTime(start);
+
+    // Check acceptance criteria.
+    if(status != 0)
+        printf("ERROR: Calibration job did not complete!\n");
+    return Report(&result) == 0 && status == 0 ? 0 : -1;
+}
+
+// Create the projector chessboard and (re)create the calibration output directories.
+int CalibrationJob::Setup(CalibrateProCam* calibrator)
+{
+    struct slParams* sl_params = mSlParams;
+    int cam_board_n  = sl_params->cam_board_w*sl_params->cam_board_h;
+    int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+
+    // Generate projector calibration chessboard pattern.
+    mProjChessboard = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 1);
+    int proj_border_cols, proj_border_rows;
+    if(calibrator->generateChessboard(sl_params, mProjChessboard, proj_border_cols, proj_border_rows) == -1)
+        return -1;
+
+    // Define image points corresponding to projector chessboard (i.e., considering projector as an inverse camera).
+    mProjPoints = cvCreateMat(proj_board_n, 1, CV_32FC2);
+    for(int j=0; j<proj_board_n; ++j){
+        int k = sl_params->proj_invert ? (proj_board_n-j-1) : j;
+        mProjPoints->data.fl[2*j+0] =
+            sl_params->proj_board_w_pixels*float(k%sl_params->proj_board_w) + (float)proj_border_cols + (float)sl_params->proj_board_w_pixels - (float)0.5;
+        mProjPoints->data.fl[2*j+1] =
+            sl_params->proj_board_h_pixels*float(k/sl_params->proj_board_w) + (float)proj_border_rows + (float)sl_params->proj_board_h_pixels - (float)0.5;
+    }
+
+    // Allocate storage for chessboard observations.
+    mCamCorners  = new CvPoint2D32f[cam_board_n];
+    mProjCorners = new CvPoint2D32f[proj_board_n];
+    mObs.n_boards          = 0;
+    mObs.cam_image_points  = cvCreateMat(mJob.n_boards*cam_board_n,  2, CV_32FC1);
+    mObs.proj_image_points = cvCreateMat(mJob.n_boards*proj_board_n, 2, CV_32FC1);
+    mObs.proj_pixel_points = cvCreateMat(mJob.n_boards*proj_board_n, 2, CV_32FC1);
+    mObs.cam_images        = new IplImage* [mJob.n_boards];
+    mObs.proj_images       = new IplImage* [mJob.n_boards];
+    mScorer = new BoardScorer(sl_params);
+    mGuide  = new CaptureGuide(sl_params, mJob.calibrate_both);
+    mMultiplexer = new ChannelMultiplexer(sl_params);
+
+    // Create calibration directories (clear previous calibration first).
+    char str[1024];
+    _mkdir(sl_params->outdir);
+    sprintf(str, "%s\\calib", sl_params->outdir);
+    _mkdir(str);
+    if(mJob.calibrate_both){
+        sprintf(str, "%s\\calib\\cam", sl_params->outdir);
+        removeDirectory(str);
+        if(_mkdir(str) != 0){
+            printf("ERROR: Cannot open output directory!\n");
+            return -1;
+        }
+    }
+    sprintf(str, "%s\\calib\\proj", sl_params->outdir);
+    removeDirectory(str);
+    if(_mkdir(str) != 0){
+        printf("ERROR: Cannot open output directory!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Capture the projector-camera homography and the calibration boards from a camera.
+// Note: Frames are corrected by the photometric calibration (or scaled by the camera gain) before detection (and recording).
+int CalibrationJob::CaptureFromCamera(CalibrateProCam* calibrator, Camera* camera)
+{
+    struct slParams* sl_params = mSlParams;
+    if(camera == NULL){
+        printf("ERROR: No camera is available for the calibration job!\n");
+        return -1;
+    }
+    int64 start = cvGetTickCount();
+
+    // Start recording the session (if enabled).
+    ScanArchiveWriter recorder;
+    bool recording = (mJob.record[0] != '\0');
+    if(recording){
+        if(recorder.Open(mJob.record) != 0)
+            return -1;
+        double parameters[SESSION_PARAMETERS];
+        getSessionParameters(sl_params, parameters);
+        CvMat parameters_mat = cvMat(1, SESSION_PARAMETERS, CV_64FC1, parameters);
+        recorder.AddMatrix("session/parameters", &parameters_mat);
+    }
+
+    // Measure the projector and camera responses (or use a previous photometric calibration).
+    PatternEngine patterns(sl_params);
+    int64 t0 = cvGetTickCount();
+    if(sl_params->photometric_calibration){
+        printf("Measuring projector and camera responses...\n");
+        PhotometricCalibration photometry(sl_params);
+        if(photometry.Run(camera, &patterns, mSlCalib) == 0){
+            char str[1024];
+            sprintf(str, "%s\\calib\\photometry.xml", sl_params->outdir);
+            photometry.Save(str, mSlCalib);
+        }
+        else
+            printf("WARNING: Photometric calibration failed; the manual gains are used.\n");
+    }
+    else if(mSlCalib->photometric_calib)
+        patterns.SetResponse(mSlCalib->proj_response_lut);
+    mPhaseTime[PHASE_PHOTOMETRY] = elapsedTime(t0);
+
+    // Project the chessboard and estimate the camera-to-projector homography.
+    printf("Estimating projector-camera homography...\n");
+    IplImage* proj_warp = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 1);
+    cvShowImage("projWindow", patterns.Chessboard());
+    cvWaitKey(sl_params->delay);
+    t0 = cvGetTickCount();
+    for(int attempt=0; !mHomographyFound && (mJob.max_attempts <= 0 || attempt < mJob.max_attempts); attempt++){
+        IplImage* cam_frame = camera->QueryFrame();
+        PhotometricCalibration::CorrectFrame(sl_params, mSlCalib, cam_frame);
+        if(DetectHomography(calibrator, cam_frame) && recording)
+            recorder.AddImage("session/homography", cam_frame, 0, elapsedTime(start)/1000.0);
+        cvReleaseImage(&cam_frame);
+        cvWaitKey(1);
+    }
+    mPhaseTime[PHASE_HOMOGRAPHY] = elapsedTime(t0);
+
+    // Measure the colour crosstalk of the rig (for multiplexed capture).
+    bool multiplexed = false;
+    if(mHomographyFound && sl_params->multiplexed_capture){
+        printf("Measuring projector-camera colour crosstalk...\n");
+        multiplexed = mMultiplexer->Calibrate(camera, &patterns, mSlCalib);
+        if(multiplexed){
+            char str[1024];
+            sprintf(str, "%s\\calib\\colour_crosstalk.xml", sl_params->outdir);
+            mMultiplexer->Save(str);
+            if(recording)
+                recorder.AddMatrix("session/crosstalk", mMultiplexer->GetMixing());
+        }
+        else
+            printf("WARNING: Multiplexed capture is not available; boards are captured sequentially.\n");
+    }
+    mWarpShown = false;
+
+    // Capture calibration boards, until enough boards are found (or too many attempts failed).
+    CvMat* proj_to_proj = cvCreateMat(3, 3, CV_64FC1);
+    double detection_time = 0;
+    int attempts = 0;
+    t0 = cvGetTickCount();
+    while(mHomographyFound && mObs.n_boards < mJob.n_boards && !mGuide->IsComplete() &&
+          (mJob.max_attempts <= 0 || attempts < mJob.max_attempts)){
+
+        // Capture the printed and projected chessboards (the illumination image serves as the white frame).
+        IplImage* red_frame     = NULL;
+        IplImage* white_frame   = NULL;
+        IplImage* pattern_frame = NULL;
+        bool found;
+        if(multiplexed){
+            found = CaptureMultiplexedBoard(calibrator, camera, &patterns, proj_warp, proj_to_proj, &red_frame, &pattern_frame, detection_time);
+            white_frame = red_frame;
+        }
+        else
+            found = CaptureSequentialBoard(calibrator, camera, &patterns, proj_warp, proj_to_proj, &red_frame, &white_frame, &pattern_frame, detection_time);
+
+        // Score and add the board.
+        if(found && !ScoreBoard(white_frame))
+            found = false;
+        if(found){
+            if(recording){
+                char name[64];
+                double timestamp = elapsedTime(start)/1000.0;
+                sprintf(name, "session/board%0.2d/red", mObs.n_boards);
+                recorder.AddImage(name, red_frame, mObs.n_boards, timestamp);
+                sprintf(name, "session/board%0.2d/white", mObs.n_boards);
+                recorder.AddImage(name, white_frame, mObs.n_boards, timestamp);
+                sprintf(name, "session/board%0.2d/pattern", mObs.n_boards);
+                recorder.AddImage(name, pattern_frame, mObs.n_boards, timestamp);
+                sprintf(name, "session/board%0.2d/homography", mObs.n_boards);
+                recorder.AddMatrix(name, proj_to_proj, mObs.n_boards, timestamp);
+            }
+            AddBoard(proj_to_proj, red_frame);
+            printf("*%d Captured frame %d of %d.\n", mObs.n_boards, mObs.n_boards, mJob.n_boards);
+            attempts = 0;
+
+            // Wait for the board to be repositioned.
+            if(mObs.n_boards < mJob.n_boards)
+                cvWaitKey(mJob.board_delay);
+        }
+        else
+            attempts++;
+
+        if(white_frame != red_frame)
+            cvReleaseImage(&white_frame);
+        cvReleaseImage(&red_frame);
+        cvReleaseImage(&pattern_frame);
+    }
+    mPhaseTime[PHASE_DETECTION] = detection_time;
+    mPhaseTime[PHASE_CAPTURE]   = elapsedTime(t0) - detection_time;
+
+    // Display red image (default projector state).
+    cvShowImage("projWindow", patterns.Solid(cvScalar(0.0, 0.0, 255.0), false));
+    cvWaitKey(1);
+
+    // Free allocated resources.
+    cvReleaseMat(&proj_to_proj);
+    cvReleaseImage(&proj_warp);
+    if(recording)
+        recorder.Close();
+
+    if(!mHomographyFound){
+        printf("ERROR: Projector chessboard was not found!\n");
+        return -1;
+    }
+    if(mGuide->IsComplete())
+        printf("Calibration uncertainty is %.3f%% after %d boards; capture is complete.\n", 100.0*mGuide->GetUncertainty(), mObs.n_boards);
+    else if(mObs.n_boards < mJob.n_boards)
+        printf("WARNING: Only %d of %d boards were captured!\n", mObs.n_boards, mJob.n_boards);
+    return 0;
+}
+
+// Replay the homography and calibration boards from a recorded session.
+int CalibrationJob::CaptureFromSession(CalibrateProCam* calibrator)
+{
+    ScanArchiveReader session;
+    if(session.Open(mJob.source) != 0)
+        return -1;
+
+    // Check that the session was recorded with the same chessboards.
+    double parameters[SESSION_PARAMETERS];
+    getSessionParameters(mSlParams, parameters);
+    int i = session.Find("session/parameters");
+    CvMat* recorded = (i >= 0) ? session.LoadMatrix(i) : NULL;
+    bool match = (recorded != NULL && recorded->cols == SESSION_PARAMETERS && CV_MAT_TYPE(recorded->type) == CV_64FC1);
+    for(int j=0; match && j<SESSION_PARAMETERS; j++)
+        match = (fabs(recorded->data.db[j] - parameters[j]) < 1e-6);
+    if(recorded != NULL)
+        cvReleaseMat(&recorded);
+    if(!match){
+        printf("ERROR: Recorded session does not match the chessboard parameters of the job!\n");
+        return -1;
+    }
+
+    // Estimate the camera-to-projector homography.
+    int64 t0 = cvGetTickCount();
+    i = session.Find("session/homography");
+    if(i >= 0){
+        IplImage* cam_frame = session.LoadImage(i);
+        if(cam_frame != NULL){
+            DetectHomography(calibrator, cam_frame);
+            cvReleaseImage(&cam_frame);
+        }
+    }
+    mPhaseTime[PHASE_HOMOGRAPHY] = elapsedTime(t0);
+    if(!mHomographyFound){
+        printf("ERROR: Projector chessboard was not found!\n");
+        return -1;
+    }
+
+    // Replay recorded boards.
+    ChessboardDetector* detector = calibrator->getDetector();
+    int cam_board_n  = mSlParams->cam_board_w*mSlParams->cam_board_h;
+    int proj_board_n = mSlParams->proj_board_w*mSlParams->proj_board_h;
+    CvMat* proj_to_proj = cvCreateMat(3, 3, CV_64FC1);
+    double detection_time = 0;
+    t0 = cvGetTickCount();
+    for(int b=0; mObs.n_boards < mJob.n_boards && !mGuide->IsComplete(); b++){
+        char name[64];
+        IplImage* frames[3] = { NULL, NULL, NULL };
+        const char* frame_names[3] = { "red", "white", "pattern" };
+        for(int k=0; k<3; k++){
+            sprintf(name, "session/board%0.2d/%s", b, frame_names[k]);
+            i = session.Find(name);
+            if(i >= 0)
+                frames[k] = session.LoadImage(i);
+        }
+        bool complete = (frames[0] != NULL && frames[1] != NULL && frames[2] != NULL);
+        if(complete){
+
+            // Detect the camera and projector chessboards concurrently.
+            int64 t1 = cvGetTickCount();
+            int cam_count = 0, proj_count = 0, cam_found = 0, proj_found = 0;
+            detector->Submit(frames[0], cvSize(mSlParams->cam_board_w, mSlParams->cam_board_h), mCamCorners, &cam_count, &cam_found);
+            if(PrepareProjectorImage(frames[1], frames[2]))
+                detector->Submit(mProjImage, cvSize(mSlParams->proj_board_w, mSlParams->proj_board_h), mProjCorners, &proj_count, &proj_found);
+            detector->Wait();
+
+            // Use the homography the projector chessboard was displayed with (if recorded).
+            bool homography = false;
+            if(cam_count == cam_board_n && proj_count == proj_board_n){
+                sprintf(name, "session/board%0.2d/homography", b);
+                i = session.Find(name);
+                if(i >= 0){
+                    CvMat* recorded_homography = session.LoadMatrix(i);
+                    homography = (recorded_homography != NULL && recorded_homography->rows == 3 && recorded_homography->cols == 3 &&
+                                  CV_MAT_TYPE(recorded_homography->type) == CV_64FC1);
+                    if(homography)
+                        cvCopy(recorded_homography, proj_to_proj);
+                    if(recorded_homography != NULL)
+                        cvReleaseMat(&recorded_homography);
+                }
+                else
+                    homography = EvaluateBoardHomography(proj_to_proj);
+            }
+            if(!homography)
+                printf("WARNING: Chessboards of recorded board %d were not found!\n", b);
+            else if(ScoreBoard(frames[1]))
+                AddBoard(proj_to_proj, frames[0]);
+            detection_time += elapsedTime(t1);
+        }
+        for(int k=0; k<3; k++)
+            if(frames[k] != NULL)
+                cvReleaseImage(&frames[k]);
+        if(!complete)
+            break;
+    }
+    mPhaseTime[PHASE_DETECTION] = detection_time;
+    mPhaseTime[PHASE_CAPTURE]   = elapsedTime(t0) - detection_time;
+    cvReleaseMat(&proj_to_proj);
+
+    printf("Replayed %d boards from \"%s\".\n", mObs.n_boards, mJob.source);
+    return 0;
+}
+
+// Capture a board with the red, white and pattern frames (the projector chessboard warped onto the printed one).
+bool CalibrationJob::CaptureSequentialBoard(CalibrateProCam* calibrator, Camera* camera, PatternEngine* patterns, IplImage* proj_warp,
+                                            CvMat* proj_to_proj, IplImage** red_frame, IplImage** white_frame, IplImage** pattern_frame, double& detection_time)
+{
+    struct slParams* sl_params = mSlParams;
+
+    // Capture the printed chessboard under red illumination.
+    cvShowImage("projWindow", patterns->Solid(cvScalar(0.0, 0.0, 255.0)));
+    cvWaitKey(sl_params->delay);
+    *red_frame = camera->QueryFrameR();
+    PhotometricCalibration::CorrectFrame(sl_params, mSlCalib, *red_frame, 2);
+    int64 t1 = cvGetTickCount();
+    bool found = DetectCameraBoard(calibrator, *red_frame, proj_to_proj);
+    detection_time += elapsedTime(t1);
+    if(!found)
+        return false;
+
+    // Capture under white illumination.
+    cvShowImage("projWindow", patterns->Solid(cvScalar(255.0, 255.0, 255.0), false));
+    cvWaitKey(sl_params->delay);
+    *white_frame = camera->QueryFrameGray();
+
+    // Capture the projector chessboard, prewarped onto the printed chessboard.
+    cvWarpPerspective(mProjChessboard, proj_warp, proj_to_proj, CV_INTER_LINEAR+CV_WARP_FILL_OUTLIERS, cvScalarAll(255.0));
+    patterns->ApplyGain(proj_warp, proj_warp);
+    cvShowImage("projWindow", proj_warp);
+    cvWaitKey(sl_params->delay);
+    *pattern_frame = camera->QueryFrameGray();
+
+    // Detect the projected chessboard.
+    t1 = cvGetTickCount();
+    found = DetectProjectorBoard(calibrator, *white_frame, *pattern_frame);
+    detection_time += elapsedTime(t1);
+    return found;
+}
+
+// Capture a board from one projector frame multiplexing the illumination and the projector chessboard.
+// Note: The displayed projector chessboard (warped for an earlier board) is tried first; the chessboard is only
+//       rewarped onto the printed chessboard, and a second frame captured, if it is not found on the board.
+bool CalibrationJob::CaptureMultiplexedBoard(CalibrateProCam* calibrator, Camera* camera, PatternEngine* patterns, IplImage* proj_warp,
+                                             CvMat* proj_to_proj, IplImage** illumination_frame, IplImage** pattern_frame, double& detection_time)
+{
+    struct slParams* sl_params = mSlParams;
+    double board_to_proj[9];
+    CvMat board_to_proj_mat = cvMat(3, 3, CV_64FC1, board_to_proj);
+    for(int pass=0; pass<2; pass++){
+
+        // Separate the printed chessboard (illumination) and the projected chessboard (pattern).
+        IplImage* cam_frame = camera->QueryFrame();
+        PhotometricCalibration::CorrectFrame(sl_params, mSlCalib, cam_frame);
+        if(*illumination_frame == NULL){
+            *illumination_frame = cvCreateImage(cvGetSize(cam_frame), IPL_DEPTH_8U, 1);
+            *pattern_frame      = cvCreateImage(cvGetSize(cam_frame), IPL_DEPTH_8U, 1);
+        }
+        mMultiplexer->Separate(cam_frame, *illumination_frame, *pattern_frame);
+        cvReleaseImage(&cam_frame);
+
+        // Detect both chessboards in the same frame.
+        int64 t1 = cvGetTickCount();
+        bool cam_found = DetectCameraBoard(calibrator, *illumination_frame, &board_to_proj_mat);
+        bool found     = cam_found && mWarpShown && DetectProjectorBoard(calibrator, *illumination_frame, *pattern_frame) && IsOnPrintedBoard();
+        detection_time += elapsedTime(t1);
+        if(found || !cam_found || pass > 0)
+            return found;
+
+        // Prewarp the projector chessboard onto the printed chessboard, and display it with the illumination.
+        cvCopy(&board_to_proj_mat, proj_to_proj);
+        cvWarpPerspective(mProjChessboard, proj_warp, proj_to_proj, CV_INTER_LINEAR+CV_WARP_FILL_OUTLIERS, cvScalarAll(255.0));
+        patterns->ApplyGain(proj_warp, proj_warp);
+        cvShowImage("projWindow", mMultiplexer->Compose(patterns, proj_warp));
+        cvWaitKey(sl_params->delay);
+        mWarpShown = true;
+    }
+    return false;
+}
+
+// Estimate the camera-to-projector homography from a frame showing the projector chessboard.
+bool CalibrationJob::DetectHomography(CalibrateProCam* calibrator, IplImage* frame)
+{
+    int proj_board_n = mSlParams->proj_board_w*mSlParams->proj_board_h;
+    int corner_count = 0;
+    calibrator->detectChessboard(frame, cvSize(mSlParams->proj_board_w, mSlParams->proj_board_h), mProjCorners, &corner_count);
+    if(corner_count != proj_board_n)
+        return false;
+
+    mHomographyFound = estimateHomography(mProjCorners, (CvPoint2D32f*)mProjPoints->data.fl, proj_board_n, mCamToProj->data.db);
+    return mHomographyFound;
+}
+
+// Detect the printed chessboard and evaluate the homography used to prewarp the projector chessboard.
+// Note: As in runProjectorCalibration, the first projector corners are assumed to correspond to
+//       the first printed corners, so that the projector chessboard is warped onto the printed one.
+bool CalibrationJob::DetectCameraBoard(CalibrateProCam* calibrator, IplImage* frame, CvMat* proj_to_proj)
+{
+    int cam_board_n  = mSlParams->cam_board_w*mSlParams->cam_board_h;
+    int corner_count = 0;
+    calibrator->detectChessboard(frame, cvSize(mSlParams->cam_board_w, mSlParams->cam_board_h), mCamCorners, &corner_count);
+    if(corner_count != cam_board_n)
+        return false;
+    return EvaluateBoardHomography(proj_to_proj);
+}
+
+// Evaluate the homography used to prewarp the projector chessboard from the detected printed chessboard.
+bool CalibrationJob::EvaluateBoardHomography(CvMat* proj_to_proj)
+{
+    int proj_board_n = mSlParams->proj_board_w*mSlParams->proj_board_h;
+    double proj_to_cam[9];
+    if(!estimateHomography((CvPoint2D32f*)mProjPoints->data.fl, mCamCorners, proj_board_n, proj_to_cam))
+        return false;
+    composeHomography(mCamToProj->data.db, proj_to_cam, proj_to_proj->data.db);
+    return true;
+}
+
+// Detect the projected chessboard from frames lit by a white and a chessboard pattern.
+bool CalibrationJob::DetectProjectorBoard(CalibrateProCam* calibrator, IplImage* white_frame, IplImage* pattern_frame)
+{
+    if(!PrepareProjectorImage(white_frame, pattern_frame))
+        return false;
+
+    // Find projector chessboard corners.
+    int proj_board_n = mSlParams->proj_board_w*mSlParams->proj_board_h;
+    int corner_count = 0;
+    calibrator->detectChessboard(mProjImage, cvSize(mSlParams->proj_board_w, mSlParams->proj_board_h), mProjCorners, &corner_count);
+    return corner_count == proj_board_n;
+}
+
+// Isolate the projected chessboard from frames lit by a white and a chessboard pattern (in mProjImage).
+bool CalibrationJob::PrepareProjectorImage(IplImage* white_frame, IplImage* pattern_frame)
+{
+    if(mProjImage == NULL || mProjImage->width != white_frame->width || mProjImage->height != white_frame->height){
+        if(mProjImage != NULL)
+            cvReleaseImage(&mProjImage);
+        mProjImage = cvCreateImage(cvGetSize(white_frame), IPL_DEPTH_8U, 1);
+    }
+
+    // Apply background subtraction and invert chessboard image.
+    cvSub(white_frame, pattern_frame, mProjImage);
+    double min_val, max_val;
+    cvMinMaxLoc(mProjImage, &min_val, &max_val);
+    if(max_val <= min_val)
+        return false;
+    cvConvertScale(mProjImage, mProjImage, -255.0/(max_val-min_val), 255.0+((255.0*min_val)/(max_val-min_val)));
+    return true;
+}
+
+// Check that the projected chessboard lies on the printed chessboard (within its outer squares).
+bool CalibrationJob::IsOnPrintedBoard()
+{
+    int cam_board_n  = mSlParams->cam_board_w*mSlParams->cam_board_h;
+    int proj_board_n = mSlParams->proj_board_w*mSlParams->proj_board_h;
+
+    // Map the projected corners onto the printed chessboard (in squares).
+    CvPoint2D32f* grid = new CvPoint2D32f[cam_board_n];
+    for(int j=0; j<cam_board_n; j++)
+        grid[j] = cvPoint2D32f(j%mSlParams->cam_board_w, j/mSlParams->cam_board_w);
+    double cam_to_board[9];
+    bool inside = estimateHomography(mCamCorners, grid, cam_board_n, cam_to_board);
+    delete[] grid;
+    for(int j=0; inside && j<proj_board_n; j++){
+        CvPoint2D32f p = applyHomography(cam_to_board, mProjCorners[j]);
+        inside = (p.x > -1 && p.x < mSlParams->cam_board_w && p.y > -1 && p.y < mSlParams->cam_board_h);
+    }
+    return inside;
+}
+
+// Score the most recently detected chessboards (white-lit camera frame).
+bool CalibrationJob::ScoreBoard(IplImage* white_frame)
+{
+    if(!mSlParams->board_scoring)
+        return true;
+    struct slBoardScore score;
+    if(!mScorer->Score(white_frame, mCamCorners, mProjCorners, &score)){
+        printf("Board rejected (%s): sharpness %.0f, residuals %.3f/%.3f squares, pose difference %.3f.\n",
+            score.reason, score.sharpness, score.cam_residual, score.proj_residual, score.difference);
+        return false;
+    }
+    return true;
+}
+
+// Add the most recently detected chessboards to the observations.
+void CalibrationJob::AddBoard(CvMat* proj_to_proj, IplImage* cam_image)
+{
+    int cam_board_n  = mSlParams->cam_board_w*mSlParams->cam_board_h;
+    int proj_board_n = mSlParams->proj_board_w*mSlParams->proj_board_h;
+    int b = mObs.n_boards;
+
+    // Add camera and projector chessboard corners (camera pixels).
+    for(int j=0; j<cam_board_n; j++){
+        CV_MAT_ELEM(*mObs.cam_image_points, float, b*cam_board_n+j, 0) = mCamCorners[j].x;
+        CV_MAT_ELEM(*mObs.cam_image_points, float, b*cam_board_n+j, 1) = mCamCorners[j].y;
+    }
+    for(int j=0; j<proj_board_n; j++){
+        CV_MAT_ELEM(*mObs.proj_image_points, float, b*proj_board_n+j, 0) = mProjCorners[j].x;
+        CV_MAT_ELEM(*mObs.proj_image_points, float, b*proj_board_n+j, 1) = mProjCorners[j].y;
+    }
+
+    // Add projector chessboard corners (projector pixels they were projected from).
+    applyHomography(proj_to_proj->data.db, (CvPoint2D32f*)mProjPoints->data.fl,
+        (CvPoint2D32f*)&CV_MAT_ELEM(*mObs.proj_pixel_points, float, b*proj_board_n, 0), proj_board_n);
+
+    mObs.cam_images[b]  = cvCloneImage(cam_image);
+    mObs.proj_images[b] = cvCloneImage(mProjImage);
+    mScorer->Accept(mCamCorners);
+    mGuide->Accept(mCamCorners, mProjCorners, (CvPoint2D32f*)&CV_MAT_ELEM(*mObs.proj_pixel_points, float, b*proj_board_n, 0));
+    mObs.n_boards++;
+}
+
+// Check the acceptance criteria and write the job report.
+int CalibrationJob::Report(struct slCalibResult* result)
+{
+    struct slParams* sl_params = mSlParams;
+
+    // Evaluate acceptance criteria.
+    bool accepted = true;
+    if(mObs.n_boards < mJob.min_boards){
+        printf("+ Rejected: %d boards captured (minimum of %d).\n", mObs.n_boards, mJob.min_boards);
+        accepted = false;
+    }
+    if(mJob.calibrate_both && mJob.max_cam_error > 0 && !(result->cam_error <= mJob.max_cam_error)){
+        printf("+ Rejected: camera error %f (maximum of %f).\n", result->cam_error, mJob.max_cam_error);
+        accepted = false;
+    }
+    if(mJob.max_proj_error > 0 && !(result->proj_error <= mJob.max_proj_error)){
+        printf("+ Rejected: projector error %f (maximum of %f).\n", result->proj_error, mJob.max_proj_error);
+        accepted = false;
+    }
+    if(mJob.max_depth_error > 0 && !(result->max_depth_error > 0 && result->max_depth_error <= mJob.max_depth_error)){
+        printf("+ Rejected: expected depth error %f mm (maximum of %f mm).\n", result->max_depth_error, mJob.max_depth_error);
+        accepted = false;
+    }
+
+    // Display timing and results.
+    printf("***Calibration job (%s):\n", mJob.source);
+    printf("+ Boards = %d\n", mObs.n_boards);
+    if(mScorer != NULL && (mSlParams->board_scoring || mOutlierBoards > 0))
+        printf("+ Rejected boards = %d (%d during capture, %d outliers)\n",
+            mScorer->GetRejectedCount() + mOutlierBoards, mScorer->GetRejectedCount(), mOutlierBoards);
+    if(mJob.calibrate_both)
+        printf("+ Camera error = %f\n", result->cam_error);
+    printf("+ Projector error = %f\n", result->proj_error);
+    if(result->max_depth_error > 0)
+        printf("+ Expected depth error = %f mm (mean %f mm)\n", result->max_depth_error, result->mean_depth_error);
+    if(result->bundle_iterations > 0)
+        printf("+ Bundle adjustment = %d iterations (%.1f ms each)\n", result->bundle_iterations,
+            result->bundle_solve_time/result->bundle_iterations);
+    printf("+ Timing (ms) = \n");
+    for(int i=0; i<NUM_PHASES; i++)
+        printf("   %-16s %10.1f\n", PHASE_NAMES[i], mPhaseTime[i]);
+    printf(accepted ? "Calibration job was accepted.\n" : "Calibration job was rejected!\n");
+
+    // Write job report.
+    char str[1024];
+    sprintf(str, "%s\\calib\\job_report.xml", sl_params->outdir);
+    CvFileStorage* fs = cvOpenFileStorage(str, 0, CV_STORAGE_WRITE);
+    if(fs != NULL){
+        cvWriteString(fs, "source",                mJob.source, 1);
+        cvWriteInt(fs,    "boards",                mObs.n_boards);
+        cvWriteReal(fs,   "camera_error_pixels",    result->cam_error);
+        cvWriteReal(fs,   "projector_error_pixels", result->proj_error);
+        cvWriteInt(fs,    "bundle_iterations",     result->bundle_iterations);
+        if(result->max_depth_error > 0){
+            cvWriteReal(fs, "maximum_depth_error_mm", result->max_depth_error);
+            cvWriteReal(fs, "mean_depth_error_mm",    result->mean_depth_error);
+        }
+        cvWriteInt(fs,    "rejected_boards",       (mScorer != NULL ? mScorer->GetRejectedCount() : 0) + mOutlierBoards);
+        if(mGuide != NULL && mGuide->GetUncertainty() < DBL_MAX)
+            cvWriteReal(fs, "calibration_uncertainty_percent", 100.0*mGuide->GetUncertainty());
+        cvWriteInt(fs,    "accepted",              accepted);
+        cvStartWriteStruct(fs, "timing_ms", CV_NODE_MAP);
+        for(int i=0; i<NUM_PHASES; i++)
+            cvWriteReal(fs, PHASE_NAMES[i], mPhaseTime[i]);
+        cvEndWriteStruct(fs);
+        cvReleaseFileStorage(&fs);
+    }
+    return accepted ? 0 : -1;
+}
@@ -0,0 +1,166 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\CalibrationJob.h
+///
+/// @brief  Declares the non-interactive (scripted) calibration job.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "CalibrateProCam.h"
+#include "Camera.h"
+#include "BoardQuality.h"
+#include "CaptureGuide.h"
+#include "ChannelMultiplexer.h"
+#include "PatternEngine.h"
+#include "PhotometricCalibration.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slCalibJob
+///
+/// @brief  Description of a scripted calibration run and its acceptance criteria.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slCalibJob{
+	char   source[1024];            // "camera", or the file name of a recorded session to replay
+	char   record[1024];            // file name to record the captured session to (empty = disabled)
+	bool   calibrate_both;          // calibrate camera and projector (otherwise projector only)
+	int    n_boards;                // number of calibration boards to capture
+	int    board_delay;             // delay after each accepted board, to reposition the board (in ms)
+	int    max_attempts;            // maximum number of frames tried per board (0 = unlimited)
+	int    min_boards;              // minimum number of boards for the calibration to be accepted
+	double max_cam_error;           // maximum accepted camera reprojection error (pixels, 0 = any)
+	double max_proj_error;          // maximum accepted projector reprojection error (pixels, 0 = any)
+	double max_depth_error;         // maximum accepted expected depth error over the working volume (mm, 0 = any)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  CalibrationJob
+///
+/// @brief  Runs projector-camera calibration end-to-end without user interaction.
+///
+/// The job captures chessboards from a camera (accepting every board for which both the printed
+/// and the projected chessboard are found) or replays a session recorded by a previous job, then
+/// solves for the calibration and checks it against the acceptance criteria. The time spent in
+/// each phase is printed and written to calib\job_report.xml, so that unattended runs can be
+/// compared for regressions in solve time and accuracy.
+///
+/// With multiplexed capture enabled, both chessboards of a board are captured from one projector
+/// frame (see ChannelMultiplexer). The projector chessboard stays warped for the previous board,
+/// and is only rewarped when it is not found on the printed chessboard: a board then takes one
+/// projector change (or none), instead of the red, white and pattern frames of the sequential capture.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class CalibrationJob
+{
+public:
+    CalibrationJob(struct slParams* sl_params);
+
+    ~CalibrationJob();
+
+    // Read a job description (chessboard parameters in the job override the configuration).
+    int Load(const char* filename);
+
+    // Capture (or replay) and solve the calibration.
+    // Note: Returns 0 if the calibration meets the acceptance criteria, -1 otherwise.
+    int Run(CalibrateProCam* calibrator, Camera* camera, struct slCalib* sl_calib);
+
+    // Accessor methods
+    bool UsesCamera() { return strcmp(mJob.source, "camera") == 0; };
+    struct slCalibJob* GetJob() { return &mJob; };
+
+private:
+    enum { PHASE_SETUP, PHASE_PHOTOMETRY, PHASE_HOMOGRAPHY, PHASE_CAPTURE, PHASE_DETECTION,
+           PHASE_CAMERA_SOLVE, PHASE_PROJECTOR_SOLVE, PHASE_BUNDLE_SOLVE, PHASE_OUTPUT, PHASE_TOTAL, NUM_PHASES };
+
+    // Create the projector chessboard and (re)create the calibration output directories.
+    int Setup(CalibrateProCam* calibrator);
+
+    // Capture the projector-camera homography and the calibration boards from a camera.
+    int CaptureFromCamera(CalibrateProCam* calibrator, Camera* camera);
+
+    // Replay the homography and calibration boards from a recorded session.
+    int CaptureFromSession(CalibrateProCam* calibrator);
+
+    // Estimate the camera-to-projector homography from a frame showing the projector chessboard.
+    bool DetectHomography(CalibrateProCam* calibrator, IplImage* frame);
+
+    // Capture a board with the red, white and pattern frames (the projector chessboard warped onto the printed one).
+    // Note: Frames are returned (and must be released) even if the board is not found.
+    bool CaptureSequentialBoard(CalibrateProCam* calibrator, Camera* camera, PatternEngine* patterns, IplImage* proj_warp,
+                                CvMat* proj_to_proj, IplImage** red_frame, IplImage** white_frame, IplImage** pattern_frame, double& detection_time);
+
+    // Capture a board from one projector frame multiplexing the illumination and the projector chessboard.
+    // Note: On return, proj_to_proj is the homography of the displayed projector chessboard; the separated
+    //       frames are returned (and must be released) even if the board is not found.
+    bool CaptureMultiplexedBoard(CalibrateProCam* calibrator, Camera* camera, PatternEngine* patterns, IplImage* proj_warp,
+                                 CvMat* proj_to_proj, IplImage** illumination_frame, IplImage** pattern_frame, double& detection_time);
+
+    // Detect the printed chessboard and evaluate the homography used to prewarp the projector chessboard.
+    bool DetectCameraBoard(CalibrateProCam* calibrator, IplImage* frame, CvMat* proj_to_proj);
+
+    // Evaluate the homography used to prewarp the projector chessboard from the detected printed chessboard.
+    // Note: proj_to_proj must be a 3x3 CV_64FC1 matrix; returns false if the corners are degenerate.
+    bool EvaluateBoardHomography(CvMat* proj_to_proj);
+
+    // Detect the projected chessboard from frames lit by a white and a chessboard pattern.
+    bool DetectProjectorBoard(CalibrateProCam* calibrator, IplImage* white_frame, IplImage* pattern_frame);
+
+    // Isolate the projected chessboard from frames lit by a white and a chessboard pattern (in mProjImage).
+    bool PrepareProjectorImage(IplImage* white_frame, IplImage* pattern_frame);
+
+    // Check that the projected chessboard lies on the printed chessboard (within its outer squares).
+    bool IsOnPrintedBoard();
+
+    // Score the most recently detected chessboards (white-lit camera frame).
+    // Note: Returns true if the board should be added (always, if board scoring is disabled).
+    bool ScoreBoard(IplImage* white_frame);
+
+    // Add the most recently detected chessboards to the observations.
+    void AddBoard(CvMat* proj_to_proj, IplImage* cam_image);
+
+    // Check the acceptance criteria and write the job report.
+    int Report(struct slCalibResult* result);
+
+    /// <summary> Job description. </summary>
+    struct slCalibJob mJob;
+
+    /// <summary> Configuration (board parameters are overridden by the job), and the calibration being run. </summary>
+    struct slParams* mSlParams;
+    struct slCalib* mSlCalib;
+
+    /// <summary> Projector chessboard pattern and its corners (projector pixels, continuous Nx1 CV_32FC2). </summary>
+    IplImage* mProjChessboard;
+    CvMat* mProjPoints;
+
+    /// <summary> Camera-to-projector homography (valid once mHomographyFound). </summary>
+    CvMat* mCamToProj;
+    bool mHomographyFound;
+
+    /// <summary> Chessboard corners detected in the current board. </summary>
+    CvPoint2D32f* mCamCorners;
+    CvPoint2D32f* mProjCorners;
+    IplImage* mProjImage;
+
+    /// <summary> Accumulated chessboard observations. </summary>
+    struct slCalibObservations mObs;
+
+    /// <summary> Board quality scoring, and the number of boards removed as outliers. </summary>
+    BoardScorer* mScorer;
+    int mOutlierBoards;
+
+    /// <summary> Coverage and uncertainty of the accepted boards (capture stops early once certain enough). </summary>
+    CaptureGuide* mGuide;
+
+    /// <summary> Colour-channel multiplexing (multiplexed capture), and whether a projector chessboard is displayed in it. </summary>
+    ChannelMultiplexer* mMultiplexer;
+    bool mWarpShown;
+
+    /// <summary> Time spent in each phase (in ms). </summary>
+    double mPhaseTime[NUM_PHASES];
+};
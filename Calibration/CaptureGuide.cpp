@@ -0,0 +1,516 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\CaptureGuide.cpp
+///
+/// @brief  Implements the coverage maps and next-pose guidance for calibration capture.
+///
+/// Overview:
+///   Homographies are estimated between board coordinates (centred, and scaled to a half-diagonal of
+///   one) and normalized image coordinates (centred, and scaled by half the larger image dimension),
+///   so the closed-form constraints are well conditioned and the uncertainty does not depend on the
+///   image resolution. The board coordinates of the projected corners are found by mapping them
+///   from the camera through the inverse of the printed board's homography. Board tilts are
+///   estimated with the principal point at the image centre, and the focal length of the current
+///   closed-form solution (or a 53 degree field of view, until it is available). The suggested
+///   position is the window (of the mean size of the accepted boards) with the most novel camera
+///   and projector cells; the projector cells are reached through a camera-to-projector homography
+///   fitted to all projected corners so far, which is only approximate (it varies with depth), but
+///   sufficient to steer the board towards the uncovered parts of the projector image.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "CaptureGuide.h"
+#include "Homography.h"
+
+#include <float.h>
+
+// Tilt (in degrees) beyond which a board counts as tilted (about either image axis).
+static const double TILT_ANGLE = 15.0;
+
+// Foreshortening of the far edge of the suggested outline (for tilted poses).
+static const double FAR_EDGE_SCALE = 0.7;
+
+// Order in which empty tilt bins are suggested: frontal, single-axis tilts, then compound tilts.
+static const int TILT_ORDER[9] = { 4, 1, 3, 5, 7, 0, 2, 6, 8 };
+
+// Normalize image points (centred, and scaled by half the larger image dimension).
+static void normalizePoints(const CvPoint2D32f* src, int n, CvSize image_size, CvPoint2D32f* dst)
+{
+    double scale = 2.0/MAX(image_size.width, image_size.height);
+    for(int i=0; i<n; i++)
+        dst[i] = cvPoint2D32f((src[i].x-0.5*image_size.width)*scale, (src[i].y-0.5*image_size.height)*scale);
+}
+
+// Evaluate the RMS distance of points from their centroid.
+static double pointSpread(const CvPoint2D32f* p, int n)
+{
+    double cx = 0, cy = 0, sum = 0;
+    for(int i=0; i<n; i++){
+        cx += p[i].x;
+        cy += p[i].y;
+    }
+    cx /= n;
+    cy /= n;
+    for(int i=0; i<n; i++)
+        sum += (p[i].x-cx)*(p[i].x-cx) + (p[i].y-cy)*(p[i].y-cy);
+    return sqrt(sum/n);
+}
+
+// Shrink an edge of an outline towards its midpoint.
+static void shrinkEdge(CvPoint2D32f* a, CvPoint2D32f* b, double scale)
+{
+    double mx = 0.5*(a->x+b->x), my = 0.5*(a->y+b->y);
+    *a = cvPoint2D32f(mx + scale*(a->x-mx), my + scale*(a->y-my));
+    *b = cvPoint2D32f(mx + scale*(b->x-mx), my + scale*(b->y-my));
+}
+
+// Evaluate the closed-form constraint vector v_ij of two homography columns (Zhang).
+static void constraintRow(const double a[3], const double c[3], double v[6])
+{
+    v[0] = a[0]*c[0];
+    v[1] = a[0]*c[1] + a[1]*c[0];
+    v[2] = a[1]*c[1];
+    v[3] = a[2]*c[0] + a[0]*c[2];
+    v[4] = a[2]*c[1] + a[1]*c[2];
+    v[5] = a[2]*c[2];
+}
+
+// Find the focal length (mean of both axes) from the closed-form solution b = (B11, B12, B22, B13, B23, B33).
+// Note: Returns -1 if the solution is not a valid camera.
+static double closedFormFocal(const double b[6])
+{
+    double den = b[0]*b[2] - b[1]*b[1];
+    if(b[0] == 0 || den == 0)
+        return -1.0;
+    double v0 = (b[1]*b[3] - b[0]*b[4])/den;
+    double lambda = b[5] - (b[3]*b[3] + v0*(b[1]*b[3] - b[0]*b[4]))/b[0];
+    double alpha2 = lambda/b[0], beta2 = lambda*b[0]/den;
+    if(alpha2 <= 0 || beta2 <= 0)
+        return -1.0;
+    return 0.5*(sqrt(alpha2)+sqrt(beta2));
+}
+
+// Constructor
+CoverageGrid::CoverageGrid()
+{
+    mImageSize = cvSize(COLS, ROWS);
+    Reset();
+}
+
+// Set the size of the image plane (and clear the grid).
+void CoverageGrid::SetImageSize(CvSize image_size)
+{
+    mImageSize = image_size;
+    Reset();
+}
+
+// Clear the grid.
+void CoverageGrid::Reset()
+{
+    for(int i=0; i<COLS*ROWS; i++)
+        mCounts[i] = 0;
+}
+
+// Add a board (outline of four corners, in order around the board).
+void CoverageGrid::Add(const CvPoint2D32f outline[4])
+{
+    bool cells[COLS*ROWS];
+    CellsInside(outline, cells);
+    for(int i=0; i<COLS*ROWS; i++)
+        mCounts[i] += cells[i] ? 1 : 0;
+}
+
+// Count the cells inside the outline that are not covered yet.
+int CoverageGrid::CountNew(const CvPoint2D32f outline[4])
+{
+    bool cells[COLS*ROWS];
+    CellsInside(outline, cells);
+    int count = 0;
+    for(int i=0; i<COLS*ROWS; i++)
+        count += (cells[i] && mCounts[i] == 0) ? 1 : 0;
+    return count;
+}
+
+// Evaluate the novelty of an outline (the cells inside, each weighted by 1/(1+number of boards covering it)).
+double CoverageGrid::Novelty(const CvPoint2D32f outline[4])
+{
+    bool cells[COLS*ROWS];
+    CellsInside(outline, cells);
+    double novelty = 0;
+    for(int i=0; i<COLS*ROWS; i++)
+        novelty += cells[i] ? 1.0/(1+mCounts[i]) : 0;
+    return novelty;
+}
+
+// Evaluate the fraction of cells covered by at least one board.
+double CoverageGrid::GetCoverage()
+{
+    int covered = 0;
+    for(int i=0; i<COLS*ROWS; i++)
+        covered += (mCounts[i] > 0) ? 1 : 0;
+    return (double)covered/(COLS*ROWS);
+}
+
+// Find the cells whose centres lie inside the outline.
+void CoverageGrid::CellsInside(const CvPoint2D32f outline[4], bool* cells)
+{
+    // A cell is inside if its centre is on the same side of every edge of the outline.
+    for(int r=0; r<ROWS; r++){
+        for(int c=0; c<COLS; c++){
+            CvPoint2D32f p = GetCellCentre(c, r);
+            int positive = 0, negative = 0;
+            for(int k=0; k<4; k++){
+                const CvPoint2D32f& a = outline[k];
+                const CvPoint2D32f& b = outline[(k+1)%4];
+                double cross = (double)(b.x-a.x)*(p.y-a.y) - (double)(b.y-a.y)*(p.x-a.x);
+                positive += (cross > 0) ? 1 : 0;
+                negative += (cross < 0) ? 1 : 0;
+            }
+            cells[r*COLS+c] = (positive == 0 || negative == 0);
+        }
+    }
+}
+
+// Constructor
+CaptureGuide::CaptureGuide(struct slParams* sl_params, bool calibrate_camera)
+{
+    mSlParams        = sl_params;
+    mCalibrateCamera = calibrate_camera;
+    int cam_board_w  = sl_params->cam_board_w;
+    int cam_board_h  = sl_params->cam_board_h;
+    int cam_board_n  = cam_board_w*cam_board_h;
+    int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+    mCamObject      = new CvPoint2D32f[cam_board_n];
+    mProjObject     = new CvPoint2D32f[proj_board_n];
+    mCamNormalized  = new CvPoint2D32f[MAX(cam_board_n, proj_board_n)];
+    mProjNormalized = new CvPoint2D32f[proj_board_n];
+
+    // Define the printed chessboard corners (centred, and scaled to a half-diagonal of one).
+    double w_mm = sl_params->cam_board_w_mm, h_mm = sl_params->cam_board_h_mm;
+    double radius = 0.5*sqrt((cam_board_w-1)*w_mm*(cam_board_w-1)*w_mm + (cam_board_h-1)*h_mm*(cam_board_h-1)*h_mm);
+    for(int i=0; i<cam_board_n; i++)
+        mCamObject[i] = cvPoint2D32f((i%cam_board_w - 0.5*(cam_board_w-1))*w_mm/radius,
+                                     (i/cam_board_w - 0.5*(cam_board_h-1))*h_mm/radius);
+
+    mCamCoverage.SetImageSize(cvSize(sl_params->cam_w, sl_params->cam_h));
+    mProjCoverage.SetImageSize(cvSize(sl_params->proj_w, sl_params->proj_h));
+    Reset();
+}
+
+// Destructor
+CaptureGuide::~CaptureGuide()
+{
+    delete[] mCamObject;
+    delete[] mProjObject;
+    delete[] mCamNormalized;
+    delete[] mProjNormalized;
+}
+
+// Forget the accepted boards.
+void CaptureGuide::Reset()
+{
+    mCamCoverage.Reset();
+    mProjCoverage.Reset();
+    for(int i=0; i<TILTS; i++)
+        mTiltCounts[i] = 0;
+    mNumBoards   = 0;
+    mBoardWidth  = 0;
+    mBoardHeight = 0;
+    for(int i=0; i<INFO*INFO; i++){
+        mCamInfo[i]  = 0;
+        mProjInfo[i] = 0;
+    }
+    mFocal           = 2.0;
+    mCamUncertainty  = DBL_MAX;
+    mProjUncertainty = DBL_MAX;
+    mCamPoints.clear();
+    mProjPoints.clear();
+    mCamToProjFound = false;
+    UpdateSuggestion();
+}
+
+// Add an accepted board (printed and projected corners in camera pixels, projector pixels of the projected corners).
+void CaptureGuide::Accept(const CvPoint2D32f* cam_corners, const CvPoint2D32f* proj_corners, const CvPoint2D32f* proj_pixels)
+{
+    int cam_board_w  = mSlParams->cam_board_w;
+    int cam_board_n  = cam_board_w*mSlParams->cam_board_h;
+    int proj_board_w = mSlParams->proj_board_w;
+    int proj_board_n = proj_board_w*mSlParams->proj_board_h;
+    CvSize cam_size  = mCamCoverage.GetImageSize();
+    CvSize proj_size = mProjCoverage.GetImageSize();
+
+    // Update the coverage maps and the mean board size.
+    CvPoint2D32f cam_outline[4]  = { cam_corners[0], cam_corners[cam_board_w-1], cam_corners[cam_board_n-1], cam_corners[cam_board_n-cam_board_w] };
+    CvPoint2D32f proj_outline[4] = { proj_pixels[0], proj_pixels[proj_board_w-1], proj_pixels[proj_board_n-1], proj_pixels[proj_board_n-proj_board_w] };
+    mCamCoverage.Add(cam_outline);
+    mProjCoverage.Add(proj_outline);
+    double x_min = DBL_MAX, y_min = DBL_MAX, x_max = -DBL_MAX, y_max = -DBL_MAX;
+    for(int i=0; i<cam_board_n; i++){
+        x_min = MIN(x_min, cam_corners[i].x); x_max = MAX(x_max, cam_corners[i].x);
+        y_min = MIN(y_min, cam_corners[i].y); y_max = MAX(y_max, cam_corners[i].y);
+    }
+    mBoardWidth  = (mBoardWidth*mNumBoards  + (x_max-x_min))/(mNumBoards+1);
+    mBoardHeight = (mBoardHeight*mNumBoards + (y_max-y_min))/(mNumBoards+1);
+    mNumBoards++;
+
+    // Add the closed-form constraints of the printed chessboard, and its tilt.
+    double cam_noise = mSlParams->guidance_corner_noise*2.0/MAX(cam_size.width, cam_size.height);
+    double H_cam[9], H_cam_inv[9], H_proj[9];
+    normalizePoints(cam_corners, cam_board_n, cam_size, mCamNormalized);
+    if(estimateHomography(mCamObject, mCamNormalized, cam_board_n, H_cam) && invertHomography(H_cam, H_cam_inv)){
+        AddConstraints(H_cam, cam_noise, cam_board_n, mCamInfo);
+        mTiltCounts[TiltBin(H_cam)]++;
+
+        // Add the closed-form constraints of the projected chessboard (from its board coordinates).
+        normalizePoints(proj_corners, proj_board_n, cam_size, mCamNormalized);
+        normalizePoints(proj_pixels, proj_board_n, proj_size, mProjNormalized);
+        applyHomography(H_cam_inv, mCamNormalized, mProjObject, proj_board_n);
+        double proj_noise = cam_noise*pointSpread(mProjNormalized, proj_board_n)/MAX(pointSpread(mCamNormalized, proj_board_n), DBL_EPSILON);
+        if(proj_noise > 0 && estimateHomography(mProjObject, mProjNormalized, proj_board_n, H_proj))
+            AddConstraints(H_proj, proj_noise, proj_board_n, mProjInfo);
+    }
+
+    // Refit the camera-to-projector homography to all projected corners.
+    mCamPoints.insert(mCamPoints.end(), proj_corners, proj_corners+proj_board_n);
+    mProjPoints.insert(mProjPoints.end(), proj_pixels, proj_pixels+proj_board_n);
+    mCamToProjFound = estimateHomography(&mCamPoints[0], &mProjPoints[0], (int)mCamPoints.size(), mCamToProj);
+
+    // Update the uncertainties, and the focal length estimate (from the closed-form camera intrinsics).
+    double focal;
+    mCamUncertainty  = FocalUncertainty(mCamInfo, &focal);
+    if(mCamUncertainty < DBL_MAX && focal > 0.2 && focal < 20.0)
+        mFocal = focal;
+    mProjUncertainty = FocalUncertainty(mProjInfo, &focal);
+    UpdateSuggestion();
+}
+
+// Check if the calibration uncertainty is below the stopping threshold.
+// Note: Capture never stops early if guidance is disabled.
+bool CaptureGuide::IsComplete()
+{
+    return mSlParams->guidance &&
+           mSlParams->guidance_stop_uncertainty > 0 &&
+           mNumBoards >= mSlParams->guidance_min_boards &&
+           100.0*GetUncertainty() < mSlParams->guidance_stop_uncertainty;
+}
+
+// Draw the uncovered camera cells, the suggested next pose and the capture status (on a camera-sized BGR image).
+void CaptureGuide::Draw(IplImage* image)
+{
+    double scale = (double)image->width/mCamCoverage.GetImageSize().width;
+    int thickness = MAX(1, image->width/640);
+
+    // Mark the centres of the uncovered camera cells.
+    for(int r=0; r<CoverageGrid::ROWS; r++){
+        for(int c=0; c<CoverageGrid::COLS; c++){
+            if(mCamCoverage.GetCount(c, r) > 0)
+                continue;
+            CvPoint2D32f p = mCamCoverage.GetCellCentre(c, r);
+            cvCircle(image, cvPoint(cvRound(scale*p.x), cvRound(scale*p.y)), 2*thickness, CV_RGB(255,0,0), -1);
+        }
+    }
+
+    // Draw the suggested outline of the next board.
+    for(int k=0; k<4; k++){
+        const CvPoint2D32f& a = mSuggestedOutline[k];
+        const CvPoint2D32f& b = mSuggestedOutline[(k+1)%4];
+        cvLine(image, cvPoint(cvRound(scale*a.x), cvRound(scale*a.y)), cvPoint(cvRound(scale*b.x), cvRound(scale*b.y)),
+            CV_RGB(0,255,0), 2*thickness);
+    }
+
+    // Display the capture status.
+    char str[128];
+    CvFont font;
+    double font_scale = MAX(0.4, image->width/1280.0);
+    cvInitFont(&font, CV_FONT_HERSHEY_SIMPLEX, font_scale, font_scale, 0, thickness);
+    int line_height = cvRound(30*font_scale);
+    sprintf(str, "Coverage: camera %.0f%%, projector %.0f%%, tilts %d of %d",
+        100.0*mCamCoverage.GetCoverage(), 100.0*mProjCoverage.GetCoverage(), GetTiltCount(), (int)TILTS);
+    cvPutText(image, str, cvPoint(line_height/2, line_height), &font, CV_RGB(255,255,0));
+    if(GetUncertainty() < DBL_MAX)
+        sprintf(str, "Uncertainty: %.2f%%", 100.0*GetUncertainty());
+    else
+        sprintf(str, "Uncertainty: (more boards needed)");
+    cvPutText(image, str, cvPoint(line_height/2, 2*line_height), &font, CV_RGB(255,255,0));
+    cvPutText(image, mSuggestion, cvPoint(line_height/2, 3*line_height), &font, CV_RGB(0,255,0));
+}
+
+// Display the coverage, diversity and uncertainty to the console.
+void CaptureGuide::DisplayStatistics()
+{
+    printf("Capture guidance: %d boards, camera coverage %.0f%%, projector coverage %.0f%%, %d of %d tilts",
+        mNumBoards, 100.0*mCamCoverage.GetCoverage(), 100.0*mProjCoverage.GetCoverage(), GetTiltCount(), (int)TILTS);
+    if(GetUncertainty() < DBL_MAX)
+        printf(", uncertainty %.2f%%.\n", 100.0*GetUncertainty());
+    else
+        printf(".\n");
+}
+
+// Count the tilt bins used by the accepted boards.
+int CaptureGuide::GetTiltCount()
+{
+    int count = 0;
+    for(int i=0; i<TILTS; i++)
+        count += (mTiltCounts[i] > 0) ? 1 : 0;
+    return count;
+}
+
+// Add the closed-form intrinsics constraints of a homography (normalized coordinates) to an information matrix.
+void CaptureGuide::AddConstraints(const double H[9], double noise, int n, double info[INFO*INFO])
+{
+    // Scale the homography so its first two columns have unit mean length.
+    double scale = sqrt(0.5*(H[0]*H[0]+H[3]*H[3]+H[6]*H[6] + H[1]*H[1]+H[4]*H[4]+H[7]*H[7]));
+    if(scale <= 0 || noise <= 0)
+        return;
+    double h[2][3];
+    for(int i=0; i<2; i++)
+        for(int k=0; k<3; k++)
+            h[i][k] = H[3*k+i]/scale;
+
+    // Constraints on the image of the absolute conic: v12'b = 0 and (v11-v22)'b = 0.
+    double v[2][INFO], v11[INFO], v22[INFO];
+    constraintRow(h[0], h[1], v[0]);
+    constraintRow(h[0], h[0], v11);
+    constraintRow(h[1], h[1], v22);
+    for(int k=0; k<INFO; k++)
+        v[1][k] = v11[k] - v22[k];
+
+    // Accumulate the outer products, weighted by the inverse variance of the constraints.
+    // Note: A homography fitted to n points with noise sigma has a noise of about sigma/sqrt(n) in each
+    //       element, i.e., sigma/(scale*sqrt(n)) once scaled, and about twice that in each constraint.
+    double weight = n*scale*scale/(4.0*noise*noise);
+    for(int i=0; i<2; i++)
+        for(int r=0; r<INFO; r++)
+            for(int c=0; c<INFO; c++)
+                info[r*INFO+c] += weight*v[i][r]*v[i][c];
+}
+
+// Evaluate the relative uncertainty of the closed-form focal length (and the focal length itself).
+double CaptureGuide::FocalUncertainty(const double info[INFO*INFO], double* focal)
+{
+    // The solution is the eigenvector of the smallest eigenvalue (of the information matrix).
+    double a[INFO*INFO], w[INFO], vt[INFO*INFO], b[INFO];
+    memcpy(a, info, sizeof(a));
+    CvMat A  = cvMat(INFO, INFO, CV_64FC1, a);
+    CvMat W  = cvMat(INFO, 1,    CV_64FC1, w);
+    CvMat Vt = cvMat(INFO, INFO, CV_64FC1, vt);
+    cvSVD(&A, &W, NULL, &Vt, CV_SVD_V_T);
+    for(int k=0; k<INFO; k++)
+        b[k] = vt[(INFO-1)*INFO+k];
+    *focal = closedFormFocal(b);
+    if(*focal <= 0 || w[INFO-2] <= DBL_EPSILON*w[0])
+        return DBL_MAX;
+
+    // Propagate the covariance of the solution (the inverse information, orthogonal to the solution) to the focal length.
+    double gradient[INFO], variance = 0;
+    for(int k=0; k<INFO; k++){
+        double b_plus[INFO], b_minus[INFO];
+        memcpy(b_plus,  b, sizeof(b));
+        memcpy(b_minus, b, sizeof(b));
+        b_plus[k]  += 1e-6;
+        b_minus[k] -= 1e-6;
+        gradient[k] = (closedFormFocal(b_plus) - closedFormFocal(b_minus))/2e-6;
+    }
+    for(int e=0; e<INFO-1; e++){
+        double projection = 0;
+        for(int k=0; k<INFO; k++)
+            projection += gradient[k]*vt[e*INFO+k];
+        variance += projection*projection/w[e];
+    }
+    return sqrt(variance)/(*focal);
+}
+
+// Find the tilt bin of a board (from its homography in normalized camera coordinates).
+int CaptureGuide::TiltBin(const double H[9])
+{
+    // Board axes (with the principal point at the image centre), and the board normal (pointing away from the camera).
+    double r1[3] = { H[0]/mFocal, H[3]/mFocal, H[6] };
+    double r2[3] = { H[1]/mFocal, H[4]/mFocal, H[7] };
+    double n[3]  = { r1[1]*r2[2]-r1[2]*r2[1], r1[2]*r2[0]-r1[0]*r2[2], r1[0]*r2[1]-r1[1]*r2[0] };
+    if(n[2] < 0){
+        n[0] = -n[0];
+        n[1] = -n[1];
+        n[2] = -n[2];
+    }
+
+    // Bin the tilts about the vertical and horizontal axes (bin 0: right/bottom edge away, bin 2: left/top edge away).
+    double tilt_x = atan2(n[0], n[2])*180.0/CV_PI;
+    double tilt_y = atan2(n[1], n[2])*180.0/CV_PI;
+    int col = (tilt_x < -TILT_ANGLE) ? 0 : (tilt_x > TILT_ANGLE) ? 2 : 1;
+    int row = (tilt_y < -TILT_ANGLE) ? 0 : (tilt_y > TILT_ANGLE) ? 2 : 1;
+    return row*3+col;
+}
+
+// Choose the suggested next pose (position and tilt).
+void CaptureGuide::UpdateSuggestion()
+{
+    CvSize cam_size = mCamCoverage.GetImageSize();
+
+    // Suggest the least used tilt.
+    mSuggestedTilt = TILT_ORDER[0];
+    for(int i=1; i<TILTS; i++)
+        if(mTiltCounts[TILT_ORDER[i]] < mTiltCounts[mSuggestedTilt])
+            mSuggestedTilt = TILT_ORDER[i];
+
+    // Suggest the window (of the mean board size) with the most novel camera and projector cells.
+    double w = (mNumBoards > 0) ? mBoardWidth  : cam_size.width/3.0;
+    double h = (mNumBoards > 0) ? mBoardHeight : cam_size.height/3.0;
+    w = MIN(MAX(w, cam_size.width/4.0),  (double)cam_size.width);
+    h = MIN(MAX(h, cam_size.height/4.0), (double)cam_size.height);
+    double best_novelty = -1;
+    CvPoint2D32f best_centre = cvPoint2D32f(0.5*cam_size.width, 0.5*cam_size.height);
+    for(int r=0; r<CoverageGrid::ROWS; r++){
+        for(int c=0; c<CoverageGrid::COLS; c++){
+            CvPoint2D32f centre = mCamCoverage.GetCellCentre(c, r);
+            centre.x = (float)MIN(MAX(centre.x, 0.5*w), cam_size.width-0.5*w);
+            centre.y = (float)MIN(MAX(centre.y, 0.5*h), cam_size.height-0.5*h);
+            CvPoint2D32f outline[4] = {
+                cvPoint2D32f(centre.x-0.5*w, centre.y-0.5*h), cvPoint2D32f(centre.x+0.5*w, centre.y-0.5*h),
+                cvPoint2D32f(centre.x+0.5*w, centre.y+0.5*h), cvPoint2D32f(centre.x-0.5*w, centre.y+0.5*h) };
+            double novelty = mCamCoverage.Novelty(outline);
+            if(mCamToProjFound){
+                CvPoint2D32f proj_outline[4];
+                applyHomography(mCamToProj, outline, proj_outline, 4);
+                novelty += mProjCoverage.Novelty(proj_outline);
+            }
+            if(novelty > best_novelty){
+                best_novelty = novelty;
+                best_centre  = centre;
+                memcpy(mSuggestedOutline, outline, sizeof(outline));
+            }
+        }
+    }
+
+    // Foreshorten the far edges of the outline (top-left, top-right, bottom-right, bottom-left).
+    int tilt_col = mSuggestedTilt%3, tilt_row = mSuggestedTilt/3;
+    if(tilt_col == 0)
+        shrinkEdge(&mSuggestedOutline[1], &mSuggestedOutline[2], FAR_EDGE_SCALE);
+    else if(tilt_col == 2)
+        shrinkEdge(&mSuggestedOutline[3], &mSuggestedOutline[0], FAR_EDGE_SCALE);
+    if(tilt_row == 0)
+        shrinkEdge(&mSuggestedOutline[2], &mSuggestedOutline[3], FAR_EDGE_SCALE);
+    else if(tilt_row == 2)
+        shrinkEdge(&mSuggestedOutline[0], &mSuggestedOutline[1], FAR_EDGE_SCALE);
+
+    // Describe the suggestion.
+    static const char* COLUMNS[3] = { "left", "centre", "right" };
+    static const char* ROWS[3]    = { "top", "middle", "bottom" };
+    static const char* EDGES_X[3] = { "right", "", "left" };
+    static const char* EDGES_Y[3] = { "bottom", "", "top" };
+    int col = MIN(2, (int)(3*best_centre.x/cam_size.width));
+    int row = MIN(2, (int)(3*best_centre.y/cam_size.height));
+    char position[32], tilt[32];
+    if(col == 1 && row == 1)
+        sprintf(position, "centre");
+    else
+        sprintf(position, "%s %s", ROWS[row], COLUMNS[col]);
+    if(tilt_col == 1 && tilt_row == 1)
+        sprintf(tilt, "facing the camera");
+    else if(tilt_col == 1)
+        sprintf(tilt, "%s edge away", EDGES_Y[tilt_row]);
+    else if(tilt_row == 1)
+        sprintf(tilt, "%s edge away", EDGES_X[tilt_col]);
+    else
+        sprintf(tilt, "%s-%s corner away", EDGES_Y[tilt_row], EDGES_X[tilt_col]);
+    sprintf(mSuggestion, "Next board: %s, %s", position, tilt);
+}
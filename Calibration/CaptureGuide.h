@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\CaptureGuide.h
+///
+/// @brief  Declares the coverage maps and next-pose guidance for calibration capture.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  CoverageGrid
+///
+/// @brief  Counts how many accepted boards cover each cell of a coarse grid over an image plane.
+///
+/// A board covers the cells whose centres lie inside its outline (its four outer corners).
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class CoverageGrid
+{
+public:
+    enum { COLS = 16, ROWS = 12 };
+
+    CoverageGrid();
+
+    // Set the size of the image plane (and clear the grid).
+    void SetImageSize(CvSize image_size);
+
+    // Clear the grid.
+    void Reset();
+
+    // Add a board (outline of four corners, in order around the board).
+    void Add(const CvPoint2D32f outline[4]);
+
+    // Count the cells inside the outline that are not covered yet.
+    int CountNew(const CvPoint2D32f outline[4]);
+
+    // Evaluate the novelty of an outline (the cells inside, each weighted by 1/(1+number of boards covering it)).
+    double Novelty(const CvPoint2D32f outline[4]);
+
+    // Evaluate the fraction of cells covered by at least one board.
+    double GetCoverage();
+
+    // Accessor methods
+    int GetCount(int col, int row) { return mCounts[row*COLS+col]; };
+    CvSize GetImageSize() { return mImageSize; };
+    CvPoint2D32f GetCellCentre(int col, int row) { return cvPoint2D32f((col+0.5)*mImageSize.width/COLS, (row+0.5)*mImageSize.height/ROWS); };
+
+private:
+    // Find the cells whose centres lie inside the outline.
+    void CellsInside(const CvPoint2D32f outline[4], bool* cells);
+
+    /// <summary> Size of the image plane, and number of boards covering each cell. </summary>
+    CvSize mImageSize;
+    int mCounts[COLS*ROWS];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  CaptureGuide
+///
+/// @brief  Tracks the coverage and pose diversity of the accepted boards, suggests the next pose, and
+///         decides when enough boards have been captured.
+///
+/// Every accepted board updates a coverage map over the camera image (printed corners) and over the
+/// projector image (projector pixels of the projected corners), and a 3x3 histogram of board tilts
+/// (estimated from the board homography). The next pose is suggested where the camera and projector
+/// maps are least covered, with the least used tilt, and is drawn onto the camera view.
+///
+/// The uncertainty of the calibration is estimated from the closed-form (Zhang) solution of the
+/// intrinsics: each board homography adds two linear constraints on the image of the absolute conic,
+/// weighted by the expected homography noise (from the assumed corner noise). The covariance of the
+/// solution (the inverse of the accumulated information matrix) is propagated to the focal length,
+/// and its relative standard deviation is the uncertainty. It is cheap to update after every board,
+/// and falls as boards with new positions and tilts are added (boards repeating a pose barely reduce
+/// it). Capture stops once it falls below sl_params->guidance_stop_uncertainty.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class CaptureGuide
+{
+public:
+    CaptureGuide(struct slParams* sl_params, bool calibrate_camera);
+
+    ~CaptureGuide();
+
+    // Forget the accepted boards.
+    void Reset();
+
+    // Add an accepted board (printed and projected corners in camera pixels, projector pixels of the projected corners).
+    void Accept(const CvPoint2D32f* cam_corners, const CvPoint2D32f* proj_corners, const CvPoint2D32f* proj_pixels);
+
+    // Check if the calibration uncertainty is below the stopping threshold.
+    // Note: Always false if guidance is disabled.
+    bool IsComplete();
+
+    // Draw the uncovered camera cells, the suggested next pose and the capture status (on a camera-sized BGR image).
+    void Draw(IplImage* image);
+
+    // Display the coverage, diversity and uncertainty to the console.
+    void DisplayStatistics();
+
+    // Accessor methods
+    int GetBoardCount() { return mNumBoards; };
+    double GetUncertainty() { return mCalibrateCamera ? MAX(mCamUncertainty, mProjUncertainty) : mProjUncertainty; };
+    double GetCameraCoverage() { return mCamCoverage.GetCoverage(); };
+    double GetProjectorCoverage() { return mProjCoverage.GetCoverage(); };
+    int GetTiltCount();
+    const char* GetSuggestion() { return mSuggestion; };
+
+private:
+    enum { TILTS = 9, INFO = 6 };
+
+    // Add the closed-form intrinsics constraints of a homography (normalized coordinates) to an information matrix.
+    // Note: noise is the standard deviation of the n image points the homography was fitted to (normalized coordinates).
+    static void AddConstraints(const double H[9], double noise, int n, double info[INFO*INFO]);
+
+    // Evaluate the relative uncertainty of the closed-form focal length (and the focal length itself).
+    // Note: Returns DBL_MAX if the solution is not constrained yet.
+    static double FocalUncertainty(const double info[INFO*INFO], double* focal);
+
+    // Find the tilt bin of a board (from its homography in normalized camera coordinates).
+    int TiltBin(const double H[9]);
+
+    // Choose the suggested next pose (position and tilt).
+    void UpdateSuggestion();
+
+    /// <summary> Configuration, and whether the camera is calibrated too. </summary>
+    struct slParams* mSlParams;
+    bool mCalibrateCamera;
+
+    /// <summary> Board grids (normalized to the board size) and buffers for the projected corners. </summary>
+    CvPoint2D32f* mCamObject;
+    CvPoint2D32f* mProjObject;
+    CvPoint2D32f* mCamNormalized;
+    CvPoint2D32f* mProjNormalized;
+
+    /// <summary> Coverage maps and tilt histogram of the accepted boards. </summary>
+    CoverageGrid mCamCoverage;
+    CoverageGrid mProjCoverage;
+    int mTiltCounts[TILTS];
+    int mNumBoards;
+    double mBoardWidth;
+    double mBoardHeight;
+
+    /// <summary> Closed-form constraints (information matrices), focal length estimate (normalized) and uncertainties. </summary>
+    double mCamInfo[INFO*INFO];
+    double mProjInfo[INFO*INFO];
+    double mFocal;
+    double mCamUncertainty;
+    double mProjUncertainty;
+
+    /// <summary> Projected corner correspondences, and the camera-to-projector homography fitted to them. </summary>
+    std::vector<CvPoint2D32f> mCamPoints;
+    std::vector<CvPoint2D32f> mProjPoints;
+    double mCamToProj[9];
+    bool mCamToProjFound;
+
+    /// <summary> Suggested next pose: outline in the camera image, tilt bin, and description. </summary>
+    CvPoint2D32f mSuggestedOutline[4];
+    int mSuggestedTilt;
+    char mSuggestion[128];
+};
@@ -0,0 +1,196 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ChannelMultiplexer.cpp
+///
+/// @brief  Implements the colour-channel multiplexing of the printed and projected chessboards.
+///
+/// Overview:
+///   The crosstalk is measured over the brighter half of the lit pixels (where the sum of the
+///   responses to the illumination and pattern fields exceeds half of its maximum), so that the
+///   responses are those of the white parts of the scene rather than of dark squares or of pixels
+///   the projector misses. The ambient column of the mixing matrix is the colour of the black
+///   frame (ambient light and projector black level), or gray if the scene is too dark to measure
+///   it. The unmixing matrix is the inverse of the mixing matrix, scaled so that a full projector
+///   channel on a white surface is separated as SEPARATED_LEVEL; cvTransform applies it to a whole
+///   frame at once, saturating negative levels (noise where a source is absent) to zero.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ChannelMultiplexer.h"
+
+// Minimum inverse condition number of the mixing matrix (otherwise the channels are not separable).
+static const double MIN_SEPARATION = 0.01;
+
+// Minimum summed level of the black frame for its colour to be used as the ambient colour.
+static const double MIN_AMBIENT_LEVEL = 6.0;
+
+// Constructor
+ChannelMultiplexer::ChannelMultiplexer(struct slParams* sl_params)
+{
+    mSlParams   = sl_params;
+    mMixing     = cvCreateMat(3, 3, CV_64FC1);
+    mUnmixing   = cvCreateMat(3, 3, CV_64FC1);
+    mCalibrated = false;
+    mFrame      = NULL;
+    mSeparated  = NULL;
+    cvSetIdentity(mMixing);
+    cvSetIdentity(mUnmixing);
+}
+
+// Destructor
+ChannelMultiplexer::~ChannelMultiplexer()
+{
+    cvReleaseMat(&mMixing);
+    cvReleaseMat(&mUnmixing);
+    if(mFrame != NULL)
+        cvReleaseImage(&mFrame);
+    if(mSeparated != NULL)
+        cvReleaseImage(&mSeparated);
+}
+
+// Measure the colour crosstalk of the rig (projecting black, illumination and pattern fields).
+bool ChannelMultiplexer::Calibrate(Camera* camera, PatternEngine* patterns, struct slCalib* sl_calib)
+{
+    CvScalar illumination = cvScalarAll(0.0);
+    CvScalar pattern      = cvScalarAll(0.0);
+    illumination.val[ILLUMINATION_CHANNEL] = 255.0;
+    pattern.val[PATTERN_CHANNEL]           = 255.0;
+
+    // Capture the black, illumination and pattern fields (with the gains of the multiplexed frames).
+    IplImage* fields[3] = { patterns->Solid(cvScalarAll(0.0), false), patterns->Solid(illumination), patterns->Solid(pattern) };
+    IplImage* frames[3];
+    for(int k=0; k<3; k++){
+        cvShowImage("projWindow", fields[k]);
+        cvWaitKey(mSlParams->delay);
+        frames[k] = camera->QueryFrame();
+        PhotometricCalibration::CorrectFrame(mSlParams, sl_calib, frames[k]);
+    }
+
+    bool separable = false;
+    if(frames[0]->nChannels != 3)
+        printf("ERROR: Multiplexed capture requires a colour camera!\n");
+    else
+        separable = Estimate(frames[0], frames[1], frames[2]);
+    for(int k=0; k<3; k++)
+        cvReleaseImage(&frames[k]);
+    return separable;
+}
+
+// Estimate the colour crosstalk from camera frames (BGR) lit by black, illumination and pattern fields.
+bool ChannelMultiplexer::Estimate(IplImage* black_frame, IplImage* illumination_frame, IplImage* pattern_frame)
+{
+    mCalibrated = false;
+    int width  = black_frame->width;
+    int height = black_frame->height;
+
+    // Find the brightest response to the two projector fields.
+    int max_response = 0;
+    for(int r=0; r<height; r++){
+        const uchar* black = (const uchar*)(black_frame->imageData        + r*black_frame->widthStep);
+        const uchar* illum = (const uchar*)(illumination_frame->imageData + r*illumination_frame->widthStep);
+        const uchar* patt  = (const uchar*)(pattern_frame->imageData      + r*pattern_frame->widthStep);
+        for(int i=0; i<3*width; i+=3){
+            int response = illum[i]+illum[i+1]+illum[i+2] + patt[i]+patt[i+1]+patt[i+2] - 2*(black[i]+black[i+1]+black[i+2]);
+            max_response = MAX(max_response, response);
+        }
+    }
+
+    // Average the responses (and the black level) over the brighter half of the lit pixels.
+    double sums[3][3] = { {0, 0, 0}, {0, 0, 0}, {0, 0, 0} };
+    int count = 0;
+    for(int r=0; r<height; r++){
+        const uchar* black = (const uchar*)(black_frame->imageData        + r*black_frame->widthStep);
+        const uchar* illum = (const uchar*)(illumination_frame->imageData + r*illumination_frame->widthStep);
+        const uchar* patt  = (const uchar*)(pattern_frame->imageData      + r*pattern_frame->widthStep);
+        for(int i=0; i<3*width; i+=3){
+            int response = illum[i]+illum[i+1]+illum[i+2] + patt[i]+patt[i+1]+patt[i+2] - 2*(black[i]+black[i+1]+black[i+2]);
+            if(2*response <= max_response)
+                continue;
+            for(int c=0; c<3; c++){
+                sums[0][c] += illum[i+c] - black[i+c];
+                sums[1][c] += patt[i+c]  - black[i+c];
+                sums[2][c] += black[i+c];
+            }
+            count++;
+        }
+    }
+    if(count == 0){
+        printf("ERROR: The projector fields were not seen by the camera!\n");
+        return false;
+    }
+
+    // Fill the mixing matrix (columns: illumination, pattern and ambient responses).
+    double ambient_level = (sums[2][0]+sums[2][1]+sums[2][2])/count;
+    for(int c=0; c<3; c++){
+        CV_MAT_ELEM(*mMixing, double, c, 0) = sums[0][c]/count;
+        CV_MAT_ELEM(*mMixing, double, c, 1) = sums[1][c]/count;
+        CV_MAT_ELEM(*mMixing, double, c, 2) = (ambient_level >= MIN_AMBIENT_LEVEL) ? sums[2][c]/count : 1.0;
+    }
+    for(int k=0; k<2; k++){
+        double response = 0;
+        for(int c=0; c<3; c++)
+            response += CV_MAT_ELEM(*mMixing, double, c, k);
+        if(response < mSlParams->multiplex_min_response){
+            printf("ERROR: The camera response to the %s channel is too weak (%.1f levels)!\n", (k == 0) ? "illumination" : "pattern", response);
+            return false;
+        }
+    }
+
+    // Invert the mixing matrix (the separated levels of a full projector channel are SEPARATED_LEVEL).
+    double separation = cvInvert(mMixing, mUnmixing, CV_SVD);
+    if(separation < MIN_SEPARATION){
+        printf("ERROR: The camera cannot separate the projector channels (separation %.4f)!\n", separation);
+        return false;
+    }
+    cvScale(mUnmixing, mUnmixing, SEPARATED_LEVEL, 0);
+    mCalibrated = true;
+
+    // Display the crosstalk (the response to the other projector channel, relative to the channel's own).
+    printf("Colour crosstalk: %.1f%% of the pattern in the illumination channel, %.1f%% of the illumination in the pattern channel.\n",
+        100.0*CV_MAT_ELEM(*mMixing, double, ILLUMINATION_CHANNEL, 1)/MAX(CV_MAT_ELEM(*mMixing, double, ILLUMINATION_CHANNEL, 0), 1e-6),
+        100.0*CV_MAT_ELEM(*mMixing, double, PATTERN_CHANNEL, 0)/MAX(CV_MAT_ELEM(*mMixing, double, PATTERN_CHANNEL, 1), 1e-6));
+    return true;
+}
+
+// Compose the projector frame: a full illumination field, and a single-channel pattern (with the gain applied).
+IplImage* ChannelMultiplexer::Compose(PatternEngine* patterns, IplImage* pattern)
+{
+    if(mFrame == NULL || mFrame->width != pattern->width || mFrame->height != pattern->height){
+        if(mFrame != NULL)
+            cvReleaseImage(&mFrame);
+        mFrame = cvCreateImage(cvGetSize(pattern), IPL_DEPTH_8U, 3);
+    }
+    IplImage* planes[3];
+    planes[0] = planes[1] = planes[2] = patterns->Solid(cvScalarAll(0.0), false);
+    planes[PATTERN_CHANNEL]      = pattern;
+    planes[ILLUMINATION_CHANNEL] = patterns->Solid(cvScalarAll(255.0));
+    cvMerge(planes[0], planes[1], planes[2], NULL, mFrame);
+    return mFrame;
+}
+
+// Separate a camera frame (BGR) into single-channel illumination and pattern images.
+void ChannelMultiplexer::Separate(IplImage* frame, IplImage* illumination, IplImage* pattern)
+{
+    if(mSeparated == NULL || mSeparated->width != frame->width || mSeparated->height != frame->height){
+        if(mSeparated != NULL)
+            cvReleaseImage(&mSeparated);
+        mSeparated = cvCreateImage(cvGetSize(frame), IPL_DEPTH_8U, 3);
+    }
+    cvTransform(frame, mSeparated, mUnmixing);
+    cvSplit(mSeparated, illumination, pattern, NULL, NULL);
+}
+
+// Write the mixing and unmixing matrices to a file.
+void ChannelMultiplexer::Save(const char* filename)
+{
+    CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_WRITE);
+    if(fs == NULL){
+        printf("WARNING: Cannot write the colour crosstalk to \"%s\"!\n", filename);
+        return;
+    }
+    cvWriteInt(fs, "illumination_channel", ILLUMINATION_CHANNEL);
+    cvWriteInt(fs, "pattern_channel",      PATTERN_CHANNEL);
+    cvWrite(fs, "mixing",   mMixing);
+    cvWrite(fs, "unmixing", mUnmixing);
+    cvReleaseFileStorage(&fs);
+}
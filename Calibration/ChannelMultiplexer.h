@@ -0,0 +1,81 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ChannelMultiplexer.h
+///
+/// @brief  Declares the colour-channel multiplexing of the printed and projected chessboards.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "Camera.h"
+#include "PatternEngine.h"
+#include "PhotometricCalibration.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ChannelMultiplexer
+///
+/// @brief  Projects the illumination of the printed chessboard and the projector chessboard in
+///         separate colour channels of one projector frame, and separates them in the camera frame.
+///
+/// The red channel of the projector frame is a uniform field (the red illumination the printed
+/// chessboard is usually captured under), and the blue channel carries the projector chessboard.
+/// The camera sees each projector channel in all of its own channels (colour crosstalk), so each
+/// camera pixel is modelled as a mix of three sources: the red field, the blue pattern, and the
+/// (approximately gray) ambient light. The 3x3 mixing matrix of a projector-camera rig is measured
+/// once per session from frames lit by black, red and blue fields, and its inverse separates every
+/// camera frame into an illumination image (the printed chessboard, as seen under a white field)
+/// and a pattern image (the printed chessboard lit by the projector chessboard).
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ChannelMultiplexer
+{
+public:
+    // Channels of the (BGR) projector frame carrying the pattern and the illumination.
+    enum { PATTERN_CHANNEL = 0, ILLUMINATION_CHANNEL = 2 };
+
+    // Level of the separated images for the calibrated response to a full projector channel.
+    enum { SEPARATED_LEVEL = 160 };
+
+    ChannelMultiplexer(struct slParams* sl_params);
+
+    ~ChannelMultiplexer();
+
+    // Measure the colour crosstalk of the rig (projecting black, illumination and pattern fields).
+    // Note: Frames are corrected as during capture (see PhotometricCalibration::CorrectFrame).
+    //       Returns false if the camera is monochrome, or cannot separate the projector channels.
+    bool Calibrate(Camera* camera, PatternEngine* patterns, struct slCalib* sl_calib);
+
+    // Estimate the colour crosstalk from camera frames (BGR) lit by black, illumination and pattern fields.
+    bool Estimate(IplImage* black_frame, IplImage* illumination_frame, IplImage* pattern_frame);
+
+    // Compose the projector frame: a full illumination field, and a single-channel pattern (with the gain applied).
+    // Note: The frame is owned by the multiplexer, and valid until the next call.
+    IplImage* Compose(PatternEngine* patterns, IplImage* pattern);
+
+    // Separate a camera frame (BGR) into single-channel illumination and pattern images.
+    void Separate(IplImage* frame, IplImage* illumination, IplImage* pattern);
+
+    // Write the mixing and unmixing matrices to a file.
+    void Save(const char* filename);
+
+    // Accessor methods
+    bool IsCalibrated() { return mCalibrated; };
+    CvMat* GetMixing() { return mMixing; };
+
+private:
+    /// <summary> Configuration. </summary>
+    struct slParams* mSlParams;
+
+    /// <summary> Camera response (BGR columns) to the illumination, the pattern and the ambient light, and its scaled inverse. </summary>
+    CvMat* mMixing;
+    CvMat* mUnmixing;
+    bool mCalibrated;
+
+    /// <summary> Composed projector frame, and separated camera frame (illumination, pattern, ambient). </summary>
+    IplImage* mFrame;
+    IplImage* mSeparated;
+};
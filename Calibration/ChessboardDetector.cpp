@@ -0,0 +1,423 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ChessboardDetector.cpp
+///
+/// @brief  Implements the multi-scale chessboard detector.
+///
+/// Overview:
+///   cvPyrDown keeps every other pixel of the blurred image, so pixel (x,y) of a level maps to
+///   (2x,2y) of the level below. Corners are refined on every level on the way down, so the final
+///   full-resolution refinement starts within a pixel or two of the corner and usually converges
+///   in one or two iterations. The refinement is the same as cvFindCornerSubPix (the corner is the
+///   point that the Gaussian-weighted gradients in the window are orthogonal to), but samples the
+///   window into a fixed-size buffer of the workspace instead of allocating per call. Worker threads
+///   follow the same scheme as AsyncImageWriter.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ChessboardDetector.h"
+#include <float.h>
+
+// Smallest width of a downscaled level (smaller boards are not reliably found).
+static const int MIN_LEVEL_WIDTH = 320;
+
+// Refinement half-window: fraction of the square size, limits, and default (if the board is incomplete).
+static const double HALF_WINDOW_SCALE   = 0.35;
+static const int    MIN_HALF_WINDOW     = 2;
+static const int    DEFAULT_HALF_WINDOW = 11;
+
+// Constructor
+ChessboardDetector::ChessboardDetector(int levels, int num_threads)
+{
+    mLevels     = (levels > 0) ? levels : 0;
+    mNumThreads = (num_threads > 0) ? num_threads : 0;
+    mPending    = 0;
+    mStop       = false;
+    ResetStatistics();
+
+    // Allocate a workspace for the calling thread and for each worker thread.
+    mNumWorkspaces = mNumThreads+1;
+    mNextWorkspace = 0;
+    mWorkspaces = new slDetectorWorkspace[mNumWorkspaces];
+    for(int i=0; i<mNumWorkspaces; i++){
+        mWorkspaces[i].gray = NULL;
+        for(int l=0; l<=MAX_LEVELS; l++)
+            mWorkspaces[i].pyramid[l] = NULL;
+    }
+
+    InitializeCriticalSection(&mLock);
+    mItems = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+    mIdle  = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+    // Start worker threads (queued detections run on Wait if none can be created).
+    mThreads = new HANDLE[mNumThreads > 0 ? mNumThreads : 1];
+    int n_started = 0;
+    for(int i=0; i<mNumThreads; i++){
+        DWORD thread_id;
+        HANDLE thread = CreateThread(NULL, 0, DetectorThread, this, 0, &thread_id);
+        if(thread != NULL)
+            mThreads[n_started++] = thread;
+    }
+    mNumThreads = n_started;
+}
+
+// Destructor
+ChessboardDetector::~ChessboardDetector()
+{
+    Wait();
+
+    // Wake every worker thread with an empty queue, which makes it exit.
+    EnterCriticalSection(&mLock);
+    mStop = true;
+    LeaveCriticalSection(&mLock);
+    if(mNumThreads > 0)
+        ReleaseSemaphore(mItems, mNumThreads, NULL);
+    for(int i=0; i<mNumThreads; i++){
+        WaitForSingleObject(mThreads[i], INFINITE);
+        CloseHandle(mThreads[i]);
+    }
+    delete[] mThreads;
+
+    for(int i=0; i<mNumWorkspaces; i++){
+        cvReleaseImage(&mWorkspaces[i].gray);
+        for(int l=1; l<=MAX_LEVELS; l++)
+            cvReleaseImage(&mWorkspaces[i].pyramid[l]);
+    }
+    delete[] mWorkspaces;
+
+    CloseHandle(mItems);
+    CloseHandle(mIdle);
+    DeleteCriticalSection(&mLock);
+}
+
+// Detect chessboard corners (with subpixel refinement) on the calling thread.
+int ChessboardDetector::Detect(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count)
+{
+    return DetectInWorkspace(frame, board_size, corners, corner_count, &mWorkspaces[0]);
+}
+
+// Refine corners of a whole chessboard (e.g., tracked from another frame) on the calling thread.
+// Note: The frame must be grayscale.
+void ChessboardDetector::Refine(IplImage* frame, CvSize board_size, CvPoint2D32f* corners)
+{
+    int count    = board_size.width*board_size.height;
+    int half_win = EstimateHalfWindow(corners, board_size);
+    int iterations = 0;
+    if(frame->depth == IPL_DEPTH_8U)
+        iterations = RefineCorners(frame, corners, count, half_win, 30, 0.1, &mWorkspaces[0]);
+    else
+        cvFindCornerSubPix(frame, corners, count, cvSize(half_win,half_win), cvSize(-1,-1),
+            cvTermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1));
+
+    EnterCriticalSection(&mLock);
+    mCorners    += count;
+    mIterations += iterations;
+    LeaveCriticalSection(&mLock);
+}
+
+// Detect chessboard corners using the given workspace.
+int ChessboardDetector::DetectInWorkspace(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count,
+                                          struct slDetectorWorkspace* workspace)
+{
+    int64 start = cvGetTickCount();
+    int count = 0, found = 0, iterations = 0;
+    bool early_out = false;
+    int flags = CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_FILTER_QUADS | CV_CALIB_CB_FAST_CHECK;
+
+    // Convert to grayscale (if needed) and build the pyramid (level 0 is the full-resolution frame).
+    int levels = PrepareWorkspace(workspace, frame);
+    IplImage** pyramid = workspace->pyramid;
+    if(frame->nChannels > 1)
+        cvCvtColor(frame, workspace->gray, CV_BGR2GRAY);
+    for(int l=1; l<=levels; l++)
+        cvPyrDown(pyramid[l-1], pyramid[l]);
+    IplImage* gray_frame = pyramid[0];
+
+    // Find chessboard corners on the coarsest level, and refine them on the way down.
+    if(levels > 0){
+        found = cvFindChessboardCorners(pyramid[levels], board_size, corners, &count, flags);
+        if(found){
+            for(int l=levels-1; l>=0; l--){
+                for(int i=0; i<count; i++){
+                    corners[i].x *= 2.0f;
+                    corners[i].y *= 2.0f;
+                }
+                if(l > 0)
+                    iterations += RefineCorners(pyramid[l], corners, count,
+                        EstimateHalfWindow(corners, board_size), 10, 0.1, workspace);
+            }
+        }
+        else if(count == 0)
+            early_out = true;
+    }
+
+    // Search the full-resolution frame (if the coarse levels found part of a board, or were skipped).
+    if(!found && !early_out)
+        found = cvFindChessboardCorners(gray_frame, board_size, corners, &count, flags);
+
+    // Refine chessboard corners (with a window sized from the squares, if the whole board was found).
+    if(count > 0){
+        int half_win = found ? EstimateHalfWindow(corners, board_size) : DEFAULT_HALF_WINDOW;
+        if(gray_frame->depth == IPL_DEPTH_8U)
+            iterations += RefineCorners(gray_frame, corners, count, half_win, 30, 0.1, workspace);
+        else
+            cvFindCornerSubPix(gray_frame, corners, count, cvSize(half_win,half_win), cvSize(-1,-1),
+                cvTermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 30, 0.1));
+    }
+
+    // Update statistics.
+    EnterCriticalSection(&mLock);
+    mFrames++;
+    mFound      += found ? 1 : 0;
+    mEarlyOuts  += early_out ? 1 : 0;
+    mTicks      += cvGetTickCount()-start;
+    mCorners    += count;
+    mIterations += iterations;
+    LeaveCriticalSection(&mLock);
+
+    if(corner_count != NULL)
+        *corner_count = count;
+    return found;
+}
+
+// (Re)allocate the grayscale copy and the pyramid for the frame (if its size changed).
+int ChessboardDetector::PrepareWorkspace(struct slDetectorWorkspace* workspace, IplImage* frame)
+{
+    // Grayscale copy (only needed for colour frames).
+    if(frame->nChannels > 1){
+        IplImage* gray = workspace->gray;
+        if(gray == NULL || gray->width != frame->width || gray->height != frame->height || gray->depth != frame->depth){
+            cvReleaseImage(&workspace->gray);
+            workspace->gray = cvCreateImage(cvGetSize(frame), frame->depth, 1);
+        }
+        workspace->pyramid[0] = workspace->gray;
+    }
+    else
+        workspace->pyramid[0] = frame;
+
+    // Downscaled levels.
+    int levels = 0;
+    IplImage** pyramid = workspace->pyramid;
+    while(levels < mLevels && levels < MAX_LEVELS && (pyramid[levels]->width/2) >= MIN_LEVEL_WIDTH){
+        CvSize size = cvSize((pyramid[levels]->width+1)/2, (pyramid[levels]->height+1)/2);
+        IplImage* level = pyramid[levels+1];
+        if(level == NULL || level->width != size.width || level->height != size.height || level->depth != frame->depth){
+            cvReleaseImage(&pyramid[levels+1]);
+            pyramid[levels+1] = cvCreateImage(size, frame->depth, 1);
+        }
+        levels++;
+    }
+    return levels;
+}
+
+// Estimate the refinement half-window from the mean spacing of neighbouring corners.
+// Note: The window must stay within a square, or the corners of neighbouring squares pull the estimate.
+int ChessboardDetector::EstimateHalfWindow(CvPoint2D32f* corners, CvSize board_size)
+{
+    double spacing = 0;
+    int n = 0;
+    for(int r=0; r<board_size.height; r++){
+        for(int c=0; c<board_size.width; c++){
+            CvPoint2D32f* p = &corners[r*board_size.width+c];
+            if(c+1 < board_size.width){
+                spacing += sqrt((double)((p[1].x-p->x)*(p[1].x-p->x) + (p[1].y-p->y)*(p[1].y-p->y)));
+                n++;
+            }
+            if(r+1 < board_size.height){
+                CvPoint2D32f* q = p+board_size.width;
+                spacing += sqrt((double)((q->x-p->x)*(q->x-p->x) + (q->y-p->y)*(q->y-p->y)));
+                n++;
+            }
+        }
+    }
+    if(n == 0)
+        return DEFAULT_HALF_WINDOW;
+    int half_win = cvRound(HALF_WINDOW_SCALE*spacing/n);
+    if(half_win < MIN_HALF_WINDOW)
+        half_win = MIN_HALF_WINDOW;
+    if(half_win > MAX_HALF_WINDOW)
+        half_win = MAX_HALF_WINDOW;
+    return half_win;
+}
+
+// Refine corners to subpixel accuracy (8-bit images), stopping each corner once it moves less than eps.
+int ChessboardDetector::RefineCorners(IplImage* image, CvPoint2D32f* corners, int count, int half_win, int max_iter, double eps,
+                                      struct slDetectorWorkspace* workspace)
+{
+    if(half_win > MAX_HALF_WINDOW)
+        half_win = MAX_HALF_WINDOW;
+    int win = 2*half_win+1;
+    int n   = win+2;
+    float* mask  = workspace->mask;
+    float* patch = workspace->patch;
+
+    // Gaussian weights of the window (as in cvFindCornerSubPix).
+    double coeff = 1.0/(half_win*half_win);
+    for(int i=0; i<win; i++)
+        for(int j=0; j<win; j++)
+            mask[i*win+j] = (float)exp(-((i-half_win)*(i-half_win) + (j-half_win)*(j-half_win))*coeff);
+
+    int iterations = 0;
+    for(int k=0; k<count; k++){
+        CvPoint2D32f initial = corners[k];
+        CvPoint2D32f corner  = initial;
+        for(int iter=0; iter<max_iter; iter++){
+            iterations++;
+
+            // Sample the (win+2)x(win+2) neighbourhood centred on the corner (bilinear, clamped to the image).
+            double x0 = corner.x-(half_win+1), y0 = corner.y-(half_win+1);
+            int ix = cvFloor(x0), iy = cvFloor(y0);
+            float ax = (float)(x0-ix), ay = (float)(y0-iy);
+            for(int i=0; i<n; i++){
+                int ya = MIN(MAX(iy+i,   0), image->height-1);
+                int yb = MIN(MAX(iy+i+1, 0), image->height-1);
+                uchar* row_a = (uchar*)(image->imageData + ya*image->widthStep);
+                uchar* row_b = (uchar*)(image->imageData + yb*image->widthStep);
+                for(int j=0; j<n; j++){
+                    int xa = MIN(MAX(ix+j,   0), image->width-1);
+                    int xb = MIN(MAX(ix+j+1, 0), image->width-1);
+                    patch[i*n+j] = (1.0f-ay)*((1.0f-ax)*row_a[xa] + ax*row_a[xb]) +
+                                         ay *((1.0f-ax)*row_b[xa] + ax*row_b[xb]);
+                }
+            }
+
+            // Accumulate the gradient normal equations over the window.
+            double a = 0, b = 0, c = 0, bb1 = 0, bb2 = 0;
+            for(int i=0; i<win; i++){
+                double py = i-half_win;
+                const float* p = patch + (i+1)*n + 1;
+                const float* m = mask + i*win;
+                for(int j=0; j<win; j++){
+                    double px = j-half_win;
+                    double gx = p[j+1]-p[j-1];
+                    double gy = p[j+n]-p[j-n];
+                    double gxx = gx*gx*m[j], gxy = gx*gy*m[j], gyy = gy*gy*m[j];
+                    a   += gxx;
+                    b   += gxy;
+                    c   += gyy;
+                    bb1 += gxx*px + gxy*py;
+                    bb2 += gxy*px + gyy*py;
+                }
+            }
+
+            // Move the corner to the solution, and stop once it has converged.
+            double det = a*c-b*b;
+            if(fabs(det) <= DBL_EPSILON*DBL_EPSILON)
+                break;
+            double dx = (c*bb1-b*bb2)/det;
+            double dy = (a*bb2-b*bb1)/det;
+            corner.x += (float)dx;
+            corner.y += (float)dy;
+            if(corner.x < 0 || corner.x >= image->width || corner.y < 0 || corner.y >= image->height)
+                break;
+            if(dx*dx+dy*dy <= eps*eps)
+                break;
+        }
+
+        // Keep the initial corner if the refinement left the window.
+        if(fabs(corner.x-initial.x) > half_win || fabs(corner.y-initial.y) > half_win)
+            corner = initial;
+        corners[k] = corner;
+    }
+    return iterations;
+}
+
+// Worker thread: runs queued detections until the detector is stopped.
+DWORD WINAPI ChessboardDetector::DetectorThread(LPVOID lpParam)
+{
+    ChessboardDetector* detector = (ChessboardDetector*)lpParam;
+    slDetectorWorkspace* workspace = &detector->mWorkspaces[InterlockedIncrement(&detector->mNextWorkspace)];
+    slDetectionRequest request;
+    for(;;){
+        WaitForSingleObject(detector->mItems, INFINITE);
+
+        // Pop the oldest request.
+        EnterCriticalSection(&detector->mLock);
+        if(detector->mQueue.empty()){
+            bool stop = detector->mStop;
+            LeaveCriticalSection(&detector->mLock);
+            if(stop)
+                break;
+            continue;
+        }
+        request = detector->mQueue.front();
+        detector->mQueue.pop_front();
+        LeaveCriticalSection(&detector->mLock);
+
+        // Detect the chessboard.
+        *request.found = detector->DetectInWorkspace(request.frame, request.board_size, request.corners, request.corner_count, workspace);
+
+        // Signal idle state once nothing is queued or running.
+        EnterCriticalSection(&detector->mLock);
+        if(--detector->mPending == 0)
+            SetEvent(detector->mIdle);
+        LeaveCriticalSection(&detector->mLock);
+    }
+    return 0;
+}
+
+// Queue a detection; the frame, corners, corner_count and found must stay valid until Wait returns.
+void ChessboardDetector::Submit(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count, int* found)
+{
+    slDetectionRequest request;
+    request.frame        = frame;
+    request.board_size   = board_size;
+    request.corners      = corners;
+    request.corner_count = corner_count;
+    request.found        = found;
+
+    EnterCriticalSection(&mLock);
+    mQueue.push_back(request);
+    if(mPending++ == 0)
+        ResetEvent(mIdle);
+    LeaveCriticalSection(&mLock);
+    if(mNumThreads > 0)
+        ReleaseSemaphore(mItems, 1, NULL);
+}
+
+// Wait until every queued detection has completed.
+// Note: Without worker threads, queued detections run here (one after another).
+void ChessboardDetector::Wait()
+{
+    if(mNumThreads > 0){
+        WaitForSingleObject(mIdle, INFINITE);
+        return;
+    }
+    while(!mQueue.empty()){
+        slDetectionRequest request = mQueue.front();
+        mQueue.pop_front();
+        *request.found = Detect(request.frame, request.board_size, request.corners, request.corner_count);
+        mPending--;
+    }
+    SetEvent(mIdle);
+}
+
+// Reset the detection statistics.
+// Note: Should only be called while no detection is running.
+void ChessboardDetector::ResetStatistics()
+{
+    mFrames     = 0;
+    mFound      = 0;
+    mEarlyOuts  = 0;
+    mTicks      = 0;
+    mCorners    = 0;
+    mIterations = 0;
+}
+
+// Display the detection statistics to the console.
+void ChessboardDetector::DisplayStatistics()
+{
+    int frames = GetFrameCount();
+    printf("Chessboard detection: %d frames, %d found, %d early-outs, %.1f ms per frame (%d pyramid levels).\n",
+        frames, GetFoundCount(), GetEarlyOutCount(), GetDetectionTime()/(frames > 0 ? frames : 1), mLevels);
+    printf("Corner refinement: %.2f iterations per corner.\n", GetIterationsPerCorner());
+}
+
+// Total time spent detecting chessboards, summed over all threads (in ms).
+double ChessboardDetector::GetDetectionTime()
+{
+    EnterCriticalSection(&mLock);
+    int64 ticks = mTicks;
+    LeaveCriticalSection(&mLock);
+    return (double)ticks/(1000.0*cvGetTickFrequency());
+}
@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ChessboardDetector.h
+///
+/// @brief  Declares the multi-scale chessboard detector.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include <deque>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ChessboardDetector
+///
+/// @brief  Detects chessboard corners coarse-to-fine, on a pool of worker threads.
+///
+/// The chessboard is first searched for on a downscaled (Gaussian pyramid) copy of the frame,
+/// with a fast check that rejects frames without a candidate board before any quads are grouped.
+/// Corners found at the coarse level are scaled back up and refined level by level, so the
+/// full-resolution frame is only touched by the subpixel refinement around each corner. The
+/// full-resolution search is only run when the coarse level found part of a board.
+/// Corners are refined in place by an allocation-free subpixel refinement, whose window is sized
+/// from the spacing of the detected corners and which stops as soon as each corner converges.
+/// The grayscale copy and the pyramid are kept in a workspace per thread, which is only
+/// reallocated when the frame size changes, so detection does not allocate in steady state.
+/// Detections can be queued with Submit, to detect several boards (e.g., the camera and the
+/// projector chessboards) concurrently.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ChessboardDetector
+{
+public:
+    ChessboardDetector(int levels, int num_threads);
+
+    // Waits for queued detections, then stops the worker threads.
+    ~ChessboardDetector();
+
+    // Detect chessboard corners (with subpixel refinement) on the calling thread.
+    // Note: Returns 1 if chessboard is found, 0 otherwise.
+    //       Must not be called from several threads at once (they would share a workspace).
+    int Detect(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count CV_DEFAULT(NULL));
+
+    // Refine corners of a whole chessboard (e.g., tracked from another frame) on the calling thread.
+    void Refine(IplImage* frame, CvSize board_size, CvPoint2D32f* corners);
+
+    // Queue a detection; the frame, corners, corner_count and found must stay valid until Wait returns.
+    void Submit(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count, int* found);
+
+    // Wait until every queued detection has completed.
+    void Wait();
+
+    // Reset the detection statistics.
+    void ResetStatistics();
+
+    // Display the detection statistics to the console.
+    void DisplayStatistics();
+
+    // Accessor methods
+    int GetLevels() { return mLevels; };
+    int GetFrameCount() { return mFrames; };
+    int GetFoundCount() { return mFound; };
+    int GetEarlyOutCount() { return mEarlyOuts; };
+    double GetDetectionTime();
+    double GetIterationsPerCorner() { return (double)mIterations/(mCorners > 0 ? mCorners : 1); };
+
+private:
+    enum { MAX_LEVELS = 7, MAX_HALF_WINDOW = 15, MAX_PATCH = 2*MAX_HALF_WINDOW+3 };
+
+    struct slDetectorWorkspace{
+        IplImage* gray;                         // grayscale copy of colour frames
+        IplImage* pyramid[MAX_LEVELS+1];        // downscaled levels (level 0 is the frame)
+        float     mask[MAX_PATCH*MAX_PATCH];    // Gaussian weights of the refinement window
+        float     patch[MAX_PATCH*MAX_PATCH];   // resampled neighbourhood of a corner
+    };
+
+    struct slDetectionRequest{
+        IplImage*     frame;
+        CvSize        board_size;
+        CvPoint2D32f* corners;
+        int*          corner_count;
+        int*          found;
+    };
+
+    // Detect chessboard corners using the given workspace.
+    int DetectInWorkspace(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count, struct slDetectorWorkspace* workspace);
+
+    // (Re)allocate the grayscale copy and the pyramid for the frame (if its size changed).
+    // Note: Returns the number of downscaled levels.
+    int PrepareWorkspace(struct slDetectorWorkspace* workspace, IplImage* frame);
+
+    // Refine corners to subpixel accuracy (8-bit images), stopping each corner once it moves less than eps.
+    // Note: Returns the number of iterations run (summed over all corners).
+    static int RefineCorners(IplImage* image, CvPoint2D32f* corners, int count, int half_win, int max_iter, double eps, struct slDetectorWorkspace* workspace);
+
+    // Estimate the refinement half-window from the mean spacing of neighbouring corners.
+    static int EstimateHalfWindow(CvPoint2D32f* corners, CvSize board_size);
+
+    static DWORD WINAPI DetectorThread(LPVOID lpParam);
+
+    /// <summary> Number of downscaled levels searched before full resolution. </summary>
+    int mLevels;
+
+    /// <summary> Queued detections and the number queued or running (guarded by mLock). </summary>
+    std::deque<slDetectionRequest> mQueue;
+    int mPending;
+
+    /// <summary> Worker threads. </summary>
+    HANDLE* mThreads;
+    int mNumThreads;
+
+    /// <summary> Workspaces (0 for the calling thread, then one per worker thread). </summary>
+    struct slDetectorWorkspace* mWorkspaces;
+    int mNumWorkspaces;
+    volatile LONG mNextWorkspace;
+
+    /// <summary> Synchronization: queue lock, queued-request count, idle event. </summary>
+    CRITICAL_SECTION mLock;
+    HANDLE mItems;
+    HANDLE mIdle;
+    bool   mStop;
+
+    /// <summary> Statistics (guarded by mLock). </summary>
+    int    mFrames;
+    int    mFound;
+    int    mEarlyOuts;
+    int64  mTicks;
+    int    mCorners;
+    int    mIterations;
+};
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ChessboardTracker.cpp
+///
+/// @brief  Implements the frame-to-frame chessboard tracker.
+///
+/// Overview:
+///   The corners keep the order in which the detector found them, so a tracked board can be used
+///   exactly like a detected one. Lens distortion bends the board away from a homography by a few
+///   pixels near the image border, so the homography check only rejects corners that moved by a
+///   sizeable fraction of a square (e.g., a corner that jumped to its neighbour). Buffers are only
+///   reallocated when the frame size or the board changes, and the pyramid of the current frame is
+///   reused as the previous pyramid of the next frame.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ChessboardTracker.h"
+#include "Homography.h"
+
+// Optical flow window, pyramid levels and termination criteria.
+static const int    FLOW_WINDOW     = 21;
+static const int    FLOW_LEVELS     = 3;
+static const int    FLOW_ITERATIONS = 20;
+static const double FLOW_EPSILON    = 0.03;
+
+// Largest distance of a tracked corner from the board homography (fraction of a square, and lower bound in pixels).
+static const double MAX_RESIDUAL_SCALE = 0.25;
+static const double MIN_MAX_RESIDUAL   = 2.0;
+
+// Constructor
+ChessboardTracker::ChessboardTracker(ChessboardDetector* detector)
+{
+    mDetector         = detector;
+    mPrevFrame        = NULL;
+    mCurrFrame        = NULL;
+    mPrevPyramid      = NULL;
+    mCurrPyramid      = NULL;
+    mPrevPyramidReady = false;
+    mBoardSize        = cvSize(0, 0);
+    mPrevCorners      = NULL;
+    mStatus           = NULL;
+    mError            = NULL;
+    mTracking         = false;
+    mGridPoints       = NULL;
+    mGridImagePoints  = NULL;
+    ResetStatistics();
+}
+
+// Destructor
+ChessboardTracker::~ChessboardTracker()
+{
+    cvReleaseImage(&mPrevFrame);
+    cvReleaseImage(&mCurrFrame);
+    cvReleaseImage(&mPrevPyramid);
+    cvReleaseImage(&mCurrPyramid);
+    delete[] mPrevCorners;
+    delete[] mStatus;
+    delete[] mError;
+    delete[] mGridPoints;
+    delete[] mGridImagePoints;
+}
+
+// Find chessboard corners, tracking them from the previous frame (or detecting them, if lost).
+int ChessboardTracker::Track(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count)
+{
+    PrepareBuffers(frame, board_size);
+    int board_n = board_size.width*board_size.height;
+
+    // Copy the frame (the camera may reuse its buffer), converting to grayscale (if needed).
+    if(frame->nChannels > 1)
+        cvCvtColor(frame, mCurrFrame, CV_BGR2GRAY);
+    else
+        cvCopy(frame, mCurrFrame);
+
+    // Track the board from the previous frame, and detect it if it was lost (or not tracked yet).
+    int found = 0, count = 0;
+    bool flow = mTracking, tracked = false;
+    if(mTracking){
+        tracked = TrackCorners(corners);
+        if(tracked){
+            mDetector->Refine(mCurrFrame, board_size, corners);
+            found = 1;
+            count = board_n;
+            mTracked++;
+        }
+        else
+            mLost++;
+    }
+    if(!tracked){
+        found = mDetector->Detect(mCurrFrame, board_size, corners, &count);
+        mDetected++;
+    }
+
+    // Keep the corners and the frame (and its pyramid, if computed) for the next frame.
+    mTracking = (found != 0);
+    if(mTracking)
+        memcpy(mPrevCorners, corners, board_n*sizeof(CvPoint2D32f));
+    IplImage* temp = mPrevFrame;
+    mPrevFrame = mCurrFrame;
+    mCurrFrame = temp;
+    temp = mPrevPyramid;
+    mPrevPyramid = mCurrPyramid;
+    mCurrPyramid = temp;
+    mPrevPyramidReady = flow;
+
+    if(corner_count != NULL)
+        *corner_count = count;
+    return found;
+}
+
+// Track the previous corners into the current frame, and check them against a homography of the board.
+bool ChessboardTracker::TrackCorners(CvPoint2D32f* corners)
+{
+    int board_n = mBoardSize.width*mBoardSize.height;
+
+    // Follow every corner with pyramidal Lucas-Kanade optical flow.
+    cvCalcOpticalFlowPyrLK(mPrevFrame, mCurrFrame, mPrevPyramid, mCurrPyramid,
+        mPrevCorners, corners, board_n, cvSize(FLOW_WINDOW, FLOW_WINDOW), FLOW_LEVELS, mStatus, mError,
+        cvTermCriteria(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS, FLOW_ITERATIONS, FLOW_EPSILON),
+        mPrevPyramidReady ? CV_LKFLOW_PYR_A_READY : 0);
+    for(int i=0; i<board_n; i++){
+        if(!mStatus[i] ||
+           corners[i].x < 0 || corners[i].x > mCurrFrame->width-1 ||
+           corners[i].y < 0 || corners[i].y > mCurrFrame->height-1)
+            return false;
+    }
+
+    // Fit a homography from the board grid to the tracked corners.
+    if(!estimateHomography(mGridPoints, corners, board_n, mHomography))
+        return false;
+
+    // Estimate the square size (mean distance between corners along the rows).
+    double spacing = 0;
+    for(int r=0; r<mBoardSize.height; r++){
+        for(int c=0; c+1<mBoardSize.width; c++){
+            CvPoint2D32f* p = &corners[r*mBoardSize.width+c];
+            spacing += sqrt((double)((p[1].x-p->x)*(p[1].x-p->x) + (p[1].y-p->y)*(p[1].y-p->y)));
+        }
+    }
+    spacing /= (mBoardSize.width > 1) ? mBoardSize.height*(mBoardSize.width-1) : 1;
+    double max_residual = MAX_RESIDUAL_SCALE*spacing;
+    if(max_residual < MIN_MAX_RESIDUAL)
+        max_residual = MIN_MAX_RESIDUAL;
+
+    // Reject the board if any corner is inconsistent with the homography.
+    applyHomography(mHomography, mGridPoints, mGridImagePoints, board_n);
+    for(int i=0; i<board_n; i++){
+        double u = mGridImagePoints[i].x - corners[i].x;
+        double v = mGridImagePoints[i].y - corners[i].y;
+        if(!(u*u+v*v <= max_residual*max_residual))
+            return false;
+    }
+    return true;
+}
+
+// (Re)allocate the frame, pyramid and corner buffers (if the frame size or the board changed).
+void ChessboardTracker::PrepareBuffers(IplImage* frame, CvSize board_size)
+{
+    // Frames and optical flow pyramids.
+    if(mCurrFrame == NULL || mCurrFrame->width != frame->width || mCurrFrame->height != frame->height){
+        cvReleaseImage(&mPrevFrame);
+        cvReleaseImage(&mCurrFrame);
+        cvReleaseImage(&mPrevPyramid);
+        cvReleaseImage(&mCurrPyramid);
+        mPrevFrame   = cvCreateImage(cvGetSize(frame), IPL_DEPTH_8U, 1);
+        mCurrFrame   = cvCreateImage(cvGetSize(frame), IPL_DEPTH_8U, 1);
+        mPrevPyramid = cvCreateImage(cvSize(frame->width+8, frame->height/3), IPL_DEPTH_8U, 1);
+        mCurrPyramid = cvCreateImage(cvSize(frame->width+8, frame->height/3), IPL_DEPTH_8U, 1);
+        mTracking = false;
+    }
+
+    // Corner buffers and board grid (in units of squares).
+    if(mGridPoints == NULL || board_size.width != mBoardSize.width || board_size.height != mBoardSize.height){
+        int board_n = board_size.width*board_size.height;
+        delete[] mPrevCorners;
+        delete[] mStatus;
+        delete[] mError;
+        delete[] mGridPoints;
+        delete[] mGridImagePoints;
+        mPrevCorners     = new CvPoint2D32f[board_n];
+        mStatus          = new char[board_n];
+        mError           = new float[board_n];
+        mGridPoints      = new CvPoint2D32f[board_n];
+        mGridImagePoints = new CvPoint2D32f[board_n];
+        for(int i=0; i<board_n; i++)
+            mGridPoints[i] = cvPoint2D32f(i%board_size.width, i/board_size.width);
+        mBoardSize = board_size;
+        mTracking  = false;
+    }
+}
+
+// Forget the tracked chessboard (the next frame is searched from scratch).
+void ChessboardTracker::Reset()
+{
+    mTracking = false;
+    mPrevPyramidReady = false;
+}
+
+// Reset the tracking statistics.
+void ChessboardTracker::ResetStatistics()
+{
+    mTracked  = 0;
+    mDetected = 0;
+    mLost     = 0;
+}
+
+// Display the tracking statistics to the console.
+void ChessboardTracker::DisplayStatistics()
+{
+    printf("Chessboard tracking: %d frames tracked, %d frames detected, %d boards lost.\n",
+        mTracked, mDetected, mLost);
+}
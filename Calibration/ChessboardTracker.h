@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ChessboardTracker.h
+///
+/// @brief  Declares the frame-to-frame chessboard tracker.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ChessboardDetector.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ChessboardTracker
+///
+/// @brief  Tracks chessboard corners from one frame of a live stream to the next.
+///
+/// Once the chessboard has been detected, its corners are followed into each new frame with
+/// pyramidal Lucas-Kanade optical flow, then refined to subpixel accuracy. A tracked board is
+/// only accepted if every corner was tracked and the corners still agree with a homography of
+/// the board; otherwise the board is lost and the frame is searched from scratch by the detector.
+/// Tracking a board is much cheaper than detecting it, so the live preview keeps up with the
+/// camera while the board is being positioned.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ChessboardTracker
+{
+public:
+    ChessboardTracker(ChessboardDetector* detector);
+
+    ~ChessboardTracker();
+
+    // Find chessboard corners, tracking them from the previous frame (or detecting them, if lost).
+    // Note: Returns 1 if chessboard is found, 0 otherwise.
+    int Track(IplImage* frame, CvSize board_size, CvPoint2D32f* corners, int* corner_count CV_DEFAULT(NULL));
+
+    // Forget the tracked chessboard (the next frame is searched from scratch).
+    void Reset();
+
+    // Reset the tracking statistics.
+    void ResetStatistics();
+
+    // Display the tracking statistics to the console.
+    void DisplayStatistics();
+
+    // Accessor methods
+    bool IsTracking() { return mTracking; };
+    int GetTrackedCount() { return mTracked; };
+    int GetDetectedCount() { return mDetected; };
+    int GetLostCount() { return mLost; };
+
+private:
+    // (Re)allocate the frame, pyramid and corner buffers (if the frame size or the board changed).
+    void PrepareBuffers(IplImage* frame, CvSize board_size);
+
+    // Track the previous corners into the current frame, and check them against a homography of the board.
+    bool TrackCorners(CvPoint2D32f* corners);
+
+    /// <summary> Detector used when the board is not tracked. </summary>
+    ChessboardDetector* mDetector;
+
+    /// <summary> Previous and current frames (grayscale) and their optical flow pyramids. </summary>
+    IplImage* mPrevFrame;
+    IplImage* mCurrFrame;
+    IplImage* mPrevPyramid;
+    IplImage* mCurrPyramid;
+    bool mPrevPyramidReady;
+
+    /// <summary> Tracked board: size, previous corners, per-corner flow status and error. </summary>
+    CvSize mBoardSize;
+    CvPoint2D32f* mPrevCorners;
+    char*  mStatus;
+    float* mError;
+    bool   mTracking;
+
+    /// <summary> Homography check: board grid, grid mapped into the image, board-to-image homography. </summary>
+    CvPoint2D32f* mGridPoints;
+    CvPoint2D32f* mGridImagePoints;
+    double mHomography[9];
+
+    /// <summary> Statistics: frames tracked, frames detected, boards lost. </summary>
+    int mTracked;
+    int mDetected;
+    int mLost;
+};
@@ -48,6 +48,9 @@ void Configuration::Load()
 	strcpy(sl_params->outdir, cvReadStringByName(fs, m, "output_directory", "./output"));
 	strcpy(sl_params->object, cvReadStringByName(fs, m, "object_name", "./output"));
 	sl_params->save = (cvReadIntByName(fs, m, "save_intermediate_results", 0) != 0);
+	sl_params->image_queue_size     =  cvReadIntByName(fs, m, "image_queue_size",          16);
+	sl_params->image_writer_threads =  cvReadIntByName(fs, m, "image_writer_threads",       2);
+	sl_params->image_queue_drop     = (cvReadIntByName(fs, m, "drop_images_when_full",      1) != 0);
 
 	// Read camera parameters.
 	m = cvGetFileNodeByName(fs, 0, "camera");
@@ -86,6 +89,50 @@ void Configuration::Load()
 	sl_params->proj_board_h        = cvReadIntByName(fs,  m, "interior_vertical_corners",    6);
 	sl_params->proj_board_w_pixels = cvReadIntByName(fs, m, "square_width_pixels",          75);
 	sl_params->proj_board_h_pixels = cvReadIntByName(fs, m, "square_height_pixels",         75);
+
+	// Read chessboard detection parameters.
+	m = cvGetFileNodeByName(fs, 0, "chessboard_detection");
+	sl_params->chessboard_levels  = cvReadIntByName(fs, m, "pyramid_levels",    1);
+	sl_params->chessboard_threads = cvReadIntByName(fs, m, "detection_threads", 2);
+	sl_params->chessboard_tracking = (cvReadIntByName(fs, m, "track_corners", 1) != 0);
+
+	// Read calibration solver parameters.
+	m = cvGetFileNodeByName(fs, 0, "calibration_solver");
+	sl_params->bundle_adjustment = (cvReadIntByName(fs, m, "enable_bundle_adjustment",     1) != 0);
+	sl_params->bundle_iterations =  cvReadIntByName(fs, m, "maximum_bundle_iterations",   50);
+	sl_params->solver_threads    =  cvReadIntByName(fs, m, "solver_threads",               0);
+	sl_params->estimate_uncertainty = (cvReadIntByName(fs, m, "enable_uncertainty_estimation", 1) != 0);
+
+	// Read board quality parameters.
+	m = cvGetFileNodeByName(fs, 0, "board_quality");
+	sl_params->board_scoring           = (cvReadIntByName(fs, m, "enable_board_scoring",              1) != 0);
+	sl_params->board_min_sharpness     = (float)cvReadRealByName(fs, m, "minimum_sharpness",          100);
+	sl_params->board_max_residual      = (float)cvReadRealByName(fs, m, "maximum_homography_error_squares", 0.1);
+	sl_params->board_min_difference    = (float)cvReadRealByName(fs, m, "minimum_pose_difference",   0.02);
+	sl_params->board_outlier_rejection = (cvReadIntByName(fs, m, "enable_outlier_rejection",          1) != 0);
+	sl_params->ransac_iterations       =  cvReadIntByName(fs, m, "ransac_iterations",               100);
+	sl_params->ransac_threshold        = (float)cvReadRealByName(fs, m, "ransac_threshold_squares",  0.25);
+	sl_params->ransac_max_outliers     =  cvReadIntByName(fs, m, "maximum_outlier_corners",           0);
+
+	// Read capture guidance parameters.
+	m = cvGetFileNodeByName(fs, 0, "capture_guidance");
+	sl_params->guidance                  = (cvReadIntByName(fs, m, "enable_capture_guidance",        1) != 0);
+	sl_params->guidance_stop_uncertainty = (float)cvReadRealByName(fs, m, "stop_uncertainty_percent", 0.1);
+	sl_params->guidance_min_boards       =  cvReadIntByName(fs, m, "minimum_boards",                 6);
+	sl_params->guidance_corner_noise     = (float)cvReadRealByName(fs, m, "corner_noise_pixels",    0.2);
+
+	// Read multiplexed capture parameters.
+	m = cvGetFileNodeByName(fs, 0, "multiplexed_capture");
+	sl_params->multiplexed_capture    = (cvReadIntByName(fs, m, "enable_multiplexed_capture", 0) != 0);
+	sl_params->multiplex_min_response =  cvReadIntByName(fs, m, "minimum_channel_response",  16);
+
+	// Read photometric calibration parameters.
+	m = cvGetFileNodeByName(fs, 0, "photometric_calibration");
+	sl_params->photometric_calibration = (cvReadIntByName(fs, m, "enable_photometric_calibration", 0) != 0);
+	sl_params->photometric_reuse       = (cvReadIntByName(fs, m, "use_previous_calibration", 0) != 0);
+	sl_params->photometric_levels      =  cvReadIntByName(fs, m, "response_levels",     17);
+	sl_params->photometric_target      =  cvReadIntByName(fs, m, "target_level",       235);
+	sl_params->photometric_max_gain    = (float)cvReadRealByName(fs, m, "maximum_camera_gain", 4.0);
 	
 	// Read scanning and reconstruction parameters.
 	m = cvGetFileNodeByName(fs, 0, "scanning_and_reconstruction");
@@ -99,6 +146,23 @@ void Configuration::Load()
 	sl_params->dist_reject             = (float) cvReadRealByName(fs, m, "maximum_distance_variation_mm",   10.0);
 	sl_params->background_depth_thresh = (float) cvReadRealByName(fs, m, "minimum_background_distance_mm",  20.0);
     sl_params->generate_normals        =        (cvReadIntByName(fs,  m, "generate_normals",                   1) != 0);
+	sl_params->mesh_max_depth_jump     = (float) cvReadRealByName(fs, m, "maximum_mesh_depth_jump",         0.02);
+	sl_params->export_sample_points    =         cvReadIntByName(fs,  m, "export_sample_points",            3000);
+	sl_params->export_sample_seed      =         cvReadIntByName(fs,  m, "export_sample_seed",                 1);
+
+	// Read phase-shift parameters.
+	m = cvGetFileNodeByName(fs, 0, "phase_shift");
+	sl_params->phase_shift_steps          =         cvReadIntByName(fs,  m, "number_of_steps",         4);
+	sl_params->phase_shift_period         =         cvReadIntByName(fs,  m, "period_pixels",          16);
+	sl_params->phase_shift_min_modulation = (float) cvReadRealByName(fs, m, "minimum_modulation",    8.0);
+
+	// Read multi-scan fusion parameters.
+	m = cvGetFileNodeByName(fs, 0, "fusion");
+	sl_params->fusion_voxel_size       = (float) cvReadRealByName(fs, m, "voxel_size_mm",              2.0);
+	sl_params->fusion_truncation       = (float) cvReadRealByName(fs, m, "truncation_distance_mm",     8.0);
+	sl_params->fusion_max_blocks       =         cvReadIntByName(fs,  m, "maximum_voxel_blocks",     32768);
+	sl_params->fusion_icp_iterations   =         cvReadIntByName(fs,  m, "icp_iterations",              20);
+	sl_params->fusion_icp_max_distance = (float) cvReadRealByName(fs, m, "icp_maximum_distance_mm",   20.0);
 
 	// Read visualization options.
 	m = cvGetFileNodeByName(fs, 0, "visualization");
@@ -142,6 +206,9 @@ void Configuration::Save()
 	cvWriteString(fs, "output_directory",          sl_params->outdir, 1);
 	cvWriteString(fs, "object_name",               sl_params->object, 1);
 	cvWriteInt(fs,    "save_intermediate_results", sl_params->save);
+	cvWriteInt(fs,    "image_queue_size",          sl_params->image_queue_size);
+	cvWriteInt(fs,    "image_writer_threads",      sl_params->image_writer_threads);
+	cvWriteInt(fs,    "drop_images_when_full",     sl_params->image_queue_drop);
 	cvEndWriteStruct(fs);
 	
 	// Write camera parameters.
@@ -188,6 +255,56 @@ void Configuration::Save()
 	cvWriteInt(fs, "square_height_pixels",         sl_params->proj_board_h_pixels);
 	cvEndWriteStruct(fs);
 
+	// Write chessboard detection parameters.
+	cvStartWriteStruct(fs, "chessboard_detection", CV_NODE_MAP);
+	cvWriteInt(fs, "pyramid_levels",    sl_params->chessboard_levels);
+	cvWriteInt(fs, "detection_threads", sl_params->chessboard_threads);
+	cvWriteInt(fs, "track_corners",     sl_params->chessboard_tracking);
+	cvEndWriteStruct(fs);
+
+	// Write calibration solver parameters.
+	cvStartWriteStruct(fs, "calibration_solver", CV_NODE_MAP);
+	cvWriteInt(fs, "enable_bundle_adjustment",  sl_params->bundle_adjustment);
+	cvWriteInt(fs, "maximum_bundle_iterations", sl_params->bundle_iterations);
+	cvWriteInt(fs, "solver_threads",            sl_params->solver_threads);
+	cvWriteInt(fs, "enable_uncertainty_estimation", sl_params->estimate_uncertainty);
+	cvEndWriteStruct(fs);
+
+	// Write board quality parameters.
+	cvStartWriteStruct(fs, "board_quality", CV_NODE_MAP);
+	cvWriteInt(fs,  "enable_board_scoring",             sl_params->board_scoring);
+	cvWriteReal(fs, "minimum_sharpness",                sl_params->board_min_sharpness);
+	cvWriteReal(fs, "maximum_homography_error_squares", sl_params->board_max_residual);
+	cvWriteReal(fs, "minimum_pose_difference",          sl_params->board_min_difference);
+	cvWriteInt(fs,  "enable_outlier_rejection",         sl_params->board_outlier_rejection);
+	cvWriteInt(fs,  "ransac_iterations",                sl_params->ransac_iterations);
+	cvWriteReal(fs, "ransac_threshold_squares",         sl_params->ransac_threshold);
+	cvWriteInt(fs,  "maximum_outlier_corners",          sl_params->ransac_max_outliers);
+	cvEndWriteStruct(fs);
+
+	// Write capture guidance parameters.
+	cvStartWriteStruct(fs, "capture_guidance", CV_NODE_MAP);
+	cvWriteInt(fs,  "enable_capture_guidance",  sl_params->guidance);
+	cvWriteReal(fs, "stop_uncertainty_percent", sl_params->guidance_stop_uncertainty);
+	cvWriteInt(fs,  "minimum_boards",           sl_params->guidance_min_boards);
+	cvWriteReal(fs, "corner_noise_pixels",      sl_params->guidance_corner_noise);
+	cvEndWriteStruct(fs);
+
+	// Write multiplexed capture parameters.
+	cvStartWriteStruct(fs, "multiplexed_capture", CV_NODE_MAP);
+	cvWriteInt(fs, "enable_multiplexed_capture", sl_params->multiplexed_capture);
+	cvWriteInt(fs, "minimum_channel_response",   sl_params->multiplex_min_response);
+	cvEndWriteStruct(fs);
+
+	// Write photometric calibration parameters.
+	cvStartWriteStruct(fs, "photometric_calibration", CV_NODE_MAP);
+	cvWriteInt(fs,  "enable_photometric_calibration", sl_params->photometric_calibration);
+	cvWriteInt(fs,  "use_previous_calibration",       sl_params->photometric_reuse);
+	cvWriteInt(fs,  "response_levels",                sl_params->photometric_levels);
+	cvWriteInt(fs,  "target_level",                   sl_params->photometric_target);
+	cvWriteReal(fs, "maximum_camera_gain",            sl_params->photometric_max_gain);
+	cvEndWriteStruct(fs);
+
 	// Write scanning and reconstruction parameters.
 	cvStartWriteStruct(fs, "scanning_and_reconstruction", CV_NODE_MAP);
 	cvWriteInt(fs,  "mode",                           sl_params->mode);
@@ -200,6 +317,25 @@ void Configuration::Save()
 	cvWriteReal(fs, "maximum_distance_variation_mm",  sl_params->dist_reject);
 	cvWriteReal(fs, "minimum_background_distance_mm", sl_params->background_depth_thresh);
     cvWriteInt(fs,  "generate_normals",               sl_params->generate_normals);
+	cvWriteReal(fs, "maximum_mesh_depth_jump",        sl_params->mesh_max_depth_jump);
+	cvWriteInt(fs,  "export_sample_points",           sl_params->export_sample_points);
+	cvWriteInt(fs,  "export_sample_seed",             sl_params->export_sample_seed);
+	cvEndWriteStruct(fs);
+
+	// Write phase-shift parameters.
+	cvStartWriteStruct(fs, "phase_shift", CV_NODE_MAP);
+	cvWriteInt(fs,  "number_of_steps",    sl_params->phase_shift_steps);
+	cvWriteInt(fs,  "period_pixels",      sl_params->phase_shift_period);
+	cvWriteReal(fs, "minimum_modulation", sl_params->phase_shift_min_modulation);
+	cvEndWriteStruct(fs);
+
+	// Write multi-scan fusion parameters.
+	cvStartWriteStruct(fs, "fusion", CV_NODE_MAP);
+	cvWriteReal(fs, "voxel_size_mm",           sl_params->fusion_voxel_size);
+	cvWriteReal(fs, "truncation_distance_mm",  sl_params->fusion_truncation);
+	cvWriteInt(fs,  "maximum_voxel_blocks",    sl_params->fusion_max_blocks);
+	cvWriteInt(fs,  "icp_iterations",          sl_params->fusion_icp_iterations);
+	cvWriteReal(fs, "icp_maximum_distance_mm", sl_params->fusion_icp_max_distance);
 	cvEndWriteStruct(fs);
 
 	// Write visualization options.
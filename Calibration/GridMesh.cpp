@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\GridMesh.cpp
+///
+/// @brief  Implements the organized (camera-grid) meshing functions.
+///
+/// Overview:
+///   Reconstructed points are indexed by camera pixel, so the neighbours of a point on the surface
+///   are (almost always) its neighbours on the camera grid. Every 2x2 block of pixels is split into
+///   two triangles along the diagonal with the smaller depth difference. An edge is rejected when
+///   the depth difference between its end points exceeds mesh_max_depth_jump times their depth,
+///   which removes the "curtains" spanning depth discontinuities (e.g., object silhouettes).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "GridMesh.h"
+
+#include <vector>
+
+// Test whether two points may be connected by a mesh edge.
+static inline bool isMeshEdge(float z1, float z2, float max_depth_jump){
+	float z_min = (z1 < z2) ? z1 : z2;
+	return fabs(z1 - z2) <= max_depth_jump*z_min;
+}
+
+// Triangulate an organized point cloud by connecting valid neighbouring camera pixels.
+// Note: Triangles are wound counter-clockwise as seen from the camera (in camera coordinates).
+//       Vertex indices are assigned while scanning each row, so a single pass over the camera
+//       grid both numbers the vertices and emits the triangles between the previous and current row.
+int generateGridMesh(struct slParams* sl_params, CvMat* points, CvMat* mask, CvMat*& faces){
+
+	// Check for input errors.
+	int width  = sl_params->cam_w;
+	int height = sl_params->cam_h;
+	faces = NULL;
+	if(points->rows != 3 || points->cols != width*height){
+		printf("ERROR: Point cloud is not organized by camera pixel!\n");
+		return -1;
+	}
+
+	// Allocate vertex indices for two rows (-1 marks an invalid pixel).
+	int*  index_prev = new int[width];
+	int*  index_cur  = new int[width];
+	const float* z   = points->data.fl + 2*(points->step/sizeof(float));
+	const float  max_depth_jump = sl_params->mesh_max_depth_jump;
+	std::vector<int> triangles;
+	triangles.reserve(4*width*height);
+
+	// Number vertices and connect each 2x2 block of pixels.
+	int n_vertices = 0;
+	for(int r=0; r<height; r++){
+		for(int c=0; c<width; c++){
+			int i = r*width+c;
+			index_cur[c] = (mask == NULL || mask->data.fl[i] != 0) ? n_vertices++ : -1;
+		}
+		if(r == 0){
+			int* tmp = index_prev; index_prev = index_cur; index_cur = tmp;
+			continue;
+		}
+		const float* z0 = z + (r-1)*width;
+		const float* z1 = z + r*width;
+		for(int c=0; c<width-1; c++){
+
+			// Gather the block: a = (r-1,c), b = (r-1,c+1), d = (r,c), e = (r,c+1).
+			int a = index_prev[c], b = index_prev[c+1], d = index_cur[c], e = index_cur[c+1];
+			bool ab = (a >= 0 && b >= 0) && isMeshEdge(z0[c], z0[c+1], max_depth_jump);
+			bool ad = (a >= 0 && d >= 0) && isMeshEdge(z0[c], z1[c],   max_depth_jump);
+			bool be = (b >= 0 && e >= 0) && isMeshEdge(z0[c+1], z1[c+1], max_depth_jump);
+			bool de = (d >= 0 && e >= 0) && isMeshEdge(z1[c], z1[c+1], max_depth_jump);
+			bool bd = (b >= 0 && d >= 0) && isMeshEdge(z0[c+1], z1[c], max_depth_jump);
+			bool ae = (a >= 0 && e >= 0) && isMeshEdge(z0[c], z1[c+1], max_depth_jump);
+
+			// Prefer the diagonal with the smaller depth difference.
+			bool use_bd = bd && (!ae || fabs(z0[c+1] - z1[c]) <= fabs(z0[c] - z1[c+1]));
+			if(use_bd){
+				if(ab && ad){
+					triangles.push_back(a); triangles.push_back(d); triangles.push_back(b);
+				}
+				if(be && de){
+					triangles.push_back(b); triangles.push_back(d); triangles.push_back(e);
+				}
+			}
+			else if(ae){
+				if(ad && de){
+					triangles.push_back(a); triangles.push_back(d); triangles.push_back(e);
+				}
+				if(ab && be){
+					triangles.push_back(a); triangles.push_back(e); triangles.push_back(b);
+				}
+			}
+		}
+		int* tmp = index_prev; index_prev = index_cur; index_cur = tmp;
+	}
+	delete[] index_prev;
+	delete[] index_cur;
+
+	// Pack triangles as a 3xF matrix (one column per face).
+	int n_faces = (int)triangles.size()/3;
+	if(n_faces > 0){
+		faces = cvCreateMat(3, n_faces, CV_32SC1);
+		for(int f=0; f<n_faces; f++)
+			for(int k=0; k<3; k++)
+				faces->data.i[f + n_faces*k] = triangles[3*f+k];
+	}
+	printf("Generated %d triangles from %d vertices.\n", n_faces, n_vertices);
+
+	// Return without errors.
+	return 0;
+}
@@ -0,0 +1,18 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\GridMesh.h
+///
+/// @brief  Declares the organized (camera-grid) meshing functions.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Triangulate an organized point cloud by connecting valid neighbouring camera pixels.
+// Note: faces is allocated as a 3xF CV_32SC1 matrix of 0-based indices into the masked vertex
+//       list (i.e., the order in which savePointsOBJ/savePointsVRML write vertices), and must be
+//       released by the caller. It is set to NULL if no triangles are generated.
+int generateGridMesh(struct slParams* sl_params, CvMat* points, CvMat* mask, CvMat*& faces);
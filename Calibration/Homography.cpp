@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\Homography.cpp
+///
+/// @brief  Implements the fixed-size planar homography kernels.
+///
+/// Overview:
+///   Homographies are estimated with the normalized direct linear transform: both point sets are
+///   translated to their centroid and scaled to a mean distance of sqrt(2), and the homography is
+///   the eigenvector of the smallest eigenvalue of the 9x9 normal matrix A'A (accumulated point by
+///   point, so only fixed-size arrays on the stack are needed), found with cyclic Jacobi rotations.
+///   Points are mapped four at a time: the interleaved (x,y) pairs are split into x and y vectors
+///   with two shuffles, transformed and divided, and interleaved again.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "Homography.h"
+
+#include <float.h>
+#include <emmintrin.h>
+
+// Find the eigenvector of the smallest eigenvalue of a symmetric 9x9 matrix (A is overwritten).
+// Note: Returns false if the smallest two eigenvalues are both (numerically) zero.
+static bool smallestEigenvector(double A[81], double v[9])
+{
+	// Diagonalize A with cyclic Jacobi rotations, accumulating the rotations in V.
+	double V[81];
+	for(int i=0; i<81; i++)
+		V[i] = (i%10 == 0) ? 1.0 : 0.0;
+	for(int sweep=0; sweep<50; sweep++){
+		double off = 0, diag = 0;
+		for(int p=0; p<9; p++){
+			diag += A[p*9+p]*A[p*9+p];
+			for(int q=p+1; q<9; q++)
+				off += A[p*9+q]*A[p*9+q];
+		}
+		if(off <= DBL_EPSILON*DBL_EPSILON*diag)
+			break;
+		for(int p=0; p<8; p++){
+			for(int q=p+1; q<9; q++){
+				double apq = A[p*9+q];
+				if(apq == 0)
+					continue;
+				double theta = (A[q*9+q]-A[p*9+p])/(2.0*apq);
+				double t = ((theta >= 0) ? 1.0 : -1.0)/(fabs(theta)+sqrt(theta*theta+1.0));
+				double c = 1.0/sqrt(t*t+1.0), s = t*c;
+				for(int k=0; k<9; k++){
+					double akp = A[k*9+p], akq = A[k*9+q];
+					A[k*9+p] = c*akp - s*akq;
+					A[k*9+q] = s*akp + c*akq;
+				}
+				for(int k=0; k<9; k++){
+					double apk = A[p*9+k], aqk = A[q*9+k];
+					A[p*9+k] = c*apk - s*aqk;
+					A[q*9+k] = s*apk + c*aqk;
+				}
+				for(int k=0; k<9; k++){
+					double vkp = V[k*9+p], vkq = V[k*9+q];
+					V[k*9+p] = c*vkp - s*vkq;
+					V[k*9+q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+
+	// Select the smallest eigenvalue (and check that the solution is unique).
+	int min_index = 0;
+	double max_value = 0;
+	for(int i=0; i<9; i++){
+		if(A[i*9+i] < A[min_index*9+min_index])
+			min_index = i;
+		max_value = MAX(max_value, A[i*9+i]);
+	}
+	double second = DBL_MAX;
+	for(int i=0; i<9; i++)
+		if(i != min_index)
+			second = MIN(second, A[i*9+i]);
+	if(max_value <= 0 || second <= 1e-12*max_value)
+		return false;
+	for(int k=0; k<9; k++)
+		v[k] = V[k*9+min_index];
+	return true;
+}
+
+// Find the similarity transform moving the centroid of the points to the origin, at a mean distance of sqrt(2).
+// Note: Returns false if all points coincide.
+static bool normalizePoints(const CvPoint2D32f* points, int n, double& cx, double& cy, double& scale)
+{
+	cx = cy = 0;
+	for(int i=0; i<n; i++){
+		cx += points[i].x;
+		cy += points[i].y;
+	}
+	cx /= n;
+	cy /= n;
+	double distance = 0;
+	for(int i=0; i<n; i++)
+		distance += sqrt((points[i].x-cx)*(points[i].x-cx) + (points[i].y-cy)*(points[i].y-cy));
+	distance /= n;
+	if(distance <= DBL_EPSILON)
+		return false;
+	scale = sqrt(2.0)/distance;
+	return true;
+}
+
+// Estimate the homography mapping src onto dst (normalized DLT, least squares over all points).
+bool estimateHomography(const CvPoint2D32f* src, const CvPoint2D32f* dst, int n, double H[9])
+{
+	if(n < 4)
+		return false;
+	double src_cx, src_cy, src_scale, dst_cx, dst_cy, dst_scale;
+	if(!normalizePoints(src, n, src_cx, src_cy, src_scale) ||
+	   !normalizePoints(dst, n, dst_cx, dst_cy, dst_scale))
+		return false;
+
+	// Accumulate the normal matrix A'A of the DLT equations (upper triangle).
+	double AtA[81];
+	for(int i=0; i<81; i++)
+		AtA[i] = 0;
+	for(int i=0; i<n; i++){
+		double x = src_scale*(src[i].x-src_cx), y = src_scale*(src[i].y-src_cy);
+		double u = dst_scale*(dst[i].x-dst_cx), v = dst_scale*(dst[i].y-dst_cy);
+		double r1[9] = {-x, -y, -1,  0,  0,  0, u*x, u*y, u};
+		double r2[9] = { 0,  0,  0, -x, -y, -1, v*x, v*y, v};
+		for(int p=0; p<9; p++)
+			for(int q=p; q<9; q++)
+				AtA[p*9+q] += r1[p]*r1[q] + r2[p]*r2[q];
+	}
+	for(int p=0; p<9; p++)
+		for(int q=0; q<p; q++)
+			AtA[p*9+q] = AtA[q*9+p];
+
+	// Solve for the normalized homography, and undo the normalization (H = T_dst^-1 * Hn * T_src).
+	double Hn[9];
+	if(!smallestEigenvector(AtA, Hn))
+		return false;
+	double T_src[9]     = {src_scale, 0, -src_scale*src_cx, 0, src_scale, -src_scale*src_cy, 0, 0, 1};
+	double T_dst_inv[9] = {1.0/dst_scale, 0, dst_cx, 0, 1.0/dst_scale, dst_cy, 0, 0, 1};
+	double temp[9];
+	composeHomography(Hn, T_src, temp);
+	composeHomography(T_dst_inv, temp, H);
+	if(fabs(H[8]) <= DBL_EPSILON)
+		return false;
+	double h_scale = 1.0/H[8];
+	for(int i=0; i<9; i++)
+		H[i] *= h_scale;
+	return true;
+}
+
+// Map points through a homography (four points at a time with SSE2); src and dst may be the same.
+void applyHomography(const double H[9], const CvPoint2D32f* src, CvPoint2D32f* dst, int n)
+{
+	const __m128 h0 = _mm_set1_ps((float)H[0]), h1 = _mm_set1_ps((float)H[1]), h2 = _mm_set1_ps((float)H[2]);
+	const __m128 h3 = _mm_set1_ps((float)H[3]), h4 = _mm_set1_ps((float)H[4]), h5 = _mm_set1_ps((float)H[5]);
+	const __m128 h6 = _mm_set1_ps((float)H[6]), h7 = _mm_set1_ps((float)H[7]), h8 = _mm_set1_ps((float)H[8]);
+	int i = 0;
+	for(; i+4<=n; i+=4){
+		// Split four (x,y) pairs into x and y vectors.
+		__m128 p01 = _mm_loadu_ps(&src[i].x);
+		__m128 p23 = _mm_loadu_ps(&src[i+2].x);
+		__m128 x = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2,0,2,0));
+		__m128 y = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3,1,3,1));
+
+		// Transform and divide by the homogeneous coordinate.
+		__m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h6, x), _mm_mul_ps(h7, y)), h8);
+		__m128 u = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h0, x), _mm_mul_ps(h1, y)), h2), w);
+		__m128 v = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h3, x), _mm_mul_ps(h4, y)), h5), w);
+
+		// Interleave the results again.
+		_mm_storeu_ps(&dst[i].x,   _mm_unpacklo_ps(u, v));
+		_mm_storeu_ps(&dst[i+2].x, _mm_unpackhi_ps(u, v));
+	}
+	for(; i<n; i++)
+		dst[i] = applyHomography(H, src[i]);
+}
+
+// Map a single point through a homography.
+CvPoint2D32f applyHomography(const double H[9], CvPoint2D32f p)
+{
+	double w = H[6]*p.x + H[7]*p.y + H[8];
+	return cvPoint2D32f((H[0]*p.x + H[1]*p.y + H[2])/w, (H[3]*p.x + H[4]*p.y + H[5])/w);
+}
+
+// Compose two homographies (AB = A*B, i.e., maps through B first, then A).
+void composeHomography(const double A[9], const double B[9], double AB[9])
+{
+	double result[9];
+	for(int r=0; r<3; r++)
+		for(int c=0; c<3; c++)
+			result[r*3+c] = A[r*3]*B[c] + A[r*3+1]*B[3+c] + A[r*3+2]*B[6+c];
+	for(int i=0; i<9; i++)
+		AB[i] = result[i];
+}
+
+// Invert a homography.
+bool invertHomography(const double H[9], double H_inv[9])
+{
+	// Adjugate (transposed cofactors) divided by the determinant.
+	double cof[9];
+	cof[0] =   H[4]*H[8] - H[5]*H[7];
+	cof[1] = -(H[1]*H[8] - H[2]*H[7]);
+	cof[2] =   H[1]*H[5] - H[2]*H[4];
+	cof[3] = -(H[3]*H[8] - H[5]*H[6]);
+	cof[4] =   H[0]*H[8] - H[2]*H[6];
+	cof[5] = -(H[0]*H[5] - H[2]*H[3]);
+	cof[6] =   H[3]*H[7] - H[4]*H[6];
+	cof[7] = -(H[0]*H[7] - H[1]*H[6]);
+	cof[8] =   H[0]*H[4] - H[1]*H[3];
+	double det = H[0]*cof[0] + H[1]*cof[3] + H[2]*cof[6];
+	if(fabs(det) <= DBL_EPSILON)
+		return false;
+	for(int i=0; i<9; i++)
+		H_inv[i] = cof[i]/det;
+	return true;
+}
+
+// Copy a homography from a 3x3 matrix (CV_32FC1 or CV_64FC1).
+void homographyFromMat(const CvMat* mat, double H[9])
+{
+	for(int r=0; r<3; r++)
+		for(int c=0; c<3; c++)
+			H[r*3+c] = cvmGet(mat, r, c);
+}
+
+// Copy a homography to a 3x3 matrix (CV_32FC1 or CV_64FC1), e.g., for cvWarpPerspective.
+void homographyToMat(const double H[9], CvMat* mat)
+{
+	for(int r=0; r<3; r++)
+		for(int c=0; c<3; c++)
+			cvmSet(mat, r, c, H[r*3+c]);
+}
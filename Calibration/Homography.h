@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\Homography.h
+///
+/// @brief  Declares the fixed-size planar homography kernels.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Homographies are 3x3 matrices, stored as 9 doubles in row-major order (H[8] = 1 after estimation).
+
+// Estimate the homography mapping src onto dst (normalized DLT, least squares over all points).
+// Note: Returns false if fewer than 4 points are given or the points are degenerate (e.g., collinear).
+bool estimateHomography(const CvPoint2D32f* src, const CvPoint2D32f* dst, int n, double H[9]);
+
+// Map points through a homography (four points at a time with SSE2); src and dst may be the same.
+void applyHomography(const double H[9], const CvPoint2D32f* src, CvPoint2D32f* dst, int n);
+
+// Map a single point through a homography.
+CvPoint2D32f applyHomography(const double H[9], CvPoint2D32f p);
+
+// Compose two homographies (AB = A*B, i.e., maps through B first, then A).
+void composeHomography(const double A[9], const double B[9], double AB[9]);
+
+// Invert a homography.
+// Note: Returns false if the homography is singular.
+bool invertHomography(const double H[9], double H_inv[9]);
+
+// Copy a homography from a 3x3 matrix (CV_32FC1 or CV_64FC1).
+void homographyFromMat(const CvMat* mat, double H[9]);
+
+// Copy a homography to a 3x3 matrix (CV_32FC1 or CV_64FC1), e.g., for cvWarpPerspective.
+void homographyToMat(const double H[9], CvMat* mat);
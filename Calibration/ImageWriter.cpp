@@ -0,0 +1,229 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ImageWriter.cpp
+///
+/// @brief  Implements the asynchronous image writer.
+///
+/// Overview:
+///   Requests are kept in a fixed ring buffer guarded by a critical section. Two semaphores count
+///   the queued requests and the free slots, so producers and writer threads only wake when there
+///   is something to do. A manual-reset event is signalled whenever no request is pending.
+///
+///   Each writer thread records the file it is saving. A thread which pops a request for a file
+///   that is already being saved hands the image over to the thread saving it, so two threads never
+///   encode the same file at once. A handed-over image replaces an optional image handed over
+///   earlier, but is queued behind a required one.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ImageWriter.h"
+
+// Constructor
+AsyncImageWriter::AsyncImageWriter(int queue_size, int num_threads, bool drop_when_full)
+{
+    mQueueSize    = (queue_size  > 0) ? queue_size  : 1;
+    mNumThreads   = (num_threads > 0) ? num_threads : 1;
+    mDropWhenFull = drop_when_full;
+    mQueue    = new slImageRequest[mQueueSize];
+    mHead     = 0;
+    mDepth    = 0;
+    mPending  = 0;
+    mStop     = false;
+    mMaxDepth = 0;
+    mWritten  = 0;
+    mDropped  = 0;
+    mFailed   = 0;
+
+    InitializeCriticalSection(&mLock);
+    mItems = CreateSemaphore(NULL, 0, mQueueSize+mNumThreads, NULL);
+    mSlots = CreateSemaphore(NULL, mQueueSize, mQueueSize, NULL);
+    mIdle  = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+    // Start writer threads (images are saved synchronously if none can be created).
+    mThreads = new HANDLE[mNumThreads];
+    mActive  = new slActiveWrite[mNumThreads];
+    for(int i=0; i<mNumThreads; i++)
+        mActive[i].busy = false;
+    int n_started = 0;
+    for(int i=0; i<mNumThreads; i++){
+        DWORD thread_id;
+        HANDLE thread = CreateThread(NULL, 0, WriterThread, this, 0, &thread_id);
+        if(thread != NULL)
+            mThreads[n_started++] = thread;
+    }
+    mNumThreads = n_started;
+}
+
+// Destructor
+AsyncImageWriter::~AsyncImageWriter()
+{
+    Flush();
+
+    // Wake every writer thread with an empty queue, which makes it exit.
+    EnterCriticalSection(&mLock);
+    mStop = true;
+    LeaveCriticalSection(&mLock);
+    if(mNumThreads > 0)
+        ReleaseSemaphore(mItems, mNumThreads, NULL);
+    for(int i=0; i<mNumThreads; i++){
+        WaitForSingleObject(mThreads[i], INFINITE);
+        CloseHandle(mThreads[i]);
+    }
+    delete[] mThreads;
+    delete[] mActive;
+
+    CloseHandle(mItems);
+    CloseHandle(mSlots);
+    CloseHandle(mIdle);
+    DeleteCriticalSection(&mLock);
+    delete[] mQueue;
+}
+
+// Writer thread: saves and releases queued images until the writer is stopped.
+DWORD WINAPI AsyncImageWriter::WriterThread(LPVOID lpParam)
+{
+    AsyncImageWriter* writer = (AsyncImageWriter*)lpParam;
+    slImageRequest request;
+    for(;;){
+        WaitForSingleObject(writer->mItems, INFINITE);
+
+        // Pop the oldest request.
+        EnterCriticalSection(&writer->mLock);
+        if(writer->mDepth == 0){
+            bool stop = writer->mStop;
+            LeaveCriticalSection(&writer->mLock);
+            if(stop)
+                break;
+            continue;
+        }
+        request = writer->mQueue[writer->mHead];
+        writer->mHead = (writer->mHead+1) % writer->mQueueSize;
+        writer->mDepth--;
+
+        // Hand the image over if another thread is saving the same file (the latest image wins,
+        // but required images are never dropped).
+        slActiveWrite* active = NULL;
+        for(int i=0; i<writer->mNumThreads; i++)
+            if(writer->mActive[i].busy && strcmp(writer->mActive[i].filename, request.filename) == 0)
+                active = &writer->mActive[i];
+        if(active != NULL){
+            if(!active->next.empty() && !active->next.back().required){
+                cvReleaseImage(&active->next.back().image);
+                active->next.pop_back();
+                writer->mPending--;
+                InterlockedIncrement(&writer->mDropped);
+            }
+            slPendingImage pending = { request.image, request.required };
+            active->next.push_back(pending);
+            LeaveCriticalSection(&writer->mLock);
+            ReleaseSemaphore(writer->mSlots, 1, NULL);
+            continue;
+        }
+
+        // Otherwise, record the file as being saved by this thread.
+        for(int i=0; active == NULL; i++)
+            if(!writer->mActive[i].busy)
+                active = &writer->mActive[i];
+        strcpy(active->filename, request.filename);
+        active->busy = true;
+        LeaveCriticalSection(&writer->mLock);
+        ReleaseSemaphore(writer->mSlots, 1, NULL);
+
+        // Encode and save the image, then any image handed over for the same file meanwhile.
+        while(request.image != NULL){
+            if(cvSaveImage(request.filename, request.image))
+                InterlockedIncrement(&writer->mWritten);
+            else{
+                printf("WARNING: Cannot save image \"%s\"!\n", request.filename);
+                InterlockedIncrement(&writer->mFailed);
+            }
+            cvReleaseImage(&request.image);
+
+            // Signal idle state once nothing is queued or being saved.
+            EnterCriticalSection(&writer->mLock);
+            if(active->next.empty()){
+                request.image = NULL;
+                active->busy  = false;
+            }
+            else{
+                request.image = active->next.front().image;
+                active->next.pop_front();
+            }
+            if(--writer->mPending == 0)
+                SetEvent(writer->mIdle);
+            LeaveCriticalSection(&writer->mLock);
+        }
+    }
+    return 0;
+}
+
+// Queue a copy of an image for saving (the caller keeps ownership of image).
+// Note: The copy is only made once a queue slot is available, so dropped images are never copied.
+int AsyncImageWriter::Save(const char* filename, IplImage* image, bool required)
+{
+    if(image == NULL)
+        return -1;
+    if(mDropWhenFull && !required && GetQueueDepth() >= mQueueSize){
+        InterlockedIncrement(&mDropped);
+        return -1;
+    }
+    return SaveOwned(filename, cvCloneImage(image), required);
+}
+
+// Queue an image for saving and take ownership of it (it is released by the writer).
+// Note: Required images wait for a free slot, regardless of the drop policy.
+int AsyncImageWriter::SaveOwned(const char* filename, IplImage* image, bool required)
+{
+    if(image == NULL)
+        return -1;
+
+    // Save synchronously if no writer thread is running.
+    if(mNumThreads == 0){
+        if(cvSaveImage(filename, image))
+            InterlockedIncrement(&mWritten);
+        else{
+            printf("WARNING: Cannot save image \"%s\"!\n", filename);
+            InterlockedIncrement(&mFailed);
+        }
+        cvReleaseImage(&image);
+        return 0;
+    }
+
+    // Reserve a queue slot (or drop the image, if the queue is full).
+    if(WaitForSingleObject(mSlots, (mDropWhenFull && !required) ? 0 : INFINITE) != WAIT_OBJECT_0){
+        InterlockedIncrement(&mDropped);
+        cvReleaseImage(&image);
+        return -1;
+    }
+
+    // Append the request and wake a writer thread.
+    EnterCriticalSection(&mLock);
+    slImageRequest& request = mQueue[(mHead+mDepth) % mQueueSize];
+    strncpy(request.filename, filename, sizeof(request.filename)-1);
+    request.filename[sizeof(request.filename)-1] = '\0';
+    request.image    = image;
+    request.required = required;
+    if(++mDepth > mMaxDepth)
+        mMaxDepth = mDepth;
+    if(mPending++ == 0)
+        ResetEvent(mIdle);
+    LeaveCriticalSection(&mLock);
+    ReleaseSemaphore(mItems, 1, NULL);
+    return 0;
+}
+
+// Wait until every queued image has been saved.
+void AsyncImageWriter::Flush()
+{
+    if(mNumThreads > 0)
+        WaitForSingleObject(mIdle, INFINITE);
+}
+
+// Number of images waiting to be saved (excluding those being encoded).
+int AsyncImageWriter::GetQueueDepth()
+{
+    EnterCriticalSection(&mLock);
+    int depth = mDepth;
+    LeaveCriticalSection(&mLock);
+    return depth;
+}
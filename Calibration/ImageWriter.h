@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ImageWriter.h
+///
+/// @brief  Declares the asynchronous image writer.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include <deque>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  AsyncImageWriter
+///
+/// @brief  Encodes and saves images on a pool of background threads.
+///
+/// Images are placed in a bounded queue and saved with cvSaveImage by the writer threads, so the
+/// capture loop never waits for PNG/TIFF encoding or disk I/O. When the queue is full, a new image
+/// is either dropped or the caller blocks until a slot is free, depending on the drop policy
+/// (images marked as required are never dropped).
+/// Queued images are owned by the writer and released once they have been saved (or dropped).
+/// Writes to the same file are serialized: an image queued for a file that another thread is
+/// still saving is saved after it, and only the latest of several such images is kept (required
+/// images are all saved, in order).
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class AsyncImageWriter
+{
+public:
+    AsyncImageWriter(int queue_size, int num_threads, bool drop_when_full);
+
+    // Waits for all queued images to be saved, then stops the writer threads.
+    ~AsyncImageWriter();
+
+    // Queue a copy of an image for saving (the caller keeps ownership of image).
+    // Note: Returns 0 if the image was queued, or -1 if it was dropped.
+    int Save(const char* filename, IplImage* image, bool required CV_DEFAULT(false));
+
+    // Queue an image for saving and take ownership of it (it is released by the writer).
+    // Note: Returns 0 if the image was queued, or -1 if it was dropped (and released).
+    int SaveOwned(const char* filename, IplImage* image, bool required CV_DEFAULT(false));
+
+    // Wait until every queued image has been saved.
+    void Flush();
+
+    // Accessor methods
+    int GetQueueDepth();
+    int GetMaxQueueDepth() { return mMaxDepth; };
+    int GetWrittenCount() { return mWritten; };
+    int GetDroppedCount() { return mDropped; };
+    int GetFailedCount() { return mFailed; };
+
+private:
+    struct slImageRequest{
+        char      filename[1024];
+        IplImage* image;
+        bool      required;
+    };
+
+    struct slPendingImage{
+        IplImage* image;
+        bool      required;
+    };
+
+    struct slActiveWrite{
+        char      filename[1024];
+        std::deque<slPendingImage> next; // images queued for the same file meanwhile (saved in order; only the last may be optional)
+        bool      busy;                  // true while a writer thread is saving the file
+    };
+
+    static DWORD WINAPI WriterThread(LPVOID lpParam);
+
+    /// <summary> Ring buffer of queued requests. </summary>
+    slImageRequest* mQueue;
+    int mQueueSize;
+    int mHead, mDepth;
+
+    /// <summary> Number of requests queued or being saved (guarded by mLock). </summary>
+    int mPending;
+
+    /// <summary> Drop (rather than block on) new images when the queue is full. </summary>
+    bool mDropWhenFull;
+
+    /// <summary> Writer threads, and the files they are saving (one entry per thread, guarded by mLock). </summary>
+    HANDLE* mThreads;
+    int mNumThreads;
+    slActiveWrite* mActive;
+
+    /// <summary> Synchronization: queue lock, queued-request and free-slot counts, idle event. </summary>
+    CRITICAL_SECTION mLock;
+    HANDLE mItems;
+    HANDLE mSlots;
+    HANDLE mIdle;
+    bool   mStop;
+
+    /// <summary> Statistics. </summary>
+    int mMaxDepth;
+    volatile LONG mWritten;
+    volatile LONG mDropped;
+    volatile LONG mFailed;
+};
@@ -0,0 +1,460 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\OfflineCalibration.cpp
+///
+/// @brief  Implements the offline recalibration from saved chessboard observations.
+///
+/// Overview:
+///   The full solve (camera, projector, and projector-camera geometry) runs once on the merged
+///   observations through solveProjectorCalibration, which writes the calibration as usual.
+///   Leave-one-out solves only need the reprojection errors, so they run without any output on
+///   private copies of the observations and intrinsics, one board per iteration of a parallel loop
+///   (boards are handed out dynamically, since the solves converge in different numbers of iterations).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "OfflineCalibration.h"
+#include "UtilProCam.h"
+#include "BoardQuality.h"
+
+#include <omp.h>
+
+// Time elapsed since a cvGetTickCount() value (in ms).
+static double elapsedTime(int64 start){
+    return (double)(cvGetTickCount()-start)/(1000.0*cvGetTickFrequency());
+}
+
+// Read a string, or a sequence of strings, from a file node.
+static void readStrings(CvFileNode* node, std::vector<std::string>& values){
+    if(node == NULL)
+        return;
+    if(CV_NODE_IS_SEQ(node->tag)){
+        CvSeq* seq = node->data.seq;
+        for(int i=0; i<seq->total; i++)
+            values.push_back(cvReadString((CvFileNode*)cvGetSeqElem(seq, i), ""));
+    }
+    else if(CV_NODE_IS_STRING(node->tag))
+        values.push_back(cvReadString(node, ""));
+}
+
+// Read an integer, or a sequence of integers, from a file node.
+static void readInts(CvFileNode* node, std::vector<int>& values){
+    if(node == NULL)
+        return;
+    if(CV_NODE_IS_SEQ(node->tag)){
+        CvSeq* seq = node->data.seq;
+        for(int i=0; i<seq->total; i++)
+            values.push_back(cvReadInt((CvFileNode*)cvGetSeqElem(seq, i), -1));
+    }
+    else if(CV_NODE_IS_INT(node->tag))
+        values.push_back(cvReadInt(node, -1));
+}
+
+// Copy rows [src_row, src_row+n) of a matrix to rows [dst_row, dst_row+n) of another matrix.
+static void copyRows(CvMat* src, int src_row, CvMat* dst, int dst_row, int n){
+    CvMat src_rows, dst_rows;
+    cvGetRows(src, &src_rows, src_row, src_row+n);
+    cvGetRows(dst, &dst_rows, dst_row, dst_row+n);
+    cvCopy(&src_rows, &dst_rows);
+}
+
+// Evaluate the RMS reprojection error of a single board, given the intrinsic calibration.
+static double reprojectionError(CvMat* object_points, CvMat* image_points, CvMat* intrinsic, CvMat* distortion){
+    float r[3], t[3];
+    CvMat rotation    = cvMat(1, 3, CV_32FC1, r);
+    CvMat translation = cvMat(1, 3, CV_32FC1, t);
+    CvMat* projected  = cvCreateMat(image_points->rows, 2, CV_32FC1);
+    cvFindExtrinsicCameraParams2(object_points, image_points, intrinsic, distortion, &rotation, &translation);
+    cvProjectPoints2(object_points, &rotation, &translation, intrinsic, distortion, projected);
+    double error = 0;
+    for(int i=0; i<image_points->rows; i++){
+        double dx = CV_MAT_ELEM(*projected, float, i, 0) - CV_MAT_ELEM(*image_points, float, i, 0);
+        double dy = CV_MAT_ELEM(*projected, float, i, 1) - CV_MAT_ELEM(*image_points, float, i, 1);
+        error += dx*dx + dy*dy;
+    }
+    cvReleaseMat(&projected);
+    return sqrt(error/image_points->rows);
+}
+
+// Evaluate the calibration flags selected by a distortion model.
+static int distortionFlags(bool* dist_model, CvMat* distortion){
+    int calib_flags = 0;
+    if(!dist_model[0])
+        calib_flags |= CV_CALIB_ZERO_TANGENT_DIST;
+    if(!dist_model[1]){
+        cvmSet(distortion, 4, 0, 0);
+        calib_flags |= CV_CALIB_FIX_K3;
+    }
+    return calib_flags;
+}
+
+// Constructor
+OfflineCalibration::OfflineCalibration(struct slParams* sl_params)
+{
+    mSlParams      = sl_params;
+    mCalibrateBoth = true;
+    mLeaveOneOut   = false;
+    mNumThreads    = 0;
+    memset(&mObs, 0, sizeof(mObs));
+    mCalibrator    = NULL;
+    mSlCalib       = NULL;
+    mContributions = NULL;
+}
+
+// Destructor
+OfflineCalibration::~OfflineCalibration()
+{
+    if(mObs.cam_image_points != NULL){
+        cvReleaseMat(&mObs.cam_image_points);
+        cvReleaseMat(&mObs.proj_image_points);
+        cvReleaseMat(&mObs.proj_pixel_points);
+    }
+    delete[] mContributions;
+}
+
+// Check whether a file describes an offline recalibration (rather than a calibration job).
+bool OfflineCalibration::IsRecalibration(const char* filename)
+{
+    CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_READ);
+    if(fs == NULL)
+        return false;
+    bool recalibration = (cvGetFileNodeByName(fs, 0, "recalibration") != NULL);
+    cvReleaseFileStorage(&fs);
+    return recalibration;
+}
+
+// Read a recalibration description (distortion models in the description override the configuration).
+int OfflineCalibration::Load(const char* filename)
+{
+    CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_READ);
+    if(fs == NULL){
+        printf("ERROR: Cannot open recalibration \"%s\"!\n", filename);
+        return -1;
+    }
+    struct slParams* sl_params = mSlParams;
+
+    // Read recalibration parameters.
+    CvFileNode* m = cvGetFileNodeByName(fs, 0, "recalibration");
+    readStrings(cvGetFileNodeByName(fs, m, "observations"),   mFiles);
+    readInts(cvGetFileNodeByName(fs, m, "exclude_boards"), mExcluded);
+    mCalibrateBoth = (cvReadIntByName(fs, m, "calibrate_camera", 1) != 0);
+    mLeaveOneOut   = (cvReadIntByName(fs, m, "leave_one_out",    0) != 0);
+    mNumThreads    =  cvReadIntByName(fs, m, "threads",          0);
+
+    // Read distortion models (defaults to the configuration).
+    m = cvGetFileNodeByName(fs, 0, "camera_distortion");
+    sl_params->cam_dist_model[0]  = (cvReadIntByName(fs, m, "enable_tangential",       sl_params->cam_dist_model[0])  != 0);
+    sl_params->cam_dist_model[1]  = (cvReadIntByName(fs, m, "enable_6th_order_radial", sl_params->cam_dist_model[1])  != 0);
+    m = cvGetFileNodeByName(fs, 0, "projector_distortion");
+    sl_params->proj_dist_model[0] = (cvReadIntByName(fs, m, "enable_tangential",       sl_params->proj_dist_model[0]) != 0);
+    sl_params->proj_dist_model[1] = (cvReadIntByName(fs, m, "enable_6th_order_radial", sl_params->proj_dist_model[1]) != 0);
+
+    cvReleaseFileStorage(&fs);
+
+    // Default to the observations saved by the last calibration.
+    if(mFiles.empty()){
+        char str[1024];
+        sprintf(str, "%s\\calib\\observations.xml", sl_params->outdir);
+        mFiles.push_back(str);
+    }
+
+    // Use one thread per processor (if not given).
+    if(mNumThreads <= 0)
+        mNumThreads = omp_get_num_procs();
+    return 0;
+}
+
+// Load the observations and solve the calibration (and evaluate every board, if enabled).
+int OfflineCalibration::Run(CalibrateProCam* calibrator, struct slCalib* sl_calib)
+{
+    struct slParams* sl_params = mSlParams;
+    int64 start = cvGetTickCount();
+
+    // Load and merge observations (before the calibration directories are cleared).
+    if(LoadObservations(calibrator) != 0)
+        return -1;
+    printf("Loaded %d boards in %.1f ms.\n", mObs.n_boards, elapsedTime(start));
+
+    // Reset projector (and camera) calibration status (will be set again, if successful).
+    if(!mCalibrateBoth && !sl_calib->cam_intrinsic_calib){
+        printf("ERROR: Camera must be calibrated first or simultaneously!\n");
+        return -1;
+    }
+    sl_calib->proj_intrinsic_calib   = false;
+    sl_calib->procam_extrinsic_calib = false;
+    if(mCalibrateBoth)
+        sl_calib->cam_intrinsic_calib = false;
+
+    // Create calibration directories (clear previous calibration first).
+    char str[1024];
+    _mkdir(sl_params->outdir);
+    sprintf(str, "%s\\calib", sl_params->outdir);
+    _mkdir(str);
+    if(mCalibrateBoth){
+        sprintf(str, "%s\\calib\\cam", sl_params->outdir);
+        removeDirectory(str);
+        if(_mkdir(str) != 0){
+            printf("ERROR: Cannot open output directory!\n");
+            return -1;
+        }
+    }
+    sprintf(str, "%s\\calib\\proj", sl_params->outdir);
+    removeDirectory(str);
+    if(_mkdir(str) != 0){
+        printf("ERROR: Cannot open output directory!\n");
+        return -1;
+    }
+
+    // Solve for the calibration.
+    struct slCalibResult result;
+    memset(&result, 0, sizeof(result));
+    int64 t0 = cvGetTickCount();
+    if(calibrator->solveProjectorCalibration(sl_params, sl_calib, &mObs, mCalibrateBoth, &result) != 0)
+        return -1;
+    printf("Solved calibration from %d boards in %.1f ms.\n", mObs.n_boards, elapsedTime(t0));
+
+    // Evaluate the contribution of every board.
+    if(mLeaveOneOut){
+        mCalibrator = calibrator;
+        mSlCalib    = sl_calib;
+        t0 = cvGetTickCount();
+        LeaveOneOut();
+        Report(&result, elapsedTime(t0));
+    }
+    printf("Recalibration completed in %.1f ms.\n", elapsedTime(start));
+    return 0;
+}
+
+// Load and merge the observation files, leaving out excluded boards.
+int OfflineCalibration::LoadObservations(CalibrateProCam* calibrator)
+{
+    struct slParams* sl_params = mSlParams;
+    int cam_board_n  = sl_params->cam_board_w*sl_params->cam_board_h;
+    int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+
+    // Load every observation file.
+    std::vector<struct slCalibObservations> files(mFiles.size());
+    int n_boards = 0, status = 0;
+    for(size_t f=0; f<mFiles.size(); f++){
+        if(calibrator->loadObservations(mFiles[f].c_str(), sl_params, &files[f]) != 0){
+            status = -1;
+            break;
+        }
+        n_boards += files[f].n_boards;
+    }
+
+    // Merge the boards which are not excluded.
+    if(status == 0){
+        mObs.n_boards          = 0;
+        mObs.cam_image_points  = cvCreateMat(n_boards*cam_board_n,  2, CV_32FC1);
+        mObs.proj_image_points = cvCreateMat(n_boards*proj_board_n, 2, CV_32FC1);
+        mObs.proj_pixel_points = cvCreateMat(n_boards*proj_board_n, 2, CV_32FC1);
+        mObs.cam_images        = NULL;
+        mObs.proj_images       = NULL;
+        int board = 0;
+        for(size_t f=0; f<files.size(); f++){
+            for(int i=0; i<files[f].n_boards; i++, board++){
+                bool excluded = false;
+                for(size_t k=0; k<mExcluded.size(); k++)
+                    excluded |= (mExcluded[k] == board);
+                if(excluded)
+                    continue;
+                int b = mObs.n_boards++;
+                copyRows(files[f].cam_image_points,  i*cam_board_n,  mObs.cam_image_points,  b*cam_board_n,  cam_board_n);
+                copyRows(files[f].proj_image_points, i*proj_board_n, mObs.proj_image_points, b*proj_board_n, proj_board_n);
+                copyRows(files[f].proj_pixel_points, i*proj_board_n, mObs.proj_pixel_points, b*proj_board_n, proj_board_n);
+                mBoardIds.push_back(board);
+            }
+        }
+        if(mObs.n_boards < n_boards)
+            printf("Excluded %d of %d boards.\n", n_boards-mObs.n_boards, n_boards);
+
+        // Remove outlier boards (keeping the original board numbers of the remaining boards).
+        if(sl_params->board_outlier_rejection && mObs.n_boards > 0){
+            BoardScorer scorer(sl_params);
+            std::vector<int> kept_boards(mObs.n_boards);
+            if(scorer.RejectOutliers(&mObs, &kept_boards[0]) > 0){
+                for(int b=0; b<mObs.n_boards; b++)
+                    mBoardIds[b] = mBoardIds[kept_boards[b]];
+                mBoardIds.resize(mObs.n_boards);
+            }
+        }
+    }
+
+    // Free loaded observations.
+    for(size_t f=0; f<files.size(); f++){
+        if(files[f].cam_image_points != NULL){
+            cvReleaseMat(&files[f].cam_image_points);
+            cvReleaseMat(&files[f].proj_image_points);
+            cvReleaseMat(&files[f].proj_pixel_points);
+        }
+    }
+    return status;
+}
+
+// Solve the calibration without each board in turn (on mNumThreads threads).
+void OfflineCalibration::LeaveOneOut()
+{
+    delete[] mContributions;
+    mContributions = new struct slBoardContribution[mObs.n_boards];
+    printf("Evaluating %d boards (leave-one-out) on %d threads...\n", mObs.n_boards, mNumThreads);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(mNumThreads)
+    for(int board=0; board<mObs.n_boards; board++)
+        SolveWithout(board);
+}
+
+// Solve the calibration without the given board and evaluate the board's reprojection error.
+// Note: Only reads shared state, so boards can be evaluated concurrently.
+void OfflineCalibration::SolveWithout(int board)
+{
+    struct slParams* sl_params = mSlParams;
+    struct slBoardContribution* contribution = &mContributions[board];
+    contribution->board              = mBoardIds[board];
+    contribution->solved             = false;
+    contribution->cam_error          = 0;
+    contribution->proj_error         = 0;
+    contribution->cam_holdout_error  = 0;
+    contribution->proj_holdout_error = 0;
+    int n_boards = mObs.n_boards-1;
+    if(n_boards < 2)
+        return;
+
+    // Allocate calibration matrices.
+    int cam_board_n  = sl_params->cam_board_w*sl_params->cam_board_h;
+    int proj_board_n = sl_params->proj_board_w*sl_params->proj_board_h;
+    CvMat* cam_object_points   = cvCreateMat(n_boards*cam_board_n,  3, CV_32FC1);
+    CvMat* cam_image_points    = cvCreateMat(n_boards*cam_board_n,  2, CV_32FC1);
+    CvMat* cam_point_counts    = cvCreateMat(n_boards, 1, CV_32SC1);
+    CvMat* proj_object_points  = cvCreateMat(n_boards*proj_board_n, 3, CV_32FC1);
+    CvMat* proj_camera_points  = cvCreateMat(n_boards*proj_board_n, 2, CV_32FC1);
+    CvMat* proj_image_points   = cvCreateMat(n_boards*proj_board_n, 2, CV_32FC1);
+    CvMat* proj_point_counts   = cvCreateMat(n_boards, 1, CV_32SC1);
+    CvMat* rotation_vectors    = cvCreateMat(n_boards, 3, CV_32FC1);
+    CvMat* translation_vectors = cvCreateMat(n_boards, 3, CV_32FC1);
+    CvMat* cam_intrinsic       = cvCreateMat(3, 3, CV_32FC1);
+    CvMat* cam_distortion      = cvCreateMat(5, 1, CV_32FC1);
+    CvMat* proj_intrinsic      = cvCreateMat(3, 3, CV_32FC1);
+    CvMat* proj_distortion     = cvCreateMat(5, 1, CV_32FC1);
+    CvMat* board_proj_object   = cvCreateMat(proj_board_n, 3, CV_32FC1);
+
+    // Transfer the observations of the other boards.
+    for(int i=0, b=0; i<mObs.n_boards; i++){
+        if(i == board)
+            continue;
+        copyRows(mObs.cam_image_points,  i*cam_board_n,  cam_image_points,   b*cam_board_n,  cam_board_n);
+        copyRows(mObs.proj_image_points, i*proj_board_n, proj_camera_points, b*proj_board_n, proj_board_n);
+        copyRows(mObs.proj_pixel_points, i*proj_board_n, proj_image_points,  b*proj_board_n, proj_board_n);
+        CV_MAT_ELEM(*cam_point_counts,  int, b, 0) = cam_board_n;
+        CV_MAT_ELEM(*proj_point_counts, int, b, 0) = proj_board_n;
+        b++;
+    }
+    for(int i=0; i<n_boards*cam_board_n; ++i){
+        int j = i%cam_board_n;
+        CV_MAT_ELEM(*cam_object_points, float, i, 0) = sl_params->cam_board_w_mm*float(j/sl_params->cam_board_w);
+        CV_MAT_ELEM(*cam_object_points, float, i, 1) = sl_params->cam_board_h_mm*float(j%sl_params->cam_board_w);
+        CV_MAT_ELEM(*cam_object_points, float, i, 2) = 0.0f;
+    }
+
+    // Calibrate the camera (or use the fixed camera calibration).
+    if(mCalibrateBoth){
+        cvZero(cam_distortion);
+        contribution->cam_error = cvCalibrateCamera2(cam_object_points, cam_image_points, cam_point_counts,
+            cvSize(sl_params->cam_w, sl_params->cam_h), cam_intrinsic, cam_distortion,
+            rotation_vectors, translation_vectors, distortionFlags(sl_params->cam_dist_model, cam_distortion));
+    }
+    else{
+        cvCopy(mSlCalib->cam_intrinsic,  cam_intrinsic);
+        cvCopy(mSlCalib->cam_distortion, cam_distortion);
+    }
+
+    // Calibrate the projector.
+    mCalibrator->evaluateProjectorObjectPoints(sl_params, cam_intrinsic, cam_distortion,
+        cam_image_points, proj_camera_points, n_boards, proj_object_points);
+    cvZero(proj_distortion);
+    contribution->proj_error = cvCalibrateCamera2(proj_object_points, proj_image_points, proj_point_counts,
+        cvSize(sl_params->proj_w, sl_params->proj_h), proj_intrinsic, proj_distortion,
+        rotation_vectors, translation_vectors, distortionFlags(sl_params->proj_dist_model, proj_distortion));
+
+    // Evaluate the reprojection error of the left-out board.
+    CvMat board_cam_object, board_cam_image, board_proj_camera, board_proj_image;
+    cvGetRows(cam_object_points,      &board_cam_object,  0, cam_board_n);
+    cvGetRows(mObs.cam_image_points,  &board_cam_image,   board*cam_board_n,  (board+1)*cam_board_n);
+    cvGetRows(mObs.proj_image_points, &board_proj_camera, board*proj_board_n, (board+1)*proj_board_n);
+    cvGetRows(mObs.proj_pixel_points, &board_proj_image,  board*proj_board_n, (board+1)*proj_board_n);
+    mCalibrator->evaluateProjectorObjectPoints(sl_params, cam_intrinsic, cam_distortion,
+        &board_cam_image, &board_proj_camera, 1, board_proj_object);
+    contribution->cam_holdout_error  = reprojectionError(&board_cam_object, &board_cam_image, cam_intrinsic, cam_distortion);
+    contribution->proj_holdout_error = reprojectionError(board_proj_object, &board_proj_image, proj_intrinsic, proj_distortion);
+    contribution->solved = true;
+
+    // Free allocated resources.
+    cvReleaseMat(&cam_object_points);
+    cvReleaseMat(&cam_image_points);
+    cvReleaseMat(&cam_point_counts);
+    cvReleaseMat(&proj_object_points);
+    cvReleaseMat(&proj_camera_points);
+    cvReleaseMat(&proj_image_points);
+    cvReleaseMat(&proj_point_counts);
+    cvReleaseMat(&rotation_vectors);
+    cvReleaseMat(&translation_vectors);
+    cvReleaseMat(&cam_intrinsic);
+    cvReleaseMat(&cam_distortion);
+    cvReleaseMat(&proj_intrinsic);
+    cvReleaseMat(&proj_distortion);
+    cvReleaseMat(&board_proj_object);
+}
+
+// Write the leave-one-out results.
+// Note: A positive change means that the remaining boards fit better without the board. The boards are solved
+//       without bundle adjustment, so they are compared with the errors of the full calibration before adjustment.
+void OfflineCalibration::Report(struct slCalibResult* result, double time)
+{
+    // Display the contribution of every board.
+    printf("***Leave-one-out evaluation (%.1f ms):\n", time);
+    printf("   board   cam error (change)   proj error (change)   held-out cam   held-out proj\n");
+    for(int i=0; i<mObs.n_boards; i++){
+        struct slBoardContribution* c = &mContributions[i];
+        if(!c->solved){
+            printf("   %5d   (not solved)\n", c->board);
+            continue;
+        }
+        printf("   %5d   %9.4f (%+7.4f)   %10.4f (%+7.4f)   %12.4f   %13.4f\n", c->board,
+            c->cam_error,  mCalibrateBoth ? result->cam_initial_error-c->cam_error : 0.0,
+            c->proj_error, result->proj_initial_error-c->proj_error,
+            c->cam_holdout_error, c->proj_holdout_error);
+    }
+    int worst = -1;
+    for(int i=0; i<mObs.n_boards; i++)
+        if(mContributions[i].solved && (worst < 0 || mContributions[i].proj_holdout_error > mContributions[worst].proj_holdout_error))
+            worst = i;
+    if(worst >= 0)
+        printf("+ Largest held-out projector error: board %d (%f pixels).\n",
+            mContributions[worst].board, mContributions[worst].proj_holdout_error);
+
+    // Write leave-one-out results.
+    char str[1024];
+    sprintf(str, "%s\\calib\\leave_one_out.xml", mSlParams->outdir);
+    CvFileStorage* fs = cvOpenFileStorage(str, 0, CV_STORAGE_WRITE);
+    if(fs == NULL){
+        printf("ERROR: Cannot save leave-one-out results \"%s\"!\n", str);
+        return;
+    }
+    cvWriteReal(fs, "camera_error_pixels",    result->cam_initial_error);
+    cvWriteReal(fs, "projector_error_pixels", result->proj_initial_error);
+    cvWriteReal(fs, "time_ms",                time);
+    cvStartWriteStruct(fs, "boards", CV_NODE_SEQ);
+    for(int i=0; i<mObs.n_boards; i++){
+        struct slBoardContribution* c = &mContributions[i];
+        cvStartWriteStruct(fs, NULL, CV_NODE_MAP);
+            cvWriteInt(fs,  "board",                           c->board);
+            cvWriteInt(fs,  "solved",                          c->solved);
+            cvWriteReal(fs, "camera_error_pixels",             c->cam_error);
+            cvWriteReal(fs, "projector_error_pixels",          c->proj_error);
+            cvWriteReal(fs, "held_out_camera_error_pixels",    c->cam_holdout_error);
+            cvWriteReal(fs, "held_out_projector_error_pixels", c->proj_holdout_error);
+        cvEndWriteStruct(fs);
+    }
+    cvEndWriteStruct(fs);
+    cvReleaseFileStorage(&fs);
+}
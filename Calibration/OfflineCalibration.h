@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\OfflineCalibration.h
+///
+/// @brief  Declares the offline recalibration from saved chessboard observations.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "CalibrateProCam.h"
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slBoardContribution
+///
+/// @brief  Leave-one-out evaluation of a single calibration board.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slBoardContribution{
+	int    board;                   // board index (in the order the observation files are listed)
+	bool   solved;                  // calibration without this board succeeded
+	double cam_error;               // camera reprojection error of the other boards (pixels)
+	double proj_error;              // projector reprojection error of the other boards (pixels)
+	double cam_holdout_error;       // camera reprojection error of this board (pixels)
+	double proj_holdout_error;      // projector reprojection error of this board (pixels)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  OfflineCalibration
+///
+/// @brief  Solves the projector-camera calibration again from saved chessboard observations.
+///
+/// Every calibration saves its chessboard corners to calib\observations.xml. A recalibration
+/// merges one or more of these files, leaves out selected boards, optionally overrides the
+/// distortion models, and solves again without capturing. In leave-one-out mode each board is
+/// also left out in turn (in parallel), to show how much it contributes to the reprojection
+/// error; the results are written to calib\leave_one_out.xml.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class OfflineCalibration
+{
+public:
+    OfflineCalibration(struct slParams* sl_params);
+
+    ~OfflineCalibration();
+
+    // Check whether a file describes an offline recalibration (rather than a calibration job).
+    static bool IsRecalibration(const char* filename);
+
+    // Read a recalibration description (distortion models in the description override the configuration).
+    int Load(const char* filename);
+
+    // Load the observations and solve the calibration (and evaluate every board, if enabled).
+    // Note: Returns 0 if the calibration was solved, -1 otherwise.
+    int Run(CalibrateProCam* calibrator, struct slCalib* sl_calib);
+
+    // Accessor methods
+    int GetBoardCount() { return mObs.n_boards; };
+    struct slBoardContribution* GetContributions() { return mContributions; };
+
+private:
+    // Load and merge the observation files, leaving out excluded boards.
+    int LoadObservations(CalibrateProCam* calibrator);
+
+    // Solve the calibration without each board in turn (on mNumThreads threads).
+    void LeaveOneOut();
+
+    // Solve the calibration without the given board and evaluate the board's reprojection error.
+    void SolveWithout(int board);
+
+    // Write the leave-one-out results.
+    void Report(struct slCalibResult* result, double time);
+
+    /// <summary> Configuration (distortion models are overridden by the recalibration). </summary>
+    struct slParams* mSlParams;
+
+    /// <summary> Recalibration description. </summary>
+    std::vector<std::string> mFiles;
+    std::vector<int> mExcluded;
+    bool mCalibrateBoth;
+    bool mLeaveOneOut;
+    int  mNumThreads;
+
+    /// <summary> Merged chessboard observations and the index of each board in the listed files. </summary>
+    struct slCalibObservations mObs;
+    std::vector<int> mBoardIds;
+
+    /// <summary> Leave-one-out state: solver, camera calibration (if fixed), per-board results. </summary>
+    CalibrateProCam* mCalibrator;
+    struct slCalib* mSlCalib;
+    struct slBoardContribution* mContributions;
+};
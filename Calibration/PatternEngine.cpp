@@ -0,0 +1,297 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PatternEngine.cpp
+///
+/// @brief  Implements the projector pattern renderer and its per-session frame cache.
+///
+/// Overview:
+///   Chessboards are rendered from two template rows (one per parity of the square rows): the
+///   column edges of the squares are found once, the black squares of each template row are
+///   cleared with memset, and every image row is a memcpy of its template (or a white border row).
+///   Gray-code bit planes follow the usual convention (reflected binary code of the column or row,
+///   most significant bit first, centred on the projector by an offset), with an inverse plane
+///   per bit for robust thresholding. Phase-shift sinusoids are rendered by
+///   generatePhaseShiftPatterns, and all steps are cached at once.
+///   The cache is a short list searched linearly (a session uses tens of patterns). The gain
+///   lookup table reproduces cvScale(frame, frame, 2*proj_gain/100): each level is scaled,
+///   rounded and saturated once, instead of for every pixel of every frame. With a projector
+///   response set, the scaled level is then mapped through it (in the same table).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "PatternEngine.h"
+#include "PhaseShift.h"
+
+// Constructor
+PatternEngine::PatternEngine(struct slParams* sl_params)
+{
+    mSlParams = sl_params;
+    mSize     = cvSize(sl_params->proj_w, sl_params->proj_h);
+    mLut      = cvCreateMat(1, 256, CV_8UC1);
+    mLutGain  = -1;
+    mResponse = NULL;
+}
+
+// Destructor
+PatternEngine::~PatternEngine()
+{
+    Clear();
+    cvReleaseMat(&mLut);
+    if(mResponse != NULL)
+        cvReleaseMat(&mResponse);
+}
+
+// Release every cached pattern.
+void PatternEngine::Clear()
+{
+    for(size_t i=0; i<mEntries.size(); i++){
+        if(mEntries[i].frame != mEntries[i].pattern)
+            cvReleaseImage(&mEntries[i].frame);
+        cvReleaseImage(&mEntries[i].pattern);
+    }
+    mEntries.clear();
+}
+
+// Rebuild the gain lookup table (if the projector gain changed).
+void PatternEngine::UpdateGain()
+{
+    if(mLutGain == mSlParams->proj_gain)
+        return;
+    mLutGain = mSlParams->proj_gain;
+    double scale = 2.*(mLutGain/100.);
+    for(int v=0; v<256; v++){
+        int level = cvRound(v*scale);
+        level = (level < 0) ? 0 : ((level > 255) ? 255 : level);
+        mLut->data.ptr[v] = (mResponse != NULL) ? mResponse->data.ptr[level] : (uchar)level;
+    }
+}
+
+// Set the inverse projector response (1x256, 8-bit; NULL = linear), applied after the projector gain.
+void PatternEngine::SetResponse(const CvMat* response)
+{
+    if(mResponse != NULL)
+        cvReleaseMat(&mResponse);
+    if(response != NULL)
+        mResponse = cvCloneMat(response);
+    mLutGain = -1;
+    Clear();
+}
+
+// Apply the projector gain to a frame rendered elsewhere (e.g., a warped pattern; src and dst may be the same).
+void PatternEngine::ApplyGain(IplImage* src, IplImage* dst)
+{
+    UpdateGain();
+    cvLUT(src, dst, mLut);
+}
+
+// Find a cached pattern (or NULL).
+// Note: Clears the cache if the projector size changed.
+struct slPatternEntry* PatternEngine::Find(int type, const int key[6])
+{
+    if(mSize.width != mSlParams->proj_w || mSize.height != mSlParams->proj_h){
+        Clear();
+        mSize = cvSize(mSlParams->proj_w, mSlParams->proj_h);
+    }
+    for(size_t i=0; i<mEntries.size(); i++)
+        if(mEntries[i].type == type && memcmp(mEntries[i].key, key, sizeof(mEntries[i].key)) == 0)
+            return &mEntries[i];
+    return NULL;
+}
+
+// Add a rendered pattern to the cache (with the gain applied, if enabled).
+struct slPatternEntry* PatternEngine::Add(int type, const int key[6], IplImage* pattern, bool apply_gain)
+{
+    struct slPatternEntry entry;
+    entry.type    = type;
+    memcpy(entry.key, key, sizeof(entry.key));
+    entry.pattern = pattern;
+    entry.frame   = pattern;
+    entry.gain    = -1;
+    if(apply_gain){
+        entry.frame = cvCreateImage(cvGetSize(pattern), pattern->depth, pattern->nChannels);
+        ApplyGain(pattern, entry.frame);
+        entry.gain = mLutGain;
+    }
+    mEntries.push_back(entry);
+    return &mEntries.back();
+}
+
+// Return the displayed frame of a cached pattern (reapplying the gain if it changed).
+IplImage* PatternEngine::GetFrame(struct slPatternEntry* entry)
+{
+    if(entry->gain < 0)
+        return entry->frame;
+    if(entry->gain != mSlParams->proj_gain){
+        ApplyGain(entry->pattern, entry->frame);
+        entry->gain = mLutGain;
+    }
+    return entry->frame;
+}
+
+// Get a solid fill (BGR colour; single-channel if the colour is gray), with the projector gain applied (if enabled).
+IplImage* PatternEngine::Solid(CvScalar color, bool apply_gain)
+{
+    int key[6] = {cvRound(color.val[0]), cvRound(color.val[1]), cvRound(color.val[2]), apply_gain, 0, 0};
+    struct slPatternEntry* entry = Find(PATTERN_SOLID, key);
+    if(entry != NULL)
+        return GetFrame(entry);
+
+    // Fill the first row, and copy it to the other rows.
+    uchar bgr[3];
+    for(int k=0; k<3; k++)
+        bgr[k] = (uchar)((key[k] < 0) ? 0 : ((key[k] > 255) ? 255 : key[k]));
+    bool gray = (bgr[0] == bgr[1] && bgr[1] == bgr[2]);
+    IplImage* pattern = cvCreateImage(mSize, IPL_DEPTH_8U, gray ? 1 : 3);
+    uchar* row = (uchar*)pattern->imageData;
+    if(gray)
+        memset(row, bgr[0], pattern->width);
+    else
+        for(int c=0; c<pattern->width; c++)
+            memcpy(&row[3*c], bgr, 3);
+    for(int r=1; r<pattern->height; r++)
+        memcpy(pattern->imageData + r*pattern->widthStep, row, pattern->width*pattern->nChannels);
+    return GetFrame(Add(PATTERN_SOLID, key, pattern, apply_gain));
+}
+
+// Get the projector calibration chessboard (squares scaled by scale), with the projector gain applied.
+IplImage* PatternEngine::Chessboard(float scale)
+{
+    int key[6];
+    memcpy(&key[0], &scale, sizeof(int));
+    key[1] = mSlParams->proj_board_w;
+    key[2] = mSlParams->proj_board_h;
+    key[3] = mSlParams->proj_board_w_pixels;
+    key[4] = mSlParams->proj_board_h_pixels;
+    key[5] = 0;
+    struct slPatternEntry* entry = Find(PATTERN_CHESSBOARD, key);
+    if(entry != NULL)
+        return GetFrame(entry);
+
+    IplImage* pattern = cvCreateImage(mSize, IPL_DEPTH_8U, 1);
+    int border_cols, border_rows;
+    if(RenderChessboard(mSlParams, pattern, scale, border_cols, border_rows) != 0){
+        cvReleaseImage(&pattern);
+        return NULL;
+    }
+    return GetFrame(Add(PATTERN_CHESSBOARD, key, pattern, true));
+}
+
+// Get a Gray-code bit plane (bit 0 is the most significant) for projector columns or rows, or its inverse.
+IplImage* PatternEngine::GrayCode(int bit, bool scan_cols, bool inverted)
+{
+    int key[6] = {bit, scan_cols, inverted, 0, 0, 0};
+    struct slPatternEntry* entry = Find(PATTERN_GRAY_CODE, key);
+    if(entry != NULL)
+        return GetFrame(entry);
+
+    IplImage* pattern = cvCreateImage(mSize, IPL_DEPTH_8U, 1);
+    RenderGrayCode(pattern, bit, scan_cols, inverted);
+    return GetFrame(Add(PATTERN_GRAY_CODE, key, pattern, true));
+}
+
+// Get a phase-shift sinusoid (step of sl_params->phase_shift_steps) for projector columns or rows.
+IplImage* PatternEngine::PhaseShift(int step, bool scan_cols)
+{
+    int n_steps = mSlParams->phase_shift_steps;
+    int key[6] = {step, scan_cols, n_steps, mSlParams->phase_shift_period, 0, 0};
+    struct slPatternEntry* entry = Find(PATTERN_PHASE_SHIFT, key);
+    if(entry != NULL)
+        return GetFrame(entry);
+    if(step < 0 || step >= n_steps)
+        return NULL;
+
+    // Render (and cache) every step of the sequence at once.
+    IplImage** patterns = new IplImage* [n_steps];
+    for(int k=0; k<n_steps; k++)
+        patterns[k] = cvCreateImage(mSize, IPL_DEPTH_8U, 1);
+    if(generatePhaseShiftPatterns(mSlParams, patterns, scan_cols) != 0){
+        for(int k=0; k<n_steps; k++)
+            cvReleaseImage(&patterns[k]);
+        delete[] patterns;
+        return NULL;
+    }
+    for(int k=0; k<n_steps; k++){
+        key[0] = k;
+        Add(PATTERN_PHASE_SHIFT, key, patterns[k], true);
+    }
+    delete[] patterns;
+    key[0] = step;
+    return GetFrame(Find(PATTERN_PHASE_SHIFT, key));
+}
+
+// Render the projector calibration chessboard (squares scaled by scale) into an 8-bit, single-channel image.
+int PatternEngine::RenderChessboard(struct slParams* sl_params, IplImage* board, float scale, int& border_cols, int& border_rows)
+{
+    // Calculate chessboard border.
+    int n_cols = sl_params->proj_board_w+1;
+    int n_rows = sl_params->proj_board_h+1;
+    border_cols = (int)floor((board->width -n_cols*sl_params->proj_board_w_pixels*scale)/2.0);
+    border_rows = (int)floor((board->height-n_rows*sl_params->proj_board_h_pixels*scale)/2.0);
+
+    // Check for chessboard errors.
+    if( (border_cols < 0) || (border_rows < 0) ){
+        printf("ERROR: Cannot create chessboard with user-requested dimensions!\n");
+        return -1;
+    }
+
+    // Render the two template rows (the first square is black in even square rows).
+    int width = board->width;
+    uchar* templates = new uchar[2*width];
+    memset(templates, 255, 2*width);
+    for(int c=0; c<n_cols; c++){
+        int c0 = border_cols + cvRound(c*sl_params->proj_board_w_pixels*scale);
+        int c1 = border_cols + cvRound((c+1)*sl_params->proj_board_w_pixels*scale);
+        memset(&templates[(c%2)*width+c0], 0, c1-c0);
+    }
+
+    // Copy the template of each square row (the border rows are white).
+    for(int i=0; i<board->height; i++)
+        memset(board->imageData + i*board->widthStep, 255, width);
+    for(int r=0; r<n_rows; r++){
+        int r0 = border_rows + cvRound(r*sl_params->proj_board_h_pixels*scale);
+        int r1 = border_rows + cvRound((r+1)*sl_params->proj_board_h_pixels*scale);
+        for(int i=r0; i<r1; i++)
+            memcpy(board->imageData + i*board->widthStep, &templates[(r%2)*width], width);
+    }
+    delete[] templates;
+
+    // Return without errors.
+    return 0;
+}
+
+// Evaluate the number of Gray-code bits (and the offset centring the code) for a number of projector columns or rows.
+int PatternEngine::GrayCodeBits(int n, int* offset)
+{
+    int bits = 0;
+    while((1 << bits) < n)
+        bits++;
+    if(offset != NULL)
+        *offset = ((1 << bits) - n)/2;
+    return bits;
+}
+
+// Render a Gray-code bit plane (bit 0 is the most significant) into an 8-bit, single-channel image.
+void PatternEngine::RenderGrayCode(IplImage* pattern, int bit, bool scan_cols, bool inverted)
+{
+    int offset;
+    int n     = scan_cols ? pattern->width : pattern->height;
+    int bits  = GrayCodeBits(n, &offset);
+    int shift = bits-bit-1;
+    uchar on  = inverted ? 0 : 255;
+    uchar off = inverted ? 255 : 0;
+    if(scan_cols){
+        uchar* row = (uchar*)pattern->imageData;
+        for(int c=0; c<pattern->width; c++){
+            int code = (c+offset) ^ ((c+offset) >> 1);
+            row[c] = ((code >> shift) & 1) ? on : off;
+        }
+        for(int r=1; r<pattern->height; r++)
+            memcpy(pattern->imageData + r*pattern->widthStep, row, pattern->width);
+    }
+    else{
+        for(int r=0; r<pattern->height; r++){
+            int code = (r+offset) ^ ((r+offset) >> 1);
+            memset(pattern->imageData + r*pattern->widthStep, ((code >> shift) & 1) ? on : off, pattern->width);
+        }
+    }
+}
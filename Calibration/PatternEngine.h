@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PatternEngine.h
+///
+/// @brief  Declares the projector pattern renderer and its per-session frame cache.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slPatternEntry
+///
+/// @brief  Cached projector pattern, keyed by its type and parameters.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slPatternEntry{
+	int       type;                 // pattern type (PatternEngine::PATTERN_*)
+	int       key[6];               // pattern parameters (the cache key, with the type)
+	IplImage* pattern;              // rendered pattern (without the projector gain)
+	IplImage* frame;                // pattern with the projector gain applied (same as pattern if the gain is not applied)
+	int       gain;                 // projector gain the frame was made with (-1 if the gain is not applied)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  PatternEngine
+///
+/// @brief  Renders the projector patterns of a session once, and keeps them ready to display.
+///
+/// Solid fills, calibration chessboards, Gray-code bit planes and phase-shift sinusoids are rendered
+/// a row at a time: a pattern which varies along the columns is rendered into its first row (one
+/// template row per row of chessboard squares), and copied to the other rows; a pattern which only
+/// varies along the rows fills each row with memset. Monochrome patterns are single-channel images.
+///
+/// Each rendered pattern is cached for the session, keyed by its parameters, together with a copy
+/// scaled by the projector gain (sl_params->proj_gain). The gain is applied through a lookup table,
+/// which is rebuilt (and the cached copies refreshed on use) only when the gain changes. Switching
+/// the projector to a cached pattern is then a pointer swap in cvShowImage. Once the projector
+/// response is measured (see PhotometricCalibration), the lookup table also maps the scaled levels
+/// through the inverse response, so that the camera sees the patterns linearly.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class PatternEngine
+{
+public:
+    enum { PATTERN_SOLID = 0, PATTERN_CHESSBOARD, PATTERN_GRAY_CODE, PATTERN_PHASE_SHIFT };
+
+    PatternEngine(struct slParams* sl_params);
+
+    ~PatternEngine();
+
+    // Get a solid fill (BGR colour; single-channel if the colour is gray), with the projector gain applied (if enabled).
+    IplImage* Solid(CvScalar color, bool apply_gain CV_DEFAULT(true));
+
+    // Get the projector calibration chessboard (squares scaled by scale), with the projector gain applied.
+    // Note: Returns NULL if the chessboard does not fit the projector.
+    IplImage* Chessboard(float scale CV_DEFAULT(1.0f));
+
+    // Get a Gray-code bit plane (bit 0 is the most significant) for projector columns or rows, or its inverse.
+    // Note: bit must be less than GrayCodeBits(sl_params->proj_w) (or proj_h, for rows).
+    IplImage* GrayCode(int bit, bool scan_cols, bool inverted);
+
+    // Get a phase-shift sinusoid (step of sl_params->phase_shift_steps) for projector columns or rows.
+    // Note: Returns NULL if the phase-shift parameters are invalid.
+    IplImage* PhaseShift(int step, bool scan_cols);
+
+    // Apply the projector gain to a frame rendered elsewhere (e.g., a warped pattern; src and dst may be the same).
+    void ApplyGain(IplImage* src, IplImage* dst);
+
+    // Set the inverse projector response (1x256, 8-bit; NULL = linear), applied after the projector gain.
+    // Note: Releases every cached pattern.
+    void SetResponse(const CvMat* response);
+
+    // Release every cached pattern.
+    void Clear();
+
+    // Render the projector calibration chessboard (squares scaled by scale) into an 8-bit, single-channel image.
+    // Note: Returns -1 if the chessboard does not fit the image. Every one of the (proj_board_w+1)x(proj_board_h+1)
+    //       squares is drawn, so each interior corner is a junction of four squares (for odd boards, the original
+    //       generateChessboard left the last square column or row white).
+    static int RenderChessboard(struct slParams* sl_params, IplImage* board, float scale, int& border_cols, int& border_rows);
+
+    // Render a Gray-code bit plane (bit 0 is the most significant) into an 8-bit, single-channel image.
+    static void RenderGrayCode(IplImage* pattern, int bit, bool scan_cols, bool inverted);
+
+    // Evaluate the number of Gray-code bits (and the offset centring the code) for a number of projector columns or rows.
+    static int GrayCodeBits(int n, int* offset CV_DEFAULT(NULL));
+
+    // Accessor methods
+    int GetCachedCount() { return (int)mEntries.size(); };
+
+private:
+    // Find a cached pattern (or NULL).
+    struct slPatternEntry* Find(int type, const int key[6]);
+
+    // Add a rendered pattern to the cache (with the gain applied, if enabled).
+    struct slPatternEntry* Add(int type, const int key[6], IplImage* pattern, bool apply_gain);
+
+    // Return the displayed frame of a cached pattern (reapplying the gain if it changed).
+    IplImage* GetFrame(struct slPatternEntry* entry);
+
+    // Rebuild the gain lookup table (if the projector gain changed).
+    void UpdateGain();
+
+    /// <summary> Configuration, and the projector size the cached patterns were rendered at. </summary>
+    struct slParams* mSlParams;
+    CvSize mSize;
+
+    /// <summary> Cached patterns. </summary>
+    std::vector<struct slPatternEntry> mEntries;
+
+    /// <summary> Gain lookup table (1x256, 8-bit), and the projector gain it was built for. </summary>
+    CvMat* mLut;
+    int mLutGain;
+
+    /// <summary> Inverse projector response (1x256, 8-bit; NULL = linear). </summary>
+    CvMat* mResponse;
+};
@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PhaseShift.cpp
+///
+/// @brief  Implements the sinusoidal phase-shift functions.
+///
+/// Overview:
+///   The projector displays N sinusoids I_k(x) = A + B*cos(2*pi*x/P - 2*pi*k/N) with period P
+///   (in projector pixels). For every camera pixel, S = sum_k I_k*sin(2*pi*k/N) and
+///   C = sum_k I_k*cos(2*pi*k/N) give the wrapped phase phi = atan2(S, C), i.e. the position
+///   x mod P, and the modulation B = 2*sqrt(S^2 + C^2)/N. The Gray-code decoded column c is used
+///   as the anchor for unwrapping: x = P*phi/(2*pi) + P*round((c - P*phi/(2*pi))/P), which is
+///   exact as long as the Gray code is within P/2 of the true column.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "PhaseShift.h"
+
+#include <emmintrin.h>
+
+// Maximum number of phase-shift steps (the decoder keeps the weights of each step on the stack).
+static const int MAX_PHASE_SHIFT_STEPS = 32;
+
+// Evaluate atan2(y, x) for four values at once, wrapped to [0, 2*pi).
+// Note: Uses a minimax polynomial for atan on [0, 1] (maximum error below 1e-5 radians).
+static inline __m128 atan2_ps(__m128 y, __m128 x){
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 pi        = _mm_set1_ps((float)CV_PI);
+	const __m128 half_pi   = _mm_set1_ps((float)(CV_PI/2.0));
+	const __m128 two_pi    = _mm_set1_ps((float)(2.0*CV_PI));
+	const __m128 zero      = _mm_setzero_ps();
+
+	// Reduce the argument to z = min(|x|,|y|)/max(|x|,|y|) in [0, 1].
+	__m128 ax   = _mm_andnot_ps(sign_mask, x);
+	__m128 ay   = _mm_andnot_ps(sign_mask, y);
+	__m128 mx   = _mm_max_ps(ax, ay);
+	__m128 mn   = _mm_min_ps(ax, ay);
+	__m128 z    = _mm_div_ps(mn, _mm_max_ps(mx, _mm_set1_ps(FLT_MIN)));
+	__m128 z2   = _mm_mul_ps(z, z);
+
+	// Evaluate the polynomial approximation of atan(z).
+	__m128 a = _mm_set1_ps(0.0208351f);
+	a = _mm_add_ps(_mm_mul_ps(a, z2), _mm_set1_ps(-0.0851330f));
+	a = _mm_add_ps(_mm_mul_ps(a, z2), _mm_set1_ps( 0.1801410f));
+	a = _mm_add_ps(_mm_mul_ps(a, z2), _mm_set1_ps(-0.3302995f));
+	a = _mm_add_ps(_mm_mul_ps(a, z2), _mm_set1_ps( 0.9998660f));
+	a = _mm_mul_ps(a, z);
+
+	// Restore the octant and quadrant.
+	__m128 swap = _mm_cmpgt_ps(ay, ax);
+	a = _mm_or_ps(_mm_andnot_ps(swap, a), _mm_and_ps(swap, _mm_sub_ps(half_pi, a)));
+	__m128 x_neg = _mm_cmplt_ps(x, zero);
+	a = _mm_or_ps(_mm_andnot_ps(x_neg, a), _mm_and_ps(x_neg, _mm_sub_ps(pi, a)));
+	__m128 y_neg = _mm_cmplt_ps(y, zero);
+	a = _mm_or_ps(_mm_andnot_ps(y_neg, a), _mm_and_ps(y_neg, _mm_sub_ps(two_pi, a)));
+	return a;
+}
+
+// Generate the sinusoidal phase-shift patterns (one per step) for projector columns or rows.
+int generatePhaseShiftPatterns(struct slParams* sl_params, IplImage** patterns, bool scan_cols){
+
+	// Check for input errors.
+	int n_steps = sl_params->phase_shift_steps;
+	int period  = sl_params->phase_shift_period;
+	if(n_steps < 3 || period < 2){
+		printf("ERROR: Phase shifting requires at least three steps and a period of two pixels!\n");
+		return -1;
+	}
+
+	// Evaluate one period of each sinusoid, then replicate it along the first row (copied to every row),
+	// or fill every row with its level (for rows).
+	uchar* profile = new uchar[period];
+	for(int k=0; k<n_steps; k++){
+		for(int i=0; i<period; i++)
+			profile[i] = (uchar)cvRound(127.5 + 127.5*cos(2.0*CV_PI*i/period - 2.0*CV_PI*k/n_steps));
+		IplImage* pattern = patterns[k];
+		if(scan_cols){
+			uchar* data = (uchar*)pattern->imageData;
+			for(int c=0; c<pattern->width; c+=period)
+				memcpy(&data[c], profile, MIN(period, pattern->width-c));
+			for(int r=1; r<pattern->height; r++)
+				memcpy(pattern->imageData + r*pattern->widthStep, data, pattern->width);
+		}
+		else{
+			for(int r=0; r<pattern->height; r++)
+				memset(pattern->imageData + r*pattern->widthStep, profile[r%period], pattern->width);
+		}
+	}
+	delete[] profile;
+
+	// Return without errors.
+	return 0;
+}
+
+// Evaluate the wrapped phase (and modulation) from a captured phase-shift image sequence.
+// Note: frames are 8-bit grayscale camera images; wrapped_phase (radians in [0, 2*pi)) and
+//       modulation are 32-bit float camera images. Rows are processed in parallel (OpenMP) and
+//       four pixels at a time (SSE2).
+int decodePhaseShift(struct slParams* sl_params, IplImage** frames, IplImage* wrapped_phase, IplImage* modulation){
+
+	// Check for input errors.
+	int n_steps = sl_params->phase_shift_steps;
+	if(n_steps < 3){
+		printf("ERROR: Phase shifting requires at least three steps!\n");
+		return -1;
+	}
+	if(n_steps > MAX_PHASE_SHIFT_STEPS){
+		printf("ERROR: Phase shifting supports at most %d steps!\n", MAX_PHASE_SHIFT_STEPS);
+		return -1;
+	}
+	for(int k=0; k<n_steps; k++){
+		if(frames[k]->nChannels != 1 || frames[k]->depth != IPL_DEPTH_8U){
+			printf("ERROR: Phase-shift frames must be 8-bit grayscale images!\n");
+			return -1;
+		}
+	}
+
+	// Pre-compute the weights of each step.
+	float sin_k[MAX_PHASE_SHIFT_STEPS], cos_k[MAX_PHASE_SHIFT_STEPS];
+	for(int k=0; k<n_steps; k++){
+		sin_k[k] = (float)sin(2.0*CV_PI*k/n_steps);
+		cos_k[k] = (float)cos(2.0*CV_PI*k/n_steps);
+	}
+	const float modulation_scale = 2.0f/n_steps;
+
+	// Evaluate wrapped phase and modulation (one camera row per iteration).
+	int width  = wrapped_phase->width;
+	int height = wrapped_phase->height;
+	#pragma omp parallel for
+	for(int r=0; r<height; r++){
+		float* phase_data      = (float*)(wrapped_phase->imageData + r*wrapped_phase->widthStep);
+		float* modulation_data = (modulation != NULL) ? (float*)(modulation->imageData + r*modulation->widthStep) : NULL;
+		int c = 0;
+		for(; c+4<=width; c+=4){
+			__m128 S = _mm_setzero_ps();
+			__m128 C = _mm_setzero_ps();
+			for(int k=0; k<n_steps; k++){
+				const uchar* frame_data = (const uchar*)(frames[k]->imageData + r*frames[k]->widthStep) + c;
+				int packed;
+				memcpy(&packed, frame_data, sizeof(int));
+				__m128i i8  = _mm_cvtsi32_si128(packed);
+				__m128i i16 = _mm_unpacklo_epi8(i8, _mm_setzero_si128());
+				__m128  I   = _mm_cvtepi32_ps(_mm_unpacklo_epi16(i16, _mm_setzero_si128()));
+				S = _mm_add_ps(S, _mm_mul_ps(I, _mm_set1_ps(sin_k[k])));
+				C = _mm_add_ps(C, _mm_mul_ps(I, _mm_set1_ps(cos_k[k])));
+			}
+			_mm_storeu_ps(phase_data+c, atan2_ps(S, C));
+			if(modulation_data != NULL)
+				_mm_storeu_ps(modulation_data+c, _mm_mul_ps(_mm_set1_ps(modulation_scale),
+					_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(S, S), _mm_mul_ps(C, C)))));
+		}
+		for(; c<width; c++){
+			float S = 0, C = 0;
+			for(int k=0; k<n_steps; k++){
+				float I = (float)((const uchar*)(frames[k]->imageData + r*frames[k]->widthStep))[c];
+				S += I*sin_k[k];
+				C += I*cos_k[k];
+			}
+			float phi = atan2(S, C);
+			phase_data[c] = (phi < 0) ? phi + (float)(2.0*CV_PI) : phi;
+			if(modulation_data != NULL)
+				modulation_data[c] = modulation_scale*sqrt(S*S + C*C);
+		}
+	}
+
+	// Return without errors.
+	return 0;
+}
+
+// Refine Gray-code decoded projector columns (or rows) to subpixel precision using the wrapped phase.
+// Note: gray_decoded is a 32-bit float camera image holding integer projector coordinates and is
+//       refined in place. Pixels outside gray_mask (if provided) or with a modulation below
+//       phase_shift_min_modulation keep their Gray-code value.
+int refineGrayCodeWithPhase(struct slParams* sl_params,
+                            IplImage* gray_decoded,
+                            IplImage* wrapped_phase,
+                            IplImage* modulation,
+                            IplImage* gray_mask,
+                            bool scan_cols){
+
+	// Define constant quantities.
+	const float period       = (float)sl_params->phase_shift_period;
+	const float inv_period   = 1.0f/period;
+	const float phase_scale  = period/(float)(2.0*CV_PI);
+	const float max_coord    = (float)((scan_cols ? sl_params->proj_w : sl_params->proj_h) - 1);
+	const float min_modulation = sl_params->phase_shift_min_modulation;
+
+	// Unwrap phase using the Gray code as the anchor (one camera row per iteration).
+	int width  = gray_decoded->width;
+	int height = gray_decoded->height;
+	#pragma omp parallel for
+	for(int r=0; r<height; r++){
+		float*       decoded_data    = (float*)(gray_decoded->imageData + r*gray_decoded->widthStep);
+		const float* phase_data      = (const float*)(wrapped_phase->imageData + r*wrapped_phase->widthStep);
+		const float* modulation_data = (modulation != NULL) ? (const float*)(modulation->imageData + r*modulation->widthStep) : NULL;
+		const uchar* mask_data       = (gray_mask != NULL) ? (const uchar*)(gray_mask->imageData + r*gray_mask->widthStep) : NULL;
+		for(int c=0; c<width; c++){
+			if(mask_data != NULL && mask_data[c] == 0)
+				continue;
+			if(modulation_data != NULL && modulation_data[c] < min_modulation)
+				continue;
+			float x_wrapped = phase_scale*phase_data[c];
+			float x = x_wrapped + period*(float)cvFloor((decoded_data[c] - x_wrapped)*inv_period + 0.5f);
+			if(x < 0)
+				x = 0;
+			else if(x > max_coord)
+				x = max_coord;
+			decoded_data[c] = x;
+		}
+	}
+
+	// Return without errors.
+	return 0;
+}
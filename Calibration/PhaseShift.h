@@ -0,0 +1,28 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PhaseShift.h
+///
+/// @brief  Declares the sinusoidal phase-shift functions used to refine Gray-code correspondences
+///         to subpixel precision.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Generate the sinusoidal phase-shift patterns (one per step) for projector columns or rows.
+// Note: patterns must hold sl_params->phase_shift_steps 8-bit, single-channel projector images.
+int generatePhaseShiftPatterns(struct slParams* sl_params, IplImage** patterns, bool scan_cols);
+
+// Evaluate the wrapped phase (and modulation) from a captured phase-shift image sequence.
+int decodePhaseShift(struct slParams* sl_params, IplImage** frames, IplImage* wrapped_phase, IplImage* modulation);
+
+// Refine Gray-code decoded projector columns (or rows) to subpixel precision using the wrapped phase.
+int refineGrayCodeWithPhase(struct slParams* sl_params,
+                            IplImage* gray_decoded,
+                            IplImage* wrapped_phase,
+                            IplImage* modulation,
+                            IplImage* gray_mask,
+                            bool scan_cols);
@@ -0,0 +1,382 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PhotometricCalibration.cpp
+///
+/// @brief  Implements the closed-loop photometric calibration of the projector and camera.
+///
+/// Overview:
+///   The lit pixels are the brighter half of the pixels responding to the brightest projector
+///   level, so that the responses are measured on the white parts of the scene rather than on
+///   dark squares or on pixels the projector misses. The projector response is the sum of the
+///   mean channel responses, normalized to [0,1] between black and the brightest unsaturated
+///   level and made monotonic; its inverse is interpolated linearly between the measured levels.
+///   The camera black and white levels are low and high percentiles of the lit pixels (rather than
+///   means), so that only a small fraction of the lit pixels is clipped by the stretch, and the
+///   stretch is limited to sl_params->photometric_max_gain to avoid amplifying the noise of a
+///   weak channel. Frames are corrected with cvLUT, after composing the camera lookup table with
+///   the (manual) camera gain, so the gain trackbars keep working as a trim on top of the tables.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "PhotometricCalibration.h"
+
+// Camera level at (or above) which a pixel is considered saturated.
+static const int SATURATION_LEVEL = 250;
+
+// Maximum fraction of saturated lit pixels at the brightest usable projector level.
+static const double MAX_SATURATED = 0.01;
+
+// Fractions of the lit pixels below the black and the white levels of the camera.
+static const double BLACK_PERCENTILE = 0.02;
+static const double WHITE_PERCENTILE = 0.98;
+
+// Minimum contrast between black and the brightest usable level (summed over the camera channels).
+static const double MIN_CONTRAST = 15.0;
+
+// Maximum number of closed-loop corrections of the white levels, and their relative tolerance.
+static const int    MAX_CORRECTIONS = 3;
+static const double WHITE_TOLERANCE = 0.05;
+
+// Constructor
+PhotometricCalibration::PhotometricCalibration(struct slParams* sl_params)
+{
+    mSlParams  = sl_params;
+    mNumLevels = MAX(sl_params->photometric_levels, 3);
+    mLevels    = new int[mNumLevels];
+    mResponse  = new double[3*mNumLevels];
+    mSaturated = new double[mNumLevels];
+    for(int k=0; k<mNumLevels; k++)
+        mLevels[k] = cvRound(255.0*k/(mNumLevels-1));
+    memset(mResponse,  0, 3*mNumLevels*sizeof(double));
+    memset(mSaturated, 0, mNumLevels*sizeof(double));
+    mMaxLevel  = mNumLevels-1;
+    mGamma     = 1.0;
+    for(int c=0; c<3; c++){
+        mBlack[c] = 0.0;
+        mWhite[c] = 255.0;
+    }
+    mMask      = NULL;
+    mMaskSize  = 0;
+    mLitCount  = 0;
+}
+
+// Destructor
+PhotometricCalibration::~PhotometricCalibration()
+{
+    delete[] mLevels;
+    delete[] mResponse;
+    delete[] mSaturated;
+    delete[] mMask;
+}
+
+// Measure the projector and camera responses, and update the lookup tables in sl_calib.
+int PhotometricCalibration::Run(Camera* camera, PatternEngine* patterns, struct slCalib* sl_calib)
+{
+    sl_calib->photometric_calib = false;
+    patterns->SetResponse(NULL);
+
+    // Capture the camera response to a ramp of uniform projector levels.
+    IplImage** frames = new IplImage* [mNumLevels];
+    for(int k=0; k<mNumLevels; k++){
+        cvShowImage("projWindow", patterns->Solid(cvScalarAll(mLevels[k]), false));
+        cvWaitKey(mSlParams->delay);
+        frames[k] = camera->QueryFrame();
+    }
+
+    // Measure the projector response, and the black and white levels of the camera.
+    int status = 0;
+    if(frames[0]->nChannels != 3){
+        printf("ERROR: Photometric calibration requires a colour camera!\n");
+        status = -1;
+    }
+    else if(FindLitPixels(frames[0], frames[mNumLevels-1]) == 0){
+        printf("ERROR: The projector is not seen by the camera!\n");
+        status = -1;
+    }
+    if(status == 0){
+        for(int k=0; k<mNumLevels; k++)
+            MeasureLevel(frames[k], k);
+        status = BuildProjectorResponse(sl_calib->proj_response_lut);
+    }
+    if(status == 0){
+        MeasurePercentile(frames[0],         BLACK_PERCENTILE, mBlack);
+        MeasurePercentile(frames[mMaxLevel], WHITE_PERCENTILE, mWhite);
+        BuildCameraResponse(sl_calib->cam_response_lut);
+    }
+    for(int k=0; k<mNumLevels; k++)
+        cvReleaseImage(&frames[k]);
+    delete[] frames;
+    if(status != 0)
+        return -1;
+
+    // Close the loop: project the brightest level again, and correct the white levels until the corrected frame meets the target.
+    double target = mSlParams->photometric_target;
+    bool converged = false;
+    for(int i=0; i<MAX_CORRECTIONS && !converged; i++){
+        cvShowImage("projWindow", patterns->Solid(cvScalarAll(mLevels[mMaxLevel]), false));
+        cvWaitKey(mSlParams->delay);
+        IplImage* frame = camera->QueryFrame();
+        cvLUT(frame, frame, sl_calib->cam_response_lut);
+        double white[3];
+        MeasurePercentile(frame, WHITE_PERCENTILE, white);
+        cvReleaseImage(&frame);
+        converged = true;
+        for(int c=0; c<3; c++){
+            double range = mWhite[c]-mBlack[c];
+            if(range <= 0 || target/range >= mSlParams->photometric_max_gain)
+                continue;
+            if(fabs(white[c]-target) > WHITE_TOLERANCE*target){
+                mWhite[c] = mBlack[c] + range*MAX(white[c], 1.0)/target;
+                converged = false;
+            }
+        }
+        if(!converged)
+            BuildCameraResponse(sl_calib->cam_response_lut);
+    }
+    if(!converged)
+        printf("WARNING: The camera white level did not settle (is the camera adjusting its exposure?).\n");
+
+    // Use the lookup tables (the manual gains are kept as a trim on top of them).
+    sl_calib->photometric_calib = true;
+    patterns->SetResponse(sl_calib->proj_response_lut);
+    printf("Photometric calibration: projector levels 0-%d (gamma %.2f), camera black %.0f/%.0f/%.0f and white %.0f/%.0f/%.0f (BGR).\n",
+        mLevels[mMaxLevel], mGamma, mBlack[0], mBlack[1], mBlack[2], mWhite[0], mWhite[1], mWhite[2]);
+    return 0;
+}
+
+// Find the pixels lit by the projector (the brighter half of the response to the brightest level).
+int PhotometricCalibration::FindLitPixels(IplImage* black_frame, IplImage* white_frame)
+{
+    int width  = black_frame->width;
+    int height = black_frame->height;
+    if(mMask == NULL || mMaskSize != width*height){
+        delete[] mMask;
+        mMaskSize = width*height;
+        mMask     = new uchar[mMaskSize];
+    }
+
+    // Find the brightest response, and keep the pixels responding with more than half of it.
+    int max_response = 0;
+    for(int pass=0; pass<2; pass++){
+        mLitCount = 0;
+        for(int r=0; r<height; r++){
+            const uchar* black = (const uchar*)(black_frame->imageData + r*black_frame->widthStep);
+            const uchar* white = (const uchar*)(white_frame->imageData + r*white_frame->widthStep);
+            uchar* mask = &mMask[r*width];
+            for(int c=0; c<width; c++){
+                int response = white[3*c]+white[3*c+1]+white[3*c+2] - (black[3*c]+black[3*c+1]+black[3*c+2]);
+                if(pass == 0)
+                    max_response = MAX(max_response, response);
+                else{
+                    mask[c] = (max_response > 0 && 2*response > max_response) ? 1 : 0;
+                    mLitCount += mask[c];
+                }
+            }
+        }
+    }
+    return mLitCount;
+}
+
+// Measure the mean response (per channel) and the saturated fraction of the lit pixels at a level.
+void PhotometricCalibration::MeasureLevel(IplImage* frame, int k)
+{
+    double sums[3] = {0, 0, 0};
+    int saturated = 0;
+    for(int r=0; r<frame->height; r++){
+        const uchar* data = (const uchar*)(frame->imageData + r*frame->widthStep);
+        const uchar* mask = &mMask[r*frame->width];
+        for(int c=0; c<frame->width; c++){
+            if(!mask[c])
+                continue;
+            for(int j=0; j<3; j++)
+                sums[j] += data[3*c+j];
+            if(data[3*c] >= SATURATION_LEVEL || data[3*c+1] >= SATURATION_LEVEL || data[3*c+2] >= SATURATION_LEVEL)
+                saturated++;
+        }
+    }
+    for(int j=0; j<3; j++)
+        mResponse[3*k+j] = sums[j]/mLitCount;
+    mSaturated[k] = (double)saturated/mLitCount;
+}
+
+// Find the level (per channel) below a fraction of the lit pixels.
+void PhotometricCalibration::MeasurePercentile(IplImage* frame, double fraction, double* level)
+{
+    int histogram[3][256];
+    memset(histogram, 0, sizeof(histogram));
+    for(int r=0; r<frame->height; r++){
+        const uchar* data = (const uchar*)(frame->imageData + r*frame->widthStep);
+        const uchar* mask = &mMask[r*frame->width];
+        for(int c=0; c<frame->width; c++)
+            if(mask[c])
+                for(int j=0; j<3; j++)
+                    histogram[j][data[3*c+j]]++;
+    }
+    int count = cvRound(fraction*mLitCount);
+    for(int j=0; j<3; j++){
+        int v = 0, sum = histogram[j][0];
+        while(v < 255 && sum < count)
+            sum += histogram[j][++v];
+        level[j] = v;
+    }
+}
+
+// Build the inverse projector response (up to the brightest unsaturated level).
+int PhotometricCalibration::BuildProjectorResponse(CvMat* lut)
+{
+    // Find the brightest level which does not saturate the camera.
+    mMaxLevel = 0;
+    for(int k=1; k<mNumLevels && mSaturated[k] <= MAX_SATURATED; k++)
+        mMaxLevel = k;
+    if(mMaxLevel == 0){
+        printf("ERROR: The camera saturates at every projector level (reduce the camera exposure or the projector brightness)!\n");
+        return -1;
+    }
+    double black = mResponse[0]+mResponse[1]+mResponse[2];
+    double white = mResponse[3*mMaxLevel]+mResponse[3*mMaxLevel+1]+mResponse[3*mMaxLevel+2];
+    if(white-black < MIN_CONTRAST){
+        printf("ERROR: The projector is not seen by the camera (contrast of %.1f levels)!\n", white-black);
+        return -1;
+    }
+
+    // Normalize the response (monotonic, from 0 at black to 1 at the brightest level).
+    double* f = new double[mMaxLevel+1];
+    f[0] = 0.0;
+    for(int k=1; k<=mMaxLevel; k++){
+        double response = (mResponse[3*k]+mResponse[3*k+1]+mResponse[3*k+2] - black)/(white-black);
+        f[k] = MAX(f[k-1], MIN(response, 1.0));
+    }
+    f[mMaxLevel] = 1.0;
+
+    // Invert the response (interpolated linearly between the measured levels).
+    for(int t=0; t<256; t++){
+        double y = t/255.0;
+        int k = 1;
+        while(k < mMaxLevel && f[k] < y)
+            k++;
+        double a = (f[k] > f[k-1]) ? (y-f[k-1])/(f[k]-f[k-1]) : 1.0;
+        a = (a < 0) ? 0 : ((a > 1) ? 1 : a);
+        lut->data.ptr[t] = (uchar)cvRound(mLevels[k-1] + a*(mLevels[k]-mLevels[k-1]));
+    }
+
+    // Fit a power law to the mid levels (for display).
+    double gamma_sum = 0;
+    int n_gamma = 0;
+    for(int k=1; k<mMaxLevel; k++){
+        if(f[k] > 0.05 && f[k] < 0.95){
+            gamma_sum += log(f[k])/log((double)mLevels[k]/mLevels[mMaxLevel]);
+            n_gamma++;
+        }
+    }
+    mGamma = (n_gamma > 0) ? gamma_sum/n_gamma : 1.0;
+    delete[] f;
+    return 0;
+}
+
+// Build the camera lookup table from the black and white levels.
+void PhotometricCalibration::BuildCameraResponse(CvMat* lut)
+{
+    double target = mSlParams->photometric_target;
+    for(int c=0; c<3; c++){
+        double range = mWhite[c]-mBlack[c];
+        double gain  = (range > 0) ? MIN(target/range, (double)mSlParams->photometric_max_gain) : 1.0;
+        double black = (range > 0) ? mBlack[c] : 0.0;
+        for(int v=0; v<256; v++){
+            int level = cvRound((v-black)*gain);
+            lut->data.ptr[3*v+c] = (uchar)((level < 0) ? 0 : ((level > 255) ? 255 : level));
+        }
+    }
+}
+
+// Save the measured responses and the lookup tables.
+int PhotometricCalibration::Save(const char* filename, struct slCalib* sl_calib)
+{
+    CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_WRITE);
+    if(fs == NULL){
+        printf("ERROR: Cannot save photometric calibration!\n");
+        return -1;
+    }
+    CvMat levels    = cvMat(1, mNumLevels, CV_32SC1, mLevels);
+    CvMat response  = cvMat(mNumLevels, 3, CV_64FC1, mResponse);
+    CvMat saturated = cvMat(1, mNumLevels, CV_64FC1, mSaturated);
+    CvMat black     = cvMat(1, 3, CV_64FC1, mBlack);
+    CvMat white     = cvMat(1, 3, CV_64FC1, mWhite);
+    cvWrite(fs, "projector_levels",   &levels);
+    cvWrite(fs, "camera_response",    &response);
+    cvWrite(fs, "saturated_fraction", &saturated);
+    cvWriteInt(fs,  "maximum_projector_level", mLevels[mMaxLevel]);
+    cvWriteReal(fs, "projector_gamma",         mGamma);
+    cvWrite(fs, "camera_black_level", &black);
+    cvWrite(fs, "camera_white_level", &white);
+    cvWrite(fs, "camera_lut",         sl_calib->cam_response_lut);
+    cvWrite(fs, "projector_lut",      sl_calib->proj_response_lut);
+    cvReleaseFileStorage(&fs);
+    return 0;
+}
+
+// Load the lookup tables previously written by Save().
+int PhotometricCalibration::Load(const char* filename, struct slCalib* sl_calib)
+{
+    CvFileStorage* fs = cvOpenFileStorage(filename, 0, CV_STORAGE_READ);
+    if(fs == NULL)
+        return -1;
+    CvMat* cam_lut  = (CvMat*)cvReadByName(fs, 0, "camera_lut");
+    CvMat* proj_lut = (CvMat*)cvReadByName(fs, 0, "projector_lut");
+    bool valid = (cam_lut != NULL && proj_lut != NULL &&
+                  CV_ARE_SIZES_EQ(cam_lut,  sl_calib->cam_response_lut)  && CV_ARE_TYPES_EQ(cam_lut,  sl_calib->cam_response_lut) &&
+                  CV_ARE_SIZES_EQ(proj_lut, sl_calib->proj_response_lut) && CV_ARE_TYPES_EQ(proj_lut, sl_calib->proj_response_lut));
+    if(valid){
+        cvCopy(cam_lut,  sl_calib->cam_response_lut);
+        cvCopy(proj_lut, sl_calib->proj_response_lut);
+        sl_calib->photometric_calib = true;
+    }
+    if(cam_lut != NULL)
+        cvReleaseMat(&cam_lut);
+    if(proj_lut != NULL)
+        cvReleaseMat(&proj_lut);
+    cvReleaseFileStorage(&fs);
+    return valid ? 0 : -1;
+}
+
+// Correct a BGR camera frame in place (with the camera lookup table, if calibrated, and the camera gain).
+// Note: Single-channel frames are corrected with the green channel.
+void PhotometricCalibration::CorrectFrame(struct slParams* sl_params, struct slCalib* sl_calib, IplImage* frame)
+{
+    if(frame->nChannels == 1){
+        CorrectFrame(sl_params, sl_calib, frame, 1);
+        return;
+    }
+    double gain = 2.*(sl_params->cam_gain/100.);
+    if(sl_calib == NULL || !sl_calib->photometric_calib){
+        cvScale(frame, frame, gain, 0);
+        return;
+    }
+
+    // Compose the camera lookup table with the camera gain.
+    uchar data[3*256];
+    for(int i=0; i<3*256; i++){
+        int level = cvRound(sl_calib->cam_response_lut->data.ptr[i]*gain);
+        data[i] = (uchar)((level > 255) ? 255 : level);
+    }
+    CvMat lut = cvMat(1, 256, CV_8UC3, data);
+    cvLUT(frame, frame, &lut);
+}
+
+// Correct a single channel (0 = blue, 1 = green, 2 = red) of a camera frame in place.
+void PhotometricCalibration::CorrectFrame(struct slParams* sl_params, struct slCalib* sl_calib, IplImage* frame, int channel)
+{
+    double gain = 2.*(sl_params->cam_gain/100.);
+    if(sl_calib == NULL || !sl_calib->photometric_calib){
+        cvScale(frame, frame, gain, 0);
+        return;
+    }
+
+    // Compose the channel of the camera lookup table with the camera gain.
+    uchar data[256];
+    for(int v=0; v<256; v++){
+        int level = cvRound(sl_calib->cam_response_lut->data.ptr[3*v+channel]*gain);
+        data[v] = (uchar)((level > 255) ? 255 : level);
+    }
+    CvMat lut = cvMat(1, 256, CV_8UC1, data);
+    cvLUT(frame, frame, &lut);
+}
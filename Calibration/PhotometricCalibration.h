@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PhotometricCalibration.h
+///
+/// @brief  Declares the closed-loop photometric calibration of the projector and camera.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+#include "Camera.h"
+#include "PatternEngine.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  PhotometricCalibration
+///
+/// @brief  Measures the projector and camera responses, and builds the lookup tables that the
+///         manual camera and projector gains then trim.
+///
+/// The projector displays a ramp of uniform gray levels, and the camera response to each level is
+/// measured (per channel) over the pixels the projector lights. The brightest level which does not
+/// saturate the camera bounds the projector range, and the inverse of the measured response curve
+/// (slCalib::proj_response_lut) maps linear pattern levels onto it: sinusoids are seen undistorted,
+/// and white never clips. The camera lookup table (slCalib::cam_response_lut) removes the black
+/// level of each channel and stretches its lit range to sl_params->photometric_target. The loop is
+/// then closed by projecting the brightest level again and correcting the white levels from the
+/// corrected frame, until they land on the target (e.g., after the camera adjusted its exposure).
+///
+/// The camera has no exposure control here, so the camera response is modelled as linear with an
+/// offset per channel; any camera nonlinearity is folded into the (end-to-end) projector response.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class PhotometricCalibration
+{
+public:
+    PhotometricCalibration(struct slParams* sl_params);
+
+    ~PhotometricCalibration();
+
+    // Measure the projector and camera responses, and update the lookup tables in sl_calib.
+    // Note: On success, the engine uses the new projector response; the manual gains are applied on top of the tables.
+    int Run(Camera* camera, PatternEngine* patterns, struct slCalib* sl_calib);
+
+    // Save the measured responses and the lookup tables.
+    int Save(const char* filename, struct slCalib* sl_calib);
+
+    // Load the lookup tables previously written by Save().
+    static int Load(const char* filename, struct slCalib* sl_calib);
+
+    // Correct a BGR camera frame in place (with the camera lookup table, if calibrated, and the camera gain).
+    static void CorrectFrame(struct slParams* sl_params, struct slCalib* sl_calib, IplImage* frame);
+
+    // Correct a single channel (0 = blue, 1 = green, 2 = red) of a camera frame in place.
+    static void CorrectFrame(struct slParams* sl_params, struct slCalib* sl_calib, IplImage* frame, int channel);
+
+    // Accessor methods
+    int GetMaxLevel() { return mLevels[mMaxLevel]; };
+    double GetGamma() { return mGamma; };
+
+private:
+    // Find the pixels lit by the projector (the brighter half of the response to the brightest level).
+    // Note: Returns the number of lit pixels.
+    int FindLitPixels(IplImage* black_frame, IplImage* white_frame);
+
+    // Measure the mean response (per channel) and the saturated fraction of the lit pixels at a level.
+    void MeasureLevel(IplImage* frame, int k);
+
+    // Find the level (per channel) below a fraction of the lit pixels.
+    void MeasurePercentile(IplImage* frame, double fraction, double* level);
+
+    // Build the inverse projector response (up to the brightest unsaturated level).
+    // Note: Returns -1 if the projector is not seen by the camera, or saturates it at every level.
+    int BuildProjectorResponse(CvMat* lut);
+
+    // Build the camera lookup table from the black and white levels.
+    void BuildCameraResponse(CvMat* lut);
+
+    /// <summary> Configuration. </summary>
+    struct slParams* mSlParams;
+
+    /// <summary> Measured projector levels, mean camera responses (BGR) and saturated fractions of the lit pixels. </summary>
+    int mNumLevels;
+    int* mLevels;
+    double* mResponse;
+    double* mSaturated;
+
+    /// <summary> Brightest unsaturated level (index), exponent of a power law fitted to the projector response, and the black and white camera levels (BGR). </summary>
+    int mMaxLevel;
+    double mGamma;
+    double mBlack[3];
+    double mWhite[3];
+
+    /// <summary> Pixels lit by the projector (mask of the camera pixels, and the number of lit pixels). </summary>
+    uchar* mMask;
+    int mMaskSize;
+    int mLitCount;
+};
@@ -0,0 +1,147 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PointMask.cpp
+///
+/// @brief  Implements the compact (index list) representation of point masks.
+///
+/// Overview:
+///   Exporters pass over the points once per attribute (positions, normals, colours, ...), so a
+///   per-pixel mask is tested several times per point. Converting the mask once into the list of
+///   valid indices lets every pass visit only the valid points. The list is built four elements at
+///   a time: SSE2 compares produce a 4-bit validity pattern, which selects the precomputed offsets
+///   of the valid elements, and all four candidate indices are stored at once.
+///
+///   Subsampling divides the index list into k strata of (almost) equal size and draws one point
+///   uniformly from each (jittered sampling), which takes O(k) time. The list is in raster order,
+///   so each stratum is a run of consecutive valid pixels: samples are spread evenly over the
+///   image rows and, as long as a stratum is shorter than a row, along the columns as well.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "PointMask.h"
+
+#include <emmintrin.h>
+
+// Offsets of the set bits (padded with zeros) and number of set bits, for every 4-bit pattern.
+static const int mask_offsets[16][4] = {
+	{0,0,0,0}, {0,0,0,0}, {1,0,0,0}, {0,1,0,0},
+	{2,0,0,0}, {0,2,0,0}, {1,2,0,0}, {0,1,2,0},
+	{3,0,0,0}, {0,3,0,0}, {1,3,0,0}, {0,1,3,0},
+	{2,3,0,0}, {0,2,3,0}, {1,2,3,0}, {0,1,2,3}};
+static const int mask_counts[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+// Append the indices base + offsets of the set bits of a 4-bit pattern.
+static inline int* emitIndices(int* dst, int base, int bits){
+	__m128i offsets = _mm_loadu_si128((const __m128i*)mask_offsets[bits]);
+	_mm_storeu_si128((__m128i*)dst, _mm_add_epi32(_mm_set1_epi32(base), offsets));
+	return dst + mask_counts[bits];
+}
+
+// Compact the indices of the non-zero elements of a float mask.
+int compactMaskIndices(const float* mask, int n, int* indices){
+	const __m128 zero = _mm_setzero_ps();
+	int* dst = indices;
+	int i = 0;
+	for(; i+4<=n; i+=4){
+		int bits = _mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(mask+i), zero));
+		dst = emitIndices(dst, i, bits);
+	}
+	for(; i<n; i++)
+		if(mask[i] != 0)
+			*dst++ = i;
+	return (int)(dst - indices);
+}
+
+// Compact the indices of the non-zero elements of an 8-bit mask.
+int compactMaskIndices(const uchar* mask, int n, int* indices){
+	const __m128i zero = _mm_setzero_si128();
+	int* dst = indices;
+	int i = 0;
+	for(; i+16<=n; i+=16){
+		int bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask+i)), zero)) & 0xFFFF;
+		if(bits == 0)
+			continue;
+		dst = emitIndices(dst, i,    bits        & 15);
+		dst = emitIndices(dst, i+4,  (bits >> 4) & 15);
+		dst = emitIndices(dst, i+8,  (bits >> 8) & 15);
+		dst = emitIndices(dst, i+12, (bits >> 12));
+	}
+	for(; i<n; i++)
+		if(mask[i] != 0)
+			*dst++ = i;
+	return (int)(dst - indices);
+}
+
+// Pack a compacted index buffer into a 1xK matrix (or the 1x1 empty list, if there are no points).
+static CvMat* packPointIndex(const int* indices, int count){
+	CvMat* index = cvCreateMat(1, (count > 0) ? count : 1, CV_32SC1);
+	if(count > 0)
+		memcpy(index->data.i, indices, count*sizeof(int));
+	else
+		index->data.i[0] = POINT_INDEX_EMPTY;
+	return index;
+}
+
+// Create the list of valid point indices (a 1xK CV_32SC1 matrix) from a float or 8-bit mask.
+CvMat* createPointIndex(CvMat* mask){
+	int type = CV_MAT_TYPE(mask->type);
+	if(type != CV_32FC1 && type != CV_8UC1){
+		printf("ERROR: Point masks must be float or 8-bit matrices!\n");
+		return NULL;
+	}
+	int  n       = mask->rows*mask->cols;
+	int* indices = new int[n+3];
+	int  count   = 0;
+	for(int r=0; r<mask->rows; r++){
+		int base = r*mask->cols;
+		int k = (type == CV_32FC1) ?
+			compactMaskIndices((const float*)(mask->data.ptr + r*mask->step), mask->cols, indices+count) :
+			compactMaskIndices((const uchar*)(mask->data.ptr + r*mask->step), mask->cols, indices+count);
+		for(int j=count; j<count+k; j++)
+			indices[j] += base;
+		count += k;
+	}
+	CvMat* index = packPointIndex(indices, count);
+	delete[] indices;
+	return index;
+}
+
+// Create the list of valid point indices from an 8-bit mask image (e.g., gray_mask).
+CvMat* createPointIndex(IplImage* mask){
+	if(mask->depth != IPL_DEPTH_8U || mask->nChannels != 1){
+		printf("ERROR: Point mask images must be 8-bit, single-channel images!\n");
+		return NULL;
+	}
+	int  n       = mask->width*mask->height;
+	int* indices = new int[n+3];
+	int  count   = 0;
+	for(int r=0; r<mask->height; r++){
+		int base = r*mask->width;
+		int k = compactMaskIndices((const uchar*)(mask->imageData + r*mask->widthStep), mask->width, indices+count);
+		for(int j=count; j<count+k; j++)
+			indices[j] += base;
+		count += k;
+	}
+	CvMat* index = packPointIndex(indices, count);
+	delete[] indices;
+	return index;
+}
+
+// Select exactly k of the listed points with a seeded, spatially stratified scheme.
+CvMat* subsamplePointIndex(CvMat* index, int k, unsigned int seed){
+	int n = pointIndexCount(index);
+	if(n == 0)
+		return packPointIndex(NULL, 0);
+	if(k <= 0 || k >= n)
+		return cvCloneMat(index);
+
+	// Draw one point from each stratum [j*n/k, (j+1)*n/k).
+	CvRNG rng = cvRNG(seed);
+	CvMat* sample = cvCreateMat(1, k, CV_32SC1);
+	for(int j=0; j<k; j++){
+		int begin = (int)(((int64)j*n)/k);
+		int end   = (int)(((int64)(j+1)*n)/k);
+		sample->data.i[j] = index->data.i[begin + (int)(cvRandInt(&rng) % (unsigned)(end-begin))];
+	}
+	return sample;
+}
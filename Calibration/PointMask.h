@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PointMask.h
+///
+/// @brief  Declares the compact (index list) representation of point masks.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Compact the indices of the non-zero elements of a float mask.
+// Note: Returns the number of valid elements; indices must have room for n+3 elements, since the
+//       SIMD path stores four indices at a time.
+int compactMaskIndices(const float* mask, int n, int* indices);
+
+// Compact the indices of the non-zero elements of an 8-bit mask.
+// Note: Returns the number of valid elements; indices must have room for n+3 elements.
+int compactMaskIndices(const uchar* mask, int n, int* indices);
+
+// Marker of an empty index list.
+// Note: CvMat cannot have zero columns, so a list without points is a 1x1 matrix holding this value.
+const int POINT_INDEX_EMPTY = -1;
+
+// Create the list of valid point indices (a 1xK CV_32SC1 matrix) from a float or 8-bit mask.
+// Note: The mask may have any shape; elements are numbered in row-major order. If no element is
+//       valid, the list is empty (see pointIndexCount).
+CvMat* createPointIndex(CvMat* mask);
+
+// Create the list of valid point indices from an 8-bit mask image (e.g., gray_mask).
+CvMat* createPointIndex(IplImage* mask);
+
+// Select exactly k of the listed points with a seeded, spatially stratified scheme.
+// Note: Returns a new index list (a copy of index if k is not smaller than its length, or the empty
+//       list if index is empty). The same index, k and seed always select the same points.
+CvMat* subsamplePointIndex(CvMat* index, int k, unsigned int seed);
+
+// Test whether an exporter mask argument is an index list (as created by createPointIndex).
+inline bool isPointIndex(const CvMat* mask){
+	return mask != NULL && CV_MAT_TYPE(mask->type) == CV_32SC1;
+}
+
+// Return the number of points in an index list (zero for the empty list).
+inline int pointIndexCount(const CvMat* index){
+	return (index->cols == 1 && index->data.i[0] == POINT_INDEX_EMPTY) ? 0 : index->cols;
+}
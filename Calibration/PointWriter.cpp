@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PointWriter.cpp
+///
+/// @brief  Implements the binary PLY exporter and the asynchronous point cloud writer.
+///
+/// Overview:
+///   Vertex records are packed into a fixed-size block and written with one fwrite per block, so
+///   a scan of several hundred thousand points takes a handful of writes instead of millions of
+///   formatted calls. Only the valid points of the mask (compacted into an index list) are packed.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "PointWriter.h"
+#include "PointMask.h"
+
+// Size of the output block (in bytes).
+static const int PLY_BLOCK_SIZE = 1 << 20;
+
+// Append a value to the output block.
+// Note: x86 is little-endian, so values are copied without byte swapping.
+template <class T>
+static inline void packValue(char*& dst, T value){
+	memcpy(dst, &value, sizeof(T));
+	dst += sizeof(T);
+}
+
+// Save a binary (little-endian) PLY point cloud, or mesh if faces are provided.
+// Note: Unlike the OBJ/VRML exporters, coordinates are written in the camera coordinate system
+//       (without flipping the y-component), and faces keep the winding of generateGridMesh.
+int savePointsPLY(const char* filename, CvMat* points, CvMat* faces, CvMat* normals, CvMat* colors, CvMat* mask){
+
+	// Open output file.
+	if(points == NULL){
+		printf("ERROR: No points to save!\n");
+		return -1;
+	}
+	CvMat* index = (mask == NULL || isPointIndex(mask)) ? mask : createPointIndex(mask);
+	if(mask != NULL && index == NULL)
+		return -1;
+	FILE* pFile = fopen(filename, "wb");
+	if(pFile == NULL){
+		printf("ERROR: Cannot open PLY file!\n");
+		if(index != mask)
+			cvReleaseMat(&index);
+		return -1;
+	}
+
+	// Create header.
+	int n_vertices = (index != NULL) ? pointIndexCount(index) : points->cols;
+	int n_faces    = (faces != NULL) ? faces->cols : 0;
+	fprintf(pFile, "ply\n");
+	fprintf(pFile, "format binary_little_endian 1.0\n");
+	fprintf(pFile, "element vertex %d\n", n_vertices);
+	fprintf(pFile, "property float x\nproperty float y\nproperty float z\n");
+	if(normals != NULL)
+		fprintf(pFile, "property float nx\nproperty float ny\nproperty float nz\n");
+	if(colors != NULL)
+		fprintf(pFile, "property uchar red\nproperty uchar green\nproperty uchar blue\n");
+	if(n_faces > 0){
+		fprintf(pFile, "element face %d\n", n_faces);
+		fprintf(pFile, "property list uchar int vertex_indices\n");
+	}
+	fprintf(pFile, "end_header\n");
+
+	// Pack vertex records of the valid points into blocks.
+	int record_size = 3*sizeof(float) + ((normals != NULL) ? 3*sizeof(float) : 0) + ((colors != NULL) ? 3 : 0);
+	char* block     = new char[PLY_BLOCK_SIZE];
+	char* block_end = block + PLY_BLOCK_SIZE - record_size;
+	char* dst       = block;
+	int points_step  = points->step/sizeof(float);
+	int normals_step = (normals != NULL) ? normals->step/sizeof(float) : 0;
+	int colors_step  = (colors  != NULL) ? colors->step/sizeof(float)  : 0;
+	bool ok = true;
+	for(int j=0; j<n_vertices; j++){
+		int c = (index != NULL) ? index->data.i[j] : j;
+		for(int r=0; r<3; r++)
+			packValue(dst, points->data.fl[c + points_step*r]);
+		if(normals != NULL)
+			for(int r=0; r<3; r++)
+				packValue(dst, normals->data.fl[c + normals_step*r]);
+		if(colors != NULL)
+			for(int r=0; r<3; r++){
+				int v = cvRound(255.0f*colors->data.fl[c + colors_step*r]);
+				packValue(dst, (uchar)((v < 0) ? 0 : ((v > 255) ? 255 : v)));
+			}
+		if(dst > block_end){
+			ok = ok && (fwrite(block, 1, dst-block, pFile) == (size_t)(dst-block));
+			dst = block;
+		}
+	}
+
+	// Pack face records (vertex count, followed by the vertex indices).
+	block_end = block + PLY_BLOCK_SIZE - (1 + 3*sizeof(int));
+	int faces_step = (faces != NULL) ? faces->step/sizeof(int) : 0;
+	for(int f=0; f<n_faces; f++){
+		packValue(dst, (uchar)3);
+		for(int r=0; r<3; r++)
+			packValue(dst, faces->data.i[f + faces_step*r]);
+		if(dst > block_end){
+			ok = ok && (fwrite(block, 1, dst-block, pFile) == (size_t)(dst-block));
+			dst = block;
+		}
+	}
+	if(dst > block)
+		ok = ok && (fwrite(block, 1, dst-block, pFile) == (size_t)(dst-block));
+	delete[] block;
+	if(index != mask)
+		cvReleaseMat(&index);
+
+	// Close file.
+	if(fclose(pFile) != 0 || !ok){
+		printf("ERROR: Cannot write PLY file!\n");
+		return -1;
+	}
+
+	// Return without errors.
+	return 0;
+}
+
+// Constructor
+AsyncPointWriter::AsyncPointWriter()
+{
+    mThread  = NULL;
+    mResult  = 0;
+    mPoints  = NULL;
+    mFaces   = NULL;
+    mNormals = NULL;
+    mColors  = NULL;
+    mMask    = NULL;
+    mFilename[0] = '\0';
+}
+
+// Destructor
+AsyncPointWriter::~AsyncPointWriter()
+{
+    Wait();
+}
+
+// Release the copied inputs of the last request.
+void AsyncPointWriter::ReleaseInputs()
+{
+    if(mPoints  != NULL) cvReleaseMat(&mPoints);
+    if(mFaces   != NULL) cvReleaseMat(&mFaces);
+    if(mNormals != NULL) cvReleaseMat(&mNormals);
+    if(mColors  != NULL) cvReleaseMat(&mColors);
+    if(mMask    != NULL) cvReleaseMat(&mMask);
+}
+
+// Writer thread: writes the copied inputs and stores the result.
+DWORD WINAPI AsyncPointWriter::WriterThread(LPVOID lpParam)
+{
+    AsyncPointWriter* writer = (AsyncPointWriter*)lpParam;
+    writer->mResult = savePointsPLY(writer->mFilename, writer->mPoints, writer->mFaces,
+                                    writer->mNormals, writer->mColors, writer->mMask);
+    return 0;
+}
+
+// Start writing a binary PLY file on the background thread.
+// Note: Falls back to writing synchronously if the thread cannot be created.
+int AsyncPointWriter::SavePLY(const char* filename, CvMat* points, CvMat* faces, CvMat* normals, CvMat* colors, CvMat* mask)
+{
+    // Wait for the previous write (only warn about a write that was still pending).
+    bool pending = (mThread != NULL);
+    int result = Wait();
+    if(pending && result != 0)
+        printf("WARNING: Previous PLY file was not written!\n");
+    mResult = 0;
+
+    strncpy(mFilename, filename, sizeof(mFilename)-1);
+    mFilename[sizeof(mFilename)-1] = '\0';
+    mPoints  = (points  != NULL) ? cvCloneMat(points)  : NULL;
+    mFaces   = (faces   != NULL) ? cvCloneMat(faces)   : NULL;
+    mNormals = (normals != NULL) ? cvCloneMat(normals) : NULL;
+    mColors  = (colors  != NULL) ? cvCloneMat(colors)  : NULL;
+    mMask    = (mask    != NULL) ? cvCloneMat(mask)    : NULL;
+
+    DWORD thread_id;
+    mThread = CreateThread(NULL, 0, WriterThread, this, 0, &thread_id);
+    if(mThread == NULL){
+        result = savePointsPLY(mFilename, mPoints, mFaces, mNormals, mColors, mMask);
+        ReleaseInputs();
+        return result;
+    }
+    return 0;
+}
+
+// Wait for the pending write (if any) and return its result.
+int AsyncPointWriter::Wait()
+{
+    if(mThread != NULL){
+        WaitForSingleObject(mThread, INFINITE);
+        CloseHandle(mThread);
+        mThread = NULL;
+        ReleaseInputs();
+    }
+    return mResult;
+}
+
+// Test whether a write is in progress.
+bool AsyncPointWriter::IsBusy()
+{
+    return mThread != NULL && WaitForSingleObject(mThread, 0) == WAIT_TIMEOUT;
+}
@@ -0,0 +1,66 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\PointWriter.h
+///
+/// @brief  Declares the binary PLY exporter and the asynchronous point cloud writer.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Save a binary (little-endian) PLY point cloud, or mesh if faces are provided.
+// Note: Arguments follow savePointsOBJ: points and normals are 3xN, colors 3xN in [0,1], mask 1xN
+//       (non-zero = valid) or a list of valid indices (see createPointIndex), and faces 3xF indices
+//       into the masked vertex list (see generateGridMesh).
+int savePointsPLY(const char* filename, CvMat* points, CvMat* faces, CvMat* normals, CvMat* colors, CvMat* mask);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  AsyncPointWriter
+///
+/// @brief  Writes a PLY file on a background thread, so the next scan can start immediately.
+///
+/// SavePLY() copies its inputs and returns; the copies are released once the file is written.
+/// At most one file is written at a time: a new request first waits for the previous one.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class AsyncPointWriter
+{
+public:
+    AsyncPointWriter();
+
+    // Waits for any pending write to finish.
+    ~AsyncPointWriter();
+
+    // Start writing a binary PLY file on the background thread.
+    int SavePLY(const char* filename, CvMat* points, CvMat* faces, CvMat* normals, CvMat* colors, CvMat* mask);
+
+    // Wait for the pending write (if any) and return its result.
+    int Wait();
+
+    // Accessor methods
+    bool IsBusy();
+
+private:
+    static DWORD WINAPI WriterThread(LPVOID lpParam);
+
+    // Release the copied inputs of the last request.
+    void ReleaseInputs();
+
+    /// <summary> Handle of the writer thread (NULL if idle). </summary>
+    HANDLE mThread;
+
+    /// <summary> Result of the last write started on the writer thread (0 until it completes). </summary>
+    int mResult;
+
+    /// <summary> Copied inputs of the pending write. </summary>
+    char   mFilename[1024];
+    CvMat* mPoints;
+    CvMat* mFaces;
+    CvMat* mNormals;
+    CvMat* mColors;
+    CvMat* mMask;
+};
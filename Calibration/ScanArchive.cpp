@@ -0,0 +1,488 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ScanArchive.cpp
+///
+/// @brief  Implements the scan archive writer and reader classes.
+///
+/// File layout (little-endian):
+///   header   "SLARCHV1", version, entry count and index offset (32 bytes)
+///   chunks   raw or LZ4-compressed rows of each image or matrix, aligned to 16 bytes
+///   index    one slArchiveEntry per chunk
+///
+/// Compressed chunks use the LZ4 block format (a token with literal and match lengths, literals,
+/// and a 16-bit match offset), so they can also be decoded by the reference LZ4 library.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ScanArchive.h"
+
+// Archive header.
+struct slArchiveHeader{
+	char   magic[8];
+	int    version;
+	int    count;
+	uint64 index_offset;
+	uint64 reserved;
+};
+static const char ARCHIVE_MAGIC[8] = {'S','L','A','R','C','H','V','1'};
+static const int  ARCHIVE_VERSION  = 1;
+static const int  ARCHIVE_ALIGN    = 16;
+
+// Size of the LZ4 match-finder hash table (log2).
+static const int LZ4_HASH_BITS = 14;
+
+// Read four unaligned bytes.
+static inline unsigned int read32(const uchar* p){
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// Write an LZ4 length extension (255, 255, ..., remainder).
+static inline uchar* writeLength(uchar* op, int length){
+	while(length >= 255){
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uchar)length;
+	return op;
+}
+
+// Compress a block in the LZ4 block format.
+// Note: Returns the compressed size, or 0 if it would exceed capacity.
+static int lz4Compress(const uchar* src, int n, uchar* dst, int capacity){
+	int* table = new int[1 << LZ4_HASH_BITS];
+	for(int h=0; h<(1 << LZ4_HASH_BITS); h++)
+		table[h] = -1;
+
+	// Matches must start at least 12 bytes, and end at least 5 bytes, before the end of the block.
+	const int match_start_limit = n - 12;
+	const int match_end_limit   = n - 5;
+	uchar* op   = dst;
+	uchar* oend = dst + capacity;
+	int anchor = 0, i = 0;
+	while(i < match_start_limit){
+		unsigned int sequence = read32(src+i);
+		int h   = (int)((sequence*2654435761u) >> (32 - LZ4_HASH_BITS));
+		int ref = table[h];
+		table[h] = i;
+		if(ref < 0 || i - ref > 65535 || read32(src+ref) != sequence){
+			i++;
+			continue;
+		}
+
+		// Extend the match backwards and forwards.
+		while(i > anchor && ref > 0 && src[i-1] == src[ref-1]){
+			i--;
+			ref--;
+		}
+		int length = 4;
+		while(i + length < match_end_limit && src[i+length] == src[ref+length])
+			length++;
+
+		// Emit the sequence: token, literals, offset and match length.
+		int literals = i - anchor;
+		if(op + 1 + literals/255 + 1 + literals + 2 + length/255 + 1 > oend){
+			delete[] table;
+			return 0;
+		}
+		uchar* token = op++;
+		*token = (uchar)(((literals >= 15) ? 15 : literals) << 4);
+		if(literals >= 15)
+			op = writeLength(op, literals-15);
+		memcpy(op, src+anchor, literals);
+		op += literals;
+		int offset = i - ref;
+		*op++ = (uchar)(offset & 255);
+		*op++ = (uchar)(offset >> 8);
+		int match = length - 4;
+		*token |= (uchar)((match >= 15) ? 15 : match);
+		if(match >= 15)
+			op = writeLength(op, match-15);
+		i += length;
+		anchor = i;
+	}
+	delete[] table;
+
+	// Emit the last literals.
+	int literals = n - anchor;
+	if(op + 1 + literals/255 + 1 + literals > oend)
+		return 0;
+	uchar* token = op++;
+	*token = (uchar)(((literals >= 15) ? 15 : literals) << 4);
+	if(literals >= 15)
+		op = writeLength(op, literals-15);
+	memcpy(op, src+anchor, literals);
+	op += literals;
+	return (int)(op - dst);
+}
+
+// Decompress an LZ4 block of known uncompressed size.
+// Note: Returns 0 on success, or -1 if the block is corrupt.
+static int lz4Decompress(const uchar* src, int n, uchar* dst, int raw_size){
+	const uchar* ip   = src;
+	const uchar* iend = src + n;
+	uchar* op   = dst;
+	uchar* oend = dst + raw_size;
+	while(ip < iend){
+
+		// Copy literals.
+		int token    = *ip++;
+		int literals = token >> 4;
+		if(literals == 15){
+			int b;
+			do{
+				if(ip >= iend)
+					return -1;
+				b = *ip++;
+				literals += b;
+			} while(b == 255);
+		}
+		if(literals > iend - ip || literals > oend - op)
+			return -1;
+		memcpy(op, ip, literals);
+		ip += literals;
+		op += literals;
+		if(ip >= iend)
+			break;
+
+		// Copy the match (byte by byte, since it may overlap the output).
+		if(iend - ip < 2)
+			return -1;
+		int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op - dst)
+			return -1;
+		int length = token & 15;
+		if(length == 15){
+			int b;
+			do{
+				if(ip >= iend)
+					return -1;
+				b = *ip++;
+				length += b;
+			} while(b == 255);
+		}
+		length += 4;
+		if(length > oend - op)
+			return -1;
+		const uchar* match = op - offset;
+		for(int k=0; k<length; k++)
+			op[k] = match[k];
+		op += length;
+	}
+	return (op == oend) ? 0 : -1;
+}
+
+// Size (in bytes) of an element of an image with the given depth.
+static inline int imageElementSize(int depth){
+	return (depth & 255)/8;
+}
+
+// Constructor
+ScanArchiveWriter::ScanArchiveWriter()
+{
+    mFile     = NULL;
+    mOffset   = 0;
+    mCompress = false;
+}
+
+// Destructor
+ScanArchiveWriter::~ScanArchiveWriter()
+{
+    if(mFile != NULL)
+        Close();
+}
+
+// Create a new archive file.
+int ScanArchiveWriter::Open(const char* filename)
+{
+    if(mFile != NULL)
+        Close();
+    mFile = fopen(filename, "wb");
+    if(mFile == NULL){
+        printf("ERROR: Cannot open archive file!\n");
+        return -1;
+    }
+    mEntries.clear();
+
+    // Reserve the header (completed by Close).
+    slArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    if(fwrite(&header, sizeof(header), 1, mFile) != 1){
+        printf("ERROR: Cannot write archive file!\n");
+        return -1;
+    }
+    mOffset = sizeof(header);
+    return 0;
+}
+
+// Append one chunk, given as rows of contiguous bytes.
+int ScanArchiveWriter::AddChunk(slArchiveEntry& entry, const char* data, int n_rows, int row_size, int row_step)
+{
+    if(mFile == NULL){
+        printf("ERROR: Archive is not open!\n");
+        return -1;
+    }
+
+    // Pad to the chunk alignment.
+    static const char padding[ARCHIVE_ALIGN] = {0};
+    int pad = (int)((ARCHIVE_ALIGN - mOffset % ARCHIVE_ALIGN) % ARCHIVE_ALIGN);
+    bool ok = (pad == 0) || (fwrite(padding, 1, pad, mFile) == (size_t)pad);
+    mOffset += pad;
+
+    // Gather rows without padding, and compress them if enabled (and worthwhile).
+    int raw_size = n_rows*row_size;
+    uchar* raw = new uchar[raw_size];
+    for(int r=0; r<n_rows; r++)
+        memcpy(raw + r*row_size, data + r*row_step, row_size);
+    const uchar* stored = raw;
+    int stored_size = raw_size;
+    uchar* packed = NULL;
+    if(mCompress && raw_size > 0){
+        packed = new uchar[raw_size];
+        int packed_size = lz4Compress(raw, raw_size, packed, raw_size);
+        if(packed_size > 0 && packed_size < raw_size){
+            stored      = packed;
+            stored_size = packed_size;
+        }
+    }
+    ok = ok && (fwrite(stored, 1, stored_size, mFile) == (size_t)stored_size);
+    delete[] raw;
+    delete[] packed;
+    if(!ok){
+        printf("ERROR: Cannot write archive file!\n");
+        return -1;
+    }
+
+    // Record the entry.
+    entry.compressed  = (stored_size < raw_size) ? 1 : 0;
+    entry.offset      = mOffset;
+    entry.stored_size = stored_size;
+    entry.raw_size    = raw_size;
+    mOffset += stored_size;
+    mEntries.push_back(entry);
+    return 0;
+}
+
+// Append an image to the archive.
+int ScanArchiveWriter::AddImage(const char* name, IplImage* image, int tag, double timestamp)
+{
+    slArchiveEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name, sizeof(entry.name)-1);
+    entry.kind      = SL_ARCHIVE_IMAGE;
+    entry.type      = image->depth;
+    entry.rows      = image->height;
+    entry.cols      = image->width;
+    entry.channels  = image->nChannels;
+    entry.tag       = tag;
+    entry.timestamp = timestamp;
+    int row_size = image->width*image->nChannels*imageElementSize(image->depth);
+    return AddChunk(entry, image->imageData, image->height, row_size, image->widthStep);
+}
+
+// Append a matrix to the archive.
+int ScanArchiveWriter::AddMatrix(const char* name, CvMat* mat, int tag, double timestamp)
+{
+    slArchiveEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name, sizeof(entry.name)-1);
+    entry.kind      = SL_ARCHIVE_MATRIX;
+    entry.type      = CV_MAT_TYPE(mat->type);
+    entry.rows      = mat->rows;
+    entry.cols      = mat->cols;
+    entry.channels  = 1;
+    entry.tag       = tag;
+    entry.timestamp = timestamp;
+    int row_size = mat->cols*CV_ELEM_SIZE(mat->type);
+    return AddChunk(entry, (const char*)mat->data.ptr, mat->rows, row_size, mat->step);
+}
+
+// Write the index block and close the file.
+int ScanArchiveWriter::Close()
+{
+    if(mFile == NULL)
+        return 0;
+
+    // Write the index block (aligned like the chunks).
+    static const char padding[ARCHIVE_ALIGN] = {0};
+    int pad = (int)((ARCHIVE_ALIGN - mOffset % ARCHIVE_ALIGN) % ARCHIVE_ALIGN);
+    bool ok = (pad == 0) || (fwrite(padding, 1, pad, mFile) == (size_t)pad);
+    mOffset += pad;
+    slArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version      = ARCHIVE_VERSION;
+    header.count        = (int)mEntries.size();
+    header.index_offset = mOffset;
+    if(!mEntries.empty())
+        ok = ok && (fwrite(&mEntries[0], sizeof(slArchiveEntry), mEntries.size(), mFile) == mEntries.size());
+
+    // Complete the header.
+    ok = ok && (fseek(mFile, 0, SEEK_SET) == 0);
+    ok = ok && (fwrite(&header, sizeof(header), 1, mFile) == 1);
+    ok = (fclose(mFile) == 0) && ok;
+    mFile = NULL;
+    if(!ok){
+        printf("ERROR: Cannot write archive index!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Constructor
+ScanArchiveReader::ScanArchiveReader()
+{
+    mFileHandle = INVALID_HANDLE_VALUE;
+    mMapping    = NULL;
+    mBase       = NULL;
+    mSize       = 0;
+    mIndex      = NULL;
+    mCount      = 0;
+}
+
+// Destructor
+ScanArchiveReader::~ScanArchiveReader()
+{
+    Close();
+}
+
+// Open (and map) an existing archive file.
+int ScanArchiveReader::Open(const char* filename)
+{
+    Close();
+
+    // Map the file (read-only).
+    mFileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if(mFileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFileHandle, &size) || size.QuadPart < (int64)sizeof(slArchiveHeader)){
+        printf("ERROR: Cannot open archive file!\n");
+        Close();
+        return -1;
+    }
+    mSize    = (uint64)size.QuadPart;
+    mMapping = CreateFileMappingA(mFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    mBase    = (mMapping != NULL) ? (const uchar*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if(mBase == NULL){
+        printf("ERROR: Cannot map archive file!\n");
+        Close();
+        return -1;
+    }
+
+    // Validate the header and the index block.
+    slArchiveHeader header;
+    memcpy(&header, mBase, sizeof(header));
+    if(memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0 || header.version != ARCHIVE_VERSION ||
+       header.count < 0 || header.index_offset > mSize ||
+       (mSize - header.index_offset)/sizeof(slArchiveEntry) < (uint64)header.count){
+        printf("ERROR: Invalid or incomplete archive file!\n");
+        Close();
+        return -1;
+    }
+    mIndex = (const slArchiveEntry*)(mBase + header.index_offset);
+    mCount = header.count;
+    for(int i=0; i<mCount; i++){
+        if(mIndex[i].offset > mSize || mIndex[i].stored_size > mSize - mIndex[i].offset){
+            printf("ERROR: Invalid archive entry!\n");
+            Close();
+            return -1;
+        }
+        char name[sizeof(mIndex[i].name)+1];
+        memcpy(name, mIndex[i].name, sizeof(mIndex[i].name));
+        name[sizeof(mIndex[i].name)] = '\0';
+        mNames[name] = i;
+    }
+    return 0;
+}
+
+// Unmap and close the archive.
+void ScanArchiveReader::Close()
+{
+    if(mBase != NULL)
+        UnmapViewOfFile(mBase);
+    if(mMapping != NULL)
+        CloseHandle(mMapping);
+    if(mFileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(mFileHandle);
+    mFileHandle = INVALID_HANDLE_VALUE;
+    mMapping    = NULL;
+    mBase       = NULL;
+    mSize       = 0;
+    mIndex      = NULL;
+    mCount      = 0;
+    mNames.clear();
+}
+
+// Find an entry by name (returns -1 if not found).
+int ScanArchiveReader::Find(const char* name)
+{
+    std::map<std::string, int>::const_iterator it = mNames.find(name);
+    return (it != mNames.end()) ? it->second : -1;
+}
+
+// Return a pointer to the data of an uncompressed entry inside the mapping (NULL if compressed).
+const void* ScanArchiveReader::GetData(int i)
+{
+    if(i < 0 || i >= mCount || mIndex[i].compressed)
+        return NULL;
+    return mBase + mIndex[i].offset;
+}
+
+// Copy (or decompress) the data of an entry into rows of a destination buffer.
+int ScanArchiveReader::ReadChunk(int i, char* data, int row_size, int row_step)
+{
+    const slArchiveEntry& entry = mIndex[i];
+    int n_rows = entry.rows;
+    if(entry.raw_size != (uint64)n_rows*row_size){
+        printf("ERROR: Archive entry has an unexpected size!\n");
+        return -1;
+    }
+    const uchar* src = mBase + entry.offset;
+    uchar* raw = NULL;
+    if(entry.compressed){
+        raw = new uchar[(size_t)entry.raw_size];
+        if(lz4Decompress(src, (int)entry.stored_size, raw, (int)entry.raw_size) != 0){
+            printf("ERROR: Archive entry is corrupt!\n");
+            delete[] raw;
+            return -1;
+        }
+        src = raw;
+    }
+    else if(entry.stored_size < entry.raw_size){
+        printf("ERROR: Archive entry is corrupt!\n");
+        return -1;
+    }
+    for(int r=0; r<n_rows; r++)
+        memcpy(data + r*row_step, src + r*row_size, row_size);
+    delete[] raw;
+    return 0;
+}
+
+// Load an image entry into a newly allocated image (released by the caller).
+IplImage* ScanArchiveReader::LoadImage(int i)
+{
+    if(i < 0 || i >= mCount || mIndex[i].kind != SL_ARCHIVE_IMAGE)
+        return NULL;
+    const slArchiveEntry& entry = mIndex[i];
+    IplImage* image = cvCreateImage(cvSize(entry.cols, entry.rows), entry.type, entry.channels);
+    int row_size = entry.cols*entry.channels*imageElementSize(entry.type);
+    if(ReadChunk(i, image->imageData, row_size, image->widthStep) != 0)
+        cvReleaseImage(&image);
+    return image;
+}
+
+// Load a matrix entry into a newly allocated matrix (released by the caller).
+CvMat* ScanArchiveReader::LoadMatrix(int i)
+{
+    if(i < 0 || i >= mCount || mIndex[i].kind != SL_ARCHIVE_MATRIX)
+        return NULL;
+    const slArchiveEntry& entry = mIndex[i];
+    CvMat* mat = cvCreateMat(entry.rows, entry.cols, entry.type);
+    int row_size = entry.cols*CV_ELEM_SIZE(entry.type);
+    if(ReadChunk(i, (char*)mat->data.ptr, row_size, mat->step) != 0)
+        cvReleaseMat(&mat);
+    return mat;
+}
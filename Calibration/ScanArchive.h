@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ScanArchive.h
+///
+/// @brief  Declares the scan archive writer and reader classes.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+#include <map>
+#include <vector>
+#include <string>
+
+// Kinds of archive entries.
+#define SL_ARCHIVE_IMAGE  1
+#define SL_ARCHIVE_MATRIX 2
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slArchiveEntry
+///
+/// @brief  Index record describing one chunk of a scan archive (128 bytes).
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slArchiveEntry{
+	char   name[64];                // unique entry name (e.g., "calib/cam_intrinsic", "scan0/frame12")
+	int    kind;                    // SL_ARCHIVE_IMAGE or SL_ARCHIVE_MATRIX
+	int    type;                    // IplImage depth (images) or CvMat type (matrices)
+	int    rows;                    // image height or matrix rows
+	int    cols;                    // image width or matrix columns
+	int    channels;                // number of image channels (1 for matrices)
+	int    compressed;              // non-zero if the chunk is LZ4-compressed
+	int    tag;                     // user-defined value (e.g., frame or board number)
+	int    reserved;
+	uint64 offset;                  // offset of the chunk from the start of the file (in bytes)
+	uint64 stored_size;             // size of the chunk in the file (in bytes)
+	uint64 raw_size;                // size of the uncompressed data (in bytes)
+	double timestamp;               // user-defined time stamp (e.g., capture time in seconds)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ScanArchiveWriter
+///
+/// @brief  Writes images and matrices of a session into a single archive file.
+///
+/// The file consists of a header, the chunks (each aligned to 16 bytes, rows stored without
+/// padding) and an index block with one slArchiveEntry per chunk, whose location is recorded in
+/// the header when the archive is closed.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ScanArchiveWriter
+{
+public:
+    ScanArchiveWriter();
+
+    // Closes the archive (if open).
+    ~ScanArchiveWriter();
+
+    // Create a new archive file.
+    int Open(const char* filename);
+
+    // Append an image or matrix to the archive.
+    int AddImage(const char* name, IplImage* image, int tag CV_DEFAULT(0), double timestamp CV_DEFAULT(0));
+    int AddMatrix(const char* name, CvMat* mat, int tag CV_DEFAULT(0), double timestamp CV_DEFAULT(0));
+
+    // Write the index block and close the file.
+    int Close();
+
+    // Enable or disable LZ4 compression of subsequent chunks.
+    void SetCompression(bool compress) { mCompress = compress; };
+
+    // Accessor methods
+    int GetCount() { return (int)mEntries.size(); };
+
+private:
+    // Append one chunk, given as rows of contiguous bytes.
+    int AddChunk(slArchiveEntry& entry, const char* data, int n_rows, int row_size, int row_step);
+
+    /// <summary> Output file (NULL if closed). </summary>
+    FILE* mFile;
+
+    /// <summary> Number of bytes written so far. </summary>
+    uint64 mOffset;
+
+    /// <summary> Flag to compress subsequent chunks. </summary>
+    bool mCompress;
+
+    /// <summary> Index entries of the chunks written so far. </summary>
+    std::vector<slArchiveEntry> mEntries;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ScanArchiveReader
+///
+/// @brief  Provides random access to the entries of a scan archive through a memory mapping.
+///
+/// Entries are located through the index block, so opening an archive reads neither images nor
+/// matrices; uncompressed chunks can be accessed in place with GetData().
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ScanArchiveReader
+{
+public:
+    ScanArchiveReader();
+
+    // Closes the archive (if open).
+    ~ScanArchiveReader();
+
+    // Open (and map) an existing archive file.
+    int Open(const char* filename);
+
+    // Unmap and close the archive.
+    void Close();
+
+    // Find an entry by name (returns -1 if not found).
+    int Find(const char* name);
+
+    // Accessor methods
+    int GetCount() { return mCount; };
+    const slArchiveEntry* GetEntry(int i) { return mIndex + i; };
+
+    // Return a pointer to the data of an uncompressed entry inside the mapping (NULL if compressed).
+    const void* GetData(int i);
+
+    // Load an image or matrix entry into a newly allocated image or matrix (released by the caller).
+    IplImage* LoadImage(int i);
+    CvMat* LoadMatrix(int i);
+
+private:
+    // Copy (or decompress) the data of an entry into rows of a destination buffer.
+    int ReadChunk(int i, char* data, int row_size, int row_step);
+
+    /// <summary> Handles of the file and its mapping. </summary>
+    HANDLE mFileHandle;
+    HANDLE mMapping;
+
+    /// <summary> Mapped file contents and size. </summary>
+    const uchar* mBase;
+    uint64 mSize;
+
+    /// <summary> Index block (inside the mapping). </summary>
+    const slArchiveEntry* mIndex;
+    int mCount;
+
+    /// <summary> Entry numbers, by name. </summary>
+    std::map<std::string, int> mNames;
+};
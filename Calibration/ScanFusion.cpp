@@ -0,0 +1,535 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ScanFusion.cpp
+///
+/// @brief  Implements the scan fusion class.
+///
+/// Overview:
+///   Registration minimizes the point-to-plane error sum_i (n_i . (R*p_i + t - q_i))^2 by
+///   Gauss-Newton, linearizing the rotation as R = (I + [w]x)*R. Correspondences q_i are found by
+///   projecting the transformed point into the previous scan's camera image (projective data
+///   association), which needs no search structure because scans are organized by camera pixel.
+///   Integration walks the truncation band along each camera ray, allocating 8x8x8 voxel blocks
+///   on demand and updating the running weighted average of the truncated signed distance.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "ScanFusion.h"
+
+#include <vector>
+
+// Maximum integration weight of a voxel (limits the influence of old observations).
+static const int MAX_VOXEL_WEIGHT = 128;
+
+// Minimum number of ICP correspondences required for successful registration.
+static const int MIN_CORRESPONDENCES = 100;
+
+// Minimum cosine of the angle between corresponding normals.
+static const double MIN_NORMAL_COSINE = 0.8;
+
+// Divide an integer voxel coordinate by the block dimension, rounding towards negative infinity.
+static inline int floorDivBlock(int v){
+	return (v >= 0) ? v/FUSION_BLOCK_DIM : (v+1)/FUSION_BLOCK_DIM - 1;
+}
+
+// Evaluate the rotation matrix for a rotation vector (Rodrigues' formula).
+static void rotationFromVector(const double* w, double* R){
+	double theta = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+	double k[3] = {0, 0, 0};
+	if(theta > 1e-12){
+		k[0] = w[0]/theta; k[1] = w[1]/theta; k[2] = w[2]/theta;
+	}
+	double s = sin(theta), c = 1.0-cos(theta);
+	R[0] = 1 - c*(k[1]*k[1] + k[2]*k[2]);
+	R[1] = -s*k[2] + c*k[0]*k[1];
+	R[2] =  s*k[1] + c*k[0]*k[2];
+	R[3] =  s*k[2] + c*k[0]*k[1];
+	R[4] = 1 - c*(k[0]*k[0] + k[2]*k[2]);
+	R[5] = -s*k[0] + c*k[1]*k[2];
+	R[6] = -s*k[1] + c*k[0]*k[2];
+	R[7] =  s*k[0] + c*k[1]*k[2];
+	R[8] = 1 - c*(k[0]*k[0] + k[1]*k[1]);
+}
+
+// Solve the symmetric positive-definite 6x6 system A*x = b (Cholesky decomposition).
+// Note: Only the upper triangle of A is read. Returns false if A is not positive definite.
+static bool solveSymmetric6(const double* A, const double* b, double* x){
+	double L[36];
+	for(int i=0; i<6; i++){
+		for(int j=0; j<=i; j++){
+			double sum = A[j*6+i];
+			for(int k=0; k<j; k++)
+				sum -= L[i*6+k]*L[j*6+k];
+			if(i == j){
+				if(sum <= 0)
+					return false;
+				L[i*6+i] = sqrt(sum);
+			}
+			else
+				L[i*6+j] = sum/L[j*6+j];
+		}
+	}
+	double y[6];
+	for(int i=0; i<6; i++){
+		double sum = b[i];
+		for(int k=0; k<i; k++)
+			sum -= L[i*6+k]*y[k];
+		y[i] = sum/L[i*6+i];
+	}
+	for(int i=5; i>=0; i--){
+		double sum = y[i];
+		for(int k=i+1; k<6; k++)
+			sum -= L[k*6+i]*x[k];
+		x[i] = sum/L[i*6+i];
+	}
+	return true;
+}
+
+// Estimate organized surface normals by central differences on the camera grid.
+// Note: Normals are oriented towards the camera. Pixels without four valid neighbours keep their
+//       point for integration but are marked with 2, which excludes them from registration.
+static void computeOrganizedNormals(int width, int height, const float* points, float* normals, uchar* valid){
+	#pragma omp parallel for
+	for(int r=0; r<height; r++){
+		for(int c=0; c<width; c++){
+			int i = r*width+c;
+			float* n = normals + 3*i;
+			n[0] = n[1] = n[2] = 0;
+			if(!valid[i])
+				continue;
+			if(r == 0 || r == height-1 || c == 0 || c == width-1 ||
+			   !valid[i-1] || !valid[i+1] || !valid[i-width] || !valid[i+width]){
+				valid[i] = 2;
+				continue;
+			}
+			const float* l = points + 3*(i-1);
+			const float* rt = points + 3*(i+1);
+			const float* u = points + 3*(i-width);
+			const float* d = points + 3*(i+width);
+			float dx[3] = {rt[0]-l[0], rt[1]-l[1], rt[2]-l[2]};
+			float dy[3] = {d[0]-u[0], d[1]-u[1], d[2]-u[2]};
+			n[0] = dx[1]*dy[2] - dx[2]*dy[1];
+			n[1] = dx[2]*dy[0] - dx[0]*dy[2];
+			n[2] = dx[0]*dy[1] - dx[1]*dy[0];
+			float len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			if(len < 1e-12f){
+				valid[i] = 2;
+				continue;
+			}
+			const float* p = points + 3*i;
+			if(n[0]*p[0] + n[1]*p[1] + n[2]*p[2] > 0)
+				len = -len;
+			n[0] /= len; n[1] /= len; n[2] /= len;
+		}
+	}
+}
+
+// Constructor
+ScanFusion::ScanFusion(struct slParams* sl_params, struct slCalib* sl_calib)
+{
+    mWidth  = sl_params->cam_w;
+    mHeight = sl_params->cam_h;
+    mFx = (float)cvmGet(sl_calib->cam_intrinsic, 0, 0);
+    mFy = (float)cvmGet(sl_calib->cam_intrinsic, 1, 1);
+    mCx = (float)cvmGet(sl_calib->cam_intrinsic, 0, 2);
+    mCy = (float)cvmGet(sl_calib->cam_intrinsic, 1, 2);
+
+    mVoxelSize      = (sl_params->fusion_voxel_size > 0) ? sl_params->fusion_voxel_size : 2.0f;
+    mTruncation     = (sl_params->fusion_truncation > mVoxelSize) ? sl_params->fusion_truncation : 2.0f*mVoxelSize;
+    mIcpMaxDistance = sl_params->fusion_icp_max_distance;
+    mIcpIterations  = sl_params->fusion_icp_iterations;
+
+    int n = mWidth*mHeight;
+    mPrevPoints  = new float[3*n];
+    mPrevNormals = new float[3*n];
+    mPrevValid   = new uchar[n];
+    mCurPoints   = new float[3*n];
+    mCurNormals  = new float[3*n];
+    mCurValid    = new uchar[n];
+
+    // Keep the hash table at most half full, so probe sequences stay short.
+    mMaxBlocks = (sl_params->fusion_max_blocks > 0) ? sl_params->fusion_max_blocks : 1;
+    mHashCapacity = 1;
+    while(mHashCapacity < 2*mMaxBlocks)
+        mHashCapacity <<= 1;
+    mHashKeys   = new int[3*mHashCapacity];
+    mHashValues = new int[mHashCapacity];
+    mBlocks     = new slVoxel[(size_t)mMaxBlocks*FUSION_BLOCK_SIZE];
+
+    Reset();
+}
+
+// Destructor
+ScanFusion::~ScanFusion()
+{
+    delete[] mPrevPoints;
+    delete[] mPrevNormals;
+    delete[] mPrevValid;
+    delete[] mCurPoints;
+    delete[] mCurNormals;
+    delete[] mCurValid;
+    delete[] mHashKeys;
+    delete[] mHashValues;
+    delete[] mBlocks;
+}
+
+// Discard the fused model and all registration state.
+void ScanFusion::Reset()
+{
+    mScanCount     = 0;
+    mBlockCount    = 0;
+    mDroppedBlocks = 0;
+    for(int i=0; i<9; i++)
+        mPoseR[i] = (i % 4 == 0) ? 1.0 : 0.0;
+    mPoseT[0] = mPoseT[1] = mPoseT[2] = 0;
+    for(int i=0; i<mHashCapacity; i++)
+        mHashValues[i] = -1;
+}
+
+// Return the scan-to-world pose of the most recent scan.
+void ScanFusion::GetPose(double* R, double* t)
+{
+    memcpy(R, mPoseR, 9*sizeof(double));
+    memcpy(t, mPoseT, 3*sizeof(double));
+}
+
+// Look up (and optionally allocate) the voxel block with the given block coordinates.
+slVoxel* ScanFusion::FindBlock(int bx, int by, int bz, bool allocate)
+{
+    unsigned int mask = (unsigned int)mHashCapacity - 1;
+    unsigned int h = (((unsigned int)bx*73856093u) ^ ((unsigned int)by*19349663u) ^ ((unsigned int)bz*83492791u)) & mask;
+    for(;;){
+        int index = mHashValues[h];
+        if(index < 0){
+            if(!allocate)
+                return NULL;
+            if(mBlockCount >= mMaxBlocks){
+                mDroppedBlocks++;
+                return NULL;
+            }
+            index = mBlockCount++;
+            mHashKeys[3*h+0] = bx;
+            mHashKeys[3*h+1] = by;
+            mHashKeys[3*h+2] = bz;
+            mHashValues[h]   = index;
+            slVoxel* block = mBlocks + (size_t)index*FUSION_BLOCK_SIZE;
+            memset(block, 0, FUSION_BLOCK_SIZE*sizeof(slVoxel));
+            return block;
+        }
+        if(mHashKeys[3*h] == bx && mHashKeys[3*h+1] == by && mHashKeys[3*h+2] == bz)
+            return mBlocks + (size_t)index*FUSION_BLOCK_SIZE;
+        h = (h+1) & mask;
+    }
+}
+
+// Look up the voxel with the given voxel coordinates (NULL if its block is not allocated).
+slVoxel* ScanFusion::FindVoxel(int vx, int vy, int vz)
+{
+    int bx = floorDivBlock(vx), by = floorDivBlock(vy), bz = floorDivBlock(vz);
+    slVoxel* block = FindBlock(bx, by, bz, false);
+    if(block == NULL)
+        return NULL;
+    int lx = vx - bx*FUSION_BLOCK_DIM, ly = vy - by*FUSION_BLOCK_DIM, lz = vz - bz*FUSION_BLOCK_DIM;
+    return block + (lz*FUSION_BLOCK_DIM + ly)*FUSION_BLOCK_DIM + lx;
+}
+
+// Register a new scan against the previous one and integrate it into the model.
+int ScanFusion::AddScan(CvMat* points, CvMat* mask)
+{
+    int n = mWidth*mHeight;
+    if(points->rows != 3 || points->cols != n || (mask != NULL && mask->rows*mask->cols != n)){
+        printf("ERROR: Scan does not match the camera resolution!\n");
+        return -1;
+    }
+
+    // Repack the scan as interleaved points and estimate normals.
+    int cols = points->cols;
+    int n_valid = 0;
+    #pragma omp parallel for reduction(+:n_valid)
+    for(int i=0; i<n; i++){
+        float x = points->data.fl[i], y = points->data.fl[i+cols], z = points->data.fl[i+2*cols];
+        mCurPoints[3*i+0] = x;
+        mCurPoints[3*i+1] = y;
+        mCurPoints[3*i+2] = z;
+        mCurValid[i] = ((mask == NULL || mask->data.fl[i] != 0) && z > 0) ? 1 : 0;
+        n_valid += mCurValid[i];
+    }
+    if(n_valid < MIN_CORRESPONDENCES){
+        printf("ERROR: Scan contains too few points for fusion!\n");
+        return -1;
+    }
+    computeOrganizedNormals(mWidth, mHeight, mCurPoints, mCurNormals, mCurValid);
+
+    // Register against the previous scan and compose with its pose.
+    double R[9], t[3];
+    if(mScanCount == 0){
+        memcpy(R, mPoseR, 9*sizeof(double));
+        memcpy(t, mPoseT, 3*sizeof(double));
+    }
+    else{
+        double R_rel[9], t_rel[3];
+        if(Register(mCurPoints, mCurNormals, mCurValid, R_rel, t_rel) != 0)
+            return -1;
+        for(int i=0; i<3; i++){
+            for(int j=0; j<3; j++)
+                R[3*i+j] = mPoseR[3*i]*R_rel[j] + mPoseR[3*i+1]*R_rel[3+j] + mPoseR[3*i+2]*R_rel[6+j];
+            t[i] = mPoseR[3*i]*t_rel[0] + mPoseR[3*i+1]*t_rel[1] + mPoseR[3*i+2]*t_rel[2] + mPoseT[i];
+        }
+    }
+
+    // Integrate the scan into the TSDF.
+    int n_dropped = mDroppedBlocks;
+    Integrate(mCurPoints, mCurValid, R, t);
+    if(mDroppedBlocks > n_dropped)
+        printf("WARNING: Fusion volume is full (%d blocks); part of the scan was not integrated.\n", mMaxBlocks);
+
+    // The current scan becomes the reference for the next one.
+    float* tmp;
+    tmp = mPrevPoints;  mPrevPoints  = mCurPoints;  mCurPoints  = tmp;
+    tmp = mPrevNormals; mPrevNormals = mCurNormals; mCurNormals = tmp;
+    uchar* tmp_valid = mPrevValid; mPrevValid = mCurValid; mCurValid = tmp_valid;
+    memcpy(mPoseR, R, 9*sizeof(double));
+    memcpy(mPoseT, t, 3*sizeof(double));
+    mScanCount++;
+
+    printf("Fused scan %d (%d points, %d of %d voxel blocks allocated).\n", mScanCount, n_valid, mBlockCount, mMaxBlocks);
+    return 0;
+}
+
+// Estimate the rigid motion mapping the current scan onto the previous scan.
+// Note: The motion between successive scans is assumed to be small (the initial estimate is identity).
+int ScanFusion::Register(const float* points, const float* normals, const uchar* valid, double* R, double* t)
+{
+    for(int i=0; i<9; i++)
+        R[i] = (i % 4 == 0) ? 1.0 : 0.0;
+    t[0] = t[1] = t[2] = 0;
+
+    int n = mWidth*mHeight;
+    double max_dist2 = (double)mIcpMaxDistance*mIcpMaxDistance;
+    double rms = 0;
+    int n_pairs = 0, iter = 0;
+    for(iter=0; iter<mIcpIterations; iter++){
+
+        // Accumulate the normal equations of the linearized point-to-plane error.
+        double A[36], b[6], error = 0;
+        memset(A, 0, sizeof(A));
+        memset(b, 0, sizeof(b));
+        n_pairs = 0;
+        #pragma omp parallel
+        {
+            double A_local[36], b_local[6], error_local = 0;
+            int n_local = 0;
+            memset(A_local, 0, sizeof(A_local));
+            memset(b_local, 0, sizeof(b_local));
+            #pragma omp for
+            for(int i=0; i<n; i++){
+                if(valid[i] != 1)
+                    continue;
+
+                // Transform the point and project it into the previous scan.
+                const float* p = points + 3*i;
+                double px = R[0]*p[0] + R[1]*p[1] + R[2]*p[2] + t[0];
+                double py = R[3]*p[0] + R[4]*p[1] + R[5]*p[2] + t[1];
+                double pz = R[6]*p[0] + R[7]*p[1] + R[8]*p[2] + t[2];
+                if(pz <= 0)
+                    continue;
+                int u = cvRound(mFx*px/pz + mCx);
+                int v = cvRound(mFy*py/pz + mCy);
+                if(u < 0 || u >= mWidth || v < 0 || v >= mHeight)
+                    continue;
+                int j = v*mWidth+u;
+                if(mPrevValid[j] != 1)
+                    continue;
+
+                // Reject distant or incompatible correspondences.
+                const float* q  = mPrevPoints + 3*j;
+                const float* nq = mPrevNormals + 3*j;
+                double dx = px-q[0], dy = py-q[1], dz = pz-q[2];
+                if(dx*dx + dy*dy + dz*dz > max_dist2)
+                    continue;
+                const float* np = normals + 3*i;
+                double cos_angle = nq[0]*(R[0]*np[0] + R[1]*np[1] + R[2]*np[2]) +
+                                   nq[1]*(R[3]*np[0] + R[4]*np[1] + R[5]*np[2]) +
+                                   nq[2]*(R[6]*np[0] + R[7]*np[1] + R[8]*np[2]);
+                if(cos_angle < MIN_NORMAL_COSINE)
+                    continue;
+
+                // Accumulate J*J' and -J*r, with J = [p x n; n].
+                double r = nq[0]*dx + nq[1]*dy + nq[2]*dz;
+                double J[6] = {py*nq[2] - pz*nq[1], pz*nq[0] - px*nq[2], px*nq[1] - py*nq[0], nq[0], nq[1], nq[2]};
+                for(int k=0; k<6; k++){
+                    for(int l=k; l<6; l++)
+                        A_local[k*6+l] += J[k]*J[l];
+                    b_local[k] -= J[k]*r;
+                }
+                error_local += r*r;
+                n_local++;
+            }
+            #pragma omp critical
+            {
+                for(int k=0; k<36; k++)
+                    A[k] += A_local[k];
+                for(int k=0; k<6; k++)
+                    b[k] += b_local[k];
+                error   += error_local;
+                n_pairs += n_local;
+            }
+        }
+        if(n_pairs < MIN_CORRESPONDENCES){
+            printf("ERROR: Scan registration failed (%d correspondences)!\n", n_pairs);
+            return -1;
+        }
+        rms = sqrt(error/n_pairs);
+
+        // Solve for the incremental motion and apply it.
+        double x[6];
+        if(!solveSymmetric6(A, b, x)){
+            printf("ERROR: Scan registration is degenerate!\n");
+            return -1;
+        }
+        double dR[9], R_new[9], t_new[3];
+        rotationFromVector(x, dR);
+        for(int i=0; i<3; i++){
+            for(int j=0; j<3; j++)
+                R_new[3*i+j] = dR[3*i]*R[j] + dR[3*i+1]*R[3+j] + dR[3*i+2]*R[6+j];
+            t_new[i] = dR[3*i]*t[0] + dR[3*i+1]*t[1] + dR[3*i+2]*t[2] + x[3+i];
+        }
+        memcpy(R, R_new, 9*sizeof(double));
+        memcpy(t, t_new, 3*sizeof(double));
+
+        // Stop when the update is negligible (rotation in radians, translation in mm).
+        if(x[0]*x[0] + x[1]*x[1] + x[2]*x[2] < 1e-12 && x[3]*x[3] + x[4]*x[4] + x[5]*x[5] < 1e-8){
+            iter++;
+            break;
+        }
+    }
+
+    printf("Registered scan: %d correspondences, RMS point-to-plane error = %f mm (%d iterations).\n", n_pairs, rms, iter);
+    return 0;
+}
+
+// Integrate the current scan into the TSDF using the given scan-to-world pose.
+// Note: Voxels between the camera and the surface receive positive distances.
+void ScanFusion::Integrate(const float* points, const uchar* valid, const double* R, const double* t)
+{
+    const float inv_voxel  = 1.0f/mVoxelSize;
+    const float inv_trunc  = 1.0f/mTruncation;
+    const int   n_samples  = 2*(int)ceil(mTruncation*inv_voxel) + 1;
+    const float step       = 2.0f*mTruncation/(n_samples-1);
+
+    // Block allocation modifies the hash table, so rays are integrated sequentially.
+    int n = mWidth*mHeight;
+    for(int i=0; i<n; i++){
+        if(!valid[i])
+            continue;
+
+        // Transform the point to world coordinates; the ray direction is R*p/|p|.
+        const float* p = points + 3*i;
+        float len = sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+        float pw[3], dir[3];
+        for(int k=0; k<3; k++){
+            dir[k] = (float)(R[3*k]*p[0] + R[3*k+1]*p[1] + R[3*k+2]*p[2]);
+            pw[k]  = dir[k] + (float)t[k];
+            dir[k] /= len;
+        }
+
+        // Update every voxel within the truncation band along the ray.
+        for(int s=0; s<n_samples; s++){
+            float offset = -mTruncation + s*step;
+            int vx = cvFloor((pw[0] + offset*dir[0])*inv_voxel);
+            int vy = cvFloor((pw[1] + offset*dir[1])*inv_voxel);
+            int vz = cvFloor((pw[2] + offset*dir[2])*inv_voxel);
+            int bx = floorDivBlock(vx), by = floorDivBlock(vy), bz = floorDivBlock(vz);
+            slVoxel* block = FindBlock(bx, by, bz, true);
+            if(block == NULL)
+                continue;
+            slVoxel* voxel = block + ((vz - bz*FUSION_BLOCK_DIM)*FUSION_BLOCK_DIM + (vy - by*FUSION_BLOCK_DIM))*FUSION_BLOCK_DIM + (vx - bx*FUSION_BLOCK_DIM);
+
+            // Signed distance from the voxel centre to the surface, along the ray.
+            float sdf = (pw[0] - (vx + 0.5f)*mVoxelSize)*dir[0] +
+                        (pw[1] - (vy + 0.5f)*mVoxelSize)*dir[1] +
+                        (pw[2] - (vz + 0.5f)*mVoxelSize)*dir[2];
+            if(sdf < -mTruncation)
+                continue;
+            float tsdf = (sdf > mTruncation) ? 1.0f : sdf*inv_trunc;
+            int w = voxel->weight;
+            voxel->tsdf = (short)cvRound((voxel->tsdf*w + 32767.0f*tsdf)/(w+1));
+            if(w < MAX_VOXEL_WEIGHT)
+                voxel->weight = (ushort)(w+1);
+        }
+    }
+}
+
+// Extract the fused surface as a point cloud with normals (zero crossings of the TSDF).
+// Note: One point is generated for every voxel edge whose end points have opposite signs; normals
+//       are the normalized TSDF gradient, which points away from the surface towards the cameras.
+int ScanFusion::ExtractSurface(CvMat*& points, CvMat*& normals)
+{
+    if(mBlockCount == 0){
+        printf("ERROR: No scans have been fused!\n");
+        return -1;
+    }
+
+    std::vector<float> surface_points, surface_normals;
+    for(int h=0; h<mHashCapacity; h++){
+        if(mHashValues[h] < 0)
+            continue;
+        const slVoxel* block = mBlocks + (size_t)mHashValues[h]*FUSION_BLOCK_SIZE;
+        int bx = mHashKeys[3*h], by = mHashKeys[3*h+1], bz = mHashKeys[3*h+2];
+        for(int i=0; i<FUSION_BLOCK_SIZE; i++){
+            if(block[i].weight == 0)
+                continue;
+            int vx = bx*FUSION_BLOCK_DIM + i%FUSION_BLOCK_DIM;
+            int vy = by*FUSION_BLOCK_DIM + (i/FUSION_BLOCK_DIM)%FUSION_BLOCK_DIM;
+            int vz = bz*FUSION_BLOCK_DIM + i/(FUSION_BLOCK_DIM*FUSION_BLOCK_DIM);
+            float v0 = block[i].tsdf/32767.0f;
+
+            // Search the positive neighbour along each axis for a zero crossing.
+            for(int axis=0; axis<3; axis++){
+                slVoxel* neighbour = FindVoxel(vx + (axis == 0), vy + (axis == 1), vz + (axis == 2));
+                if(neighbour == NULL || neighbour->weight == 0)
+                    continue;
+                float v1 = neighbour->tsdf/32767.0f;
+                if((v0 > 0) == (v1 > 0) || v0 == v1)
+                    continue;
+
+                // Interpolate the crossing, and evaluate the gradient by central differences.
+                float a = v0/(v0 - v1);
+                float x[3] = {(vx + 0.5f)*mVoxelSize, (vy + 0.5f)*mVoxelSize, (vz + 0.5f)*mVoxelSize};
+                x[axis] += a*mVoxelSize;
+                float g[3];
+                for(int k=0; k<3; k++){
+                    slVoxel* lo = FindVoxel(vx - (k == 0), vy - (k == 1), vz - (k == 2));
+                    slVoxel* hi = FindVoxel(vx + (k == 0), vy + (k == 1), vz + (k == 2));
+                    float f_lo = (lo != NULL && lo->weight > 0) ? lo->tsdf/32767.0f : v0;
+                    float f_hi = (hi != NULL && hi->weight > 0) ? hi->tsdf/32767.0f : v0;
+                    g[k] = f_hi - f_lo;
+                }
+                float g_len = sqrt(g[0]*g[0] + g[1]*g[1] + g[2]*g[2]);
+                if(g_len < 1e-6f)
+                    continue;
+                for(int k=0; k<3; k++){
+                    surface_points.push_back(x[k]);
+                    surface_normals.push_back(g[k]/g_len);
+                }
+            }
+        }
+    }
+
+    // Pack results as 3xM matrices (one column per point).
+    int m = (int)surface_points.size()/3;
+    if(m == 0){
+        printf("ERROR: Fused model does not contain a surface!\n");
+        return -1;
+    }
+    points  = cvCreateMat(3, m, CV_32FC1);
+    normals = cvCreateMat(3, m, CV_32FC1);
+    for(int j=0; j<m; j++){
+        for(int k=0; k<3; k++){
+            points->data.fl[j + m*k]  = surface_points[3*j+k];
+            normals->data.fl[j + m*k] = surface_normals[3*j+k];
+        }
+    }
+    printf("Extracted %d surface points from %d voxel blocks.\n", m, mBlockCount);
+    return 0;
+}
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\ScanFusion.h
+///
+/// @brief  Declares the scan fusion class.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Number of voxels along each side of a voxel block.
+#define FUSION_BLOCK_DIM  8
+#define FUSION_BLOCK_SIZE (FUSION_BLOCK_DIM*FUSION_BLOCK_DIM*FUSION_BLOCK_DIM)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slVoxel
+///
+/// @brief  Truncated signed distance and integration weight of one voxel.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slVoxel{
+	short  tsdf;                    // signed distance, normalized to [-1,1] and scaled by 32767
+	ushort weight;                  // number of integrated observations (0 = unobserved)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  ScanFusion
+///
+/// @brief  Registers successive scans and fuses them into a single model.
+///
+/// Each scan is aligned to the previous one with point-to-plane ICP using projective data
+/// association on the organized camera grid, then integrated into a truncated signed distance
+/// function (TSDF). The TSDF is stored sparsely as 8x8x8 voxel blocks in a hash table, with the
+/// number of blocks (and therefore memory) bounded by slParams::fusion_max_blocks. The world
+/// coordinate system is the camera coordinate system of the first scan.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ScanFusion
+{
+public:
+    ScanFusion(struct slParams* sl_params, struct slCalib* sl_calib);
+
+    ~ScanFusion();
+
+    // Discard the fused model and all registration state.
+    void Reset();
+
+    // Register a new scan against the previous one and integrate it into the model.
+    // Note: points is 3xN and mask 1xN (non-zero = valid), indexed by camera pixel.
+    //       Returns 0 on success or -1 if registration failed (the scan is not integrated).
+    int AddScan(CvMat* points, CvMat* mask);
+
+    // Extract the fused surface as a point cloud with normals (zero crossings of the TSDF).
+    // Note: Allocates 3xM points and normals matrices, which must be released by the caller.
+    int ExtractSurface(CvMat*& points, CvMat*& normals);
+
+    // Accessor methods
+    int GetScanCount() { return mScanCount; };
+    int GetBlockCount() { return mBlockCount; };
+    void GetPose(double* R, double* t);
+
+private:
+    // Estimate the rigid motion mapping the current scan onto the previous scan.
+    int Register(const float* points, const float* normals, const uchar* valid, double* R, double* t);
+
+    // Integrate the current scan into the TSDF using the given scan-to-world pose.
+    void Integrate(const float* points, const uchar* valid, const double* R, const double* t);
+
+    // Look up (and optionally allocate) the voxel block with the given block coordinates.
+    slVoxel* FindBlock(int bx, int by, int bz, bool allocate);
+
+    // Look up the voxel with the given voxel coordinates (NULL if its block is not allocated).
+    slVoxel* FindVoxel(int vx, int vy, int vz);
+
+    /// <summary> Camera resolution. </summary>
+    int mWidth, mHeight;
+
+    /// <summary> Pinhole camera intrinsics (used for projective data association). </summary>
+    float mFx, mFy, mCx, mCy;
+
+    /// <summary> Fusion parameters. </summary>
+    float mVoxelSize, mTruncation, mIcpMaxDistance;
+    int   mIcpIterations;
+
+    /// <summary> Number of registered scans. </summary>
+    int mScanCount;
+
+    /// <summary> Scan-to-world pose of the previous scan. </summary>
+    double mPoseR[9], mPoseT[3];
+
+    /// <summary> Organized points, normals and validity of the previous scan (camera coordinates). </summary>
+    float* mPrevPoints;
+    float* mPrevNormals;
+    uchar* mPrevValid;
+
+    /// <summary> Scratch storage for the current scan. </summary>
+    float* mCurPoints;
+    float* mCurNormals;
+    uchar* mCurValid;
+
+    /// <summary> Open-addressing hash table of block coordinates (3 ints per slot) and block indices. </summary>
+    int* mHashKeys;
+    int* mHashValues;
+    int  mHashCapacity;
+
+    /// <summary> Voxel block pool. </summary>
+    slVoxel* mBlocks;
+    int mMaxBlocks;
+    int mBlockCount;
+    int mDroppedBlocks;
+};
@@ -0,0 +1,369 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\TextWriter.cpp
+///
+/// @brief  Implements the buffered text writer used by the ASCII point cloud exporters.
+///
+/// Overview:
+///   formatFloat searches for the smallest number n of significant digits (between 1 and 9) such
+///   that the value, scaled by a power of ten and rounded down or up to an n-digit integer, reads
+///   back to the same float, i.e. lies within its rounding interval: half a float ulp on either side (a quarter
+///   ulp below a power of two), with the bounds included for even mantissas, since the reader
+///   rounds half to even. The double-precision distance decides, unless it is within a small
+///   margin of the bound; the decimal is then compared exactly with the bound, in integer
+///   arithmetic. Nine digits always suffice for a float (sprintf("%.9g") is only a safeguard).
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "TextWriter.h"
+#include "PointMask.h"
+
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Powers of ten from 1e-60 to 1e60 (filled in before main, so formatting threads only read them).
+static double pow10_table[121];
+static struct Pow10Init{
+	Pow10Init(){
+		for(int i=0; i<121; i++)
+			pow10_table[i] = pow(10.0, i-60);
+	}
+} pow10_init;
+static inline double pow10i(int k){
+	return pow10_table[k+60];
+}
+
+// Number of 32-bit limbs of the integers compared by compareDecimalBound (enough for 320 bits).
+#define BIG_LIMBS 10
+
+// Set a multi-limb integer (least significant limb first).
+static void bigSet(unsigned int* a, uint64 value){
+	memset(a, 0, BIG_LIMBS*sizeof(unsigned int));
+	a[0] = (unsigned int)value;
+	a[1] = (unsigned int)(value >> 32);
+}
+
+// Multiply a multi-limb integer by a small factor.
+static void bigMul(unsigned int* a, unsigned int factor){
+	uint64 carry = 0;
+	for(int i=0; i<BIG_LIMBS; i++){
+		carry += (uint64)a[i]*factor;
+		a[i]   = (unsigned int)carry;
+		carry >>= 32;
+	}
+}
+
+// Shift a multi-limb integer left.
+static void bigShift(unsigned int* a, int bits){
+	int words = bits/32;
+	bits %= 32;
+	for(int i=BIG_LIMBS-1; i>=0; i--){
+		uint64 value = (i >= words) ? ((uint64)a[i-words] << bits) : 0;
+		if(bits > 0 && i > words)
+			value |= a[i-words-1] >> (32-bits);
+		a[i] = (unsigned int)value;
+	}
+}
+
+// Compare the decimal digits*10^q with the dyadic bound*2^p; returns -1, 0 or 1.
+static int compareDecimalBound(uint64 digits, int q, uint64 bound, int p){
+	unsigned int a[BIG_LIMBS], b[BIG_LIMBS];
+	bigSet(a, digits);
+	bigSet(b, bound);
+	for(int i=0; i<q; i++)
+		bigMul(a, 5);
+	for(int i=0; i<-q; i++)
+		bigMul(b, 5);
+	if(q > p)
+		bigShift(a, q-p);
+	else
+		bigShift(b, p-q);
+	for(int i=BIG_LIMBS-1; i>=0; i--)
+		if(a[i] != b[i])
+			return (a[i] < b[i]) ? -1 : 1;
+	return 0;
+}
+
+// Test exactly whether the decimal digits*10^-k lies within the rounding interval of the float mantissa*2^e.
+// Note: above selects the upper or the lower bound of the interval (the midpoints between the float and its neighbours).
+static bool readsBackExact(double digits, int k, unsigned int mantissa, int e, bool above){
+	int c;
+	if(above)
+		c = -compareDecimalBound((uint64)digits, -k, 2*(uint64)mantissa+1, e-1);
+	else if(mantissa == (1u << 23) && e > -149)
+		c = compareDecimalBound((uint64)digits, -k, 4*(uint64)mantissa-1, e-2);
+	else
+		c = compareDecimalBound((uint64)digits, -k, 2*(uint64)mantissa-1, e-1);
+	return (c > 0) || (c == 0 && (mantissa & 1) == 0);
+}
+
+// Test whether the decimal digits*10^-k reads back as the float v = mantissa*2^e (rounding half to even).
+// Note: Distances below lower are always within the rounding interval and distances above upper never
+//       are (whatever their sign); the decimal is only compared exactly in between.
+static inline bool readsBack(double digits, int k, double v, double lower, double upper, unsigned int mantissa, int e){
+	double d    = digits/pow10i(k);
+	double dist = fabs(d - v);
+	if(dist < lower)
+		return true;
+	if(dist > upper)
+		return false;
+	return readsBackExact(digits, k, mantissa, e, d >= v);
+}
+
+// Write the decimal digits of a positive integer; returns the number of digits.
+static inline int formatDigits(unsigned int value, char* dst){
+	char tmp[10];
+	int n = 0;
+	do{
+		tmp[n++] = (char)('0' + value % 10);
+		value /= 10;
+	} while(value != 0);
+	for(int i=0; i<n; i++)
+		dst[i] = tmp[n-1-i];
+	return n;
+}
+
+// Format an integer.
+int formatInt(int value, char* dst){
+	if(value < 0){
+		dst[0] = '-';
+		return 1 + formatDigits((unsigned int)(-(value+1)) + 1u, dst+1);
+	}
+	return formatDigits((unsigned int)value, dst);
+}
+
+// Format a float with the fewest significant digits that read back to exactly the same value.
+int formatFloat(float value, char* dst){
+
+	// Handle special values.
+	char* p = dst;
+	if(value != value){
+		memcpy(dst, "nan", 3);
+		return 3;
+	}
+	if(value < 0){
+		*p++ = '-';
+		value = -value;
+	}
+	if(value == 0){
+		*p++ = '0';
+		return (int)(p-dst);
+	}
+	if(value > FLT_MAX){
+		memcpy(p, "inf", 3);
+		return (int)(p-dst) + 3;
+	}
+
+	// Split the float into its integer mantissa and the exponent of its ulp (value = mantissa*2^e).
+	double v = value;
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	int biased = (int)(bits >> 23);
+	unsigned int mantissa = (biased > 0) ? ((bits & 0x7FFFFF) | 0x800000) : bits;
+	int e = ((biased > 0) ? biased : 1) - 150;
+
+	// Bound the distances which certainly are (lower) or are not (upper) within the rounding interval:
+	// half an ulp (a quarter ulp below a power of two), less or plus an error margin of 2^-45 of the value.
+	double half_ulp;
+	uint64 half_ulp_bits = (uint64)(e-1+1023) << 52;
+	memcpy(&half_ulp, &half_ulp_bits, sizeof(half_ulp));
+	double margin = v*2.8421709430404007e-14;
+	double lower  = ((mantissa == (1u << 23) && e > -149) ? 0.5*half_ulp : half_ulp) - margin;
+	double upper  = half_ulp + margin;
+
+	// Evaluate the decimal exponent.
+	int e10 = (int)floor(log10(v));
+	if(pow10i(e10) > v)
+		e10--;
+	else if(pow10i(e10+1) <= v)
+		e10++;
+
+	// Binary search for the shortest digit string that reads back as the same float.
+	// Note: An n-digit decimal is also an (n+1)-digit decimal, so the test is monotonic in n. If
+	//       the nearest integer to the scaled value does not read back, the other neighbour is tried
+	//       (the rounding interval is asymmetric below a power of two, and ties round to even).
+	double best = 0;
+	int n = 0, lo = 1, hi = 10;
+	while(lo < hi){
+		int mid = (lo+hi)/2;
+		int k = mid - 1 - e10;
+		double x = v*pow10i(k);
+		double scaled = floor(x + 0.5);
+		bool found = readsBack(scaled, k, v, lower, upper, mantissa, e);
+		if(!found){
+			scaled = (scaled > x) ? scaled-1 : scaled+1;
+			found  = readsBack(scaled, k, v, lower, upper, mantissa, e);
+		}
+		if(found){
+			best = scaled;
+			n    = mid;
+			hi   = mid;
+		}
+		else
+			lo = mid+1;
+	}
+	if(n == 0)
+		return (int)(p-dst) + sprintf(p, "%.9g", v);
+
+	// Rounding may carry into a new digit (e.g., 9.96 to two digits is 10).
+	if(best >= pow10i(n)){
+		best /= 10;
+		e10++;
+	}
+	unsigned int digits = (unsigned int)best;
+
+	// Write the digits in fixed notation for moderate exponents, and scientific notation otherwise.
+	char buf[10];
+	formatDigits(digits, buf);
+	while(n > 1 && buf[n-1] == '0')
+		n--;
+	if(e10 >= 0 && e10 < 9){
+		if(n <= e10+1){
+			memcpy(p, buf, n);
+			p += n;
+			for(int i=n; i<=e10; i++)
+				*p++ = '0';
+		}
+		else{
+			memcpy(p, buf, e10+1);
+			p += e10+1;
+			*p++ = '.';
+			memcpy(p, buf+e10+1, n-e10-1);
+			p += n-e10-1;
+		}
+	}
+	else if(e10 < 0 && e10 >= -5){
+		*p++ = '0';
+		*p++ = '.';
+		for(int i=0; i<-e10-1; i++)
+			*p++ = '0';
+		memcpy(p, buf, n);
+		p += n;
+	}
+	else{
+		*p++ = buf[0];
+		if(n > 1){
+			*p++ = '.';
+			memcpy(p, buf+1, n-1);
+			p += n-1;
+		}
+		*p++ = 'e';
+		p += formatInt(e10, p);
+	}
+	return (int)(p-dst);
+}
+
+// Constructor
+TextWriter::TextWriter(FILE* file, int chunk_size)
+{
+    mFile     = file;
+    mCapacity = (chunk_size < 256) ? 256 : chunk_size;
+    mBuffer   = new char[mCapacity];
+    mSize     = 0;
+    mOk       = true;
+}
+
+// Destructor
+TextWriter::~TextWriter()
+{
+    Flush();
+    delete[] mBuffer;
+}
+
+// Write buffered text to the file. Returns false if any write has failed.
+bool TextWriter::Flush()
+{
+    if(mSize > 0){
+        mOk = mOk && (fwrite(mBuffer, 1, mSize, mFile) == (size_t)mSize);
+        mSize = 0;
+    }
+    return mOk;
+}
+
+void TextWriter::Write(const char* str)
+{
+    int n = (int)strlen(str);
+    if(n > mCapacity){
+        Flush();
+        mOk = mOk && (fwrite(str, 1, n, mFile) == (size_t)n);
+        return;
+    }
+    Reserve(n);
+    memcpy(mBuffer + mSize, str, n);
+    mSize += n;
+}
+
+void TextWriter::WriteChar(char c)
+{
+    Reserve(1);
+    mBuffer[mSize++] = c;
+}
+
+void TextWriter::WriteInt(int value)
+{
+    Reserve(12);
+    mSize += formatInt(value, mBuffer + mSize);
+}
+
+void TextWriter::WriteFloat(float value)
+{
+    Reserve(TEXT_FLOAT_MAX_CHARS);
+    mSize += formatFloat(value, mBuffer + mSize);
+}
+
+// Write "prefix v_0 v_1 ... v_{rows-1}suffix" for every column of mat listed in index.
+// Note: The listed columns (not all columns) are split among threads, so the work is balanced
+//       even if the valid points are concentrated in part of the image.
+void TextWriter::WriteColumns(const char* prefix, CvMat* mat, const float* scale, const char* suffix, CvMat* index)
+{
+    // Define the worst-case length of a line and the parts formatted by each thread.
+    int prefix_len = (int)strlen(prefix);
+    int suffix_len = (int)strlen(suffix);
+    int rows       = mat->rows;
+    int step       = mat->step/sizeof(float);
+    int line_len   = prefix_len + rows*(TEXT_FLOAT_MAX_CHARS+1) + suffix_len;
+    int n_threads  = 1;
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+#endif
+    const int part_cols  = 16384;
+    const int batch_cols = part_cols*n_threads;
+    std::vector< std::vector<char> > parts(n_threads);
+    std::vector<int> part_size(n_threads);
+    for(int t=0; t<n_threads; t++)
+        parts[t].resize(part_cols*line_len);
+
+    // Format one batch of columns at a time (one part per thread), then write the parts in order.
+    int n_cols = (index != NULL) ? pointIndexCount(index) : mat->cols;
+    Flush();
+    for(int batch=0; batch<n_cols; batch+=batch_cols){
+        #pragma omp parallel for
+        for(int t=0; t<n_threads; t++){
+            int j_begin = batch + t*part_cols;
+            int j_end   = (j_begin + part_cols < n_cols) ? j_begin + part_cols : n_cols;
+            char* dst = parts[t].empty() ? NULL : &parts[t][0];
+            char* start = dst;
+            for(int j=j_begin; j<j_end; j++){
+                int c = (index != NULL) ? index->data.i[j] : j;
+                memcpy(dst, prefix, prefix_len);
+                dst += prefix_len;
+                for(int r=0; r<rows; r++){
+                    float value = mat->data.fl[c + step*r];
+                    if(scale != NULL)
+                        value *= scale[r];
+                    if(r > 0)
+                        *dst++ = ' ';
+                    dst += formatFloat(value, dst);
+                }
+                memcpy(dst, suffix, suffix_len);
+                dst += suffix_len;
+            }
+            part_size[t] = (j_begin < j_end) ? (int)(dst - start) : 0;
+        }
+        for(int t=0; t<n_threads; t++)
+            if(part_size[t] > 0)
+                mOk = mOk && (fwrite(&parts[t][0], 1, part_size[t], mFile) == (size_t)part_size[t]);
+    }
+}
@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\TextWriter.h
+///
+/// @brief  Declares the buffered text writer used by the ASCII point cloud exporters.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+// Maximum number of characters written by formatFloat (excluding the terminating null).
+#define TEXT_FLOAT_MAX_CHARS 16
+
+// Format a float with the fewest significant digits that read back to exactly the same value.
+// Note: Returns the number of characters written; dst is not null-terminated.
+int formatFloat(float value, char* dst);
+
+// Format an integer.
+// Note: Returns the number of characters written; dst is not null-terminated.
+int formatInt(int value, char* dst);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @class  TextWriter
+///
+/// @brief  Formats text into a large in-memory chunk, written with one fwrite per chunk.
+///
+/// WriteColumns() formats the columns of a matrix (one line per valid column) in parallel: the
+/// list of valid columns is split into one part per thread, each part is formatted into its own
+/// buffer, and the parts are written in order.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class TextWriter
+{
+public:
+    TextWriter(FILE* file, int chunk_size CV_DEFAULT(1 << 20));
+
+    // Flushes any buffered text (the file is not closed).
+    ~TextWriter();
+
+    void Write(const char* str);
+    void WriteChar(char c);
+    void WriteInt(int value);
+    void WriteFloat(float value);
+
+    // Write "prefix v_0 v_1 ... v_{rows-1}suffix" for every column of mat listed in index.
+    // Note: index is a list of valid columns (see createPointIndex), or NULL to write all columns.
+    //       Each value is multiplied by scale[row] (if provided), e.g. to flip the y-component.
+    void WriteColumns(const char* prefix, CvMat* mat, const float* scale, const char* suffix, CvMat* index);
+
+    // Write buffered text to the file. Returns false if any write has failed.
+    bool Flush();
+
+private:
+    // Make room for at least n characters in the chunk.
+    inline void Reserve(int n) { if(mSize + n > mCapacity) Flush(); };
+
+    /// <summary> Output file. </summary>
+    FILE* mFile;
+
+    /// <summary> Chunk of formatted text. </summary>
+    char* mBuffer;
+    int   mSize;
+    int   mCapacity;
+
+    /// <summary> Flag indicating that all writes have succeeded. </summary>
+    bool mOk;
+};
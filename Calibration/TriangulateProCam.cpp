@@ -0,0 +1,406 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\TriangulateProCam.cpp
+///
+/// @brief  Implements the projector-camera triangulation functions.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Common.h"
+#include "Calibration.h"
+#include "TriangulateProCam.h"
+
+#include <emmintrin.h>
+#include <vector>
+
+// Evaluate unit-length optical rays for every pixel of a calibrated device.
+// Note: Rays are stored as a 3xN matrix (one row per component) in the device coordinate system.
+static void evaluateDeviceRays(int width, int height, CvMat* intrinsic, CvMat* distortion, CvMat* rays){
+
+	// Undistort the center of every pixel.
+	int nelems = width*height;
+	CvMat* dist_points   = cvCreateMat(nelems, 1, CV_32FC2);
+	CvMat* undist_points = cvCreateMat(nelems, 1, CV_32FC2);
+	for(int r=0; r<height; r++){
+		for(int c=0; c<width; c++){
+			dist_points->data.fl[2*(width*r+c)]   = (float)c;
+			dist_points->data.fl[2*(width*r+c)+1] = (float)r;
+		}
+	}
+	cvUndistortPoints(dist_points, undist_points, intrinsic, distortion, NULL, NULL);
+
+	// Normalize rays through the undistorted (normalized) image coordinates.
+	for(int i=0; i<nelems; i++){
+		float x = undist_points->data.fl[2*i];
+		float y = undist_points->data.fl[2*i+1];
+		float norm = 1.0f/sqrt(x*x + y*y + 1.0f);
+		rays->data.fl[i]          = x*norm;
+		rays->data.fl[i+nelems]   = y*norm;
+		rays->data.fl[i+2*nelems] = norm;
+	}
+
+	// Release allocated resources.
+	cvReleaseMat(&dist_points);
+	cvReleaseMat(&undist_points);
+}
+
+// Convert an extrinsic parameter matrix (rotation vector, translation vector) to a rotation matrix and translation.
+static void extrinsicToRotationTranslation(CvMat* extrinsic, CvMat* rotation, CvMat* translation){
+	CvMat* r = cvCreateMat(1, 3, CV_32FC1);
+	for(int i=0; i<3; i++){
+		r->data.fl[i]           = CV_MAT_ELEM(*extrinsic, float, 0, i);
+		translation->data.fl[i] = CV_MAT_ELEM(*extrinsic, float, 1, i);
+	}
+	cvRodrigues2(r, rotation, NULL);
+	cvReleaseMat(&r);
+}
+
+// Evaluate centers of projection and optical rays of the projector-camera system.
+// Note: The camera center is the origin. Camera rays are evaluated for every camera pixel and
+//       projector rays for every projector pixel (so "ray-ray" triangulation can look them up
+//       by decoded projector column and row).
+int evaluateProCamGeometry(struct slParams* sl_params, struct slCalib* sl_calib){
+
+	// Check for input errors.
+	if(!(sl_calib->cam_intrinsic_calib && sl_calib->proj_intrinsic_calib && sl_calib->procam_extrinsic_calib)){
+		printf("ERROR: Projector-camera system must be calibrated first!\n");
+		return -1;
+	}
+	int cam_nelems  = sl_params->cam_w*sl_params->cam_h;
+	int proj_nelems = sl_params->proj_w*sl_params->proj_h;
+	if(sl_calib->cam_rays->cols != cam_nelems || sl_calib->proj_rays->cols != proj_nelems){
+		printf("ERROR: Optical ray storage does not match the camera and projector resolution!\n");
+		return -1;
+	}
+
+	// Extract extrinsic calibration parameters.
+	CvMat* cam_rotation     = cvCreateMat(3, 3, CV_32FC1);
+	CvMat* cam_translation  = cvCreateMat(3, 1, CV_32FC1);
+	CvMat* proj_rotation    = cvCreateMat(3, 3, CV_32FC1);
+	CvMat* proj_translation = cvCreateMat(3, 1, CV_32FC1);
+	extrinsicToRotationTranslation(sl_calib->cam_extrinsic,  cam_rotation,  cam_translation);
+	extrinsicToRotationTranslation(sl_calib->proj_extrinsic, proj_rotation, proj_translation);
+
+	// Determine centers of projection.
+	// Note: The projector center is first found in the chessboard coordinate system (-R'*T) and
+	//       then transformed into the camera coordinate system.
+	CvMat* proj_center_board = cvCreateMat(3, 1, CV_32FC1);
+	cvSet(sl_calib->cam_center, cvScalar(0));
+	cvGEMM(proj_rotation, proj_translation, -1, NULL, 0, proj_center_board, CV_GEMM_A_T);
+	cvGEMM(cam_rotation, proj_center_board, 1, cam_translation, 1, sl_calib->proj_center, 0);
+
+	// Pre-compute optical rays for each camera pixel.
+	evaluateDeviceRays(sl_params->cam_w, sl_params->cam_h,
+		sl_calib->cam_intrinsic, sl_calib->cam_distortion, sl_calib->cam_rays);
+
+	// Pre-compute optical rays for each projector pixel (rotated into the camera coordinate system).
+	evaluateDeviceRays(sl_params->proj_w, sl_params->proj_h,
+		sl_calib->proj_intrinsic, sl_calib->proj_distortion, sl_calib->proj_rays);
+	CvMat* proj_to_cam = cvCreateMat(3, 3, CV_32FC1);
+	cvGEMM(cam_rotation, proj_rotation, 1, NULL, 0, proj_to_cam, CV_GEMM_B_T);
+	float R[9];
+	for(int i=0; i<9; i++)
+		R[i] = proj_to_cam->data.fl[i];
+	float* rx = sl_calib->proj_rays->data.fl;
+	float* ry = rx + proj_nelems;
+	float* rz = ry + proj_nelems;
+	for(int i=0; i<proj_nelems; i++){
+		float x = rx[i], y = ry[i], z = rz[i];
+		rx[i] = R[0]*x + R[1]*y + R[2]*z;
+		ry[i] = R[3]*x + R[4]*y + R[5]*z;
+		rz[i] = R[6]*x + R[7]*y + R[8]*z;
+	}
+
+	// Release allocated resources.
+	cvReleaseMat(&cam_rotation);
+	cvReleaseMat(&cam_translation);
+	cvReleaseMat(&proj_rotation);
+	cvReleaseMat(&proj_translation);
+	cvReleaseMat(&proj_center_board);
+	cvReleaseMat(&proj_to_cam);
+
+	// Return without errors.
+	return 0;
+}
+
+// Per-row accumulators for triangulation statistics (combined after the parallel pass).
+struct slRowStats{
+	int    n_candidates;
+	int    n_reconstructed;
+	int    n_degenerate;
+	int    n_rejected_residual;
+	int    n_rejected_range;
+	int    n_rejected_background;
+	double residual_sum;
+	double residual_sum_sq;
+	float  residual_max;
+};
+
+// Reconstruct a point cloud by "ray-ray" triangulation of decoded projector-camera correspondences.
+// Note: For every camera pixel with a valid decoded (column,row) pair, the camera ray and the
+//       corresponding projector ray (bilinearly interpolated, so subpixel correspondences from
+//       phase-shift refinement are honoured) are intersected in the least-squares sense. The midpoint of
+//       the shortest segment between the rays is the reconstructed point and the segment length
+//       is its residual. Rays that are nearly parallel or meet behind either device are rejected,
+//       as are points with a residual above dist_reject or a depth outside dist_range.
+//       Points that are not at least background_depth_thresh in front of the background depth
+//       map are masked in the same vectorized pass, so they are never written.
+//       Rows are processed in parallel (OpenMP) and four pixels at a time (SSE2).
+//       Outputs follow the exporter conventions: points is 3xN, mask is 1xN (1 = valid), and
+//       depth_map and residuals (optional) are cam_h x cam_w.
+int triangulateRayRay(struct slParams* sl_params,
+                      struct slCalib* sl_calib,
+                      IplImage* gray_decoded_cols,
+                      IplImage* gray_decoded_rows,
+                      IplImage* gray_mask,
+                      CvMat* points,
+                      CvMat* depth_map,
+                      CvMat* residuals,
+                      CvMat* mask,
+                      struct slTriangulationStats* stats){
+
+	// Check for input errors.
+	int cam_w       = sl_params->cam_w;
+	int cam_h       = sl_params->cam_h;
+	int proj_w      = sl_params->proj_w;
+	int proj_h      = sl_params->proj_h;
+	int cam_nelems  = cam_w*cam_h;
+	int proj_nelems = proj_w*proj_h;
+	if(sl_calib->proj_rays->cols != proj_nelems){
+		printf("ERROR: Projector rays have not been evaluated!\n");
+		return -1;
+	}
+	if(points->cols != cam_nelems || mask->cols*mask->rows != cam_nelems){
+		printf("ERROR: Point cloud storage does not match the camera resolution!\n");
+		return -1;
+	}
+
+	// Define pointers to various data elements (for fast pixel access).
+	const float* cam_rays_x  = sl_calib->cam_rays->data.fl;
+	const float* cam_rays_y  = cam_rays_x + cam_nelems;
+	const float* cam_rays_z  = cam_rays_y + cam_nelems;
+	const float* proj_rays_x = sl_calib->proj_rays->data.fl;
+	const float* proj_rays_y = proj_rays_x + proj_nelems;
+	const float* proj_rays_z = proj_rays_y + proj_nelems;
+	float*  points_data          = points->data.fl;
+	float*  mask_data            = mask->data.fl;
+	float*  depth_data           = (depth_map != NULL) ? depth_map->data.fl : NULL;
+	float*  residual_data        = (residuals != NULL) ? residuals->data.fl : NULL;
+	int     depth_step           = (depth_map != NULL) ? depth_map->step/sizeof(float) : 0;
+	int     residual_step        = (residuals != NULL) ? residuals->step/sizeof(float) : 0;
+	uchar*  gray_mask_data       = (gray_mask != NULL) ? (uchar*)gray_mask->imageData : NULL;
+	int     gray_mask_step       = (gray_mask != NULL) ? gray_mask->widthStep/sizeof(uchar) : 0;
+	float*  gray_decoded_cols_data = (float*)gray_decoded_cols->imageData;
+	int     gray_decoded_cols_step = gray_decoded_cols->widthStep/sizeof(float);
+	float*  gray_decoded_rows_data = (float*)gray_decoded_rows->imageData;
+	int     gray_decoded_rows_step = gray_decoded_rows->widthStep/sizeof(float);
+	float*  background_depth_data  = (sl_calib->background_depth_map != NULL) ? sl_calib->background_depth_map->data.fl : NULL;
+	int     background_depth_step  = (sl_calib->background_depth_map != NULL) ? sl_calib->background_depth_map->step/sizeof(float) : 0;
+
+	// Define constant quantities (shared by every camera pixel).
+	float q1[3], q2[3];
+	for(int i=0; i<3; i++){
+		q1[i] = sl_calib->cam_center->data.fl[i];
+		q2[i] = sl_calib->proj_center->data.fl[i];
+	}
+	const __m128 q1_x    = _mm_set1_ps(q1[0]);
+	const __m128 q1_y    = _mm_set1_ps(q1[1]);
+	const __m128 q1_z    = _mm_set1_ps(q1[2]);
+	const __m128 q2_x    = _mm_set1_ps(q2[0]);
+	const __m128 q2_y    = _mm_set1_ps(q2[1]);
+	const __m128 q2_z    = _mm_set1_ps(q2[2]);
+	const __m128 q12_x   = _mm_set1_ps(q1[0]-q2[0]);
+	const __m128 q12_y   = _mm_set1_ps(q1[1]-q2[1]);
+	const __m128 q12_z   = _mm_set1_ps(q1[2]-q2[2]);
+	const __m128 half    = _mm_set1_ps(0.5f);
+	const __m128 zero    = _mm_setzero_ps();
+	const __m128 par_eps = _mm_set1_ps(1.0e-9f);
+	const __m128 bg_eps  = _mm_set1_ps(sl_params->background_depth_thresh);
+	const float  dist_min    = sl_params->dist_range[0];
+	const float  dist_max    = sl_params->dist_range[1];
+	const float  dist_reject = sl_params->dist_reject;
+
+	// Reconstruct point cloud, depth map and residuals (one camera row per iteration).
+	std::vector<slRowStats> row_stats(cam_h);
+	#pragma omp parallel for schedule(dynamic, 8)
+	for(int r=0; r<cam_h; r++){
+		slRowStats rs = {0, 0, 0, 0, 0, 0, 0.0, 0.0, 0.0f};
+		for(int c0=0; c0<cam_w; c0+=4){
+
+			// Gather camera and projector rays for (up to) four pixels.
+			int   n = (cam_w-c0 < 4) ? cam_w-c0 : 4;
+			int   valid[4] = {0, 0, 0, 0};
+			float v1[3][4] = {{0}}, v2[3][4] = {{0}};
+			float bg[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+			for(int l=0; l<n; l++){
+				int c  = c0+l;
+				int rc = cam_w*r+c;
+				if(gray_mask_data != NULL && gray_mask_data[r*gray_mask_step+c] == 0)
+					continue;
+				float corresponding_column = gray_decoded_cols_data[r*gray_decoded_cols_step+c];
+				float corresponding_row    = gray_decoded_rows_data[r*gray_decoded_rows_step+c];
+				if(!(corresponding_column > -0.5f && corresponding_column < proj_w-0.5f &&
+				     corresponding_row    > -0.5f && corresponding_row    < proj_h-0.5f))
+					continue;
+				v1[0][l] = cam_rays_x[rc];
+				v1[1][l] = cam_rays_y[rc];
+				v1[2][l] = cam_rays_z[rc];
+
+				// Look up the projector ray (bilinearly interpolated for subpixel correspondences).
+				float x = (corresponding_column < 0) ? 0 : ((corresponding_column > proj_w-1) ? (float)(proj_w-1) : corresponding_column);
+				float y = (corresponding_row    < 0) ? 0 : ((corresponding_row    > proj_h-1) ? (float)(proj_h-1) : corresponding_row);
+				int   x0 = (int)x, y0 = (int)y;
+				int   x1 = (x0 < proj_w-1) ? x0+1 : x0;
+				int   y1 = (y0 < proj_h-1) ? y0+1 : y0;
+				float ax = x-x0, ay = y-y0;
+				float w00 = (1-ax)*(1-ay), w01 = ax*(1-ay), w10 = (1-ax)*ay, w11 = ax*ay;
+				int   rc00 = proj_w*y0+x0, rc01 = proj_w*y0+x1, rc10 = proj_w*y1+x0, rc11 = proj_w*y1+x1;
+				v2[0][l] = w00*proj_rays_x[rc00] + w01*proj_rays_x[rc01] + w10*proj_rays_x[rc10] + w11*proj_rays_x[rc11];
+				v2[1][l] = w00*proj_rays_y[rc00] + w01*proj_rays_y[rc01] + w10*proj_rays_y[rc10] + w11*proj_rays_y[rc11];
+				v2[2][l] = w00*proj_rays_z[rc00] + w01*proj_rays_z[rc01] + w10*proj_rays_z[rc10] + w11*proj_rays_z[rc11];
+				if(background_depth_data != NULL)
+					bg[l] = background_depth_data[r*background_depth_step+c];
+				valid[l] = 1;
+				rs.n_candidates++;
+			}
+
+			// Clear outputs for this group of pixels (accepted points are written below).
+			for(int l=0; l<n; l++){
+				int c  = c0+l;
+				int rc = cam_w*r+c;
+				mask_data[rc] = 0;
+				if(depth_data != NULL)
+					depth_data[r*depth_step+c] = FLT_MAX;
+				if(residual_data != NULL)
+					residual_data[r*residual_step+c] = FLT_MAX;
+			}
+			if(!(valid[0] | valid[1] | valid[2] | valid[3]))
+				continue;
+
+			// Evaluate inner products.
+			__m128 v1_x = _mm_loadu_ps(v1[0]), v1_y = _mm_loadu_ps(v1[1]), v1_z = _mm_loadu_ps(v1[2]);
+			__m128 v2_x = _mm_loadu_ps(v2[0]), v2_y = _mm_loadu_ps(v2[1]), v2_z = _mm_loadu_ps(v2[2]);
+			__m128 v1_dot_v1  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1_x, v1_x), _mm_mul_ps(v1_y, v1_y)), _mm_mul_ps(v1_z, v1_z));
+			__m128 v2_dot_v2  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v2_x, v2_x), _mm_mul_ps(v2_y, v2_y)), _mm_mul_ps(v2_z, v2_z));
+			__m128 v1_dot_v2  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1_x, v2_x), _mm_mul_ps(v1_y, v2_y)), _mm_mul_ps(v1_z, v2_z));
+			__m128 q12_dot_v1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q12_x, v1_x), _mm_mul_ps(q12_y, v1_y)), _mm_mul_ps(q12_z, v1_z));
+			__m128 q12_dot_v2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q12_x, v2_x), _mm_mul_ps(q12_y, v2_y)), _mm_mul_ps(q12_z, v2_z));
+
+			// Calculate scale factors (rejecting nearly parallel rays).
+			__m128 v11_v22    = _mm_mul_ps(v1_dot_v1, v2_dot_v2);
+			__m128 denom      = _mm_sub_ps(v11_v22, _mm_mul_ps(v1_dot_v2, v1_dot_v2));
+			__m128 degenerate = _mm_cmple_ps(denom, _mm_mul_ps(par_eps, v11_v22));
+			denom             = _mm_or_ps(_mm_andnot_ps(degenerate, denom), _mm_and_ps(degenerate, _mm_set1_ps(1.0f)));
+			__m128 inv_denom  = _mm_div_ps(_mm_set1_ps(1.0f), denom);
+			__m128 s = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(v1_dot_v2, q12_dot_v2), _mm_mul_ps(v2_dot_v2, q12_dot_v1)), inv_denom);
+			__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(v1_dot_v1, q12_dot_v2), _mm_mul_ps(v1_dot_v2, q12_dot_v1)), inv_denom);
+			degenerate = _mm_or_ps(degenerate, _mm_or_ps(_mm_cmple_ps(s, zero), _mm_cmple_ps(t, zero)));
+
+			// Evaluate closest points on both rays, their midpoint and their distance.
+			__m128 p1_x = _mm_add_ps(q1_x, _mm_mul_ps(s, v1_x));
+			__m128 p1_y = _mm_add_ps(q1_y, _mm_mul_ps(s, v1_y));
+			__m128 p1_z = _mm_add_ps(q1_z, _mm_mul_ps(s, v1_z));
+			__m128 p2_x = _mm_add_ps(q2_x, _mm_mul_ps(t, v2_x));
+			__m128 p2_y = _mm_add_ps(q2_y, _mm_mul_ps(t, v2_y));
+			__m128 p2_z = _mm_add_ps(q2_z, _mm_mul_ps(t, v2_z));
+			__m128 d_x  = _mm_sub_ps(p1_x, p2_x);
+			__m128 d_y  = _mm_sub_ps(p1_y, p2_y);
+			__m128 d_z  = _mm_sub_ps(p1_z, p2_z);
+			__m128 residual = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, d_x), _mm_mul_ps(d_y, d_y)), _mm_mul_ps(d_z, d_z)));
+			__m128 m_x  = _mm_mul_ps(half, _mm_add_ps(p1_x, p2_x));
+			__m128 m_y  = _mm_mul_ps(half, _mm_add_ps(p1_y, p2_y));
+			__m128 m_z  = _mm_mul_ps(half, _mm_add_ps(p1_z, p2_z));
+
+			// Evaluate depth along the camera ray (i.e., distance from the camera center).
+			__m128 depth = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(v1_x, _mm_sub_ps(m_x, q1_x)),
+				_mm_mul_ps(v1_y, _mm_sub_ps(m_y, q1_y))),
+				_mm_mul_ps(v1_z, _mm_sub_ps(m_z, q1_z)));
+			depth = _mm_div_ps(depth, _mm_sqrt_ps(_mm_max_ps(v1_dot_v1, _mm_set1_ps(FLT_MIN))));
+
+			// Mask points that are not in front of the background model.
+			int out_background = _mm_movemask_ps(_mm_cmpge_ps(depth, _mm_sub_ps(_mm_loadu_ps(bg), bg_eps)));
+
+			// Store results and apply rejection tests.
+			float out_x[4], out_y[4], out_z[4], out_res[4], out_depth[4];
+			int   out_degen = _mm_movemask_ps(degenerate);
+			_mm_storeu_ps(out_x, m_x);
+			_mm_storeu_ps(out_y, m_y);
+			_mm_storeu_ps(out_z, m_z);
+			_mm_storeu_ps(out_res, residual);
+			_mm_storeu_ps(out_depth, depth);
+			for(int l=0; l<n; l++){
+				if(!valid[l])
+					continue;
+				if(out_degen & (1 << l)){
+					rs.n_degenerate++;
+					continue;
+				}
+				if(out_res[l] > dist_reject){
+					rs.n_rejected_residual++;
+					continue;
+				}
+				if(out_depth[l] < dist_min || out_depth[l] > dist_max){
+					rs.n_rejected_range++;
+					continue;
+				}
+				if(out_background & (1 << l)){
+					rs.n_rejected_background++;
+					continue;
+				}
+				int c  = c0+l;
+				int rc = cam_w*r+c;
+				points_data[rc]              = out_x[l];
+				points_data[rc+cam_nelems]   = out_y[l];
+				points_data[rc+2*cam_nelems] = out_z[l];
+				mask_data[rc] = 1;
+				if(depth_data != NULL)
+					depth_data[r*depth_step+c] = out_depth[l];
+				if(residual_data != NULL)
+					residual_data[r*residual_step+c] = out_res[l];
+				rs.n_reconstructed++;
+				rs.residual_sum    += out_res[l];
+				rs.residual_sum_sq += out_res[l]*out_res[l];
+				if(out_res[l] > rs.residual_max)
+					rs.residual_max = out_res[l];
+			}
+		}
+		row_stats[r] = rs;
+	}
+
+	// Combine per-row statistics.
+	if(stats != NULL){
+		double residual_sum = 0, residual_sum_sq = 0;
+		memset(stats, 0, sizeof(struct slTriangulationStats));
+		for(int r=0; r<cam_h; r++){
+			stats->n_candidates        += row_stats[r].n_candidates;
+			stats->n_reconstructed     += row_stats[r].n_reconstructed;
+			stats->n_degenerate        += row_stats[r].n_degenerate;
+			stats->n_rejected_residual += row_stats[r].n_rejected_residual;
+			stats->n_rejected_range    += row_stats[r].n_rejected_range;
+			stats->n_rejected_background += row_stats[r].n_rejected_background;
+			residual_sum               += row_stats[r].residual_sum;
+			residual_sum_sq            += row_stats[r].residual_sum_sq;
+			if(row_stats[r].residual_max > stats->residual_max)
+				stats->residual_max = row_stats[r].residual_max;
+		}
+		if(stats->n_reconstructed > 0){
+			stats->residual_mean = (float)(residual_sum/stats->n_reconstructed);
+			stats->residual_rms  = (float)sqrt(residual_sum_sq/stats->n_reconstructed);
+		}
+	}
+
+	// Return without errors.
+	return 0;
+}
+
+// Display triangulation statistics to the console.
+void displayTriangulationStats(struct slTriangulationStats* stats){
+	printf("***Triangulation:\n");
+	printf("+ Decoded pixels        = %d\n", stats->n_candidates);
+	printf("+ Reconstructed points  = %d\n", stats->n_reconstructed);
+	printf("+ Rejected (degenerate) = %d\n", stats->n_degenerate);
+	printf("+ Rejected (residual)   = %d\n", stats->n_rejected_residual);
+	printf("+ Rejected (range)      = %d\n", stats->n_rejected_range);
+	printf("+ Rejected (background) = %d\n", stats->n_rejected_background);
+	printf("+ Residual mean/RMS/max = %7.3f %7.3f %7.3f mm\n",
+		stats->residual_mean, stats->residual_rms, stats->residual_max);
+}
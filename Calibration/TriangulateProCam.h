@@ -0,0 +1,51 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @file   Calibration\TriangulateProCam.h
+///
+/// @brief  Declares the projector-camera triangulation functions.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Common.h"
+#include "Calibration.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// @struct slTriangulationStats
+///
+/// @brief  Per-scan accuracy statistics gathered during "ray-ray" triangulation. The residual of
+///         a point is the shortest distance between its camera ray and its projector ray.
+///
+/// @ingroup Calibration
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct slTriangulationStats{
+	int   n_candidates;             // decoded pixels passed to the triangulator
+	int   n_reconstructed;          // points accepted by all rejection tests
+	int   n_degenerate;             // rejected because the rays are parallel or meet behind a device
+	int   n_rejected_residual;      // rejected because the residual exceeds dist_reject
+	int   n_rejected_range;         // rejected because the depth is outside dist_range
+	int   n_rejected_background;    // rejected because the point is not in front of the background model
+	float residual_mean;            // mean residual of the accepted points (in mm)
+	float residual_rms;             // RMS residual of the accepted points (in mm)
+	float residual_max;             // maximum residual of the accepted points (in mm)
+};
+
+// Evaluate centers of projection and optical rays of the projector-camera system.
+// Note: All quantities are defined in the camera coordinate system.
+int evaluateProCamGeometry(struct slParams* sl_params, struct slCalib* sl_calib);
+
+// Reconstruct a point cloud by "ray-ray" triangulation of decoded projector-camera correspondences.
+int triangulateRayRay(struct slParams* sl_params,
+                      struct slCalib* sl_calib,
+                      IplImage* gray_decoded_cols,
+                      IplImage* gray_decoded_rows,
+                      IplImage* gray_mask,
+                      CvMat* points,
+                      CvMat* depth_map,
+                      CvMat* residuals,
+                      CvMat* mask,
+                      struct slTriangulationStats* stats CV_DEFAULT(NULL));
+
+// Display triangulation statistics to the console.
+void displayTriangulationStats(struct slTriangulationStats* stats);
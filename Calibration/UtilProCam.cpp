@@ -8,9 +8,12 @@
 #include "Calibration.h"
 #include "UtilProCam.h"
 #include "Camera.h"
+#include "TextWriter.h"
+#include "PointMask.h"
+#include "PatternEngine.h"
+#include "PhotometricCalibration.h"
 
 #include <stdlib.h>
-#include <time.h>
 
 // Calculate the base 2 logarithm.
 double log2(double x)
@@ -128,7 +131,9 @@ int camPreview(Camera* camera, struct slParams* sl_params, struct slCalib* sl_ca
 
 	// Create a window to display captured frames.
 	IplImage* cam_frame  = camera->QueryFrame();
-	IplImage* proj_frame = cvCreateImage(cvSize(sl_params->proj_w, sl_params->proj_h), IPL_DEPTH_8U, 1);
+	PatternEngine patterns(sl_params);
+	if(sl_calib != NULL && sl_calib->photometric_calib)
+		patterns.SetResponse(sl_calib->proj_response_lut);
 	cvNamedWindow("camWindow", CV_WINDOW_AUTOSIZE);
 	cvCreateTrackbar("Cam. Gain",  "camWindow", &sl_params->cam_gain,  100, NULL);
 	cvCreateTrackbar("Proj. Gain", "camWindow", &sl_params->proj_gain, 100, NULL);
@@ -140,17 +145,15 @@ int camPreview(Camera* camera, struct slParams* sl_params, struct slCalib* sl_ca
 	int cvKey = -1, cvKey_temp = -1;
 	while(1){
 
-		// Project white image.
-		cvSet(proj_frame, cvScalar(255));
-		cvScale(proj_frame, proj_frame, 2.*(sl_params->proj_gain/100.), 0);
-		cvShowImage("projWindow", proj_frame);
+		// Project white image (rescaled only when the gain trackbar changes).
+		cvShowImage("projWindow", patterns.Solid(cvScalarAll(255.0)));
 		cvKey_temp = cvWaitKey(1);
 		if(cvKey_temp != -1) 
 			cvKey = cvKey_temp;
 
 		// Capture next frame and update display window.
 		cam_frame = camera->QueryFrame();
-		cvScale(cam_frame, cam_frame, 2.*(sl_params->cam_gain/100.), 0);
+		PhotometricCalibration::CorrectFrame(sl_params, sl_calib, cam_frame);
 		ShowImageResampled("camWindow", cam_frame, sl_params->window_w, sl_params->window_h);
 		cvKey_temp = cvWaitKey(10);
 		if(cvKey_temp != -1) 
@@ -162,13 +165,11 @@ int camPreview(Camera* camera, struct slParams* sl_params, struct slCalib* sl_ca
 	}
 
 	// Project black image.
-	cvZero(proj_frame);
-	cvShowImage("projWindow", proj_frame);
+	cvShowImage("projWindow", patterns.Solid(cvScalarAll(0.0), false));
 	cvKey_temp = cvWaitKey(1);
 
 	// Return without errors.
 	cvDestroyWindow("camWindow");
-	cvReleaseImage(&proj_frame);
 	return 0;
 }
 
@@ -218,81 +219,100 @@ void ShowImageResampled(char* name,
 	cvReleaseImage(&resampled_image);
 }
 
+// Show an image, resampled into a preallocated image (of the desired size).
+void ShowImageResampled(char* name, 
+						  IplImage* image, 
+						  IplImage* resampled_image){
+
+	// Resize image.
+	cvResize(image, resampled_image, CV_INTER_LINEAR);
+
+	// Display resampled image.
+	cvShowImage(name, resampled_image);
+}
+
 // Save a VRML-formatted point cloud.
 int savePointsVRML(char* filename, 
 				   CvMat* points,
+				   CvMat* faces,
 				   CvMat* normals,
 				   CvMat* colors,
 				   CvMat* mask){
 
+	// Compact the mask once, so every attribute pass only visits valid points.
+	CvMat* index = (mask == NULL || isPointIndex(mask)) ? mask : createPointIndex(mask);
+	if(mask != NULL && index == NULL)
+		return -1;
+
 	// Open output file and create header.
 	FILE* pFile = fopen(filename, "w");
 	if(pFile == NULL){
 		fprintf(stderr,"ERROR: Cannot open VRML file!\n");
+		if(index != mask)
+			cvReleaseMat(&index);
 		return -1;
 	}
-	fprintf(pFile, "#VRML V2.0 utf8\n");
-	fprintf(pFile, "Shape {\n");
-	fprintf(pFile, " geometry IndexedFaceSet {\n");
+	TextWriter out(pFile);
+	out.Write("#VRML V2.0 utf8\n");
+	out.Write("Shape {\n");
+	out.Write(" geometry IndexedFaceSet {\n");
 
 	// Output points (i.e., indexed face set vertices).
 	// Note: Flip y-component for compatibility with Java-based viewer.
 	if(points != NULL){
-		fprintf(pFile, "  coord Coordinate {\n");
-		fprintf(pFile, "   point [\n");
-		for(int c=0; c<points->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-				for(int r=0; r<points->rows; r++){
-					if(r != 1)
-						fprintf(pFile, "    %f ",  points->data.fl[c + points->cols*r]);
-					else
-						fprintf(pFile, "    %f ", -points->data.fl[c + points->cols*r]);
-				}
-				fprintf(pFile, "\n");
+		const float flip_y[3] = {1, -1, 1};
+		out.Write("  coord Coordinate {\n");
+		out.Write("   point [\n");
+		out.WriteColumns("    ", points, flip_y, "\n", index);
+		out.Write("   ]\n");
+		out.Write("  }\n");
+	}
+
+	// Output faces (if provided).
+	// Note: Reverses the vertex order, since flipping the y-component mirrors the triangles.
+	if(faces != NULL){
+		out.Write("  coordIndex [\n");
+		for(int c=0; c<faces->cols; c++){
+			out.Write("   ");
+			for(int r=faces->rows-1; r>=0; r--){
+				out.WriteInt(faces->data.i[c + faces->step/sizeof(int)*r]);
+				out.Write(", ");
 			}
+			out.Write("-1,\n");
 		}
-		fprintf(pFile, "   ]\n");
-		fprintf(pFile, "  }\n");
+		out.Write("  ]\n");
 	}
 
 	// Output normals (if provided).
 	// Note: Flips normals, for compatibility with Java-based viewer.
 	if(normals != NULL){
-		fprintf(pFile, "  normalPerVertex TRUE\n");
-		fprintf(pFile, "  normal Normal {\n");
-		fprintf(pFile, "   vector [\n");
-		for(int c=0; c<normals->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-				for(int r=0; r<normals->rows; r++)
-					fprintf(pFile, "    %f ", -normals->data.fl[c + normals->cols*r]);
-				fprintf(pFile, "\n");
-			}
-		}
-		fprintf(pFile, "   ]\n");
-		fprintf(pFile, "  }\n");
+		const float flip[3] = {-1, -1, -1};
+		out.Write("  normalPerVertex TRUE\n");
+		out.Write("  normal Normal {\n");
+		out.Write("   vector [\n");
+		out.WriteColumns("    ", normals, flip, "\n", index);
+		out.Write("   ]\n");
+		out.Write("  }\n");
 	}
 
 	// Output colors (if provided).
 	// Note: Assumes input is an 8-bit RGB color array.
 	if(colors != NULL){
-		fprintf(pFile, "  colorPerVertex TRUE\n");
-		fprintf(pFile, "  color Color {\n");
-		fprintf(pFile, "   color [\n");
-		for(int c=0; c<colors->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-				for(int r=0; r<colors->rows; r++)
-					fprintf(pFile, "    %f ", colors->data.fl[c + colors->cols*r]);
-				fprintf(pFile, "\n");
-			}
-		}
-		fprintf(pFile, "   ]\n");
-		fprintf(pFile, "  }\n");
+		out.Write("  colorPerVertex TRUE\n");
+		out.Write("  color Color {\n");
+		out.Write("   color [\n");
+		out.WriteColumns("    ", colors, NULL, "\n", index);
+		out.Write("   ]\n");
+		out.Write("  }\n");
 	}
 
 	// Create footer and close file.
-	fprintf(pFile, " }\n");
-	fprintf(pFile, "}\n");
-	if(fclose(pFile) != 0){
+	out.Write(" }\n");
+	out.Write("}\n");
+	bool ok = out.Flush();
+	if(index != mask)
+		cvReleaseMat(&index);
+	if(fclose(pFile) != 0 || !ok){
 		printf("ERROR: Cannot close VRML file!\n");
 		return -1;
 	}
@@ -302,19 +322,31 @@ int savePointsVRML(char* filename,
 }
 
 // Save a text file of 3D world points and camera and projector image points
+// Note: Writes export_sample_points points (or all valid points, if zero), selected by
+//       subsamplePointIndex with export_sample_seed, so the output is reproducible.
 int savePointsTxt(char* filename, 
 					CvMat* points,
 					IplImage*& gray_decoded_cols, 
 					IplImage*& gray_decoded_rows, 
 					CvMat* mask, struct slParams* sl_params)
 {
+	// Select a reproducible, spatially stratified subset of the valid points.
+	CvMat* index = isPointIndex(mask) ? mask : createPointIndex(mask);
+	if(index == NULL)
+		return -1;
+	CvMat* sample = subsamplePointIndex(index, sl_params->export_sample_points, (unsigned int)sl_params->export_sample_seed);
+	if(index != mask)
+		cvReleaseMat(&index);
+
 	FILE* pFile = fopen(filename, "w");
 	
 	if(pFile == NULL)
 	{
 		fprintf(stderr, "ERROR: Cannot open text file!\n");
+		cvReleaseMat(&sample);
 		return -1;
 	}
+	TextWriter out(pFile);
 
 	float*	gray_decoded_cols_data = (float*)gray_decoded_cols->imageData;
 	int     gray_decoded_cols_step = gray_decoded_cols->widthStep/sizeof(float);
@@ -322,57 +354,41 @@ int savePointsTxt(char* filename,
 	int     gray_decoded_rows_step = gray_decoded_rows->widthStep/sizeof(float);
 	int		cam_nelems				= sl_params->cam_w*sl_params->cam_h;
 	int		num_frames				= 2;
-	float	point[3];
-	float   percentSubSample = 0.01;
 
 	// Output point format: X Y Z  nframes  frame0 x0 y0  frame1 x1 y1
 	// This format is for a 1 camera, 1 projector set up
-
-	// to do:
-	// change to use rand with ms
-	srand(time(NULL));
-	
-	for(int r=0; r<sl_params->cam_h; r++)
+	for(int j=0; j<pointIndexCount(sample); j++)
 	{
-		for(int c=0; c<sl_params->cam_w; c++)
-		{	
-			if(mask->data.fl[sl_params->cam_w*r+c] == 1)
-			{
-				// randomly subsample
-				float randVal = rand() % 1000 / 1000.0;
-				if(randVal < percentSubSample)
-				{
-                    fprintf(pFile, "\n");
-
-					float corresponding_column = gray_decoded_cols_data[r*gray_decoded_cols_step+c];
-					float corresponding_row    = gray_decoded_rows_data[r*gray_decoded_rows_step+c];
-
-					int rc_cam  = (sl_params->cam_w)*r+c;
-					
-					for(int i = 0; i < 3; i++)
-						point[i] = points->data.fl[rc_cam+cam_nelems*i];
-
-					for(int i = 0; i < 3; i++)
-					{
-						fprintf(pFile, "%f ", point[i]);
-					}
-
-					float fRow = r;
-					float fCol = c;
-
-					fprintf(pFile, "%d ", num_frames);
-					
-					fprintf(pFile, "0 ");
-					fprintf(pFile, "%f %f ", fCol, fRow);
-					fprintf(pFile, "1 ");
-					fprintf(pFile, "%f %f", corresponding_column, corresponding_row);
-				}
-			}
+		int rc_cam = sample->data.i[j];
+		int r      = rc_cam / sl_params->cam_w;
+		int c      = rc_cam % sl_params->cam_w;
+
+		out.WriteChar('\n');
+
+		float corresponding_column = gray_decoded_cols_data[r*gray_decoded_cols_step+c];
+		float corresponding_row    = gray_decoded_rows_data[r*gray_decoded_rows_step+c];
+
+		for(int i = 0; i < 3; i++)
+		{
+			out.WriteFloat(points->data.fl[rc_cam+cam_nelems*i]);
+			out.WriteChar(' ');
 		}
+
+		out.WriteInt(num_frames);
+		out.Write(" 0 ");
+		out.WriteFloat((float)c);
+		out.WriteChar(' ');
+		out.WriteFloat((float)r);
+		out.Write(" 1 ");
+		out.WriteFloat(corresponding_column);
+		out.WriteChar(' ');
+		out.WriteFloat(corresponding_row);
 	}
+	cvReleaseMat(&sample);
 
 	// Create footer and close file.
-	if(fclose(pFile) != 0){
+	bool ok = out.Flush();
+	if(fclose(pFile) != 0 || !ok){
 		printf("ERROR: Cannot close Txt file!\n");
 		return -1;
 	}
@@ -380,7 +396,7 @@ int savePointsTxt(char* filename,
     return 0;
 }
 
-// Save a VRML-formatted point cloud.
+// Save a OBJ-formatted point cloud.
 int savePointsOBJ(char* filename, 
 				   CvMat* points,
                    CvMat* faces,
@@ -389,82 +405,68 @@ int savePointsOBJ(char* filename,
 				   CvMat* colors,
 				   CvMat* mask){
 
+	// Compact the mask once, so every attribute pass only visits valid points.
+	CvMat* index = (mask == NULL || isPointIndex(mask)) ? mask : createPointIndex(mask);
+	if(mask != NULL && index == NULL)
+		return -1;
+
 	// Open output file and create header.
 	FILE* pFile = fopen(filename, "w");
 	if(pFile == NULL){
-		fprintf(stderr,"ERROR: Cannot open VRML file!\n");
+		fprintf(stderr,"ERROR: Cannot open OBJ file!\n");
+		if(index != mask)
+			cvReleaseMat(&index);
 		return -1;
 	}
-	fprintf(pFile, "#OBJ File\n");
-	fprintf(pFile, "\n");
+	TextWriter out(pFile);
+	out.Write("#OBJ File\n");
+	out.Write("\n");
 
-	fprintf(pFile, "#Begin Vertices\n");
+	out.Write("#Begin Vertices\n");
 
 	// Output points (i.e., indexed face set vertices).
 	// Note: Flip y-component for compatibility with Java-based viewer.
 	if(points != NULL){
-		for(int c=0; c<points->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-		        fprintf(pFile, "v ");
-				for(int r=0; r<points->rows; r++){
-					if(r != 1)
-                        fprintf(pFile, "%f ",  points->data.fl[c + points->step/sizeof(float)*r]);
-					else
-                        fprintf(pFile, "%f ", -points->data.fl[c + points->step/sizeof(float)*r]);
-				}
-				fprintf(pFile, "\n");
-			}
-		}
-		fprintf(pFile, "\n");
+		const float flip_y[3] = {1, -1, 1};
+		out.WriteColumns("v ", points, flip_y, "\n", index);
+		out.Write("\n");
 	}
 
-	// Output faces
+	// Output faces (if provided).
+	// Note: Face indices refer to the masked vertex list (0-based, as generated by generateGridMesh),
+	//       and the vertex order is reversed, since flipping the y-component mirrors the triangles.
 	if(faces != NULL){
 		for(int c=0; c<faces->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-                if( faces->data.i[c] > 0 ){
-		            fprintf(pFile, "f ");
-				    for(int r=0; r<faces->rows; r++){
-                        fprintf(pFile, "%i ",  faces->data.i[c + faces->step/sizeof(int)*r]);
-				    }
-				    fprintf(pFile, "\n");
-                }
+			out.Write("f");
+			for(int r=faces->rows-1; r>=0; r--){
+				out.WriteChar(' ');
+				out.WriteInt(faces->data.i[c + faces->step/sizeof(int)*r] + 1);
 			}
+			out.Write("\n");
 		}
-		fprintf(pFile, "\n");
+		out.Write("\n");
 	}
 
 	// Output normals (if provided).
 	// Note: Flips normals, for compatibility with Java-based viewer.
 	if(normals != NULL){
-		for(int c=0; c<normals->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-                fprintf(pFile, "vn ");
-				for(int r=0; r<normals->rows; r++)
-                    fprintf(pFile, "%f ", -normals->data.fl[c + normals->step/sizeof(float)*r]);
-				fprintf(pFile, "\n");
-			}
-		}
-		fprintf(pFile, "   ]\n");
+		const float flip[3] = {-1, -1, -1};
+		out.WriteColumns("vn ", normals, flip, "\n", index);
+		out.Write("\n");
 	}
 
 	// Output uv coords
 	if(uvCoords != NULL){
-		for(int c=0; c<uvCoords->cols; c++){
-			if(mask == NULL || mask->data.fl[c] != 0){
-		        fprintf(pFile, "vt ");
-				for(int r=0; r<uvCoords->rows; r++){
-                    fprintf(pFile, "%f ", uvCoords->data.fl[c + uvCoords->step/sizeof(float)*r]);
-				}
-				fprintf(pFile, "\n");
-			}
-		}
-		fprintf(pFile, "\n");
+		out.WriteColumns("vt ", uvCoords, NULL, "\n", index);
+		out.Write("\n");
 	}
 
 	// Create footer and close file.
-	fprintf(pFile, "\n");
-	if(fclose(pFile) != 0){
+	out.Write("\n");
+	bool ok = out.Flush();
+	if(index != mask)
+		cvReleaseMat(&index);
+	if(fclose(pFile) != 0 || !ok){
 		printf("ERROR: Cannot close OBJ file!\n");
 		return -1;
 	}
@@ -509,6 +511,15 @@ IplImage* Gray2BGR(IplImage* frame)
     return frameRGB;
 }
 
+// Convert a grayscale image to BGR, into a preallocated image (BGR images are copied).
+void Gray2BGR(IplImage* frame, IplImage* frameBGR)
+{
+    if(frame->nChannels == 1)
+        cvCvtColor(frame, frameBGR, CV_GRAY2BGR);
+    else
+        cvCopy(frame, frameBGR);
+}
+
 void PrintMatrix(std::string name, cv::Mat &mat)
 {
     printf("%s:\n", name.c_str());
@@ -520,4 +531,40 @@ void PrintMatrix(std::string name, cv::Mat &mat)
         }
         printf("\n");
     }
-}
\ No newline at end of file
+}
+
+// Delete a directory and all of its contents (succeeds if the directory does not exist).
+// Note: Replaces shelling out to "rd /s /q", which cannot report errors and spawns a console.
+int removeDirectory(const char* dir)
+{
+	if(GetFileAttributesA(dir) == INVALID_FILE_ATTRIBUTES)
+		return 0;
+
+	// Delete files and subdirectories.
+	char path[1024];
+	sprintf(path, "%s\\*", dir);
+	WIN32_FIND_DATAA find_data;
+	HANDLE find = FindFirstFileA(path, &find_data);
+	if(find != INVALID_HANDLE_VALUE){
+		do{
+			if(strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0)
+				continue;
+			sprintf(path, "%s\\%s", dir, find_data.cFileName);
+			if(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				removeDirectory(path);
+			else{
+				if(find_data.dwFileAttributes & FILE_ATTRIBUTE_READONLY)
+					SetFileAttributesA(path, FILE_ATTRIBUTE_NORMAL);
+				DeleteFileA(path);
+			}
+		} while(FindNextFileA(find, &find_data));
+		FindClose(find);
+	}
+
+	// Delete the (now empty) directory.
+	if(!RemoveDirectoryA(dir)){
+		printf("ERROR: Cannot remove directory \"%s\"!\n", dir);
+		return -1;
+	}
+	return 0;
+}
@@ -35,13 +35,19 @@ void colorizeWinter(IplImage* src, IplImage*& dst, IplImage* mask);
 // Show an image, resampled to desired size.
 void ShowImageResampled(char* name, IplImage* image, int width, int height);
 
-// Save a VRML-formatted point cloud.
-int savePointsVRML(char* filename, CvMat* points, CvMat* normals, CvMat* colors, CvMat* mask);
+// Show an image, resampled into a preallocated image (of the desired size).
+void ShowImageResampled(char* name, IplImage* image, IplImage* resampled_image);
+
+// Save a VRML-formatted point cloud (or mesh, if faces are provided).
+// Note: mask is either a 1xN float mask or a list of valid indices (see createPointIndex).
+int savePointsVRML(char* filename, CvMat* points, CvMat* faces, CvMat* normals, CvMat* colors, CvMat* mask);
 
 // Save a OBJ-formatted point cloud.
+// Note: mask is either a 1xN float mask or a list of valid indices (see createPointIndex).
 int savePointsOBJ(char* filename, CvMat* points, CvMat* faces, CvMat* normals, CvMat* uvCoords, CvMat* colors, CvMat* mask);
 
 // Save in a format used by sba - sfm
+// Note: mask is either a 1xN float mask or a list of valid indices (see createPointIndex).
 int savePointsTxt(char* filename, CvMat* points, IplImage*& gray_decoded_cols, IplImage*& gray_decoded_rows, CvMat* mask, struct slParams* sl_params);
 
 // Save XML-formatted configuration file.
@@ -56,4 +62,10 @@ void CvtLogitech9000Raw(IplImage* image, bool return_raw);
 
 IplImage* Gray2BGR(IplImage* frame);
 
+// Convert a grayscale image to BGR, into a preallocated image (BGR images are copied).
+void Gray2BGR(IplImage* frame, IplImage* frameBGR);
+
+// Delete a directory and all of its contents (succeeds if the directory does not exist).
+int removeDirectory(const char* dir);
+
 void PrintMatrix(std::string name, cv::Mat &mat);
\ No newline at end of file